@@ -4,12 +4,220 @@
 
 compile with visual studio 2015 community at the command line, and run on Win7.
 cl discogs.c
+(for --compress gzip set HAVE_ZLIB to 1 and add zlib.lib.  For --compress
+zstd, --build-frames and --frames set HAVE_ZSTD to 1 and add libzstd.lib.  For
+--sqlite set HAVE_SQLITE to 1 and add sqlite3.c, the SQLite amalgamation.)
 
 
 
 
 Usage
- discogs infile outfile csvfile
+ discogs [options] infile outfile csvfile
+
+Options
+ --shard-dir dir --artists file [--shard-max-open n]
+	Sharded output.  Instead of matching SEARCH_STRING, a release is matched
+	if it references any artist id listed in file (one per line), and is
+	written to dir/<artist id>.xml and dir/<artist id>.csv for every listed
+	artist in it.  outfile and csvfile only get the run summary.
+ --sort [--sort-memory mb]
+	csvfile lines are sorted by master_id, then release_id, and repeated
+	releases are dropped.  Lines are kept in memory up to mb megabytes, then
+	written out as sorted runs (csvfile.run0, .run1...) which are merged into
+	csvfile at the end and deleted.
+ --aggregate field[,field...]
+	Nothing is written per release.  Matched releases are counted in a hash
+	table grouped by the fields (country, year, released, format, label,
+	catno, description, data_quality), and the table is written to csvfile
+	at the end, largest group first.  label, catno and description count a
+	release once for each of its distinct values.
+ --start-offset n --end-offset n [--debug-file name]
+	Only releases whose "<release id=" starts in bytes n to n-1 of infile.
+	The search starts at the first "<release id=" at or after the start
+	offset, and the release that straddles the end offset is finished, so
+	consecutive ranges neither drop nor repeat a release.  Lets several
+	hosts split up one dump.
+ --merge outfile csvfile part.xml part.csv part.debug [part.xml...]
+	Joins the outputs of the byte range runs (in offset order) into outfile,
+	csvfile and the debug file, with the headers of the first part and the
+	close files counts summed, the same as a run over the whole file.  The
+	parts need the same columns (or all --json), and can't be from --sort
+	or --aggregate runs.
+ --validate infile
+	Reads infile once and checks that tags nest, every <release has an id
+	and its </release>, and there are no NUL bytes or truncation.  Lists
+	the byte offset of any damage, and reports release id gaps and ids out
+	of order, and the largest release (and how many are over BLOCKSIZE).
+	Exits with 9 if there was damage.
+ --metrics-file name [--metrics-interval s]
+	Every s seconds (default 5) name is rewritten (via name.tmp and a
+	rename) with Prometheus text format metrics: bytes scanned and to scan,
+	releases, matches, errors, releases/s and bytes/s over the last
+	interval, current release id, buffer refills, seek-backs, ETA, and the
+	time of the update.  For node_exporter's textfile collector, or anything
+	else that polls it.
+ --role role[,role...]
+	Only releases that credit SEARCH_STRING's artist in one of the listed
+	ways: main (the release's <artists>), extra (the release's
+	<extraartists>), track (a track's artists or extraartists), or any
+	other word is a <role> value such as Remix or Producer (without case,
+	or the [...] part).  csvfile gets a matched_role column, with the first
+	credit that passed as main, extra:<role> or track:<role>.
+ --text phrase [--text phrase...] [--text-fields field[,field...]]
+	Releases are matched by words instead of by SEARCH_STRING's artist: a
+	release matches if any phrase is in any of the fields (title, notes;
+	both by default), ignoring ascii case.  Only the release's own title is
+	looked at, not the track titles.
+ --build-index indexfile infile [--index-memory mb]
+	Reads infile (as --stream would) and writes indexfile: a list of the
+	releases for every three characters (ignoring ascii case) in a title or
+	notes, and where each release is.  Lists are built in mb megabytes
+	(default 256) at a time, in segment files (indexfile.seg0, .seg1...)
+	that are merged at the end and deleted.  Exits with 10 if it failed.
+ --index indexfile
+	With --text, reads only the releases the index says have all three
+	character pieces of a phrase (all of them if a phrase is shorter), with
+	a positioned read each, and checks them as --text would.  The index has
+	to be of the same infile (its size and start are checked).  Not with
+	--stream.
+ --build-store storefile infile
+	Writes storefile: each release of infile (up to BLOCKSIZE) with where
+	its id, title, released, country, notes, data_quality, labels, formats
+	and artists are, and the ids of all its artists as numbers.  Exits with
+	10 if it failed or left a release out.
+ --store
+	infile is a storefile.  It is mapped into memory and the releases are
+	matched and written from it, with the same output as from the dump but
+	without searching the xml.  Not with --stream or --index.
+ --build-frames framefile infile [--frame-bytes kb] [--compress-level n]
+	Writes framefile: infile (plain, or gzip with HAVE_ZLIB) recompressed as
+	zstd frames of about kb KB (default 4096), each starting at a release
+	and holding whole releases, so any frame can be decompressed on its
+	own.  A zstd skippable frame at the end is the frame index: where
+	each frame is, its sizes, and its lowest and highest release id.
+	zstd -d still gives back infile as it was.  Needs HAVE_ZSTD.
+ --frames [--frame-threads n] [--release-ids first-last]
+	infile is a framefile.  Its frames are read in order and decompressed
+	on n threads (default 4) ahead of the search, which goes through each
+	as through a block of the dump.  With --release-ids only the frames
+	with ids in first-last are read, and only those releases searched.
+	Not with --stream, --index, --store, --sample, --follow, --dump,
+	--threads, --zero-copy or --cache-dir.
+ --trace file [--trace-events n]
+	Writes a timeline of the run to file as Chrome trace event JSON (for
+	chrome://tracing or Perfetto): a begin time and length for each block
+	read, seek back, boundary search, field extraction, release write,
+	output flush, and wait on the extraction threads or --follow, on the
+	thread that did it.  Each thread keeps its last n events (default
+	262144, rounded up to a power of 2) in memory, and older ones are
+	overwritten, so a long run keeps its end.
+ --dump type infile outfile [--dump-text text] [--io-readers n]
+	Also scan infile, a Discogs dump of type masters, artists or labels,
+	at the same time as the search, writing its records that have text to
+	outfile.  text is <artist><id>...</id> of SEARCH_STRING's artist for
+	masters, <artist><id>...</id> of it at the start of the record for
+	artists (the artist's own record, not groups it is a member of), and
+	must be given for labels.  Up to 7 --dump scans, each on its own
+	thread.  The reads of all of them and of the search share one I/O
+	scheduler that lets n reads (default 1) go at once, each to the scan
+	that has had the fewest bytes so far, so a small dump is done early and
+	the whole run takes about as long as the biggest dump.  The record
+	start and end tags of each type are in recordtypes[].  Not with
+	--stream, --index, --store, --sample, --follow or --cache-dir.
+ --sample k [--sample-releases n] [--sample-seed s]
+	An estimate instead of a full search: infile is cut into k equal parts
+	and n releases (default 100) are read from a random byte in each, so
+	only a small fraction of the file is read.  The releases-per-byte and
+	matches-per-byte of the samples give the estimated number of releases
+	and of matched releases in the whole file (or --start-offset to
+	--end-offset), with 95% intervals, printed and written to outfile.
+	The sampled matches are written to outfile and csvfile as usual, and
+	with --aggregate the table gets an estimated column, its counts scaled
+	to the estimate.  s (default the time) makes the offsets repeatable.
+	Not with --stream, --index, --store, --threads, --follow, --shard-dir
+	or --cache-dir.
+ --sqlite dbfile [--sqlite-batch n]
+	Matched releases are also loaded into the SQLite database dbfile (which
+	is overwritten): tables releases, labels and formats (with the
+	descriptions of each format joined by ", "), linked by release_id, as
+	--json has them.  Inserts are prepared statements, n releases (default
+	50000) to a transaction, with no journal or syncing while loading, and
+	the indexes are made at the end.  A run that fails part way leaves a
+	damaged dbfile.  Needs HAVE_SQLITE.  Not with --stream, --threads,
+	--aggregate, --shard-dir or --cache-dir.
+ --json
+	csvfile is JSON Lines instead: one object per matched release, with
+	release_id, title, released, country, notes, data_quality, master_id,
+	labels (name, catno and id of each), formats (name, qty, text and the
+	descriptions of each), genres, styles and matched_role with --role.
+	Values are taken from the release's xml without its entities, null if
+	a release doesn't have them, and the file has no header lines.  Not
+	with --stream, --columns, --aggregate or --shard-dir.
+ --compress gzip|zstd [--compress-level n] [--compress-threads n]
+	outfile, csvfile and the debug file are written compressed (name them
+	.gz or .zst; the default debug file becomes debug.txt.gz or .zst).
+	What the search writes goes through a pipe to a thread that cuts it
+	into frames of 1MB, each compressed on its own (a gzip member or a zstd
+	frame) by one of n threads (default 2) and written in order, so the
+	search doesn't wait on the compression.  A frame is cut
+	early once no more output has come for 5 seconds, so a file that is
+	still being written can be decompressed up to its last frame.  gzip
+	needs HAVE_ZLIB, zstd HAVE_ZSTD.  Not with --shard-dir or --zero-copy.
+ --zero-copy
+	On Linux, matched releases go from infile to outfile by
+	copy_file_range() (or sendfile()) in batches of byte ranges, without
+	being copied through the program, and neighbouring releases in one
+	range.  outfile is the same.  Not with --shard-dir or --aggregate.
+ --cache-dir dir [--cache-size mb]
+	The outputs of a run are kept in dir (which has to exist), found again
+	by the fingerprint of infile (its size, time and a hash of pieces of
+	it) and the options that change the output.  A run of the same search
+	on the same dump copies them to outfile and csvfile without reading
+	the dump.  Up to mb megabytes (default 1024) are kept, the least
+	recently used entries deleted first.  Runs with errors aren't kept.
+	Not with --shard-dir or --follow.
+ --columns c1,c2... | --schema file
+	The columns of csvfile, in order: any of release_id, title, released,
+	country, notes, data_quality, first_label&catno, first_label,
+	first_catno, all_label&catno, format_name, format_qty, format_text,
+	description, combined_description, master_id, genres, styles and
+	identifiers (file has one per line, # for comments).  Only the fields
+	of these columns are looked for in each release.  Every column is
+	written, " " if a release doesn't have it.  Not with --aggregate, and
+	genres, styles and identifiers not with --stream.
+ --bench [--bench-repeats n]
+	A run of its own: times memmem() for the start, end and artist tags
+	(the artist in 0 to 100% of the releases), the resync to a release
+	boundary, process_xml() and write_csv_row() on synthetic releases with
+	1, 3 and 20 labels and formats.  Prints ns per byte and per record of
+	the median of n runs (default 15), the fastest and the spread.
+ --follow [--follow-marker file]
+	infile is still being downloaded or decompressed.  At its current end
+	the block search waits for it to grow (inotify on Linux, otherwise
+	looking every second) instead of stopping, and finishes once infile
+	ends with </releases>, or file exists.  Not with --stream, --index or
+	--store.
+ --threads n
+	The block search hands each matched release to one of n worker threads
+	(up to 64), which pick out its fields and format its csv line while
+	the search goes on.  Releases are written in the order they are in
+	infile, so the output is the same as without.  Not with --shard-dir,
+	--stream, --index or --store.
+ --perf-counters
+	On Linux, counts cycles, instructions, branch misses and last level
+	cache misses with perf_event_open() for each stage of the search
+	(reading, release boundaries, artist match, field extraction, output)
+	and reports them per MB and per release at the end.  Counters that
+	aren't available are left out, and without any the run goes on as
+	normal.  Only the search thread is counted, so not with --threads, and
+	the background threads of --compress and --frames are left out.
+ --stream
+	infile is read once, front to back, by a resumable streaming XML parser
+	instead of the block search.  Fields are picked out as the elements go
+	by, a release is matched on the <artist><id> in SEARCH_STRING, and a
+	release can be any size (not limited to BLOCKSIZE).  Gives the same
+	output, and works with --sort, --aggregate, the byte range options and
+	--metrics-file, but not --shard-dir.
 
 
 Precautions and limitations
@@ -17,6 +225,116 @@ Precautions and limitations
 
 Revision history
 
+0.26 10/18/26.  Added --build-frames and --frames: the dump as seekable zstd
+	frames of whole releases with a frame index, searched with the frames
+	decompressed in parallel, or only those of a --release-ids range.
+
+0.25 10/18/26.  Added --dump, --dump-text and --io-readers: masters, artists
+	and labels dumps scanned alongside the release search, by record type
+	descriptors, with their reads shared out by an I/O scheduler.
+
+0.24 10/18/26.  Added --sample, --sample-releases and --sample-seed: counts
+	of the whole file estimated, with intervals, from releases read at
+	random offsets.
+
+0.23 10/18/26.  Added --sqlite and --sqlite-batch: matched releases, labels
+	and formats bulk loaded into a SQLite database as the search goes.
+
+0.22 10/18/26.  Added --json: csvfile as JSON Lines, written straight from
+	the spans of a release into csvrow, with arrays of all its labels,
+	formats and descriptions.
+
+0.21 10/18/26.  Added --compress, --compress-level and --compress-threads:
+	gzip or zstd outfile, csvfile and debug file, compressed in frames by
+	background threads.
+
+0.20 10/18/26.  Added --trace and --trace-events, a Chrome trace event
+	timeline of the search from per thread rings of events.
+
+0.19 10/18/26.  Added --zero-copy, matched releases copied from infile to
+	outfile by copy_file_range()/sendfile() as batched byte ranges.
+	write_release() is given the release's offset in infile by every
+	search.
+
+0.18 10/18/26.  Added --cache-dir and --cache-size, a cache of finished
+	outputs keyed by the dump's fingerprint and the search.
+
+0.17 10/18/26.  Added --columns and --schema, to choose the csv columns,
+	with genres, styles, master_id and identifiers as new ones.  The
+	columns are compiled into the set of fields process_xml() looks for,
+	which --aggregate also uses for just its fields.
+
+0.16 10/18/26.  Added --bench, microbenchmarks of the search and extraction
+	kernels on synthetic releases.
+
+0.15 10/18/26.  Added --follow and --follow-marker, to search a dump while
+	it is still being written, waiting at its end for more.
+
+0.14 10/18/26.  Added --threads: field extraction and csv formatting of
+	matched releases on a pool of worker threads, with a ring of jobs
+	written back in dump order.  The extraction globals are per thread.
+
+0.13 10/18/26.  Added --build-store and --store: a binary copy of the dump
+	with the place of each release's fields and its artist ids, mapped
+	into memory, so repeat runs skip the tag searches.  The label and
+	format parsing of process_xml() is now in process_xml_labels() and
+	process_xml_formats().
+
+0.12 10/18/26.  Added --build-index and --index: a trigram index of the
+	titles and notes (delta varint posting lists, built in segments within
+	--index-memory and merged), so a --text search only reads the releases
+	that can match, each with a positioned read.
+
+0.11 10/18/26.  Added --text and --text-fields: match releases on phrases in
+	their title or notes, case insensitive, with an SSE2 case folding
+	search, instead of on the artist.
+
+0.10 10/18/26.  Added --validate: a one pass check of the dump (nesting,
+	unclosed releases, NULs, truncation) with the offsets of any damage,
+	release id gaps and the largest release.  Uses an SSE2 tag scanner.
+
+0.9  10/18/26.  Added --perf-counters: hardware counters (perf_event_open)
+	charged to the read, boundary search, match, extraction and output
+	stages, reported per MB and per release.
+
+0.8  10/18/26.  Added --role: match only releases that credit the artist
+	as main artist, extra artist, on a track, or with a given <role>, and
+	add the credit that matched to the csv line.
+
+0.7  10/18/26.  Added --stream: a resumable XML tokenizer with start
+	element, attribute, text and end element callbacks, that reads infile
+	in one pass with no seeking back and no limit on release size.
+	process_xml() only finds the fields now; write_csv_row() formats them,
+	and write_release() writes a matched release for both searches.
+	Fixed the <description> search in process_xml() also matching the
+	<descriptions> of the next format.
+
+0.6  10/18/26.  Added --metrics-file: progress metrics in Prometheus text
+	format (bytes, releases, matches, errors, rates, current release id,
+	buffer refills, seek-backs, ETA), rewritten every --metrics-interval
+	seconds during the scan.
+
+0.5  10/18/26.  Added --start-offset/--end-offset to search one byte range of
+	infile, --merge to join the outputs of the ranges, and --debug-file.
+	File positions are now 64 bit (fseek64/ftell64).
+
+0.4  10/18/26.  Added --aggregate: matched releases are only counted, in a
+	hash table grouped by the listed fields, and the table is written at
+	the end.  process_xml() keeps the spans of the fields it finds in
+	fields, and skips formatting csvrow when nothing will write it.
+
+0.3  10/18/26.  Added --sort: csv lines are sorted by master_id and
+	release_id with duplicates dropped, as an external merge sort (sorted
+	runs within --sort-memory, merged SORT_MAX_MERGE at a time).
+
+0.2  10/18/26.  Added sharded output (--shard-dir, --artists).  Each shard
+	file is buffered in memory and written in large blocks, with only
+	--shard-max-open shard files kept open (least recently used is closed).
+	process_xml() now builds the csv line in csvrow instead of writing to
+	csvfile, so it can be routed to any number of files.  Its trace output
+	and pauses are now under DEBUG_PROCESS_XML.  Capped the label and
+	description copies at their array sizes.
+
 0.1  09/09/18 blk.  Added parsing of XML for the creation of CSV file
 	passed on command line as 3rd parameter.
 	Previous version only removed the specified XML.
@@ -81,6 +399,7 @@ Optionally writes a debug.txt file that contains a list of the releases saved.
 */
 
 #define _CRT_SECURE_NO_WARNINGS 1
+#define _FILE_OFFSET_BITS 64
 
 #include<dos.h>
 #include<stdio.h>
@@ -88,10 +407,80 @@ Optionally writes a debug.txt file that contains a list of the releases saved.
 #include<stdlib.h>
 #include<fcntl.h>
 #include<time.h>
+#include<stdarg.h>
+#include<ctype.h>
+#include<math.h>
+#include<sys/types.h>
+#include<sys/stat.h>  // --cache-dir fingerprint
+
+// --compress: gzip needs zlib, zstd needs libzstd (both off by default)
+#define HAVE_ZLIB 0
+#define HAVE_ZSTD 0
+#if HAVE_ZLIB
+#include<zlib.h>
+#endif
+#if HAVE_ZSTD
+#include<zstd.h>
+#endif
+
+// --sqlite needs SQLite (off by default)
+#define HAVE_SQLITE 0
+#if HAVE_SQLITE
+#include<sqlite3.h>
+#endif
+
+
+
+// file positions past 2GB (the dump is 35GB+)
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#include<unistd.h>  // pread() for --index
+#include<sys/mman.h>  // mmap() for --store
+#include<pthread.h>  // --threads
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include<windows.h>  // file mapping for --store, threads for --threads
+#include<io.h>
+#endif
+
+// a copy per thread, for the extraction state used by --threads
+#ifdef _MSC_VER
+#define THREADLOCAL __declspec(thread)
+#else
+#define THREADLOCAL __thread
+#endif
+
+// --perf-counters
+#ifdef __linux__
+#include<errno.h>
+#include<unistd.h>
+#include<sys/ioctl.h>
+#include<sys/syscall.h>
+#include<linux/perf_event.h>
+#include<sys/inotify.h>  // --follow
+#include<poll.h>
+#include<sys/sendfile.h>  // --zero-copy
+#endif
 
+// --validate tag scanner
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define VALIDATE_SSE2 1
+#include<emmintrin.h>
+#ifdef _MSC_VER
+#include<intrin.h>
+#endif
+#else
+#define VALIDATE_SSE2 0
+#endif
 
 
-#define VERSION "DISCOGS Release database XML search processor, version 0.1"
+#define VERSION "DISCOGS Release database XML search processor, version 0.26"
 
 
 #define SEPARATOR "	"
@@ -120,6 +509,27 @@ Optionally writes a debug.txt file that contains a list of the releases saved.
 #define FORMAT_NAME_START "<format name=\""
 #define FORMATS_END "</formats>"
 
+// only for --json
+#define LABEL_START "<label "
+#define FORMATS_START "<formats>"
+#define FORMAT_START "<format "
+#define FORMAT_END "</format>"
+#define DESCRIPTION_START "<description>"
+#define DESCRIPTION_END "</description>"
+
+// only for --columns
+#define GENRES_START "<genres>"
+#define GENRES_END "</genres>"
+#define GENRE_START "<genre>"
+#define GENRE_END "</genre>"
+#define STYLES_START "<styles>"
+#define STYLES_END "</styles>"
+#define STYLE_START "<style>"
+#define STYLE_END "</style>"
+#define IDENTIFIERS_START "<identifiers>"
+#define IDENTIFIERS_END "</identifiers>"
+#define IDENTIFIER_START "<identifier "
+
 
 
 
@@ -143,6 +553,17 @@ Optionally writes a debug.txt file that contains a list of the releases saved.
 // write file with found release IDs and error messages
 #define WRITE_DEBUG_FILE 1
 
+//show process_xml() field extraction trace, and pause for Enter after each step
+#define DEBUG_PROCESS_XML 0
+
+#if DEBUG_PROCESS_XML
+#define xmltrace(...) printf(__VA_ARGS__)
+#define xmlpause() (ch=getchar())
+#else
+#define xmltrace(...)
+#define xmlpause()
+#endif
+
 
 #define SEARCH_START "<release id="
 #define SEARCH_END "</release>"
@@ -159,6 +580,725 @@ Optionally writes a debug.txt file that contains a list of the releases saved.
 //#define BLOCKSIZE 524288 //(not large enough -- see release id="7910952"  (2^19)
 #define BLOCKSIZE 1048576  // (2^20) is enough.
 
+// one formatted csv line from process_xml(); can never be longer than the release xml itself
+#define CSVROW_SIZE (BLOCKSIZE+2)
+
+
+// sharded output (--shard-dir, --artists): one xml and one csv file per artist
+#define SHARD_ARTIST_TAG "<artist><id>"
+#define SHARD_XML_EXT ".xml"
+#define SHARD_CSV_EXT ".csv"
+#define SHARD_MAX_OPEN_FILES 64
+// default number of shard files kept open at once, least recently used is closed first
+#define SHARD_INITIAL_BUFFER 4096
+#define SHARD_BUFFER_SIZE 262144
+// per shard file write buffer grows from SHARD_INITIAL_BUFFER up to this, then is written in one piece
+#define SHARD_MEMORY_LIMIT 268435456
+// total bytes of shard buffers before the fullest buffers are written out and released early
+#define MAX_SHARD_MATCHES 64
+// most distinct sharded artists routed from a single release
+
+
+// sorted csv output (--sort): by master_id then release_id, duplicates removed
+#define MASTER_ID_START "<master_id"
+#define SORT_MEMORY_BUDGET 256
+// default MB of csv lines (and their sort keys) held in memory before a sorted run is written out
+#define SORT_MAX_MERGE 64
+// most runs merged at once, more than this are merged in several passes
+#define SORT_IO_BUFFER 1048576
+// stdio buffer for each run file being written or merged
+#define SORT_RUN_EXT ".run"
+
+
+// aggregation (--aggregate fields): count releases grouped by fields, no per-release output
+#define AGGREGATE_MAX_FIELDS 4
+#define AGGREGATE_MAX_KEY 1000
+#define AGGREGATE_PRINT_ROWS 20
+// largest groups shown on screen at the end, csvfile gets all of them
+#define AGGREGATE_YEAR_LEN 4
+
+
+// --merge of the outputs of --start-offset/--end-offset runs
+#define CLOSE_FILES_LINE "\n\nclose files.  processed "
+#define MERGE_TAIL 4096
+// how far from the end of a part to look for its close files summary
+#define MERGE_MAX_HEADER_LINES 20
+#define MERGE_SORT_LINE "\nSort: "
+#define MERGE_AGGREGATE_LINE "Aggregating by "
+// parts with these can't be merged by copying
+
+
+// live metrics (--metrics-file): Prometheus text format, rewritten every --metrics-interval seconds
+#define METRICS_INTERVAL 5
+#define METRICS_CHECK_RELEASES 256
+// releases between looks at the clock
+#define METRICS_TMP_EXT ".tmp"
+
+
+// streaming parser (--stream)
+#define STREAM_NAME_MAX 64
+// element and attribute names are cut to this, no name we look for is near it
+#define STREAM_ATTR_MAX 1024
+#define STREAM_FIELD_MAX 65536
+// text kept of each field, the rest is dropped
+#define STREAM_MAX_DEPTH 64
+// element ids kept on the stack, deeper elements are counted but not identified
+
+// xmlstream states
+#define XS_TEXT 0
+#define XS_TAG 1            // after <
+#define XS_NAME 2
+#define XS_ATTRS 3          // in a start tag, between attributes
+#define XS_ATTR_NAME 4
+#define XS_ATTR_EQ 5        // after an attribute name, before =
+#define XS_ATTR_QUOTE 6     // after =, before the quote
+#define XS_ATTR_VALUE 7
+#define XS_EMPTY 8          // after / in a start tag
+#define XS_END_NAME 9
+#define XS_END_WAIT 10      // after the end tag name, before >
+#define XS_BANG 11          // after <!
+#define XS_SPECIAL 12       // comment, processing instruction or doctype, up to terminator
+#define XS_CDATA_OPEN 13
+#define XS_CDATA 14
+
+// element ids, index into stream_element_names
+#define ELEM_OTHER 0
+#define ELEM_RELEASES 1
+#define ELEM_RELEASE 2
+#define ELEM_TITLE 3
+#define ELEM_RELEASED 4
+#define ELEM_COUNTRY 5
+#define ELEM_NOTES 6
+#define ELEM_DATA_QUALITY 7
+#define ELEM_MASTER_ID 8
+#define ELEM_LABELS 9
+#define ELEM_LABEL 10
+#define ELEM_FORMATS 11
+#define ELEM_FORMAT 12
+#define ELEM_DESCRIPTIONS 13
+#define ELEM_DESCRIPTION 14
+#define ELEM_ARTIST 15
+#define ELEM_ID 16
+#define ELEM_ARTISTS 17
+#define ELEM_EXTRAARTISTS 18
+#define ELEM_ROLE 19
+
+
+// artist roles (--role)
+#define ROLE_MAIN 0
+#define ROLE_EXTRA 1
+#define ROLE_TRACK 2
+#define ROLE_MAX_FILTERS 16
+#define ROLE_TEXT_MAX 200
+#define ROLE_HEADER "	\"matched_role\""
+#define ROLE_TRACKLIST_START "<tracklist>"
+#define ROLE_TRACKLIST_END "</tracklist>"
+#define ROLE_ARTISTS_START "<artists>"
+#define ROLE_EXTRAARTISTS_START "<extraartists>"
+#define ROLE_ARTIST_END "</artist>"
+#define ROLE_START "<role>"
+#define ROLE_END "</role>"
+
+
+// performance counters (--perf-counters), by stage of the search
+#define PERF_READ 0
+#define PERF_SEARCH 1       // release boundaries, or tokenizing with --stream
+#define PERF_MATCH 2
+#define PERF_EXTRACT 3
+#define PERF_OUTPUT 4
+#define PERF_STAGES 5
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_BRANCH_MISSES 2
+#define PERF_LLC_MISSES 3
+#define PERF_COUNTERS 4
+
+#define perfstage(s) (perf_mode ? perf_stage(s) : (void)0)
+
+
+// dump validation (--validate)
+#define VALIDATE_MAX_DAMAGE 100
+// damage listed, the rest is only counted
+#define VALIDATE_TAG_LOOKAHEAD 9
+// bytes wanted after a < to tell what it starts (<![CDATA[)
+
+
+// text search (--text, --text-fields)
+#define TEXT_MAX_PHRASES 8
+#define TEXT_PHRASE_MAX 200
+#define TEXT_TITLE 0
+#define TEXT_NOTES 1
+#define TEXT_DEFAULT_FIELDS "title,notes"
+
+
+// trigram index (--build-index, --index)
+#define INDEX_MAGIC "DSTRIGR1"
+#define INDEX_VERSION 1
+#define INDEX_MEMORY_BUDGET 256
+// default MB of posting lists (and their table) held while building before a segment is written
+#define INDEX_TABLE_START 65536
+// trigram hash table slots to start with, doubled when half full
+#define INDEX_FINGERPRINT_BYTES 65536
+// of the start of infile hashed into the index header, with its size
+#define INDEX_SEGMENT_EXT ".seg"
+
+
+// binary release store (--build-store, --store)
+#define STORE_MAGIC "DSSTORE1"
+#define STORE_VERSION 1
+#define STORE_ALIGN 8
+// records start on a multiple of this
+#define STORE_ARTISTS_END "</artists>"
+
+// fields of a storerecord
+#define STORE_TITLE 0
+#define STORE_RELEASED 1
+#define STORE_COUNTRY 2
+#define STORE_NOTES 3
+#define STORE_DATA_QUALITY 4
+#define STORE_LABELS 5      // inside <labels>
+#define STORE_FORMATS 6     // from the first <format name=" to </formats>
+#define STORE_ARTISTS 7     // inside the release's <artists>
+#define STORE_FIELDS 8
+
+
+// following a growing infile (--follow)
+#define FOLLOW_END_TAG "</releases>"
+#define FOLLOW_POLL_MS 1000
+// longest wait between looks at infile and the --follow-marker
+#define FOLLOW_TAIL 64
+// last bytes of infile looked through for FOLLOW_END_TAG
+
+
+// microbenchmarks (--bench)
+#define BENCH_REPEATS 15
+#define BENCH_RELEASES 4000
+// synthetic releases searched by the search kernels
+#define BENCH_RELEASE_MAX 16384
+#define BENCH_RESYNCS 20000
+#define BENCH_EXTRACTS 5000
+// records per run of the extract and csv kernels
+
+// kernels
+#define BENCH_SEARCH 0
+#define BENCH_RESYNC 1
+#define BENCH_EXTRACT 2
+#define BENCH_CSV 3
+
+
+// csv columns (--columns, --schema)
+#define SCHEMA_MAX_COLUMNS 40
+#define SCHEMA_LIST_SEPARATOR ", "
+// between the values of genres, styles and identifiers
+
+// fields process_xml() looks for, bits of schemaneeds
+#define SCHEMA_TITLE 0x01
+#define SCHEMA_RELEASED 0x02
+#define SCHEMA_COUNTRY 0x04
+#define SCHEMA_NOTES 0x08
+#define SCHEMA_DATA_QUALITY 0x10
+#define SCHEMA_LABELS 0x20
+#define SCHEMA_FORMATS 0x40
+#define SCHEMA_MASTER_ID 0x80
+#define SCHEMA_GENRES 0x100
+#define SCHEMA_STYLES 0x200
+#define SCHEMA_IDENTIFIERS 0x400
+#define SCHEMA_LABEL_LIST 0x800  // the labels and formats spans, for --json and --sqlite
+#define SCHEMA_FORMAT_LIST 0x1000
+#define SCHEMA_ALL_HEADER 0xff  // HEADER_LINE, and master_id for --sort
+
+// columns, in schema_column_names
+#define SCHEMA_COL_RELEASE_ID 0
+#define SCHEMA_COL_TITLE 1
+#define SCHEMA_COL_RELEASED 2
+#define SCHEMA_COL_COUNTRY 3
+#define SCHEMA_COL_NOTES 4
+#define SCHEMA_COL_DATA_QUALITY 5
+#define SCHEMA_COL_FIRST_LABEL_CATNO 6
+#define SCHEMA_COL_FIRST_LABEL 7
+#define SCHEMA_COL_FIRST_CATNO 8
+#define SCHEMA_COL_ALL_LABEL_CATNO 9
+#define SCHEMA_COL_FORMAT_NAME 10
+#define SCHEMA_COL_FORMAT_QTY 11
+#define SCHEMA_COL_FORMAT_TEXT 12
+#define SCHEMA_COL_DESCRIPTION 13
+#define SCHEMA_COL_COMBINED_DESCRIPTION 14
+#define SCHEMA_COL_MASTER_ID 15
+#define SCHEMA_COL_GENRES 16
+#define SCHEMA_COL_STYLES 17
+#define SCHEMA_COL_IDENTIFIERS 18
+
+
+// result cache (--cache-dir)
+#define CACHE_SIZE 1024
+// default MB of cached outputs kept
+#define CACHE_SAMPLES 16
+#define CACHE_SAMPLE_BYTES 4096
+// pieces of infile hashed for its fingerprint
+#define CACHE_KEY_MAX 8192
+#define CACHE_MAX_ENTRIES 1000
+#define CACHE_PATH_MAX 1024
+#define CACHE_INDEX_NAME "cache.idx"
+#define CACHE_TMP_EXT ".tmp"
+
+
+// zero-copy output (--zero-copy)
+#define ZEROCOPY_RANGES 4096
+// ranges of infile waiting to be copied to outfile
+
+// how they are copied, falling back down the list
+#define ZEROCOPY_COPY_FILE_RANGE 0
+#define ZEROCOPY_SENDFILE 1
+#define ZEROCOPY_READ_WRITE 2
+
+
+// extraction threads (--threads)
+#define POOL_MAX_THREADS 64
+#define POOL_JOBS_PER_THREAD 4
+// jobs in the ring for each worker, so workers rarely wait on the oldest one
+
+// job states
+#define POOL_FREE 0
+#define POOL_QUEUED 1
+#define POOL_DONE 2
+
+#ifdef _WIN32
+typedef HANDLE poolthread_t;
+typedef CRITICAL_SECTION poolmutex_t;
+typedef CONDITION_VARIABLE poolcond_t;
+#define mutex_init(m) InitializeCriticalSection(&(m))
+#define mutex_lock(m) EnterCriticalSection(&(m))
+#define mutex_unlock(m) LeaveCriticalSection(&(m))
+#define cond_init(c) InitializeConditionVariable(&(c))
+#define cond_wait(c,m) SleepConditionVariableCS(&(c),&(m),INFINITE)
+#define cond_signal(c) WakeConditionVariable(&(c))
+#define cond_broadcast(c) WakeAllConditionVariable(&(c))
+#else
+typedef pthread_t poolthread_t;
+typedef pthread_mutex_t poolmutex_t;
+typedef pthread_cond_t poolcond_t;
+#define mutex_init(m) pthread_mutex_init(&(m),NULL)
+#define mutex_lock(m) pthread_mutex_lock(&(m))
+#define mutex_unlock(m) pthread_mutex_unlock(&(m))
+#define cond_init(c) pthread_cond_init(&(c),NULL)
+#define cond_wait(c,m) pthread_cond_wait(&(c),&(m))
+#define cond_signal(c) pthread_cond_signal(&(c))
+#define cond_broadcast(c) pthread_cond_broadcast(&(c))
+#endif
+
+
+// seekable zstd frames (--build-frames, --frames)
+#define FRAME_BYTES 4096
+// KB of releases in a frame
+#define FRAME_THREADS 4
+#define FRAME_MAX_THREADS 64
+#define FRAME_SKIPPABLE_MAGIC 0x184D2A5E
+// the zstd skippable frame the index is in
+#define FRAME_INDEX_MAGIC "DSFRAMES"
+#define FRAME_INDEX_VERSION 1
+
+
+// other dumps scanned at the same time (--dump), and the I/O scheduler
+#define DUMP_MAX 7
+#define DUMP_READ_BYTES 4194304
+// a read of a --dump scan
+#define IOSCHED_MAX_STREAMS (DUMP_MAX+1)
+// the search's reads, and the --dump scans'
+#define IOSCHED_SEARCH 0
+#define IOSCHED_READERS 1
+// reads at once, one for a disk
+
+
+// sampling (--sample)
+#define SAMPLE_RELEASES 100
+// read at each sample point
+#define SAMPLE_READ_BYTES 65536
+// first read at a point, doubled up to BLOCKSIZE for a long release
+#define SAMPLE_MIN_READ 4096
+// when the parts are smaller than SAMPLE_READ_BYTES
+#define SAMPLE_MAX_POINTS 1000000
+#define SAMPLE_Z 1.96
+// normal quantile of the 95% intervals
+
+
+// SQLite output (--sqlite)
+#define DB_BATCH 50000
+// releases to a transaction
+#define DB_PAGE_SIZE 65536
+#define DB_CACHE_KB 262144
+#define DB_LIST_SEPARATOR ", "
+// between the descriptions of a format
+
+
+// compressed output (--compress)
+#define COMPRESS_NONE 0
+#define COMPRESS_GZIP 1
+#define COMPRESS_ZSTD 2
+#define COMPRESS_FRAME_BYTES 1048576
+// output compressed on its own, as one gzip member or zstd frame
+#define COMPRESS_FLUSH_SECONDS 5
+// a frame is cut early after this long without output, so partial files can be read
+#define COMPRESS_THREADS 2
+#define COMPRESS_MAX_THREADS 32
+#define COMPRESS_MAX_STREAMS 3
+// outfile, csvfile and the debug file
+#define COMPRESS_QUEUE (COMPRESS_MAX_STREAMS*(COMPRESS_MAX_THREADS+2))
+#define COMPRESS_PIPE_BYTES 65536
+// stdio buffer of the pipe the program writes into
+// frames use the POOL_ job states
+
+
+// timeline trace (--trace)
+#define TRACE_EVENTS 262144
+// events kept for each thread, the oldest overwritten
+#define TRACE_THREADS (POOL_MAX_THREADS+1)
+
+// the events
+#define TRACE_READ 0
+#define TRACE_SEEKBACK 1
+#define TRACE_BOUNDARY 2
+#define TRACE_EXTRACT 3
+#define TRACE_WRITE 4
+#define TRACE_FLUSH 5
+#define TRACE_POOL_WAIT 6
+#define TRACE_FOLLOW_WAIT 7
+#define TRACE_TYPES 8
+
+#define tracebegin(e) (trace_mode ? trace_begin(e) : (void)0)
+#define traceend(e,arg) (trace_mode ? trace_end(e,(long long)(arg)) : (void)0)
+
+
+/*--- types --------------------------------------------------*/
+
+struct shardfile
+	{
+	unsigned long artist_id;
+	const char *ext;
+	FILE *fp;                 // NULL unless currently in the open file cache
+	int created;              // file exists on disk, reopen with append
+	unsigned char *buf;
+	size_t len;
+	size_t cap;
+	struct shardfile *lru_prev;  // open file cache, most recently used first
+	struct shardfile *lru_next;
+	};
+
+struct shard
+	{
+	unsigned long artist_id;
+	struct shardfile xml;
+	struct shardfile csv;
+	};
+
+struct xmlspan
+	{
+	unsigned char *ptr;       // into the release xml, not terminated
+	size_t len;
+	int found;                // 1 found, 0 missing, -1 start tag without end tag
+	};
+
+struct releasefields
+	{
+	unsigned long release_id;
+	struct xmlspan title;
+	struct xmlspan released;
+	struct xmlspan country;
+	struct xmlspan notes;
+	struct xmlspan data_quality;
+	unsigned long long master_id;
+	struct xmlspan genres;    // only looked for with --columns
+	struct xmlspan styles;
+	struct xmlspan identifiers;
+	struct xmlspan labels;    // only looked for with --json
+	struct xmlspan formats;
+	};
+
+struct aggregate_entry
+	{
+	unsigned char *key;       // group-by values separated by tabs
+	unsigned int keylen;
+	unsigned int hash;
+	unsigned long count;
+	};
+
+struct sortentry
+	{
+	unsigned long long master_id;
+	unsigned long long release_id;
+	size_t offset;            // of the csv line in sortarena
+	unsigned int len;
+	};
+
+struct sortrun
+	{
+	FILE *fp;
+	unsigned long long master_id;
+	unsigned long long release_id;
+	unsigned int len;
+	unsigned char *row;
+	unsigned int rowcap;
+	};
+
+struct xmlstream
+	{
+	int state;                // XS_
+	long long offset;         // file offset of the next byte to be fed
+	long long tagoffset;      // of the < of the current tag
+	long long endoffset;      // just past the > of the current tag
+	unsigned char name[STREAM_NAME_MAX];
+	unsigned int namelen;
+	unsigned char attrname[STREAM_NAME_MAX];
+	unsigned int attrnamelen;
+	unsigned char attrvalue[STREAM_ATTR_MAX];
+	size_t attrvaluelen;
+	unsigned char quote;
+	const char *terminator;   // XS_SPECIAL ends at this
+	unsigned int matched;     // of terminator
+	int elem;                 // ELEM_ id of the current element
+	int emptytag;             // in end_element, the element was <name/>
+	unsigned int depth;
+	int stack[STREAM_MAX_DEPTH];
+	int stop;                 // set by a callback to return from xmlstream_feed()
+
+	// callbacks, NULL if not wanted.  The element is elem and the top of stack.
+	void (*start_element)(struct xmlstream *xs);
+	void (*attribute)(struct xmlstream *xs);   // attrname=attrvalue, both terminated
+	void (*text)(struct xmlstream *xs, unsigned char *data, size_t len);  // maybe in pieces
+	void (*end_element)(struct xmlstream *xs);
+	};
+
+struct streamfield
+	{
+	unsigned char buf[STREAM_FIELD_MAX];
+	size_t len;
+	};
+
+struct indexheader
+	{
+	char magic[8];            // INDEX_MAGIC
+	unsigned int version;
+	unsigned int releases;
+	unsigned int trigrams;
+	unsigned int pad;
+	long long dumpsize;       // of the infile it was built from
+	unsigned long long dumphash;
+	long long recordsoffset;  // of the indexrecords
+	long long postingsoffset;
+	long long directoryoffset;  // of the indexentries
+	};
+
+struct indexrecord
+	{
+	long long offset;         // of the <release in infile
+	unsigned int len;
+	unsigned int release_id;
+	};
+
+struct indexentry
+	{
+	unsigned int trigram;
+	unsigned int count;       // releases in its list
+	long long offset;         // of its list in the index file
+	unsigned int bytes;
+	unsigned int pad;
+	};
+
+struct indexposting
+	{
+	unsigned int trigram;
+	unsigned int count;       // 0 is an empty slot
+	unsigned int last;        // release number last added
+	unsigned char *buf;       // varint differences
+	size_t len;
+	size_t cap;
+	};
+
+struct storeheader
+	{
+	char magic[8];            // STORE_MAGIC
+	unsigned int version;
+	unsigned int releases;
+	long long dumpsize;       // of the infile it was built from
+	unsigned long long dumphash;
+	long long recordsoffset;
+	long long bytes;          // of all the records
+	};
+
+struct storefield
+	{
+	unsigned int offset;      // in the record's xml
+	unsigned int len;
+	int found;                // as xmlspan found
+	};
+
+struct storerecord
+	{
+	unsigned int size;        // to the next record
+	unsigned int release_id;
+	unsigned long long master_id;
+	long long offset;         // of the release in infile
+	unsigned int xmllen;
+	unsigned int artistcount; // ids after this, then the xml
+	struct storefield field[STORE_FIELDS];
+	};
+
+struct pooljob
+	{
+	int state;                // POOL_
+	unsigned char *xml;       // copy of the matched release
+	size_t xmllen;
+	size_t xmlcap;
+	unsigned char *csv;       // its csv line, from the worker
+	size_t csvlen;
+	size_t csvcap;
+	unsigned long long master_id;
+	unsigned long release_id;
+	unsigned long rel_id;
+	long long offset;         // of the release in infile
+	char role[ROLE_TEXT_MAX]; // matchedrole
+	};
+
+struct zerocopyrange
+	{
+	long long offset;         // in infile
+	size_t len;
+	int addnewline;           // after it, as infile doesn't have it next
+	};
+
+struct traceevent
+	{
+	double start;             // ns from the start of the trace
+	double len;               // ns
+	long long arg;            // trace_arg_names[type]
+	int type;                 // TRACE_
+	};
+
+struct tracering
+	{
+	struct traceevent *events; // trace_events of them
+	unsigned long long count;  // ever added, count&(trace_events-1) is next
+	double open[TRACE_TYPES];  // start of each event begun, 0 if none
+	unsigned int tid;
+	};
+
+struct compressframe
+	{
+	int state;                // POOL_
+	unsigned char *in;        // COMPRESS_FRAME_BYTES
+	size_t inlen;
+	unsigned char *out;
+	size_t outlen;
+	size_t outcap;
+	struct compressstream *cs;
+	};
+
+struct compressstream
+	{
+	const char *name;
+	FILE *file;                  // the compressed file
+	int readfd;                  // the pipe the program writes into
+	poolthread_t thread;         // reading it
+	struct compressframe *frames; // compressthreads+2 of them
+	unsigned long long filled;   // frames queued
+	unsigned long long written;  // frames written to file
+	unsigned long long inbytes;
+	unsigned long long outbytes;
+	};
+
+struct frameentry
+	{
+	long long offset;         // of the frame in framefile
+	long long dumpoffset;     // of its first byte in the dump
+	unsigned int size;        // compressed
+	unsigned int dumpsize;    // decompressed
+	unsigned int firstid;     // lowest release id in it
+	unsigned int lastid;      // highest
+	unsigned int releases;
+	unsigned int spare;
+	};
+
+struct frametrailer
+	{
+	unsigned int frames;      // frameentry before it
+	unsigned int version;
+	char magic[8];            // FRAME_INDEX_MAGIC, the last bytes of framefile
+	};
+
+struct framejob
+	{
+	int state;                // POOL_
+	struct frameentry *entry;
+	unsigned char *in;
+	size_t incap;
+	unsigned char *out;       // entry->dumpsize, and a NUL
+	size_t outcap;
+	int failed;
+	};
+
+struct recordtype
+	{
+	const char *name;         // for --dump
+	const char *start;        // of a record
+	const char *end;          // with the newline after it if the tag nests
+	const char *match;        // format of the text a record is matched on, from the artist id.  NULL for none
+	int anchored;             // match only starts the record, not anywhere in it
+	};
+
+struct dumpscan
+	{
+	const struct recordtype *type;
+	char *infilename;
+	char *outfilename;
+	char *text;               // --dump-text, or made from type->match
+	int anchored;             // text is type->match's, and starts the record
+	FILE *in;
+	FILE *out;
+	unsigned char *buf;       // a read, after what was left of the one before
+	size_t cap;
+	int stream;               // of the I/O scheduler
+	unsigned long records;
+	unsigned long matched;
+	int failed;
+	poolthread_t thread;
+	};
+
+struct iostream
+	{
+	const char *name;
+	unsigned long long served; // bytes read
+	unsigned long reads;
+	double waited;            // ns for a turn
+	int waiting;
+	};
+
+struct samplepoint
+	{
+	unsigned long releases;   // read
+	unsigned long matched;
+	long long first;          // offset of the first, -1 if none
+	long long last;           // end of the last
+	long long next;           // start of the release after them, the end of the sample
+	};
+
+struct cacheentry
+	{
+	char name[17];            // hash of the key, hex
+	unsigned long long bytes; // of its outputs
+	unsigned long long used;  // time() of the last hit or store
+	};
+
+struct indexsegment
+	{
+	FILE *fp;
+	unsigned int trigram;     // of the list at the head
+	unsigned int count;
+	unsigned int last;
+	unsigned int bytes;
+	int done;
+	};
+
+/*------------------------------------------------------------*/
+
 
 /*--- proto --------------------------------------------------*/
 
@@ -169,10 +1309,271 @@ void execute(void);
 void terminate(void);
 
 void process_input_file();
+void write_release(unsigned char *startptr, long long startoffset, size_t len);
 void process_xml(unsigned char *foundstartptr,size_t searchresultlen);
+void process_xml_reset(void);
+void process_xml_labels(unsigned char *ptr, size_t n);
+void process_xml_formats(unsigned char *ptr, size_t n);
 
 void *memmem(unsigned char *haystack, size_t hlen, unsigned char *needle, size_t nlen);
 
+int parse_options(int argc, char *argv[]);
+void write_csv_row(void);
+void write_csv_field(struct xmlspan *span);
+void rowprintf(const char *format, ...);
+
+int shard_load_artists(char *filename);
+struct shard *shard_lookup(unsigned long artist_id);
+unsigned char *shard_match_release(unsigned char *startptr, size_t len);
+void shard_write_release(unsigned char *startptr, size_t len);
+void shard_append(struct shardfile *sf, unsigned char *data, size_t len);
+void shard_grow(struct shardfile *sf, size_t needed);
+void shard_reclaim(struct shardfile *exclude);
+void shard_flush(struct shardfile *sf);
+void shard_write(struct shardfile *sf, unsigned char *data, size_t len);
+FILE *shard_open(struct shardfile *sf);
+void shard_closeall(void);
+
+void sort_add_row(void);
+int sort_compare(const void *a, const void *b);
+int sort_compare_runs(struct sortrun *a, struct sortrun *b);
+void sort_write_run(void);
+void sort_merge(unsigned int *runs, unsigned int count, FILE *out, int final);
+int sort_read_record(struct sortrun *run);
+void sort_finish(void);
+
+int aggregate_parse_fields(char *list);
+unsigned int aggregate_value_count(int field);
+unsigned char *aggregate_value(int field, unsigned int index, size_t *len);
+int aggregate_repeated_value(int field, unsigned int index);
+void aggregate_release(void);
+void aggregate_add(unsigned char *key, unsigned int keylen);
+void aggregate_grow(void);
+int aggregate_compare(const void *a, const void *b);
+void aggregate_write_key(FILE *fp, struct aggregate_entry *e);
+void aggregate_finish(void);
+
+void merge_outputs(int argc, char *argv[]);
+int merge_check_part(char **name, char *columns);
+void merge_abandon(void);
+int merge_copy_header(FILE *in, FILE *out, const char *lastline, int extralines);
+int merge_find_footer(FILE *in, long long *footerpos, unsigned long *processed, unsigned long *matched, unsigned long *errors);
+void merge_copy_range(FILE *in, FILE *out, long long from, long long to);
+
+void metrics_start(void);
+void metrics_check(unsigned long releaseid);
+void metrics_write(int final);
+
+void xmlstream_init(struct xmlstream *xs, long long offset);
+int xmlstream_lookup(unsigned char *name);
+int xmlstream_parent(struct xmlstream *xs, unsigned int up);
+void xmlstream_open_tag(struct xmlstream *xs);
+void xmlstream_close_tag(struct xmlstream *xs);
+size_t xmlstream_feed(struct xmlstream *xs, unsigned char *data, size_t len);
+void stream_input_file(void);
+long long stream_resync(long long offset);
+void stream_start_element(struct xmlstream *xs);
+void stream_capture(struct xmlstream *xs, struct streamfield *sf);
+void stream_attribute(struct xmlstream *xs);
+void stream_text(struct xmlstream *xs, unsigned char *data, size_t len);
+void stream_end_element(struct xmlstream *xs);
+void stream_set_field(struct xmlstream *xs, struct streamfield *sf, struct streamfield *want, struct xmlspan *span);
+void stream_end_release(struct xmlstream *xs);
+size_t stream_copy_release(long long startoffset, size_t len);
+
+int role_parse_filter(char *list);
+int role_accept(int where, unsigned char *role, size_t rolelen);
+int role_compare(unsigned char *a, unsigned char *b, size_t n);
+unsigned char *role_last(unsigned char *startptr, unsigned char *endptr, char *tag);
+unsigned char *role_match_release(unsigned char *startptr, size_t len);
+
+#ifdef __linux__
+long perf_open(int counter, int groupfd, int kernel);
+#endif
+void perf_start(void);
+int perf_read(unsigned long long *values);
+void perf_stage(int stage);
+void perf_report(void);
+
+unsigned char *validate_scan(unsigned char *p, unsigned char *end, unsigned char c1, unsigned char c2);
+void validate_damage(long long offset, const char *format, ...);
+void validate_pop(unsigned int depth);
+void validate_start_tag(unsigned char *name, size_t namelen, unsigned char *tag, size_t taglen, long long offset, int empty);
+void validate_end_tag(unsigned char *name, size_t namelen, long long offset, long long endoffset);
+size_t validate_buffer(unsigned char *buf, size_t len, long long bufoffset, int eof);
+void validate_file(int argc, char *argv[]);
+
+int text_add_phrase(char *phrase);
+int text_parse_fields(char *list);
+#if VALIDATE_SSE2
+__m128i text_fold16(__m128i x);
+#endif
+int text_equal(unsigned char *p, unsigned char *lowered, size_t n);
+unsigned char *text_find(unsigned char *hay, size_t haylen, unsigned char *phrase, size_t n);
+int text_match_span(unsigned char *ptr, size_t len);
+unsigned char *text_match_release(unsigned char *startptr, size_t len);
+int text_match_fields(void);
+
+int index_read_at(FILE *fp, void *buf, size_t len, long long offset);
+int index_fingerprint(FILE *fp, long long *size, unsigned long long *hash);
+unsigned int index_put_varint(unsigned char *p, unsigned int v);
+unsigned int index_get_varint(unsigned char **p, unsigned char *end);
+void index_grow(void);
+void index_add_posting(unsigned int trigram, unsigned int ordinal);
+void index_add_text(unsigned char *p, size_t len, unsigned int ordinal);
+void index_add_release(struct xmlstream *xs);
+int index_compare_postings(const void *a, const void *b);
+void index_write_segment(void);
+int index_read_segment(struct indexsegment *seg);
+void index_merge_segments(long long offset);
+void index_build(int argc, char *argv[]);
+int index_open(void);
+struct indexentry *index_lookup(unsigned int trigram);
+unsigned int *index_postings(struct indexentry *e);
+int index_compare_entries(const void *a, const void *b);
+unsigned int index_phrase(unsigned int phrase, unsigned int **result);
+int index_compare_ordinals(const void *a, const void *b);
+void index_query_file(void);
+
+void store_span(unsigned char *xml, size_t len, const char *start, const char *end, struct storefield *sf);
+void store_add_release(unsigned char *xml, size_t len, long long offset);
+void store_build(int argc, char *argv[]);
+unsigned char *store_map(FILE *fp, long long *size);
+void store_unmap(unsigned char *base, long long size);
+void store_set_field(struct xmlspan *span, unsigned char *xml, struct storefield *sf);
+void store_extract(struct storerecord *rec, unsigned char *xml);
+int store_match(struct storerecord *rec, unsigned char *xml);
+void store_input_file(void);
+
+#ifdef _WIN32
+DWORD WINAPI pool_worker(LPVOID arg);
+#else
+void *pool_worker(void *arg);
+#endif
+int pool_reserve(unsigned char **buf, size_t *cap, size_t len);
+void pool_start(void);
+int pool_write_next(int wait);
+void pool_submit(unsigned char *startptr, size_t len);
+void pool_finish(void);
+
+void follow_start(void);
+void follow_stop(void);
+int follow_finished(void);
+void follow_wait(void);
+size_t follow_read(unsigned char *buffer);
+
+double bench_now(void);
+size_t bench_release(unsigned char *out, unsigned long id, unsigned int labels, unsigned int formats, int match);
+size_t bench_releases(unsigned char *out, unsigned int percent);
+unsigned long long bench_kernel(int kernel, unsigned char *buf, size_t len, const char *needle, unsigned int count);
+int bench_compare(const void *a, const void *b);
+void bench_measure(const char *name, int kernel, unsigned char *buf, size_t len, const char *needle, unsigned int count, double bytes, double records);
+void bench_run(void);
+
+int schema_parse_columns(char *list);
+char *schema_read_file(char *filename);
+int schema_compile(void);
+void process_xml_lists(unsigned char *xml, size_t len);
+void schema_find_span(unsigned char *xml, size_t len, const char *start, const char *end, struct xmlspan *span);
+void schema_write_span(struct xmlspan *span);
+void schema_write_list(struct xmlspan *span, const char *start, const char *end);
+unsigned char *schema_attribute(unsigned char *p, unsigned char *stop, const char *name, size_t *len);
+void schema_write_identifiers(struct xmlspan *span);
+void schema_write_row(void);
+
+void json_init(void);
+void json_put(const char *p, size_t n);
+void json_char(unsigned int c);
+void json_codepoint(unsigned long cp);
+size_t json_entity(unsigned char *p, unsigned char *stop, unsigned long *cp);
+void json_string(unsigned char *p, size_t n);
+void json_number(unsigned long long v);
+void json_span(const char *key, struct xmlspan *span);
+void json_list(const char *key, struct xmlspan *span, const char *start, const char *end);
+void json_attribute(const char *key, unsigned char *p, unsigned char *stop, const char *name, int number);
+void json_labels(void);
+void json_formats(void);
+void json_write_row(void);
+size_t json_utf8(unsigned long cp, unsigned char *buf);
+
+void frames_build(int argc, char *argv[]);
+void frames_input_file(void);
+#if HAVE_ZSTD
+size_t frames_read(void *in, unsigned char *buf, size_t len);
+int frames_write(FILE *fp, unsigned char *buf, size_t len, struct frameentry *entry, void *cctx, unsigned char **out, size_t *outcap);
+int frames_open(void);
+#ifdef _WIN32
+DWORD WINAPI frames_worker(LPVOID arg);
+#else
+void *frames_worker(void *arg);
+#endif
+void frames_search(struct framejob *job);
+#endif
+
+void dump_start(void);
+#ifdef _WIN32
+DWORD WINAPI dump_scan(LPVOID arg);
+#else
+void *dump_scan(void *arg);
+#endif
+void dump_finish(void);
+void iosched_begin(int stream);
+void iosched_end(int stream, unsigned long long bytes);
+
+void sample_input_file(void);
+void sample_release(struct samplepoint *sp, unsigned char *start, long long offset, size_t len);
+void sample_report(struct samplepoint *points, double span);
+
+void db_start(void);
+void db_add_release(void);
+void db_finish(void);
+#if HAVE_SQLITE
+int db_exec(const char *sql);
+void db_fail(const char *what);
+size_t db_unescape(unsigned char *out, unsigned char *p, size_t n);
+void db_text(sqlite3_stmt *stmt, int col, unsigned char *p, size_t n);
+void db_span(sqlite3_stmt *stmt, int col, struct xmlspan *span);
+void db_attribute(sqlite3_stmt *stmt, int col, unsigned char *p, unsigned char *stop, const char *name, int number);
+int db_step(sqlite3_stmt *stmt);
+void db_labels(void);
+void db_formats(void);
+#endif
+
+int cache_fingerprint(char *filename, FILE *fp, unsigned long long *size, unsigned long long *mtime, unsigned int *hash);
+int cache_make_key(void);
+int cache_copy(char *from, char *to);
+void cache_path(char *path, const char *name, const char *ext);
+unsigned int cache_read_index(void);
+void cache_write_index(unsigned int count);
+void cache_touch(unsigned long long bytes);
+int cache_lookup(void);
+void cache_store(void);
+
+int zerocopy_add(long long offset, size_t len, int newlinenext);
+int zerocopy_range(int infd, int outfd, long long offset, size_t len);
+void zerocopy_flush(void);
+void zerocopy_finish(void);
+
+FILE *compress_open(FILE *fp, const char *name);
+void compress_start(void);
+#ifdef _WIN32
+DWORD WINAPI compress_worker(LPVOID arg);
+DWORD WINAPI compress_reader(LPVOID arg);
+#else
+void *compress_worker(void *arg);
+void *compress_reader(void *arg);
+#endif
+void compress_frame(struct compressframe *frame);
+int compress_wait_input(int fd);
+int compress_write_next(struct compressstream *cs, int wait);
+void compress_finish(void);
+
+void trace_start(void);
+void trace_thread(void);
+void trace_begin(int type);
+void trace_end(int type, long long arg);
+void trace_finish(void);
+
 /*------------------------------------------------------------*/
 
 
@@ -211,8 +1612,8 @@ int searchstringlen;
 int startstringlen;
 int endstringlen;
 
-int xmlstartstringlen;
-int xmlendstringlen;
+THREADLOCAL int xmlstartstringlen;
+THREADLOCAL int xmlendstringlen;
 
 unsigned long long fileposition;
 long int fileoffset;
@@ -232,10 +1633,10 @@ unsigned char searchbuffer[1000];
 unsigned char startsearchbuffer[1000];
 unsigned char endsearchbuffer[1000];
 
-unsigned char xmlfindstartbuffer[1000];
-unsigned char xmlfindendbuffer[1000];
+THREADLOCAL unsigned char xmlfindstartbuffer[1000];
+THREADLOCAL unsigned char xmlfindendbuffer[1000];
 
-unsigned char tempbuffer[BLOCKSIZE+2];
+THREADLOCAL unsigned char tempbuffer[BLOCKSIZE+2];
 
 unsigned char *foundstartptr;
 unsigned int foundstartptrvalid;
@@ -247,12 +1648,12 @@ unsigned char *foundendptr;
 unsigned int foundendptrvalid;
 unsigned int foundendptrvalid;
 unsigned char *foundsearchstringptr;
-unsigned char *foundxmlstringptr;
-unsigned char *foundxml2stringptr;
+THREADLOCAL unsigned char *foundxmlstringptr;
+THREADLOCAL unsigned char *foundxml2stringptr;
 
 unsigned long release_id;
 unsigned long looking_for_releaseid;
-unsigned long rel_id;
+THREADLOCAL unsigned long rel_id;
 
 size_t writesuccess;
 
@@ -263,7 +1664,7 @@ FILE *outfile;
 FILE *csvfile;
 FILE *debugfile;
 
-// mostly temporary variables
+// mostly temporary variables (per thread: the extraction state of process_xml())
 
 #define MAX_CATNO_COUNT	3
 #define MAX_CATNO_LEN	40
@@ -272,29 +1673,425 @@ FILE *debugfile;
 #define MAX_FORMAT_COUNT	20
 #define MAX_FORMAT_LEN	40
 
-unsigned char catno[MAX_CATNO_COUNT][MAX_CATNO_LEN];
-unsigned char labelname[MAX_CATNO_COUNT][MAX_LABELNAME_LEN];
+THREADLOCAL unsigned char catno[MAX_CATNO_COUNT][MAX_CATNO_LEN];
+THREADLOCAL unsigned char labelname[MAX_CATNO_COUNT][MAX_LABELNAME_LEN];
 unsigned char format[MAX_FORMAT_COUNT][MAX_FORMAT_LEN];
-unsigned int catno_count;
+THREADLOCAL unsigned int catno_count;
 unsigned int format_count;
-unsigned int nx;
-unsigned char *tptr;
-unsigned char *currentptr;
-unsigned char *labelnameptr;
-unsigned char *xptr;
+THREADLOCAL unsigned int nx;
+THREADLOCAL unsigned char *tptr;
+THREADLOCAL unsigned char *currentptr;
+THREADLOCAL unsigned char *labelnameptr;
+THREADLOCAL unsigned char *xptr;
 
-unsigned char format_name[100];
-unsigned char format_qty[100];
-unsigned char format_text[1000]; //what is this?
-unsigned int format_desc_count;
+THREADLOCAL unsigned char format_name[100];
+THREADLOCAL unsigned char format_qty[100];
+THREADLOCAL unsigned char format_text[1000]; //what is this?
+THREADLOCAL unsigned int format_desc_count;
+THREADLOCAL int labels_found;          // as xmlspan found
+THREADLOCAL int formats_found;
 
-unsigned char *qtyptr;  // formats qty=
+THREADLOCAL unsigned char *qtyptr;  // formats qty=
 
 #define MAX_DESCRIPTION_COUNT 50
 #define MAX_DESCRIPTION_LEN 50
-unsigned char description[MAX_DESCRIPTION_COUNT][MAX_DESCRIPTION_LEN];
+THREADLOCAL unsigned char description[MAX_DESCRIPTION_COUNT][MAX_DESCRIPTION_LEN];
 #define FORMAT_DESCRIPTION_SEPARATOR ", "
 
+// fields found by process_xml() in the current release (labels and formats are above)
+THREADLOCAL struct releasefields fields;
+
+THREADLOCAL unsigned char csvrow[CSVROW_SIZE];
+THREADLOCAL size_t csvrowlen;
+int csvrow_enabled;        // process_xml() formats csvrow
+
+// command line options
+char *sharddirname;
+char *artistsfilename;
+unsigned int shard_max_open;
+
+// sharded output
+int shard_mode;
+struct shard *shards;
+unsigned int shardcount;
+unsigned int *shardhash;   // open addressed, holds shard index+1, 0 is empty
+unsigned int shardhashmask;
+struct shard *shardmatch[MAX_SHARD_MATCHES];
+unsigned int shardmatchcount;
+unsigned char shardartisttag[]=SHARD_ARTIST_TAG;
+size_t shardartisttaglen;
+struct shardfile *shardlru_head;
+struct shardfile *shardlru_tail;
+unsigned int shardopencount;
+size_t shardbufferbytes;
+unsigned long shardopens;
+unsigned long shardevictions;
+unsigned long shardwrites;
+unsigned long long shardbyteswritten;
+
+// sorted csv output
+int sort_mode;
+size_t sort_memory;
+unsigned char *sortarena;
+size_t sortarenalen;
+size_t sortarenacap;
+struct sortentry *sortentries;
+size_t sortentrycount;
+size_t sortentrycap;
+unsigned int *sortruns;     // run file numbers waiting to be merged
+unsigned int sortruncount;
+unsigned int sortnextrun;
+unsigned long sortrowsin;
+unsigned long sortrowsout;
+unsigned long sortduplicates;
+unsigned long sortrunswritten;
+
+// aggregation
+int aggregate_mode;
+char *aggregatefieldlist;
+int aggregatefields[AGGREGATE_MAX_FIELDS];
+unsigned int aggregatefieldcount;
+const char *aggregate_field_names[]=
+	{
+	"country","year","released","format","label","catno","description","data_quality",NULL
+	};
+#define AGG_COUNTRY 0
+#define AGG_YEAR 1
+#define AGG_RELEASED 2
+#define AGG_FORMAT 3
+#define AGG_LABEL 4
+#define AGG_CATNO 5
+#define AGG_DESCRIPTION 6
+#define AGG_DATA_QUALITY 7
+struct aggregate_entry *aggregatetable;  // open addressed on hash
+unsigned int aggregatetablesize;
+unsigned int aggregatecount;
+unsigned long aggregatereleases;
+
+// byte range (--start-offset, --end-offset) and --merge
+unsigned long long start_offset;
+unsigned long long end_offset;     // 0 is to the end of the file
+long long blockfileposition;       // file offset of inputbuffer[0]
+int merge_mode;
+char *debugfileoption;
+
+// live metrics
+char *metricsfilename;
+unsigned int metrics_interval;
+long long scanposition;            // file offset the scan has got to
+long long scantotalbytes;          // bytes to be scanned, from start_offset
+unsigned long seekbackcount;
+unsigned long current_release_id;
+time_t metricsstarttime;
+time_t metricslasttime;
+unsigned long metricslastreleases;
+long long metricslastposition;
+double metricsreleaserate;
+double metricsbyterate;
+
+// streaming parser
+int stream_mode;
+struct xmlstream stream;
+const char *stream_element_names[]=
+	{
+	"","releases","release","title","released","country","notes","data_quality","master_id",
+	"labels","label","formats","format","descriptions","description","artist","id",
+	"artists","extraartists","role",NULL
+	};
+unsigned char streamartistid[32];  // the text of <id> to match, from SEARCH_STRING
+size_t streamartistidlen;
+int streamrelease;                 // inside a <release>
+int streammatched;
+long long streamreleasestart;      // file offset of its <release
+unsigned int streamformatcount;
+struct streamfield streamtitle;
+struct streamfield streamreleased;
+struct streamfield streamcountry;
+struct streamfield streamnotes;
+struct streamfield streamdataquality;
+struct streamfield streammasterid;
+struct streamfield streamtext;     // description or artist id
+struct streamfield *streamcapture; // being collected, NULL if none
+unsigned int streamcapturedepth;
+struct streamfield streamrole;     // of the current <artist>
+int streamartisthit;               // the current <artist> is SEARCH_STRING's, for --role
+int streamartistwhere;             // ROLE_ of the current <artist>
+FILE *streamcopyfile;              // infile again, to copy releases no longer in inputbuffer
+unsigned long streamcopies;
+
+// artist roles
+int role_mode;
+char *rolelist;
+char rolefilter[ROLE_MAX_FILTERS][ROLE_TEXT_MAX];
+unsigned int rolefiltercount;
+const char *role_names[]={"main","extra","track"};
+THREADLOCAL char matchedrole[ROLE_TEXT_MAX];   // for the csv line of the matched release
+
+// performance counters
+int perf_option;
+int perf_mode;                     // counters are running
+const char *perf_stage_names[]={"read","boundaries","match","extract","output"};
+const char *perf_counter_names[]={"cycles","instructions","branch misses","LLC misses"};
+#ifdef __linux__
+unsigned int perf_counter_types[]={PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE};
+unsigned long long perf_counter_configs[]=
+	{
+	PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,PERF_COUNT_HW_BRANCH_MISSES,PERF_COUNT_HW_CACHE_MISSES
+	};
+#endif
+int perfleader;                    // group leader fd
+int perfslot[PERF_COUNTERS];       // place in the group read, -1 if not open
+int perferrno[PERF_COUNTERS];
+unsigned int perfcount;
+int perfkernel;                    // kernel time counted too
+int perfcurrent;                   // stage being counted
+unsigned long long perflast[PERF_COUNTERS];
+unsigned long long perftotals[PERF_STAGES][PERF_COUNTERS];
+unsigned long long perfenabled;
+unsigned long long perfrunning;
+
+// validation
+int validate_mode;
+unsigned char validatestack[STREAM_MAX_DEPTH][STREAM_NAME_MAX];
+size_t validatestacklen[STREAM_MAX_DEPTH];
+unsigned int validatedepth;
+int validaterelease;               // inside a release
+unsigned long validatereleaseid;
+long long validatereleasestart;
+unsigned int validatereleasedepth;
+unsigned long validatetags;
+unsigned long validatereleases;
+unsigned long validatefirstid;
+unsigned long validatelastid;
+unsigned long validategaps;
+unsigned long validatemissing;
+unsigned long validatelargestgap;
+unsigned long validategapafter;
+unsigned long validateoutoforder;
+long long validatelargest;
+unsigned long validatelargestid;
+long long validatelargestoffset;
+unsigned long validatetoolarge;
+unsigned long validatedamage;
+
+// text search
+int text_mode;
+char *textfieldlist;
+unsigned int textfields;           // bit per TEXT_ field
+const char *text_field_names[]={"title","notes",NULL};
+const char *text_field_starts[]={TITLE_START,NOTES_START};
+const char *text_field_ends[]={TITLE_END,NOTES_END};
+unsigned char textphrase[TEXT_MAX_PHRASES][TEXT_PHRASE_MAX];  // lower case
+size_t textphraselen[TEXT_MAX_PHRASES];
+unsigned int textphrasecount;
+
+// trigram index
+int index_build_mode;
+int index_mode;                    // --index, a query
+char *indexfilename;
+size_t index_memory;
+FILE *indexfile;
+struct indexheader indexheader;
+struct indexposting *indextable;   // while building, open addressed on trigram
+unsigned int indextablesize;
+unsigned int indextrigrams;
+size_t indexbytes;                 // of the lists in indextable
+unsigned long long indexpostings;
+unsigned int indexreleases;
+unsigned int indexsegments;
+struct indexentry *indexdirectory; // while querying
+
+// binary release store
+int store_build_mode;
+int store_mode;                    // --store, infile is a store
+char *storefilename;
+FILE *storefile;
+struct storeheader storeheader;
+unsigned int *storeids;            // artist ids of the release being stored
+unsigned int storeidcap;
+unsigned int storeartistid;        // SEARCH_STRING's
+
+// extraction threads
+unsigned int poolthreads;          // --threads, 0 for none
+unsigned int poolslots;
+struct pooljob *pooljobs;          // ring, job n at n%poolslots
+poolthread_t *poolthreadids;
+poolmutex_t poolmutex;             // job states and the counts below
+poolmutex_t poolaggregatemutex;
+poolcond_t poolwork;               // a job was queued, or poolstop
+poolcond_t pooldone;               // a job is done
+unsigned long long poolqueued;     // jobs handed out so far
+unsigned long long pooltaken;      // by a worker
+unsigned long long poolwritten;    // written by the search thread
+int poolstop;
+
+// following a growing infile
+int follow_mode;
+char *followmarkername;            // --follow-marker
+int followfd;                      // inotify, -1 for none
+unsigned long followwaits;
+
+// microbenchmarks
+int bench_mode;
+unsigned int bench_repeats;
+unsigned long benchartistid;       // SEARCH_STRING's
+unsigned long long bench_sink;     // results, so the kernels are not optimized away
+
+// csv columns
+int schema_mode;                   // --columns or --schema given
+char *schemacolumnlist;
+char *schemafilename;
+int schemacolumns[SCHEMA_MAX_COLUMNS];
+unsigned int schemacount;
+unsigned int schemaneeds;          // SCHEMA_ bits, the extraction plan
+char *csvheader;                   // HEADER_LINE or the --columns names
+const char *schema_column_names[]=
+	{
+	"release_id","title","released","country","notes","data_quality",
+	"first_label&catno","first_label","first_catno","all_label&catno",
+	"format_name","format_qty","format_text","description","combined_description",
+	"master_id","genres","styles","identifiers",NULL
+	};
+const unsigned int schema_column_needs[]=
+	{
+	0,SCHEMA_TITLE,SCHEMA_RELEASED,SCHEMA_COUNTRY,SCHEMA_NOTES,SCHEMA_DATA_QUALITY,
+	SCHEMA_LABELS,SCHEMA_LABELS,SCHEMA_LABELS,SCHEMA_LABELS,
+	SCHEMA_FORMATS,SCHEMA_FORMATS,SCHEMA_FORMATS,SCHEMA_FORMATS,SCHEMA_FORMATS,
+	SCHEMA_MASTER_ID,SCHEMA_GENRES,SCHEMA_STYLES,SCHEMA_IDENTIFIERS
+	};
+const unsigned int schema_aggregate_needs[]=  // by AGG_ field
+	{
+	SCHEMA_COUNTRY,SCHEMA_RELEASED,SCHEMA_RELEASED,SCHEMA_FORMATS,SCHEMA_LABELS,SCHEMA_LABELS,SCHEMA_FORMATS,SCHEMA_DATA_QUALITY
+	};
+
+// result cache
+char *cachedirname;
+unsigned long long cache_size;     // bytes
+char cachekey[CACHE_KEY_MAX];      // of this run
+char cachename[17];
+int cachekeyvalid;                 // so the outputs are kept at the end
+struct cacheentry cacheentries[CACHE_MAX_ENTRIES];
+
+// zero-copy output
+int zerocopy_mode;
+struct zerocopyrange zerocopyranges[ZEROCOPY_RANGES];
+unsigned int zerocopycount;
+int zerocopy_method;               // ZEROCOPY_
+const char *zerocopy_method_names[]={"copy_file_range","sendfile","pread/write"};
+unsigned long zerocopyreleases;
+unsigned long long zerocopybytes;
+unsigned long zerocopyflushes;
+unsigned long zerocopysyscalls;
+
+// JSON Lines csvfile
+int json_mode;
+unsigned char jsonspecial[256];    // bytes json_string() can't copy as they are
+THREADLOCAL int jsonoverflow;      // csvrow is full
+
+// seekable zstd frames
+int frames_build_mode;
+char *framefilename;               // --build-frames
+size_t frame_bytes;
+int frames_mode;                   // infile is a framefile
+unsigned int framethreads;
+int releaseidrange;                // --release-ids
+unsigned long releaseidfirst;
+unsigned long releaseidlast;
+struct frameentry *frameentries;
+unsigned int framecount;
+struct framejob *framejobs;        // a ring, in frame order
+unsigned int frameslots;
+poolthread_t *framethreadids;
+unsigned long long framesqueued;
+unsigned long long framestaken;
+int framesstop;
+poolmutex_t framesmutex;
+poolcond_t frameswork;             // a frame was queued, or framesstop
+poolcond_t framesdone;             // a frame is decompressed
+
+// --dump scans and the I/O scheduler
+const struct recordtype recordtypes[]=
+	{
+	{"releases",SEARCH_START,SEARCH_END,SHARD_ARTIST_TAG "%lu</id>",0},
+	{"masters","<master id=","</master>",SHARD_ARTIST_TAG "%lu</id>",0},
+	{"artists","<artist>","</artist>","<artist><id>%lu</id>",1},  // its own id, not one in <members>
+	{"labels","<label>","</label>\n",NULL,0},  // <sublabels> has <label id=...>...</label>
+	};
+struct dumpscan dumps[DUMP_MAX];
+unsigned int dumpcount;
+struct iostream iostreams[IOSCHED_MAX_STREAMS];
+unsigned int iostreamcount;
+unsigned int io_readers;           // reads at once
+unsigned int ioactive;             // reading now
+poolmutex_t iomutex;
+poolcond_t ioturn;                 // a read is done, someone else may go
+
+// sampling
+int sample_mode;
+unsigned int sample_points;        // --sample k
+unsigned long sample_releases;     // at each
+unsigned long long sample_seed;
+unsigned long long samplebytes;    // of infile read
+double samplematched;              // estimated matched releases in the whole file
+
+// SQLite output
+char *dbfilename;
+int db_mode;                       // loading
+unsigned long db_batch;            // releases to a transaction
+#if HAVE_SQLITE
+sqlite3 *db;
+sqlite3_stmt *dbrelease;
+sqlite3_stmt *dblabel;
+sqlite3_stmt *dbformat;
+#endif
+unsigned long dbreleases;
+unsigned long dblabels;
+unsigned long dbformats;
+unsigned long dbinbatch;
+double dbstarttime;                // bench_now()
+unsigned char dbtext[CSVROW_SIZE]; // the text bound to a statement, without entities
+size_t dbtextlen;
+
+// compressed output
+int compress_mode;                 // COMPRESS_
+int compress_level;                // -1 for the library's default
+unsigned int compressthreads;
+const char *compress_names[]={"none","gzip","zstd"};
+const char *compress_extensions[]={"",".gz",".zst"};  // for the default debug file name
+poolthread_t *compressthreadids;
+struct compressstream compressstreams[COMPRESS_MAX_STREAMS];
+unsigned int compressstreamcount;
+struct compressframe *compressqueue[COMPRESS_QUEUE];  // frames to compress, in order
+unsigned long long compressqueued;
+unsigned long long compresstaken;
+int compressstop;
+poolmutex_t compressmutex;         // frame states, the queue and its counts
+poolcond_t compresswork;           // a frame was queued, or compressstop
+poolcond_t compressdone;           // a frame is compressed
+int compressfailed;
+#if HAVE_ZLIB
+THREADLOCAL z_stream compresszs;
+THREADLOCAL int compresszsready;
+#endif
+#if HAVE_ZSTD
+THREADLOCAL ZSTD_CCtx *compresscctx;
+#endif
+
+// timeline trace
+char *tracefilename;
+FILE *tracefile;
+int trace_mode;                    // events are being kept
+unsigned int trace_events;         // per thread, a power of 2
+double tracebase;                  // bench_now() at trace_start()
+struct tracering *tracerings[TRACE_THREADS];
+unsigned int tracethreads;
+poolmutex_t tracemutex;            // adding to tracerings
+THREADLOCAL struct tracering *tracering;  // this thread's, NULL if it has none
+THREADLOCAL int traceregistered;
+const char *trace_names[]={"block read","seek back","boundary search","extract","write","flush","extraction wait","follow wait"};
+const char *trace_categories[]={"io","io","search","extract","output","output","wait","wait"};
+const char *trace_arg_names[]={"offset","bytes","bytes","bytes","bytes","total bytes","job","offset"};
+
 /*------------------------------------------------------------*/
 
 
@@ -304,6 +2101,38 @@ char *argv[];
 {
 
 	initialize();
+	argc=parse_options(argc,argv);
+
+	if (merge_mode)
+		{
+		merge_outputs(argc,argv);
+		exit(errorcode);
+		}
+	if (validate_mode)
+		{
+		validate_file(argc,argv);
+		exit(errorcode);
+		}
+	if (index_build_mode)
+		{
+		index_build(argc,argv);
+		exit(errorcode);
+		}
+	if (store_build_mode)
+		{
+		store_build(argc,argv);
+		exit(errorcode);
+		}
+	if (frames_build_mode)
+		{
+		frames_build(argc,argv);
+		exit(errorcode);
+		}
+	if (bench_mode)
+		{
+		bench_run();
+		exit(errorcode);
+		}
 
 
 	switch (argc)
@@ -313,7 +2142,11 @@ char *argv[];
 			strcpy(infilename,argv[1]);
 			strcpy(outfilename,argv[2]);
 			strcpy(csvfilename,argv[3]);
-			strcpy(debugfilename,DEBUGFILENAME);
+			strcpy((char *)debugfilename,debugfileoption!=NULL ? debugfileoption : DEBUGFILENAME);
+			if (debugfileoption==NULL)
+				{
+				strcat((char *)debugfilename,compress_extensions[compress_mode]);
+				}
 
 //			printf("infilename=%s\n",infilename);
 			infile=fopen(infilename,"rb");
@@ -323,6 +2156,11 @@ char *argv[];
 				errorcode=1;
 				break;
 				}
+			if (cachedirname!=NULL && cache_lookup())
+				{
+				fclose(infile);
+				break;
+				}
 #if WRITE_DEBUG_FILE
 			printf("debug output directed to %s\n",debugfilename);
 #endif
@@ -347,10 +2185,13 @@ char *argv[];
 				fclose(infile);
 				break;
 				}
+			if (compress_mode)
+				{
+				outfile=compress_open(outfile,(char *)outfilename);
+				csvfile=compress_open(csvfile,(char *)csvfilename);
+				}
 			fprintf(outfile,"\n");
 			fprintf(outfile,"%s\n", VERSION);
-			fprintf(csvfile,"\n");
-			fprintf(csvfile,"%s\n", VERSION);
 			printf("Using input file %s\n", infilename);
 			printf("Search string: \"%s\"\n", SEARCH_STRING);
 			printf("Searching between \"%s\" and \"%s\"\n", SEARCH_START, SEARCH_END);
@@ -359,11 +2200,23 @@ char *argv[];
 			fprintf(outfile,"Searching between \"%s\" and \"%s\"\n", SEARCH_START, SEARCH_END);
 			fprintf(outfile,"\n\n");
 
-			fprintf(csvfile,"Using input file %s\n", infilename);
-			fprintf(csvfile,"Search string: \"%s\"\n", SEARCH_STRING);
-			fprintf(csvfile,"Searching between \"%s\" and \"%s\"\n", SEARCH_START, SEARCH_END);
-			fprintf(csvfile,"\n\n");
-			fprintf(csvfile,HEADER_LINE);
+			if (!json_mode)  // JSON Lines has nothing but the objects
+				{
+				fprintf(csvfile,"\n");
+				fprintf(csvfile,"%s\n", VERSION);
+				fprintf(csvfile,"Using input file %s\n", infilename);
+				fprintf(csvfile,"Search string: \"%s\"\n", SEARCH_STRING);
+				fprintf(csvfile,"Searching between \"%s\" and \"%s\"\n", SEARCH_START, SEARCH_END);
+				fprintf(csvfile,"\n\n");
+				if (role_mode)
+					{
+					fprintf(csvfile,"%.*s%s\n",(int)strlen(csvheader)-1,csvheader,ROLE_HEADER);
+					}
+				else if (!aggregate_mode)
+					{
+					fprintf(csvfile,"%s",csvheader);
+					}
+				}
 
 #if WRITE_DEBUG_FILE
 			debugfile = fopen(debugfilename, "wb");
@@ -376,12 +2229,54 @@ char *argv[];
 				fclose(csvfile);
 				break;
 				}
+			if (compress_mode)
+				{
+				debugfile=compress_open(debugfile,(char *)debugfilename);
+				}
 			fprintf(debugfile,"\n");
 			fprintf(debugfile,"%s\n\n", VERSION);
 			fprintf(debugfile,"Using input file %s\n", infilename);
 			fprintf(debugfile,"Debug output of found releases and errors:\n\n");
 #endif
 
+			if (text_mode)
+				{
+				printf("Searching %s for",textfieldlist);
+				fprintf(outfile,"Searching %s for",textfieldlist);
+				if (!json_mode)
+					fprintf(csvfile,"Searching %s for",textfieldlist);
+				for (i=0;i<textphrasecount;i++)
+					{
+					printf(" \"%s\"",textphrase[i]);
+					fprintf(outfile," \"%s\"",textphrase[i]);
+					if (!json_mode)
+						fprintf(csvfile," \"%s\"",textphrase[i]);
+					}
+				printf(" instead of the artist\n");
+				fprintf(outfile," instead of the artist\n\n");
+				if (!json_mode)
+					fprintf(csvfile," instead of the artist\n\n");
+				}
+			if (aggregate_mode)
+				{
+				printf("Aggregating by %s\n",aggregatefieldlist);
+				fprintf(outfile,"Aggregating by %s\n\n",aggregatefieldlist);
+				fprintf(csvfile,"Aggregating by %s\n\n",aggregatefieldlist);
+				}
+			if (shard_mode)
+				{
+				if (shard_load_artists(artistsfilename)<=0)
+					{
+					printf("artists file %s failed or lists no artists!\n",artistsfilename);
+					errorcode=6;
+					closefiles();
+					break;
+					}
+				printf("Sharding %u artists from %s into %s\n",shardcount,artistsfilename,sharddirname);
+				fprintf(outfile,"Sharding %u artists from %s into %s\n\n",shardcount,artistsfilename,sharddirname);
+				fprintf(csvfile,"Sharding %u artists from %s into %s\n\n",shardcount,artistsfilename,sharddirname);
+				}
+
 			execute();
 			break;
 
@@ -400,11 +2295,103 @@ char *argv[];
 void syntax(void)
 {
 	printf("%s\n",VERSION);
-	printf("syntax:  DISCOGS infile outfile csvfile\n\n");
+	printf("syntax:  DISCOGS [options] infile outfile csvfile\n\n");
 	printf("   infile  = XML dump of discogs.com release database to be searched for artist\n");
 	printf("   outfile = output file for storing xml search results.\n");
 	printf("   csvfile = output file for storing csv data.\n");
 	printf("\n");
+	printf("options:\n");
+	printf("   --shard-dir dir       write one dir/<artist id>.xml and .csv per artist instead\n");
+	printf("                         of outfile and csvfile (which then only get the run summary)\n");
+	printf("   --artists file        artist ids to shard by, one per line (needs --shard-dir)\n");
+	printf("   --shard-max-open n    shard files kept open at once (default %u)\n",SHARD_MAX_OPEN_FILES);
+	printf("   --sort                write csvfile sorted by master_id then release_id,\n");
+	printf("                         without duplicate releases\n");
+	printf("   --sort-memory mb      memory for --sort before runs go to disk (default %u)\n",SORT_MEMORY_BUDGET);
+	printf("   --aggregate f1,f2..   only count matched releases grouped by the fields:\n");
+	printf("                         country year released format label catno description\n");
+	printf("                         data_quality.  The table goes to csvfile.\n");
+	printf("   --start-offset n      only releases starting at or after byte n of infile\n");
+	printf("   --end-offset n        only releases starting before byte n of infile\n");
+	printf("   --debug-file name     debug output file (default %s)\n",DEBUGFILENAME);
+	printf("   --metrics-file name   keep Prometheus text format progress metrics in name\n");
+	printf("   --metrics-interval s  seconds between --metrics-file updates (default %u)\n",METRICS_INTERVAL);
+	printf("   --role r1,r2..        only releases crediting the artist as one of: main,\n");
+	printf("                         extra, track, or a <role> value such as Remix.\n");
+	printf("                         Adds a matched_role column to csvfile\n");
+	printf("   --text phrase         match releases with phrase (any case) in their\n");
+	printf("                         --text-fields instead of the artist.  Repeatable\n");
+	printf("   --text-fields f1,f2   title, notes (default %s)\n",TEXT_DEFAULT_FIELDS);
+	printf("   --index file          with --text, only read the releases the --build-index\n");
+	printf("                         file gives\n");
+	printf("   --store               infile is a --build-store file\n");
+	printf("   --zero-copy           copy matched releases from infile to outfile in the\n");
+	printf("                         kernel (copy_file_range, Linux)\n");
+	printf("   --frames              infile is a --build-frames file, its frames\n");
+	printf("                         decompressed in parallel\n");
+	printf("   --frame-threads n     threads decompressing (default %u)\n",FRAME_THREADS);
+	printf("   --release-ids a-b     with --frames, only the frames and releases of ids a to b\n");
+	printf("   --dump type in out    also scan in, a masters, artists or labels dump, at\n");
+	printf("                         the same time, writing its matched records to out\n");
+	printf("   --dump-text text      what the records of that --dump are matched on\n");
+	printf("   --io-readers n        reads of infile and the --dump files at once\n");
+	printf("                         (default %u)\n",IOSCHED_READERS);
+	printf("   --sample k            estimate the counts of the whole file, with intervals,\n");
+	printf("                         from releases read at k random offsets\n");
+	printf("   --sample-releases n   releases read at each (default %u)\n",SAMPLE_RELEASES);
+	printf("   --sample-seed s       for the same offsets as another run\n");
+	printf("   --sqlite dbfile       also load matched releases, labels and formats into\n");
+	printf("                         the SQLite database dbfile\n");
+	printf("   --sqlite-batch n      releases to a transaction (default %u)\n",DB_BATCH);
+	printf("   --json                write csvfile as JSON Lines, an object per release\n");
+	printf("                         with arrays of its labels, formats and descriptions\n");
+	printf("   --compress gzip|zstd  write outfile, csvfile and the debug file compressed,\n");
+	printf("                         in %uKB frames, on background threads\n",COMPRESS_FRAME_BYTES/1024);
+	printf("   --compress-level n    gzip 1-9, zstd 1-19 (default the library's)\n");
+	printf("   --compress-threads n  threads compressing (default %u)\n",COMPRESS_THREADS);
+	printf("   --trace file          write a Chrome trace event timeline of the run to file\n");
+	printf("   --trace-events n      events kept per thread, the oldest overwritten\n");
+	printf("                         (default %u)\n",TRACE_EVENTS);
+	printf("   --cache-dir dir       keep the outputs in dir, and copy them from there when\n");
+	printf("                         the same search of the same infile is run again\n");
+	printf("   --cache-size mb       cached outputs kept, least recently used go (default %u)\n",CACHE_SIZE);
+	printf("   --columns c1,c2..     csvfile columns, in order, from those of the header and\n");
+	printf("                         master_id genres styles identifiers.  Only these\n");
+	printf("                         fields are looked for\n");
+	printf("   --schema file         --columns from file, one per line\n");
+	printf("   --follow              infile is still being written: wait for more at its\n");
+	printf("                         end until it ends with %s\n",FOLLOW_END_TAG);
+	printf("   --follow-marker file  also finish --follow once file exists\n");
+	printf("   --threads n           extract and format matched releases on n threads\n");
+	printf("                         (up to %u), output still in dump order\n",POOL_MAX_THREADS);
+	printf("   --perf-counters       report cpu counters by stage of the search (Linux)\n");
+	printf("   --stream              parse infile in one pass with the streaming parser,\n");
+	printf("                         no release size limit\n");
+	printf("\n");
+	printf("syntax:  DISCOGS --merge outfile csvfile part.xml part.csv part.debug...\n\n");
+	printf("   joins the outputs of --start-offset/--end-offset runs, given in offset order,\n");
+	printf("   as if the whole file had been searched at once.  Debug output goes to\n");
+	printf("   the --debug-file.\n");
+	printf("\n");
+	printf("syntax:  DISCOGS --validate infile\n\n");
+	printf("   checks infile for damage (tags that don't nest, unclosed releases, NULs,\n");
+	printf("   truncation) and reports release id gaps and the largest release.\n");
+	printf("\n");
+	printf("syntax:  DISCOGS --build-index indexfile [--index-memory mb] infile\n\n");
+	printf("   writes a trigram index of the titles and notes in infile for --index,\n");
+	printf("   building it in mb megabytes at a time (default %u).\n",INDEX_MEMORY_BUDGET);
+	printf("\n");
+	printf("syntax:  DISCOGS --build-store storefile infile\n\n");
+	printf("   writes the releases of infile with the places of their fields, for --store.\n");
+	printf("\n");
+	printf("syntax:  DISCOGS --build-frames framefile [--frame-bytes kb] infile\n\n");
+	printf("   writes infile as zstd frames of whole releases, about kb KB each (default\n");
+	printf("   %u), with an index of them, for --frames.\n",FRAME_BYTES);
+	printf("\n");
+	printf("syntax:  DISCOGS --bench [--bench-repeats n]\n\n");
+	printf("   times the search, resync, extraction and csv kernels on synthetic releases\n");
+	printf("   (median of n runs, default %u).\n",BENCH_REPEATS);
+	printf("\n");
 	printf("Compiled to search for:\n");
 	printf("   \"%s\"\n", SEARCH_STRING);
 	printf("   between: \"%s\"\n", SEARCH_START);
@@ -419,8 +2406,43 @@ void syntax(void)
 
 void execute(void)
 {
-	process_input_file();
+	if (tracefilename!=NULL)
+		{
+		trace_start();
+		}
+	if (dbfilename!=NULL)
+		{
+		db_start();
+		}
+	if (dumpcount)
+		{
+		dump_start();
+		}
+	if (store_mode)
+		store_input_file();
+	else if (index_mode)
+		index_query_file();
+	else if (sample_mode)
+		sample_input_file();
+	else if (frames_mode)
+		frames_input_file();
+	else if (stream_mode)
+		stream_input_file();
+	else
+		process_input_file();
+	if (dumpcount)
+		{
+		dump_finish();
+		}
 	closefiles();
+	if (cachekeyvalid)
+		{
+		if (csvfile!=NULL)
+			{
+			fclose(csvfile);  // closefiles() leaves it to exit()
+			}
+		cache_store();
+		}
 	terminate();
 }
 void process_input_file()
@@ -430,10 +2452,40 @@ void process_input_file()
 	fprintf(outfile,"Searching input file	%s: \n\n",infilename);
 
 	begin_time=clock();
+	if (poolthreads)
+		{
+		pool_start();
+		}
+	if (follow_mode)
+		{
+		follow_start();
+		}
+	if (metricsfilename!=NULL)
+		{
+		metrics_start();
+		}
+	if (perf_option)
+		{
+		perf_start();
+		}
 	readblockcount=1;
 	fileposition=0; // this is how far into the input file that data has been searched xyzzy not needed???
 // is a previous copy of it needed??
 
+	if (start_offset || end_offset)
+		{
+		printf("Searching releases starting from byte %llu to ",start_offset);
+		if (end_offset)
+			printf("%llu\n",end_offset);
+		else
+			printf("the end\n");
+		if (fseek64(infile,(long long)start_offset,SEEK_SET))
+			{
+			printf("Error: can't seek to --start-offset %llu\n",start_offset);
+			errorcount++;
+			}
+		}
+
 	currentfileposition=ftell(infile);
 #if DEBUG_SEARCH_RESULTS
 	printf("Prior to read file loop, file position=%li\n",currentfileposition);
@@ -447,7 +2499,19 @@ void process_input_file()
 		beginbuffersearchat=inputbuffer;
 		remainingbufferlen=BLOCKSIZE;
 
-		readresult=fread(&inputbuffer, BLOCKSIZE, 1, infile);
+		perfstage(PERF_READ);
+		tracebegin(TRACE_READ);
+		blockfileposition=ftell64(infile);
+		if (dumpcount)
+			iosched_begin(IOSCHED_SEARCH);
+		if (follow_mode)
+			readresult=follow_read(inputbuffer);
+		else
+			readresult=fread(&inputbuffer, BLOCKSIZE, 1, infile);
+		if (dumpcount)
+			iosched_end(IOSCHED_SEARCH,ftell64(infile)-blockfileposition);
+		traceend(TRACE_READ,blockfileposition);
+		perfstage(PERF_SEARCH);
 #if DEBUG_SEARCH_RESULTS
 		printf("fread returned %zu blocks read from fileposition=%llu\n",readresult,fileposition);
 #endif
@@ -489,9 +2553,19 @@ while (!done)
 //	foundendsearchposition=0;
 	foundstartptrvalid=0;
 	foundendptrvalid=0;
+	tracebegin(TRACE_BOUNDARY);
 	foundstartptr=memmem(beginbuffersearchat, remainingbufferlen, startsearchbuffer, startstringlen);
 
-	if (foundstartptr!=NULL)
+	if (foundstartptr!=NULL && end_offset && blockfileposition+(foundstartptr-inputbuffer)>=(long long)end_offset)
+		{
+		// the rest belongs to the next byte range
+		printf("End offset %llu reached\n",end_offset);
+		foundstartptr=NULL;
+		eof_encountered=1;
+		readresult=0;
+		done=1;
+		}
+	else if (foundstartptr!=NULL)
 		{
 		foundstartptrvalid=1;
 
@@ -506,6 +2580,7 @@ while (!done)
 #endif
 		// now search for endstring
 		foundendptr=memmem(foundstartptr+startstringlen, remainingbufferlen, endsearchbuffer, endstringlen);
+		traceend(TRACE_BOUNDARY,foundendptr!=NULL ? foundendptr+endstringlen-foundstartptr : 0);
 		if (foundendptr!=NULL)
 			{
 			foundendptrvalid=1;
@@ -556,6 +2631,11 @@ if (remainingbufferlen>BLOCKSIZE)
 			printf("E LESP=%lu, remainingbuflen=%u  , set bbs-at to %lu",lastendsearchposition,remainingbufferlen,(unsigned long)beginbuffersearchat);
 #endif
 			releasecount++;
+			scanposition=blockfileposition+(beginbuffersearchat-inputbuffer);
+			if (metricsfilename!=NULL && 0==releasecount%METRICS_CHECK_RELEASES)
+				{
+				metrics_check(strtoul((char *)foundstartptr+startstringlen+1,NULL,10));
+				}
 #if DEBUG_PROGRESS
 			if (0==releasecount%100)
 				{
@@ -576,7 +2656,16 @@ if (remainingbufferlen>BLOCKSIZE)
 #if DEBUG_SEARCH_RESULTS
 			printf("Search result string is	%u characters long.\n",searchresultlen);
 #endif
-			foundsearchstringptr=memmem(foundstartptr, searchresultlen , searchbuffer, searchstringlen);
+			perfstage(PERF_MATCH);
+			if (shard_mode)
+				foundsearchstringptr=shard_match_release(foundstartptr,searchresultlen);
+			else if (role_mode)
+				foundsearchstringptr=role_match_release(foundstartptr,searchresultlen);
+			else if (text_mode)
+				foundsearchstringptr=text_match_release(foundstartptr,searchresultlen);
+			else
+				foundsearchstringptr=memmem(foundstartptr, searchresultlen , searchbuffer, searchstringlen);
+			perfstage(PERF_SEARCH);
 			if (foundsearchstringptr==NULL)
 				{
 #if DEBUG_SEARCH_RESULTS
@@ -610,26 +2699,20 @@ if (remainingbufferlen>BLOCKSIZE)
 #endif
 
 				// process XML into CSV data
-				process_xml(foundstartptr,searchresultlen);
-
-				// write the data to output file
-				writesuccess=fwrite(foundstartptr,searchresultlen,1,outfile);
-				fwrite(newline,1,1,outfile);
-				if (writesuccess==1)
+				if (poolthreads)
 					{
-#if DEBUG_SEARCH_RESULTS
-					printf("successfully wrote found record %u to outfile ******************\n",foundcount);
-//					exit(0);
-#endif
+					perfstage(PERF_OUTPUT);
+					pool_submit(foundstartptr,searchresultlen);
 					}
 				else
 					{
-					errorcount++;
-					printf("Error %u: failed to write found [r%u], record %u to outfile\n",errorcount,release_id,foundcount);
-#if WRITE_DEBUG_FILE
-					fprintf(debugfile,"Error %u: failed to write found [r%u], record %u to outfile\n",errorcount,release_id,foundcount);
-#endif
+					perfstage(PERF_EXTRACT);
+					csvrowlen=0;
+					process_xml(foundstartptr,searchresultlen);
+					perfstage(PERF_OUTPUT);
+					write_release(foundstartptr,blockfileposition+(foundstartptr-inputbuffer),searchresultlen);
 					}
+				perfstage(PERF_SEARCH);
 #if TEST_MODE
 if (foundcount>9)
 	{
@@ -674,7 +2757,10 @@ if (foundcount>9)
 					exit(5);
 					}
 #endif
+				tracebegin(TRACE_SEEKBACK);
 				result=fseek(infile,fileoffset,SEEK_CUR);
+				traceend(TRACE_SEEKBACK,-fileoffset);
+				seekbackcount++;
 #if DEBUG_SEARCH_RESULTS
 				if (result==0) printf(" - succeeded \n"); else printf(" - failed\n");
 #endif
@@ -696,6 +2782,7 @@ if (foundcount>9)
 		{
 		// didn't find the startstring.  offset file position pointer by -startstringlen (in case the start string spans the two blocks)
 		// If there is no startstring, one possibility is EOF is encountered and there is no more data
+		traceend(TRACE_BOUNDARY,0);
 #if DEBUG_SEARCH_RESULTS
 			printf("startstring not found\n");
 #endif
@@ -711,7 +2798,10 @@ if (foundcount>9)
 #if DEBUG_SEARCH_RESULTS
 			printf("startstring not found, setting file offset to %li\n",fileoffset);
 #endif
+			tracebegin(TRACE_SEEKBACK);
 			result=fseek(infile,fileoffset,SEEK_CUR);
+			traceend(TRACE_SEEKBACK,-fileoffset);
+			seekbackcount++;
 
 			currentfileposition=ftell(infile);
 #if DEBUG_SEARCH_RESULTS
@@ -729,6 +2819,21 @@ if (foundcount>9)
 
 	} while (readresult);
 
+	if (poolthreads)
+		{
+		perfstage(PERF_OUTPUT);
+		pool_finish();
+		}
+	if (follow_mode)
+		{
+		follow_stop();
+		}
+
+	if (metricsfilename!=NULL)
+		{
+		scanposition=(long long)start_offset+scantotalbytes;  // all of it
+		metrics_write(1);
+		}
 
 //xyzzy
 	end_time=clock();
@@ -752,6 +2857,64 @@ if (foundcount>9)
 } // end execute
 
 
+void write_release(unsigned char *startptr, long long startoffset, size_t len)
+{
+// write out a matched release, after process_xml() or the stream parser has
+// filled fields and csvrow.  startptr is the release xml, or NULL if it is no
+// longer in memory, to copy it from infile at startoffset instead.  startoffset
+// is where the release is in infile, for --zero-copy.
+	tracebegin(TRACE_WRITE);
+	if (aggregate_mode)
+		{
+		// only counted, nothing written per release
+		aggregate_release();
+		writesuccess=1;
+		}
+	else if (shard_mode)
+		{
+		// route to the files of every matched artist
+		shard_write_release(startptr,len);
+		writesuccess=1;
+		}
+	else
+		{
+		// write the data to output file
+		if (zerocopy_mode)
+			writesuccess=zerocopy_add(startoffset,len,startptr>=inputbuffer && startptr+len<inputbuffer+BLOCKSIZE && startptr[len]=='\n');
+		else
+			{
+			if (startptr!=NULL)
+				writesuccess=fwrite(startptr,len,1,outfile);
+			else
+				writesuccess=stream_copy_release(startoffset,len);
+			fwrite(newline,1,1,outfile);
+			}
+		if (sort_mode)
+			sort_add_row();
+		else
+			fwrite(csvrow,csvrowlen,1,csvfile);
+		if (db_mode)
+			db_add_release();
+		}
+	if (writesuccess==1)
+		{
+#if DEBUG_SEARCH_RESULTS
+		printf("successfully wrote found record %u to outfile ******************\n",foundcount);
+//		exit(0);
+#endif
+		}
+	else
+		{
+		errorcount++;
+		printf("Error %lu: failed to write found [r%lu], record %lu to outfile\n",errorcount,release_id,foundcount);
+#if WRITE_DEBUG_FILE
+		fprintf(debugfile,"Error %lu: failed to write found [r%lu], record %lu to outfile\n",errorcount,release_id,foundcount);
+#endif
+		}
+	traceend(TRACE_WRITE,len);
+}
+
+
 void terminate(void)
 {
 	exit(0);
@@ -789,22 +2952,80 @@ void initialize(void)
 	printf("endstringlen=%u\n",endstringlen);
 	strcpy(endsearchbuffer,SEARCH_END);
 
+	csvrowlen=0;
+	followfd=-1;
+	bench_repeats=BENCH_REPEATS;
+	trace_events=TRACE_EVENTS;
+	compress_level=-1;
+	db_batch=DB_BATCH;
+	sample_releases=SAMPLE_RELEASES;
+	io_readers=IOSCHED_READERS;
+	frame_bytes=(size_t)FRAME_BYTES*1024;
+	framethreads=FRAME_THREADS;
+	sample_seed=(unsigned long long)time(NULL);
+	compressthreads=COMPRESS_THREADS;
+	schemaneeds=SCHEMA_ALL_HEADER;
+	csvheader=HEADER_LINE;
+	cache_size=(unsigned long long)CACHE_SIZE*1048576;
+	shard_mode=0;
+	shard_max_open=SHARD_MAX_OPEN_FILES;
+	sort_mode=0;
+	sort_memory=(size_t)SORT_MEMORY_BUDGET*1048576;
+	aggregate_mode=0;
+	csvrow_enabled=1;
+	metrics_interval=METRICS_INTERVAL;
+	index_memory=(size_t)INDEX_MEMORY_BUDGET*1048576;
+	shardartisttaglen=strlen(SHARD_ARTIST_TAG);
+
 }
 
 void closefiles(void)
 {
+	perfstage(PERF_OUTPUT);  // the flushes and merges below
+	if (zerocopy_mode)
+		{
+		zerocopy_finish();  // before the summaries in outfile
+		}
+	tracebegin(TRACE_FLUSH);  // zerocopy_flush() has its own
+	if (shard_mode)
+		{
+		shard_closeall();
+		}
+	if (sort_mode)
+		{
+		sort_finish();
+		}
+	if (aggregate_mode)
+		{
+		aggregate_finish();
+		}
+	if (dbfilename!=NULL)
+		{
+		db_finish();
+		}
+	if (perf_mode)
+		{
+		perf_report();
+		}
 	printf("close files.  processed %lu releases, matched %lu releases\n",	releasecount,foundcount);
 	fprintf(outfile,"\n\nclose files.  processed %lu releases, matched %lu releases\n",	releasecount,foundcount);
 	fprintf(outfile,"%u errors.\n",errorcount);
 	fclose(infile);
+	traceend(TRACE_FLUSH,ftell64(outfile));
 	fclose(outfile);
+	if (trace_mode)
+		{
+		trace_finish();
+		}
 #if WRITE_DEBUG_FILE
 	fprintf(debugfile,"\n\nclose files.  processed %lu releases, matched %lu releases\n",	releasecount,foundcount);
 	fprintf(debugfile,"%u errors.\n",errorcount);
 	fclose(debugfile);
 #endif
-
-
+	if (compress_mode)
+		{
+		compress_finish();  // closes csvfile too
+		}
 }
 
 
@@ -866,7 +3087,8 @@ void process_xml(unsigned char *foundstartptr,size_t searchresultlen)
 	size_t n;
 
 
-// Search through the xml for items and write them to the csvfile as CSV.
+// Search through the xml for items, into fields and the label and format arrays,
+// then format them as a line of CSV in csvrow.
 
 // Fields to extract:
 //  non-nested fields first:
@@ -878,208 +3100,226 @@ void process_xml(unsigned char *foundstartptr,size_t searchresultlen)
 //    data_quality
 //    
 
+	tracebegin(TRACE_EXTRACT);
+	process_xml_reset();
+
 // 1.  Release ID
 	xmlstartstringlen=strlen(SEARCH_START);
-	printf("xmlstartringlen=%u\n",xmlstartstringlen);
+	xmltrace("xmlstartringlen=%u\n",xmlstartstringlen);
 	strcpy(xmlfindstartbuffer,SEARCH_START);
 
 	xmlendstringlen=strlen(SEARCH_END);
-	printf("xmlendstringlen=%u\n",xmlendstringlen);
+	xmltrace("xmlendstringlen=%u\n",xmlendstringlen);
 	strcpy(xmlfindendbuffer,SEARCH_END);
 
 	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
 	if (foundxmlstringptr==NULL)
 		{
-		printf("xml search returned NULL\n");
+		xmltrace("xml search returned NULL\n");
 		}
 	else
 		{
-		printf("Found xml string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+		xmltrace("Found xml string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
   		rel_id=strtoul(foundxmlstringptr+13,NULL,10);
-		printf("Found xml search string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		printf("Release ID=%lu\n",rel_id);
-		fprintf(csvfile,"\"%u\"",release_id);
-		printf("to csvfile:\"%u\"\n",release_id);
+		xmltrace("Found xml search string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+		xmltrace("Release ID=%lu\n",rel_id);
+		fields.release_id=rel_id;
+		xmltrace("to csvfile:\"%lu\"\n",rel_id);
 //		ch=getchar();
 		}
 
 // 2.  title
-	xmlstartstringlen=strlen(TITLE_START);
-	printf("xmlstartringlen=%u\n",xmlstartstringlen);
-	strcpy(xmlfindstartbuffer,TITLE_START);
+	if (schemaneeds&SCHEMA_TITLE)
+		{
+		xmlstartstringlen=strlen(TITLE_START);
+		xmltrace("xmlstartringlen=%u\n",xmlstartstringlen);
+		strcpy((char *)xmlfindstartbuffer,TITLE_START);
 
-	xmlendstringlen=strlen(TITLE_END);
-	printf("xmlendstringlen=%u\n",xmlendstringlen);
-	strcpy(xmlfindendbuffer,TITLE_END);
+		xmlendstringlen=strlen(TITLE_END);
+		xmltrace("xmlendstringlen=%u\n",xmlendstringlen);
+		strcpy((char *)xmlfindendbuffer,TITLE_END);
 
-	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
-	if (foundxmlstringptr==NULL)
-		{
-		printf("ERROR! xml title search returned NULL\n");
-		ch=getchar();
-		}
-	else
-		{
-		printf("Found xml title string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
-		if (foundxml2stringptr==NULL)
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
+		if (foundxmlstringptr==NULL)
 			{
-			printf("Error! xml title end search returned NULL\n");
-			ch=getchar();
+			printf("ERROR! xml title search returned NULL\n");
+			xmlpause();
 			}
 		else
 			{
-			fprintf(csvfile,SEPARATOR);
-			n=foundxml2stringptr-foundxmlstringptr-strlen(TITLE_START);
-			fprintf(csvfile,"\"%.*s\"",n,foundxmlstringptr+strlen(TITLE_START));
-			printf("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(TITLE_START));
-//			ch=getchar();
+			xmltrace("Found xml title string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+			foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
+			if (foundxml2stringptr==NULL)
+				{
+				printf("Error! xml title end search returned NULL\n");
+				fields.title.found=-1;
+				xmlpause();
+				}
+			else
+				{
+				n=foundxml2stringptr-foundxmlstringptr-strlen(TITLE_START);
+				fields.title.ptr=foundxmlstringptr+strlen(TITLE_START);
+				fields.title.len=n;
+				fields.title.found=1;
+				xmltrace("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(TITLE_START));
+//				ch=getchar();
+				}
 			}
 		}
 
 
 // 3. released
-	xmlstartstringlen=strlen(RELEASED_START);
-	printf("xmlstartringlen=%u\n",xmlstartstringlen);
-	strcpy(xmlfindstartbuffer,RELEASED_START);
+	if (schemaneeds&SCHEMA_RELEASED)
+		{
+		xmlstartstringlen=strlen(RELEASED_START);
+		xmltrace("xmlstartringlen=%u\n",xmlstartstringlen);
+		strcpy((char *)xmlfindstartbuffer,RELEASED_START);
 
-	xmlendstringlen=strlen(RELEASED_END);
-	printf("xmlendstringlen=%u\n",xmlendstringlen);
-	strcpy(xmlfindendbuffer,RELEASED_END);
+		xmlendstringlen=strlen(RELEASED_END);
+		xmltrace("xmlendstringlen=%u\n",xmlendstringlen);
+		strcpy((char *)xmlfindendbuffer,RELEASED_END);
 
-	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
-	if (foundxmlstringptr==NULL)
-		{
-		printf("xml released search returned NULL\n");
-		fprintf(csvfile,SEPARATOR);
-		fprintf(csvfile,"%s",EMPTY_FIELD);
-		}
-	else
-		{
-		printf("Found xml released string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
-		if (foundxml2stringptr==NULL)
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
+		if (foundxmlstringptr==NULL)
 			{
-			printf("Error! xml released end search returned NULL\n");
-			ch=getchar();
+			xmltrace("xml released search returned NULL\n");
 			}
 		else
 			{
-			fprintf(csvfile,SEPARATOR);
-			n=foundxml2stringptr-foundxmlstringptr-strlen(RELEASED_START);
-			fprintf(csvfile,"\"%.*s\"",n,foundxmlstringptr+strlen(RELEASED_START));
-			printf("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(RELEASED_START));
-//			ch=getchar();
+			xmltrace("Found xml released string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+			foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
+			if (foundxml2stringptr==NULL)
+				{
+				printf("Error! xml released end search returned NULL\n");
+				fields.released.found=-1;
+				xmlpause();
+				}
+			else
+				{
+				n=foundxml2stringptr-foundxmlstringptr-strlen(RELEASED_START);
+				fields.released.ptr=foundxmlstringptr+strlen(RELEASED_START);
+				fields.released.len=n;
+				fields.released.found=1;
+				xmltrace("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(RELEASED_START));
+//				ch=getchar();
+				}
 			}
 		}
 
 // 4. country
 
-	xmlstartstringlen=strlen(COUNTRY_START);
-	printf("xmlstartringlen=%u\n",xmlstartstringlen);
-	strcpy(xmlfindstartbuffer,COUNTRY_START);
+	if (schemaneeds&SCHEMA_COUNTRY)
+		{
+		xmlstartstringlen=strlen(COUNTRY_START);
+		xmltrace("xmlstartringlen=%u\n",xmlstartstringlen);
+		strcpy((char *)xmlfindstartbuffer,COUNTRY_START);
 
-	xmlendstringlen=strlen(COUNTRY_END);
-	printf("xmlendstringlen=%u\n",xmlendstringlen);
-	strcpy(xmlfindendbuffer,COUNTRY_END);
+		xmlendstringlen=strlen(COUNTRY_END);
+		xmltrace("xmlendstringlen=%u\n",xmlendstringlen);
+		strcpy((char *)xmlfindendbuffer,COUNTRY_END);
 
-	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
-	if (foundxmlstringptr==NULL)
-		{
-		printf("xml country search returned NULL\n");
-		fprintf(csvfile,SEPARATOR);
-		fprintf(csvfile,"%s",EMPTY_FIELD);
-		}
-	else
-		{
-		printf("Found xml country string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
-		if (foundxml2stringptr==NULL)
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
+		if (foundxmlstringptr==NULL)
 			{
-			printf("Error! xml country end search returned NULL\n");
-			ch=getchar();
+			xmltrace("xml country search returned NULL\n");
 			}
 		else
 			{
-			fprintf(csvfile,SEPARATOR);
-			n=foundxml2stringptr-foundxmlstringptr-strlen(COUNTRY_START);
-			fprintf(csvfile,"\"%.*s\"",n,foundxmlstringptr+strlen(COUNTRY_START));
-			printf("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(COUNTRY_START));
-//			ch=getchar();
+			xmltrace("Found xml country string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+			foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
+			if (foundxml2stringptr==NULL)
+				{
+				printf("Error! xml country end search returned NULL\n");
+				fields.country.found=-1;
+				xmlpause();
+				}
+			else
+				{
+				n=foundxml2stringptr-foundxmlstringptr-strlen(COUNTRY_START);
+				fields.country.ptr=foundxmlstringptr+strlen(COUNTRY_START);
+				fields.country.len=n;
+				fields.country.found=1;
+				xmltrace("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(COUNTRY_START));
+//				ch=getchar();
+				}
 			}
 		}
 
 // 5. notes
 
-	xmlstartstringlen=strlen(NOTES_START);
-	printf("xmlstartringlen=%u\n",xmlstartstringlen);
-	strcpy(xmlfindstartbuffer,NOTES_START);
+	if (schemaneeds&SCHEMA_NOTES)
+		{
+		xmlstartstringlen=strlen(NOTES_START);
+		xmltrace("xmlstartringlen=%u\n",xmlstartstringlen);
+		strcpy((char *)xmlfindstartbuffer,NOTES_START);
 
-	xmlendstringlen=strlen(NOTES_END);
-	printf("xmlendstringlen=%u\n",xmlendstringlen);
-	strcpy(xmlfindendbuffer,NOTES_END);
+		xmlendstringlen=strlen(NOTES_END);
+		xmltrace("xmlendstringlen=%u\n",xmlendstringlen);
+		strcpy((char *)xmlfindendbuffer,NOTES_END);
 
-	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
-	if (foundxmlstringptr==NULL)
-		{
-		printf("xml notes search returned NULL\n");
-		fprintf(csvfile,SEPARATOR);
-		fprintf(csvfile,"%s",EMPTY_FIELD);
-		}
-	else
-		{
-		printf("Found xml notes string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
-		if (foundxml2stringptr==NULL)
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
+		if (foundxmlstringptr==NULL)
 			{
-			printf("Error! xml notes end search returned NULL\n");
-			ch=getchar();
+			xmltrace("xml notes search returned NULL\n");
 			}
 		else
 			{
-			fprintf(csvfile,SEPARATOR);
-			n=foundxml2stringptr-foundxmlstringptr-strlen(NOTES_START);
-			fprintf(csvfile,"\"%.*s\"",n,foundxmlstringptr+strlen(NOTES_START));
-			printf("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(NOTES_START));
-//			ch=getchar();
+			xmltrace("Found xml notes string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+			foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
+			if (foundxml2stringptr==NULL)
+				{
+				printf("Error! xml notes end search returned NULL\n");
+				fields.notes.found=-1;
+				xmlpause();
+				}
+			else
+				{
+				n=foundxml2stringptr-foundxmlstringptr-strlen(NOTES_START);
+				fields.notes.ptr=foundxmlstringptr+strlen(NOTES_START);
+				fields.notes.len=n;
+				fields.notes.found=1;
+				xmltrace("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(NOTES_START));
+//				ch=getchar();
+				}
 			}
 		}
 
 
 // 6. data_quality
-	xmlstartstringlen=strlen(DATA_QUALITY_START);
-	printf("xmlstartringlen=%u\n",xmlstartstringlen);
-	strcpy(xmlfindstartbuffer,DATA_QUALITY_START);
+	if (schemaneeds&SCHEMA_DATA_QUALITY)
+		{
+		xmlstartstringlen=strlen(DATA_QUALITY_START);
+		xmltrace("xmlstartringlen=%u\n",xmlstartstringlen);
+		strcpy((char *)xmlfindstartbuffer,DATA_QUALITY_START);
 
-	xmlendstringlen=strlen(DATA_QUALITY_END);
-	printf("xmlendstringlen=%u\n",xmlendstringlen);
-	strcpy(xmlfindendbuffer,DATA_QUALITY_END);
+		xmlendstringlen=strlen(DATA_QUALITY_END);
+		xmltrace("xmlendstringlen=%u\n",xmlendstringlen);
+		strcpy((char *)xmlfindendbuffer,DATA_QUALITY_END);
 
-	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
-	if (foundxmlstringptr==NULL)
-		{
-		printf("xml data_quality search returned NULL\n");
-		fprintf(csvfile,SEPARATOR);
-		fprintf(csvfile,"%s",EMPTY_FIELD);
-		}
-	else
-		{
-		printf("Found xml data_quality string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
-		if (foundxml2stringptr==NULL)
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
+		if (foundxmlstringptr==NULL)
 			{
-			printf("Error! xml data_quality end search returned NULL\n");
-			fprintf(csvfile,SEPARATOR);
-			fprintf(csvfile,"%s",EMPTY_FIELD);
-			ch=getchar();
+			xmltrace("xml data_quality search returned NULL\n");
 			}
 		else
 			{
-			n=foundxml2stringptr-foundxmlstringptr-strlen(DATA_QUALITY_START);
-			fprintf(csvfile,SEPARATOR);
- 			fprintf(csvfile,"\"%.*s\"",n,foundxmlstringptr+strlen(DATA_QUALITY_START));
-			printf("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(DATA_QUALITY_START));
-//			ch=getchar();
+			xmltrace("Found xml data_quality string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+			foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
+			if (foundxml2stringptr==NULL)
+				{
+				printf("Error! xml data_quality end search returned NULL\n");
+				fields.data_quality.found=-1;
+				xmlpause();
+				}
+			else
+				{
+				n=foundxml2stringptr-foundxmlstringptr-strlen(DATA_QUALITY_START);
+				fields.data_quality.ptr=foundxmlstringptr+strlen(DATA_QUALITY_START);
+				fields.data_quality.len=n;
+				fields.data_quality.found=1;
+				xmltrace("to csvfile: \"%.*s\"\n",n,foundxmlstringptr+strlen(DATA_QUALITY_START));
+//				ch=getchar();
+				}
 			}
 		}
 
@@ -1099,184 +3339,239 @@ also:
 
 
 // 7. labels
-	xmlstartstringlen=strlen(LABELS_START);
-//	printf("xmlstartringlen=%u\n",xmlstartstringlen);
-	strcpy(xmlfindstartbuffer,LABELS_START);
+	if (schemaneeds&SCHEMA_LABELS)
+		{
+		xmlstartstringlen=strlen(LABELS_START);
+//		printf("xmlstartringlen=%u\n",xmlstartstringlen);
+		strcpy((char *)xmlfindstartbuffer,LABELS_START);
 
-	xmlendstringlen=strlen(LABELS_END);
-//	printf("xmlendstringlen=%u\n",xmlendstringlen);
-	strcpy(xmlfindendbuffer,LABELS_END);
+		xmlendstringlen=strlen(LABELS_END);
+//		printf("xmlendstringlen=%u\n",xmlendstringlen);
+		strcpy((char *)xmlfindendbuffer,LABELS_END);
 
-	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
-	if (foundxmlstringptr==NULL)
-		{
-		printf("xml labels search returned NULL\n");
-		fprintf(csvfile,SEPARATOR);
-		fprintf(csvfile,"%s",EMPTY_FIELD);
-		}
-	else
-		{
-		printf("Found xml labels string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
-		if (foundxml2stringptr==NULL)
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
+		if (foundxmlstringptr==NULL)
 			{
-			printf("Error! xml labels end search returned NULL\n");
-			fprintf(debugfile,"Error! xml labels end search returned NULL\n");
-			ch=getchar();
+			xmltrace("xml labels search returned NULL\n");
 			}
 		else
 			{
-			n=foundxml2stringptr-foundxmlstringptr-strlen(LABELS_START);  // length of one or more <label> entries
-			sprintf(tempbuffer,"%.*s\"\0",n,foundxmlstringptr+strlen(LABELS_START));
-//			printf("tempbuffer=%.*s\"\n",n,foundxmlstringptr+strlen(LABELS_START));
-//			printf(" len=%u ",n);
-//			ch=getchar();
-
-//Extract catalog numbers, and label names...
-//<labels><label catno="74321-78040-2" id="930" name="Logic Records"/>
-//<label catno="74321-78040-2" id="926736" name="Beyond (3)"/></labels>
-
-			catno_count=0;
-			tptr=strstr(tempbuffer,"label catno=\"");
-			if (tptr==NULL)
+			xmltrace("Found xml labels string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+			foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
+			if (foundxml2stringptr==NULL)
 				{
-				printf("Error!  No label data found.\n");
-				ch=getchar();
+				printf("Error! xml labels end search returned NULL\n");
+				labels_found=-1;
+				fprintf(debugfile,"Error! xml labels end search returned NULL\n");
+				xmlpause();
 				}
-			while (tptr!=NULL)
+			else
 				{
-				currentptr=strstr(tptr+strlen("label catno=\""),"\"");
-//				currentptr=strstr(tptr+1,"\"");
-				printf("tptr=%s\n",tptr);
-				printf("currentptr=%s\n",currentptr);
-				nx=currentptr-tptr-strlen("label catno=\"");
-//				printf("nx=%u\n",nx);
+				labels_found=1;
+				n=foundxml2stringptr-foundxmlstringptr-strlen(LABELS_START);  // length of one or more <label> entries
+				process_xml_labels(foundxmlstringptr+strlen(LABELS_START),n);
+				}
+			}
+		}
 
-				sprintf(catno[catno_count],"%.*s\0",nx,tptr+strlen("label catno=\""));
-				printf("catno[%u]=%.*s\0",catno_count,nx,tptr+strlen("label catno=\""));
-//				printf("catno[%u]=%.*s\0",catno_count,nx,tptr);
 
-				tptr=strstr(currentptr,"label catno=\"");  // for next iteration
+/*<formats>
+<format name="Vinyl" qty="1" text="">
+<descriptions><description>12"</description><description>45
+RPM</description></descriptions></format>
+</formats>
+*/
 
-// extract label name
-				labelnameptr=strstr(currentptr,"name=\"");
-				labelnameptr+=strlen("name=\"");
-				nx=strstr(labelnameptr,"\"")-labelnameptr;
-//				printf("nx=%u\n",nx);
-				sprintf(labelname[catno_count],"%.*s\0",nx,labelnameptr);
-				printf("labelname[%u]=%.*s\0",catno_count,nx,labelnameptr);
-//strip " (3)" from labelname if present
-				xptr=strstr(labelname[catno_count]," (");
-				if (xptr!=NULL)
-					{
-					printf("found parenthetical in label name %s - removing\n",labelname[catno_count]);
-					*xptr='\0';
-					ch=getchar();
-					}
-				catno_count++;
-//				ch=getchar();
+
+// 8. format
+	if (schemaneeds&SCHEMA_FORMATS)
+		{
+		xmlstartstringlen=strlen(FORMAT_NAME_START);
+//		printf("xmlstartringlen=%u\n",xmlstartstringlen);
+		strcpy((char *)xmlfindstartbuffer,FORMAT_NAME_START);
+
+		xmlendstringlen=strlen(FORMATS_END);
+//		printf("xmlendstringlen=%u\n",xmlendstringlen);
+		strcpy((char *)xmlfindendbuffer,FORMATS_END);
+
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
+		if (foundxmlstringptr==NULL)
+			{
+			printf("ERROR! xml format name search returned NULL\n");
+			xmlpause();
+			}
+		else
+			{
+			xmltrace("Found format name string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
+			foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
+			if (foundxml2stringptr==NULL)
+				{
+				printf("Error! xml format name end search returned NULL\n");
+				formats_found=-1;
+				fprintf(debugfile,"Error! xml format name end search returned NULL\n");
+				xmlpause();
 				}
-//put label and catno data in csvfile as label--catno.  (defined constant, Later, use &ndash;).
-//Into columns:
-// export first label, first catno, firstlabel--firstcatno, then all of them in a column. (4 output columns total)
-			fprintf(csvfile,SEPARATOR);
+			else
+				{
+				formats_found=1;
+				n=foundxml2stringptr-foundxmlstringptr-strlen(FORMAT_NAME_START);  // length of block containing format <description>s
+				process_xml_formats(foundxmlstringptr+strlen(FORMAT_NAME_START),n);
+				}
+			}
+		}
 
-			printf("to csvfile: \"%s%s%s\"\n",labelname[0],LABEL_CATNO_SEPARATOR,catno[0]);
-			fprintf(csvfile,"\"%s%s%s\"",labelname[0],LABEL_CATNO_SEPARATOR,catno[0]);
-			fprintf(csvfile,"%s",SEPARATOR);
 
-			printf("to csvfile: \"%s\"\n",labelname[0]);
-			fprintf(csvfile,"\"%s\"",labelname[0]);
 
-			fprintf(csvfile,"%s",SEPARATOR);
-			printf("to csvfile: \"%s\"\n",catno[0]);
-			fprintf(csvfile,"\"%s\"",catno[0]);
 
-			fprintf(csvfile,"%s",SEPARATOR);
-			fprintf(csvfile,"\""); // start field for label+catno list
+/*
+<master_id
+is_main_release="false">142262</master_id><tracklist><track><position>A1</position><title>Hot
+Shot '97 (Rollercoaster Club
+Mix)</title><duration>5:57</duration><extraartists><artist><id>16019</id><name>Rollercoaster</name><anv></anv><join></join><role>Remix</role><tracks></tracks></artist></extraartists></track><track><position>A2</position><title>Hot
+Shot '97 (Da Techno Bohemian Hot Vocal
+Mix)</title><duration>6:09</duration><extraartists><artist><id>20922</id><name>Da
+Techno
+Bohemian</name><anv></anv><join></join><role>Remix</role><tracks></tracks></artist></extraartists></track><track><position>B1</position><title>Hot
+Shot '97 (Da Techno Bohemian Dirty Dub
+Mix)</title><duration>5:25</duration><extraartists><artist><id>20922</id><name>Da
+Techno
+Bohemian</name><anv></anv><join></join><role>Remix</role><tracks></tracks></artist></extraartists></track><track><position>B2</position><title>Hotdisco</title><duration>4:11</duration></track></tracklist>
+*/
+
 
-			for (i=0;i<catno_count;i++)
+// 9. master_id, for --sort and --columns
+	if (schemaneeds&SCHEMA_MASTER_ID)
+		{
+		foundxmlstringptr=memmem(foundstartptr, searchresultlen , (unsigned char *)MASTER_ID_START, strlen(MASTER_ID_START));
+		if (foundxmlstringptr!=NULL)
+			{
+			foundxml2stringptr=memchr(foundxmlstringptr,'>',foundstartptr+searchresultlen-foundxmlstringptr);
+			if (foundxml2stringptr!=NULL)
 				{
-				printf("to csvfile: \"%s%s%s\"\n",labelname[i],LABEL_CATNO_SEPARATOR,catno[i]);
-				fprintf(csvfile,"%s%s%s",labelname[i],LABEL_CATNO_SEPARATOR,catno[i]);
-				if (i!=catno_count-1)
-					{
-					fprintf(csvfile,", ");
-					}
+				fields.master_id=strtoull((char *)foundxml2stringptr+1,NULL,10);
 				}
+			}
+		}
 
-			fprintf(csvfile,"\""); // end field for label+catno list
+// 10. genres, styles and identifiers, for --columns
+	process_xml_lists(foundstartptr,searchresultlen);
 
-//			ch=getchar();
-			}
+	if (csvrow_enabled)
+		{
+		write_csv_row();
 		}
+	traceend(TRACE_EXTRACT,searchresultlen);
+}
 
 
-/*<formats>
-<format name="Vinyl" qty="1" text="">
-<descriptions><description>12"</description><description>45
-RPM</description></descriptions></format>
-</formats>
-*/
+void process_xml_reset(void)
+{
+// nothing found yet, before the fields of a release are looked for
+	memset(&fields,0,sizeof(fields));
+	catno_count=0;
+	labels_found=0;
+	catno[0][0]='\0';
+	labelname[0][0]='\0';
+	format_desc_count=0;
+	formats_found=0;
+	format_name[0]='\0';
+	format_qty[0]='\0';
+	format_text[0]='\0';
+}
 
 
-// 8. format
-	xmlstartstringlen=strlen(FORMAT_NAME_START);
-//	printf("xmlstartringlen=%u\n",xmlstartstringlen);
-	strcpy(xmlfindstartbuffer,FORMAT_NAME_START);
+void process_xml_labels(unsigned char *ptr, size_t n)
+{
+// catno and labelname from the n bytes of <label> entries at ptr (inside <labels>)
+	sprintf((char *)tempbuffer,"%.*s\"",(int)n,ptr);
+//			printf("tempbuffer=%.*s\"\n",n,ptr);
+//			printf(" len=%u ",n);
+//			ch=getchar();
 
-	xmlendstringlen=strlen(FORMATS_END);
-//	printf("xmlendstringlen=%u\n",xmlendstringlen);
-	strcpy(xmlfindendbuffer,FORMATS_END);
+//Extract catalog numbers, and label names...
+//<labels><label catno="74321-78040-2" id="930" name="Logic Records"/>
+//<label catno="74321-78040-2" id="926736" name="Beyond (3)"/></labels>
 
-	foundxmlstringptr=memmem(foundstartptr, searchresultlen , xmlfindstartbuffer, xmlstartstringlen);
-	if (foundxmlstringptr==NULL)
+	catno_count=0;
+	tptr=(unsigned char *)strstr((char *)tempbuffer,"label catno=\"");
+	if (tptr==NULL)
 		{
-		printf("ERROR! xml format name search returned NULL\n");
-		ch=getchar();
+		printf("Error!  No label data found.\n");
+		xmlpause();
 		}
-	else
+	while (tptr!=NULL && catno_count<MAX_CATNO_COUNT)
 		{
-		printf("Found format name string within bounds at position %u\n",(foundxmlstringptr-inputbuffer));
-		foundxml2stringptr=memmem(foundstartptr, searchresultlen , xmlfindendbuffer, xmlendstringlen);
-		if (foundxml2stringptr==NULL)
+		currentptr=(unsigned char *)strstr((char *)tptr+strlen("label catno=\""),"\"");
+//				currentptr=strstr(tptr+1,"\"");
+		xmltrace("tptr=%s\n",tptr);
+		xmltrace("currentptr=%s\n",currentptr);
+		nx=currentptr-tptr-strlen("label catno=\"");
+//				printf("nx=%u\n",nx);
+		if (nx>=MAX_CATNO_LEN) nx=MAX_CATNO_LEN-1;
+
+		sprintf((char *)catno[catno_count],"%.*s",nx,tptr+strlen("label catno=\""));
+		xmltrace("catno[%u]=%.*s",catno_count,nx,tptr+strlen("label catno=\""));
+//				printf("catno[%u]=%.*s\0",catno_count,nx,tptr);
+
+		tptr=(unsigned char *)strstr((char *)currentptr,"label catno=\"");  // for next iteration
+
+// extract label name
+		labelnameptr=(unsigned char *)strstr((char *)currentptr,"name=\"");
+		labelnameptr+=strlen("name=\"");
+		nx=(unsigned char *)strstr((char *)labelnameptr,"\"")-labelnameptr;
+//				printf("nx=%u\n",nx);
+		if (nx>=MAX_LABELNAME_LEN) nx=MAX_LABELNAME_LEN-1;
+		sprintf((char *)labelname[catno_count],"%.*s",nx,labelnameptr);
+		xmltrace("labelname[%u]=%.*s",catno_count,nx,labelnameptr);
+//strip " (3)" from labelname if present
+		xptr=(unsigned char *)strstr((char *)labelname[catno_count]," (");
+		if (xptr!=NULL)
 			{
-			printf("Error! xml format name end search returned NULL\n");
-			fprintf(debugfile,"Error! xml format name end search returned NULL\n");
-			ch=getchar();
+			xmltrace("found parenthetical in label name %s - removing\n",labelname[catno_count]);
+			*xptr='\0';
+			xmlpause();
 			}
-		else
-			{
+		catno_count++;
+//				ch=getchar();
+		}
+
+//			ch=getchar();
+}
+
+
+void process_xml_formats(unsigned char *ptr, size_t n)
+{
+// format_name, qty, text and the descriptions from the n bytes at ptr, from
+// the first <format name=" to </formats>
 // copy block to search later for <descriptions> into tempbuffer
-			n=foundxml2stringptr-foundxmlstringptr-strlen(FORMAT_NAME_START);  // length of block containing format <description>s
-			sprintf(tempbuffer,"%.*s\"\0",n,foundxmlstringptr+strlen(FORMAT_NAME_START));
-			printf("tempbuffer=%.*s\"\n",n,foundxmlstringptr+strlen(FORMAT_NAME_START));
+	sprintf((char *)tempbuffer,"%.*s\"",(int)n,ptr);
+	xmltrace("tempbuffer=%.*s\"\n",n,ptr);
 
 //Extract format fields...
 //<format name="Vinyl" qty="1" text="">
 //extract format name
-			xptr=strstr(tempbuffer,"\"");
-			nx=xptr-tempbuffer;
-			sprintf(format_name,"%.*s\0",nx,tempbuffer);
-			printf("nx=%u format_name,%.*s\n",nx,nx,tempbuffer);
+	xptr=(unsigned char *)strstr((char *)tempbuffer,"\"");
+	nx=xptr-tempbuffer;
+	sprintf((char *)format_name,"%.*s",nx,tempbuffer);
+	xmltrace("nx=%u format_name,%.*s\n",nx,nx,tempbuffer);
 
 //			ch=getchar();
 
 
 //extract qty
-			currentptr=strstr(tempbuffer,"qty=\"")+strlen("qty=\"");
-			tptr=strstr(currentptr,"\"");
-			nx=tptr-currentptr;
-			sprintf(format_qty,"%.*s\0",nx,currentptr);
-			printf("nx=%u format_qty:%.*s\n",nx,nx,currentptr);
+	currentptr=(unsigned char *)strstr((char *)tempbuffer,"qty=\"")+strlen("qty=\"");
+	tptr=(unsigned char *)strstr((char *)currentptr,"\"");
+	nx=tptr-currentptr;
+	sprintf((char *)format_qty,"%.*s",nx,currentptr);
+	xmltrace("nx=%u format_qty:%.*s\n",nx,nx,currentptr);
 
-			ch=getchar();
+	xmlpause();
 //extract text
-			currentptr=strstr(tempbuffer,"text=\"")+strlen("text=\"");
-			tptr=strstr(currentptr,"\"");
-			nx=tptr-currentptr;
-			sprintf(format_text,"%.*s\0",nx,currentptr);
-			printf("nx=%u format_text:%.*s\n",nx,nx,currentptr);
+	currentptr=(unsigned char *)strstr((char *)tempbuffer,"text=\"")+strlen("text=\"");
+	tptr=(unsigned char *)strstr((char *)currentptr,"\"");
+	nx=tptr-currentptr;
+	sprintf((char *)format_text,"%.*s",nx,currentptr);
+	xmltrace("nx=%u format_text:%.*s\n",nx,nx,currentptr);
 
 //			ch=getchar();
 
@@ -1285,120 +3580,9524 @@ RPM</description></descriptions></format>
 //<descriptions><description>12"</description><description>45
 //RPM</description></descriptions></format>
 
-			format_desc_count=0;
-			tptr=strstr(tempbuffer,"<description>");
-			if (tptr==NULL)
-				{
-				printf("Error!  No <description> data found.\n");
-				ch=getchar();
-				}
-			while (tptr!=NULL)
-				{
-				currentptr=strstr(tptr+strlen("<description>"),"</description>");
-				printf("tptr=%s\n",tptr);
-				printf("currentptr=%s\n",currentptr);
-				nx=currentptr-tptr-strlen("<description>");
+	format_desc_count=0;
+	tptr=(unsigned char *)strstr((char *)tempbuffer,"<description>");
+	if (tptr==NULL)
+		{
+		printf("Error!  No <description> data found.\n");
+		xmlpause();
+		}
+	while (tptr!=NULL && format_desc_count<MAX_DESCRIPTION_COUNT)
+		{
+		currentptr=(unsigned char *)strstr((char *)tptr+strlen("<description>"),"</description>");
+		xmltrace("tptr=%s\n",tptr);
+		xmltrace("currentptr=%s\n",currentptr);
+		nx=currentptr-tptr-strlen("<description>");
 //				printf("nx=%u\n",nx);
+		if (nx>=MAX_DESCRIPTION_LEN) nx=MAX_DESCRIPTION_LEN-1;
 
-				sprintf(description[format_desc_count],"%.*s\0",nx,tptr+strlen("<description>"));
-				printf("description[%u]=%.*s\0",format_desc_count,nx,tptr+strlen("<description>"));
-				format_desc_count++;
+		sprintf((char *)description[format_desc_count],"%.*s",nx,tptr+strlen("<description>"));
+		xmltrace("description[%u]=%.*s",format_desc_count,nx,tptr+strlen("<description>"));
+		format_desc_count++;
 
-				tptr=strstr(currentptr,"<description");  // for next iteration
+		tptr=(unsigned char *)strstr((char *)currentptr,"<description>");  // for next iteration
 
-				ch=getchar();
-				}
+		xmlpause();
+		}
 
-//put format and <description> data in outfile as
-// columns: "format_name", "format_qty", "format_text", "description[format_desc_count]"
-// then a combined version all in one column.
-// export format--
-			fprintf(csvfile,"%s",SEPARATOR);
 
-			printf("to csvfile: \"%s\"\n",format_name);
-			fprintf(csvfile,"\"%s\"",format_name);
-			fprintf(csvfile,"%s",SEPARATOR);
+	xmlpause();
+}
 
-			printf("to csvfile: \"%s\"\n",format_qty);
-			fprintf(csvfile,"\"%s\"",format_qty);
-			fprintf(csvfile,"%s",SEPARATOR);
 
-			printf("to csvfile: \"%s\"\n",format_text);
-			fprintf(csvfile,"\"%s\"",format_text);
-			fprintf(csvfile,"%s",SEPARATOR);
 
-			fprintf(csvfile,"\""); // start field for label+catno list
-			for (i=0;i<format_desc_count;i++)
+int parse_options(int argc, char *argv[])
+{
+// strips the --options out of argv, leaving the positional arguments in order.
+// returns the new argc.
+	int in,out;
+	unsigned int n;
+	char *p;
+
+	out=1;
+	for (in=1;in<argc;in++)
+		{
+		if (strncmp(argv[in],"--",2))
+			{
+			argv[out++]=argv[in];
+			}
+		else if (!strcmp(argv[in],"--shard-dir") && in+1<argc)
+			{
+			sharddirname=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--artists") && in+1<argc)
+			{
+			artistsfilename=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--sort"))
+			{
+			sort_mode=1;
+			}
+		else if (!strcmp(argv[in],"--sort-memory") && in+1<argc)
+			{
+			sort_memory=(size_t)strtoul(argv[++in],NULL,10)*1048576;
+			if (sort_memory<1048576)
 				{
-				printf("to csvfile: \"%s\"\n",description[i]);
-				fprintf(csvfile,"%s",description[i]);
-				if (i!=format_desc_count-1)
-					{
-					fprintf(csvfile,FORMAT_DESCRIPTION_SEPARATOR);
-					}
+				sort_memory=1048576;
 				}
-
-			fprintf(csvfile,"\""); // end field for <description> list
-
-// Now the combined_description version all in one column.
-// "format_qty"x"format_text", description[format_desc_count]"
-// "2xCD, Reissue, Limited Edition" etc.
-
-			fprintf(csvfile,SEPARATOR);
-
-			if (!strcmp(format_qty,"1"))
+			}
+		else if (!strcmp(argv[in],"--aggregate") && in+1<argc)
+			{
+			aggregatefieldlist=argv[++in];
+			if (!aggregate_parse_fields(aggregatefieldlist))
 				{
-				printf("to csvfile: %s\n",format_name);
-				fprintf(csvfile,"\"%s",format_name);
+				syntax();
 				}
-			else
+			aggregate_mode=1;
+			csvrow_enabled=0;
+			}
+		else if (!strcmp(argv[in],"--start-offset") && in+1<argc)
+			{
+			start_offset=strtoull(argv[++in],NULL,10);
+			}
+		else if (!strcmp(argv[in],"--end-offset") && in+1<argc)
+			{
+			end_offset=strtoull(argv[++in],NULL,10);
+			}
+		else if (!strcmp(argv[in],"--debug-file") && in+1<argc)
+			{
+			debugfileoption=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--metrics-file") && in+1<argc)
+			{
+			metricsfilename=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--metrics-interval") && in+1<argc)
+			{
+			metrics_interval=strtoul(argv[++in],NULL,10);
+			if (metrics_interval<1)
 				{
-				printf("to csvfile: \"%sx%s\n",format_qty,format_name);
-				fprintf(csvfile,"\"%sx%s",format_qty,format_name);
+				metrics_interval=1;
 				}
-
-
-			fprintf(csvfile,"%s",FORMAT_DESCRIPTION_SEPARATOR);
-			printf("%s",FORMAT_DESCRIPTION_SEPARATOR);
-			for (i=0;i<format_desc_count;i++)
+			}
+		else if (!strcmp(argv[in],"--role") && in+1<argc)
+			{
+			rolelist=argv[++in];
+			if (!role_parse_filter(rolelist))
+				{
+				syntax();
+				}
+			role_mode=1;
+			}
+		else if (!strcmp(argv[in],"--text") && in+1<argc)
+			{
+			if (!text_add_phrase(argv[++in]))
+				{
+				syntax();
+				}
+			text_mode=1;
+			}
+		else if (!strcmp(argv[in],"--text-fields") && in+1<argc)
+			{
+			textfieldlist=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--build-index") && in+1<argc)
+			{
+			indexfilename=argv[++in];
+			index_build_mode=1;
+			}
+		else if (!strcmp(argv[in],"--index") && in+1<argc)
+			{
+			indexfilename=argv[++in];
+			index_mode=1;
+			}
+		else if (!strcmp(argv[in],"--build-store") && in+1<argc)
+			{
+			storefilename=argv[++in];
+			store_build_mode=1;
+			}
+		else if (!strcmp(argv[in],"--build-frames") && in+1<argc)
+			{
+			framefilename=argv[++in];
+			frames_build_mode=1;
+			}
+		else if (!strcmp(argv[in],"--frame-bytes") && in+1<argc)
+			{
+			frame_bytes=(size_t)strtoul(argv[++in],NULL,10)*1024;
+			if (frame_bytes<BLOCKSIZE/16)
+				{
+				frame_bytes=BLOCKSIZE/16;
+				}
+			}
+		else if (!strcmp(argv[in],"--frames"))
+			{
+			frames_mode=1;
+			}
+		else if (!strcmp(argv[in],"--frame-threads") && in+1<argc)
+			{
+			framethreads=strtoul(argv[++in],NULL,10);
+			if (framethreads<1)
+				{
+				framethreads=1;
+				}
+			if (framethreads>FRAME_MAX_THREADS)
+				{
+				framethreads=FRAME_MAX_THREADS;
+				}
+			}
+		else if (!strcmp(argv[in],"--release-ids") && in+1<argc)
+			{
+			in++;
+			releaseidrange=1;
+			releaseidfirst=strtoul(argv[in],&p,10);
+			releaseidlast=*p=='-' ? strtoul(p+1,NULL,10) : releaseidfirst;
+			if (releaseidlast<releaseidfirst)
+				{
+				printf("Error: --release-ids %s goes backwards\n",argv[in]);
+				syntax();
+				}
+			}
+		else if (!strcmp(argv[in],"--store"))
+			{
+			store_mode=1;
+			}
+		else if (!strcmp(argv[in],"--index-memory") && in+1<argc)
+			{
+			index_memory=(size_t)strtoul(argv[++in],NULL,10)*1048576;
+			if (index_memory<16777216)
 				{
-				printf("to csvfile: \"%s\"\n",description[i]);
-				fprintf(csvfile,"%s",description[i]);
-				if (i!=format_desc_count-1)
+				index_memory=16777216;
+				}
+			}
+		else if (!strcmp(argv[in],"--dump") && in+3<argc)
+			{
+			if (dumpcount==DUMP_MAX)
+				{
+				printf("Error: no more than %u --dump scans\n",DUMP_MAX);
+				syntax();
+				}
+			in++;
+			for (n=1;n<sizeof(recordtypes)/sizeof(recordtypes[0]);n++)
+				{
+				if (!strcmp(argv[in],recordtypes[n].name))
 					{
-					fprintf(csvfile,FORMAT_DESCRIPTION_SEPARATOR);
+					break;
 					}
 				}
-
-			fprintf(csvfile,"\""); // end field for <description> list
-
-			ch=getchar();
+			if (n==sizeof(recordtypes)/sizeof(recordtypes[0]))
+				{
+				printf("Error: --dump %s isn't one of masters, artists, labels\n",argv[in]);
+				syntax();
+				}
+			dumps[dumpcount].type=&recordtypes[n];
+			dumps[dumpcount].infilename=argv[++in];
+			dumps[dumpcount].outfilename=argv[++in];
+			dumpcount++;
+			}
+		else if (!strcmp(argv[in],"--dump-text") && in+1<argc)
+			{
+			if (!dumpcount)
+				{
+				printf("Error: --dump-text is for the --dump before it\n");
+				syntax();
+				}
+			dumps[dumpcount-1].text=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--io-readers") && in+1<argc)
+			{
+			io_readers=strtoul(argv[++in],NULL,10);
+			if (io_readers<1)
+				{
+				io_readers=1;
+				}
+			}
+		else if (!strcmp(argv[in],"--sample") && in+1<argc)
+			{
+			sample_mode=1;
+			sample_points=strtoul(argv[++in],NULL,10);
+			if (sample_points<1)
+				{
+				sample_points=1;
+				}
+			if (sample_points>SAMPLE_MAX_POINTS)
+				{
+				sample_points=SAMPLE_MAX_POINTS;
+				}
+			}
+		else if (!strcmp(argv[in],"--sample-releases") && in+1<argc)
+			{
+			sample_releases=strtoul(argv[++in],NULL,10);
+			if (sample_releases<1)
+				{
+				sample_releases=1;
+				}
+			}
+		else if (!strcmp(argv[in],"--sample-seed") && in+1<argc)
+			{
+			sample_seed=strtoull(argv[++in],NULL,10);
+			}
+		else if (!strcmp(argv[in],"--sqlite") && in+1<argc)
+			{
+			dbfilename=argv[++in];
+			if (!HAVE_SQLITE)
+				{
+				printf("Error: --sqlite wasn't compiled in (HAVE_SQLITE)\n");
+				syntax();
+				}
+			}
+		else if (!strcmp(argv[in],"--sqlite-batch") && in+1<argc)
+			{
+			db_batch=strtoul(argv[++in],NULL,10);
+			if (db_batch<1)
+				{
+				db_batch=1;
+				}
+			}
+		else if (!strcmp(argv[in],"--json"))
+			{
+			json_mode=1;
+			}
+		else if (!strcmp(argv[in],"--compress") && in+1<argc)
+			{
+			in++;
+			if (!strcmp(argv[in],"gzip") && HAVE_ZLIB)
+				compress_mode=COMPRESS_GZIP;
+			else if (!strcmp(argv[in],"zstd") && HAVE_ZSTD)
+				compress_mode=COMPRESS_ZSTD;
+			else
+				{
+				printf("Error: --compress %s isn't one of gzip, zstd, or wasn't compiled in (HAVE_ZLIB, HAVE_ZSTD)\n",argv[in]);
+				syntax();
+				}
+			}
+		else if (!strcmp(argv[in],"--compress-level") && in+1<argc)
+			{
+			compress_level=atoi(argv[++in]);
+			}
+		else if (!strcmp(argv[in],"--compress-threads") && in+1<argc)
+			{
+			compressthreads=strtoul(argv[++in],NULL,10);
+			if (compressthreads<1)
+				{
+				compressthreads=1;
+				}
+			if (compressthreads>COMPRESS_MAX_THREADS)
+				{
+				compressthreads=COMPRESS_MAX_THREADS;
+				}
+			}
+		else if (!strcmp(argv[in],"--trace") && in+1<argc)
+			{
+			tracefilename=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--trace-events") && in+1<argc)
+			{
+			trace_events=strtoul(argv[++in],NULL,10);  // trace_start() rounds it up
+			}
+		else if (!strcmp(argv[in],"--zero-copy"))
+			{
+#ifdef __linux__
+			zerocopy_mode=1;
+#else
+			printf("Note: --zero-copy is only on Linux, writing outfile as normal\n");
+#endif
+			}
+		else if (!strcmp(argv[in],"--cache-dir") && in+1<argc)
+			{
+			cachedirname=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--cache-size") && in+1<argc)
+			{
+			cache_size=(unsigned long long)strtoul(argv[++in],NULL,10)*1048576;
+			}
+		else if (!strcmp(argv[in],"--columns") && in+1<argc)
+			{
+			schemacolumnlist=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--schema") && in+1<argc)
+			{
+			schemafilename=argv[++in];
+			}
+		else if (!strcmp(argv[in],"--bench"))
+			{
+			bench_mode=1;
+			}
+		else if (!strcmp(argv[in],"--bench-repeats") && in+1<argc)
+			{
+			bench_repeats=strtoul(argv[++in],NULL,10);
+			if (bench_repeats<1)
+				{
+				bench_repeats=1;
+				}
+			}
+		else if (!strcmp(argv[in],"--follow"))
+			{
+			follow_mode=1;
+			}
+		else if (!strcmp(argv[in],"--follow-marker") && in+1<argc)
+			{
+			followmarkername=argv[++in];
+			follow_mode=1;
+			}
+		else if (!strcmp(argv[in],"--threads") && in+1<argc)
+			{
+			poolthreads=strtoul(argv[++in],NULL,10);
+			if (poolthreads>POOL_MAX_THREADS)
+				{
+				poolthreads=POOL_MAX_THREADS;
+				}
+			}
+		else if (!strcmp(argv[in],"--perf-counters"))
+			{
+			perf_option=1;
+			}
+		else if (!strcmp(argv[in],"--stream"))
+			{
+			stream_mode=1;
+			}
+		else if (!strcmp(argv[in],"--validate"))
+			{
+			validate_mode=1;
+			}
+		else if (!strcmp(argv[in],"--merge"))
+			{
+			merge_mode=1;
+			}
+		else if (!strcmp(argv[in],"--shard-max-open") && in+1<argc)
+			{
+			shard_max_open=strtoul(argv[++in],NULL,10);
+			if (shard_max_open<2)
+				{
+				shard_max_open=2;
+				}
+			}
+		else
+			{
+			printf("Error: unknown or incomplete option %s\n",argv[in]);
+			syntax();
+			}
+		}
+	argv[out]=NULL;
+
+	if ((sharddirname==NULL)!=(artistsfilename==NULL))
+		{
+		printf("Error: --shard-dir and --artists must be used together\n");
+		syntax();
+		}
+	shard_mode=(sharddirname!=NULL);
+	if (shard_mode && sort_mode)
+		{
+		printf("Error: --sort does not apply to --shard-dir output\n");
+		syntax();
+		}
+	if (aggregate_mode && (shard_mode || sort_mode))
+		{
+		printf("Error: --aggregate writes no releases to shard or sort\n");
+		syntax();
+		}
+	if (textfieldlist==NULL)
+		{
+		textfieldlist=TEXT_DEFAULT_FIELDS;
+		}
+	if (!text_parse_fields(textfieldlist))
+		{
+		syntax();
+		}
+	if (text_mode && (shard_mode || role_mode))
+		{
+		printf("Error: --text matches on words, not on artists for --shard-dir or --role\n");
+		syntax();
+		}
+	if (role_mode && shard_mode)
+		{
+		printf("Error: --role does not apply to --shard-dir, which matches on --artists\n");
+		syntax();
+		}
+	if (index_build_mode && index_mode)
+		{
+		printf("Error: --build-index writes an index, --index reads one\n");
+		syntax();
+		}
+	if (index_mode && (!text_mode || stream_mode))
+		{
+		printf("Error: --index is for --text searches, without --stream\n");
+		syntax();
+		}
+	if (store_mode && (stream_mode || index_mode))
+		{
+		printf("Error: --store reads a store, not with --stream or --index\n");
+		syntax();
+		}
+	if (store_build_mode && (index_build_mode || index_mode || store_mode))
+		{
+		printf("Error: --build-store is a run of its own\n");
+		syntax();
+		}
+	if ((frames_build_mode || frames_mode) && !HAVE_ZSTD)
+		{
+		printf("Error: --build-frames and --frames weren't compiled in (HAVE_ZSTD)\n");
+		syntax();
+		}
+	if (frames_build_mode && (index_build_mode || store_build_mode || frames_mode))
+		{
+		printf("Error: --build-frames is a run of its own\n");
+		syntax();
+		}
+	if (frames_mode && (stream_mode || index_mode || store_mode || sample_mode || follow_mode || dumpcount || poolthreads || zerocopy_mode || cachedirname!=NULL))
+		{
+		printf("Error: --frames reads a framefile, not with --stream, --index, --store, --sample, --follow, --dump, --threads, --zero-copy or --cache-dir\n");
+		syntax();
+		}
+	if (releaseidrange && !frames_mode)
+		{
+		printf("Error: --release-ids is for --frames\n");
+		syntax();
+		}
+	if (schemacolumnlist!=NULL && schemafilename!=NULL)
+		{
+		printf("Error: give the columns with --columns or --schema, not both\n");
+		syntax();
+		}
+	if ((schemacolumnlist!=NULL || schemafilename!=NULL) && aggregate_mode)
+		{
+		printf("Error: --aggregate writes its own table, not --columns\n");
+		syntax();
+		}
+	if (json_mode && (schemacolumnlist!=NULL || schemafilename!=NULL || aggregate_mode || shard_mode))
+		{
+		printf("Error: --json writes its own objects, not with --columns, --schema, --aggregate or --shard-dir\n");
+		syntax();
+		}
+	if (json_mode && stream_mode)
+		{
+		printf("Error: --json writes every label, format, genre and style of a release, not with --stream\n");
+		syntax();
+		}
+	if (dumpcount && (stream_mode || index_mode || store_mode || sample_mode || follow_mode || cachedirname!=NULL))
+		{
+		printf("Error: --dump runs beside the block search, not with --stream, --index, --store, --sample, --follow or --cache-dir\n");
+		syntax();
+		}
+	for (n=0;n<dumpcount;n++)
+		{
+		if (dumps[n].text==NULL && dumps[n].type->match==NULL)
+			{
+			printf("Error: --dump %s needs --dump-text\n",dumps[n].type->name);
+			syntax();
+			}
+		}
+	if (sample_mode && (stream_mode || index_mode || store_mode || poolthreads || follow_mode || shard_mode || cachedirname!=NULL))
+		{
+		printf("Error: --sample reads infile at its own offsets, not with --stream, --index, --store, --threads, --follow, --shard-dir or --cache-dir\n");
+		syntax();
+		}
+	if (dbfilename!=NULL && (poolthreads || aggregate_mode || shard_mode || cachedirname!=NULL))
+		{
+		printf("Error: --sqlite loads releases from the search thread, not with --threads, --aggregate, --shard-dir or --cache-dir\n");
+		syntax();
+		}
+	if (dbfilename!=NULL && stream_mode)
+		{
+		printf("Error: --sqlite loads every label and format of a release, not with --stream\n");
+		syntax();
+		}
+	if (!schema_compile())
+		{
+		syntax();
+		}
+	if (dbfilename!=NULL)
+		{
+		// every column of releases, and the labels and formats spans for their tables
+		schemaneeds|=SCHEMA_ALL_HEADER|SCHEMA_LABEL_LIST|SCHEMA_FORMAT_LIST;
+		}
+	if (stream_mode && (schemaneeds&(SCHEMA_GENRES|SCHEMA_STYLES|SCHEMA_IDENTIFIERS)))
+		{
+		printf("Error: --stream can't give the genres, styles or identifiers columns\n");
+		syntax();
+		}
+	if (zerocopy_mode && (shard_mode || aggregate_mode))
+		{
+		printf("Error: --zero-copy is for releases written to outfile, not --shard-dir or --aggregate\n");
+		syntax();
+		}
+	if (compress_mode && (shard_mode || zerocopy_mode))
+		{
+		printf("Error: --compress is for outfile and csvfile, not --shard-dir or --zero-copy\n");
+		syntax();
+		}
+	if (cachedirname!=NULL && (shard_mode || follow_mode))
+		{
+		printf("Error: --cache-dir keeps outfile and csvfile of a whole dump, not --shard-dir or --follow\n");
+		syntax();
+		}
+	if (poolthreads && (shard_mode || stream_mode || index_mode || store_mode))
+		{
+		printf("Error: --threads is for the block search, not --shard-dir, --stream, --index or --store\n");
+		syntax();
+		}
+	if (poolthreads && perf_option)
+		{
+		printf("Error: --perf-counters counts the search thread, not the --threads workers\n");
+		syntax();
+		}
+	if (follow_mode && (stream_mode || index_mode || store_mode))
+		{
+		printf("Error: --follow is for the block search, not --stream, --index or --store\n");
+		syntax();
+		}
+	if (stream_mode && shard_mode)
+		{
+		printf("Error: --stream does not do --shard-dir output\n");
+		syntax();
+		}
+	if (end_offset && end_offset<=start_offset)
+		{
+		printf("Error: --end-offset must be after --start-offset\n");
+		syntax();
+		}
+
+	return out;
+}
+
+
+void write_csv_row(void)
+{
+// csvrow from fields and the label and format arrays, in the HEADER_LINE columns.
+// An element that was missing gets EMPTY_FIELD, except title and formats,
+// which are left out, and one that was started but not ended is left out.
+	unsigned int n;
+
+	if (json_mode)
+		{
+		json_write_row();
+		return;
+		}
+	if (schema_mode)
+		{
+		schema_write_row();
+		return;
+		}
+	csvrowlen=0;
+	rowprintf("\"%lu\"",fields.release_id);
+
+	if (fields.title.found>0)
+		{
+		rowprintf(SEPARATOR);
+		rowprintf("\"%.*s\"",(int)fields.title.len,fields.title.ptr);
+		}
+	write_csv_field(&fields.released);
+	write_csv_field(&fields.country);
+	write_csv_field(&fields.notes);
+	if (fields.data_quality.found<0)
+		{
+		rowprintf(SEPARATOR);
+		rowprintf("%s",EMPTY_FIELD);
+		}
+	else
+		{
+		write_csv_field(&fields.data_quality);
+		}
+
+	if (labels_found==0)
+		{
+		rowprintf(SEPARATOR);
+		rowprintf("%s",EMPTY_FIELD);
+		}
+	else if (labels_found>0)
+		{
+//put label and catno data in csvfile as label--catno.  (defined constant, Later, use &ndash;).
+//Into columns:
+// export first label, first catno, firstlabel--firstcatno, then all of them in a column. (4 output columns total)
+		rowprintf(SEPARATOR);
+		rowprintf("\"%s%s%s\"",labelname[0],LABEL_CATNO_SEPARATOR,catno[0]);
+		rowprintf("%s",SEPARATOR);
+		rowprintf("\"%s\"",labelname[0]);
+		rowprintf("%s",SEPARATOR);
+		rowprintf("\"%s\"",catno[0]);
+
+		rowprintf("%s",SEPARATOR);
+		rowprintf("\""); // start field for label+catno list
+		for (n=0;n<catno_count;n++)
+			{
+			rowprintf("%s%s%s",labelname[n],LABEL_CATNO_SEPARATOR,catno[n]);
+			if (n!=catno_count-1)
+				{
+				rowprintf(", ");
+				}
+			}
+		rowprintf("\""); // end field for label+catno list
+		}
+
+	if (formats_found>0)
+		{
+//put format and <description> data in outfile as
+// columns: "format_name", "format_qty", "format_text", "description[format_desc_count]"
+// then a combined version all in one column.
+		rowprintf("%s",SEPARATOR);
+		rowprintf("\"%s\"",format_name);
+		rowprintf("%s",SEPARATOR);
+		rowprintf("\"%s\"",format_qty);
+		rowprintf("%s",SEPARATOR);
+		rowprintf("\"%s\"",format_text);
+		rowprintf("%s",SEPARATOR);
+
+		rowprintf("\""); // start field for <description> list
+		for (n=0;n<format_desc_count;n++)
+			{
+			rowprintf("%s",description[n]);
+			if (n!=format_desc_count-1)
+				{
+				rowprintf(FORMAT_DESCRIPTION_SEPARATOR);
+				}
+			}
+		rowprintf("\""); // end field for <description> list
+
+// Now the combined_description version all in one column.
+// "format_qty"x"format_text", description[format_desc_count]"
+// "2xCD, Reissue, Limited Edition" etc.
+		rowprintf(SEPARATOR);
+		if (!strcmp((char *)format_qty,"1"))
+			{
+			rowprintf("\"%s",format_name);
+			}
+		else
+			{
+			rowprintf("\"%sx%s",format_qty,format_name);
+			}
+		rowprintf("%s",FORMAT_DESCRIPTION_SEPARATOR);
+		for (n=0;n<format_desc_count;n++)
+			{
+			rowprintf("%s",description[n]);
+			if (n!=format_desc_count-1)
+				{
+				rowprintf(FORMAT_DESCRIPTION_SEPARATOR);
+				}
+			}
+		rowprintf("\""); // end field for <description> list
+		}
+
+	if (role_mode)
+		{
+		rowprintf(SEPARATOR);
+		rowprintf("\"%s\"",matchedrole);
+		}
+	rowprintf("\n");
+}
+
+
+void write_csv_field(struct xmlspan *span)
+{
+	if (span->found==0)
+		{
+		rowprintf(SEPARATOR);
+		rowprintf("%s",EMPTY_FIELD);
+		}
+	else if (span->found>0)
+		{
+		rowprintf(SEPARATOR);
+		rowprintf("\"%.*s\"",(int)span->len,span->ptr);
+		}
+}
+
+
+void rowprintf(const char *format, ...)
+{
+// append to the csv line being built by process_xml()
+	va_list args;
+	int n;
+
+	if (!csvrow_enabled)
+		{
+		return;
+		}
+	va_start(args,format);
+	n=vsnprintf((char *)csvrow+csvrowlen,CSVROW_SIZE-csvrowlen,format,args);
+	va_end(args);
+	if (n>0)
+		{
+		csvrowlen+=n;
+		if (csvrowlen>=CSVROW_SIZE)
+			{
+			csvrowlen=CSVROW_SIZE-1;  // truncated
+			}
+		}
+}
+
+
+/*--- sharded output -----------------------------------------
+Each artist listed in the --artists file gets its own xml and csv file in the
+--shard-dir directory.  A matched release is written to the files of every
+listed artist that appears in it.
+
+Thousands of shards can't all be open at once, and can't each be written a
+record at a time without turning the output into lots of small random writes,
+so every shard file has its own memory buffer that is only written out when
+it fills up (or at the end), and only the SHARD_MAX_OPEN_FILES most recently
+written shard files are kept open.  Closed shard files are reopened for append.
+------------------------------------------------------------*/
+
+int shard_load_artists(char *filename)
+{
+// read artist ids, one per line, and set up a shard and hash entry for each.
+// returns the number of artists, -1 if the file can't be read.
+	FILE *artistsfile;
+	char line[100];
+	unsigned long artist_id;
+	unsigned int capacity,slot,n;
+
+	artistsfile=fopen(filename,"rb");
+	if (artistsfile==NULL)
+		{
+		return -1;
+		}
+
+	capacity=0;
+	shardcount=0;
+	while (fgets(line,sizeof(line),artistsfile)!=NULL)
+		{
+		if (strtoul(line,NULL,10)==0)
+			{
+			continue;  // blank or comment line
+			}
+		if (shardcount==capacity)
+			{
+			capacity=capacity ? capacity*2 : 1024;
+			shards=realloc(shards,capacity*sizeof(struct shard));
+			if (shards==NULL)
+				{
+				printf("Error: out of memory loading artists\n");
+				exit(6);
+				}
+			}
+		memset(&shards[shardcount],0,sizeof(struct shard));
+		shards[shardcount].artist_id=strtoul(line,NULL,10);
+		shardcount++;
+		}
+	fclose(artistsfile);
+
+	// hash table at least twice the number of artists, power of 2
+	for (n=16;n<shardcount*2;n*=2)
+		;
+	shardhashmask=n-1;
+	shardhash=calloc(n,sizeof(unsigned int));
+	if (shardhash==NULL)
+		{
+		printf("Error: out of memory loading artists\n");
+		exit(6);
+		}
+
+	for (n=0;n<shardcount;n++)
+		{
+		artist_id=shards[n].artist_id;
+		if (shard_lookup(artist_id)!=NULL)
+			{
+			continue;  // listed twice, the first shard gets it
+			}
+		slot=(unsigned int)(artist_id*2654435761UL)&shardhashmask;
+		while (shardhash[slot])
+			{
+			slot=(slot+1)&shardhashmask;
+			}
+		shardhash[slot]=n+1;
+
+		shards[n].xml.artist_id=artist_id;
+		shards[n].xml.ext=SHARD_XML_EXT;
+		shards[n].csv.artist_id=artist_id;
+		shards[n].csv.ext=SHARD_CSV_EXT;
+		}
+
+	return shardcount;
+}
+
+
+struct shard *shard_lookup(unsigned long artist_id)
+{
+	unsigned int slot;
+
+	slot=(unsigned int)(artist_id*2654435761UL)&shardhashmask;
+	while (shardhash[slot])
+		{
+		if (shards[shardhash[slot]-1].artist_id==artist_id)
+			{
+			return &shards[shardhash[slot]-1];
+			}
+		slot=(slot+1)&shardhashmask;
+		}
+	return NULL;
+}
+
+
+unsigned char *shard_match_release(unsigned char *startptr, size_t len)
+{
+// collect the distinct sharded artists referenced in the release into shardmatch[].
+// returns a pointer to the first match, NULL if the release has none of them.
+	unsigned char *p;
+	unsigned char *endptr;
+	unsigned char *firstmatch;
+	struct shard *s;
+	unsigned int n;
+
+	shardmatchcount=0;
+	firstmatch=NULL;
+	p=startptr;
+	endptr=startptr+len;
+	while ((p=memmem(p,endptr-p,shardartisttag,shardartisttaglen))!=NULL)
+		{
+		p+=shardartisttaglen;
+		s=shard_lookup(strtoul((char *)p,NULL,10));
+		if (s==NULL)
+			{
+			continue;
+			}
+		for (n=0;n<shardmatchcount;n++)
+			{
+			if (shardmatch[n]==s)
+				{
+				break;
+				}
+			}
+		if (n==shardmatchcount && shardmatchcount<MAX_SHARD_MATCHES)
+			{
+			shardmatch[shardmatchcount++]=s;
+			}
+		if (firstmatch==NULL)
+			{
+			firstmatch=p-shardartisttaglen;
+			}
+		}
+	return firstmatch;
+}
+
+
+void shard_write_release(unsigned char *startptr, size_t len)
+{
+// release xml and the csv line in csvrow go to every artist in shardmatch[]
+	unsigned int n;
+	char header[200];
+	int headerlen;
+
+	for (n=0;n<shardmatchcount;n++)
+		{
+		if (!shardmatch[n]->xml.created && shardmatch[n]->xml.len==0)
+			{
+			headerlen=sprintf(header,"\n%s\nArtist id %lu\n\n",VERSION,shardmatch[n]->artist_id);
+			shard_append(&shardmatch[n]->xml,(unsigned char *)header,headerlen);
+			shard_append(&shardmatch[n]->csv,(unsigned char *)header,headerlen);
+			shard_append(&shardmatch[n]->csv,(unsigned char *)csvheader,strlen(csvheader));
+			}
+		shard_append(&shardmatch[n]->xml,startptr,len);
+		shard_append(&shardmatch[n]->xml,(unsigned char *)newline,1);
+		shard_append(&shardmatch[n]->csv,csvrow,csvrowlen);
+		}
+}
+
+
+void shard_append(struct shardfile *sf, unsigned char *data, size_t len)
+{
+	if (sf->len+len>sf->cap && sf->cap<SHARD_BUFFER_SIZE)
+		{
+		shard_grow(sf,sf->len+len);
+		}
+	if (sf->len+len>sf->cap)
+		{
+		shard_flush(sf);
+		}
+	if (len>sf->cap)
+		{
+		shard_write(sf,data,len);  // bigger than a whole buffer, write it straight out
+		}
+	else
+		{
+		memcpy(sf->buf+sf->len,data,len);
+		sf->len+=len;
+		}
+}
+
+
+void shard_grow(struct shardfile *sf, size_t needed)
+{
+// double the buffer until it holds needed bytes or reaches SHARD_BUFFER_SIZE
+	size_t newcap;
+	unsigned char *newbuf;
+
+	newcap=sf->cap ? sf->cap : SHARD_INITIAL_BUFFER;
+	while (newcap<needed && newcap<SHARD_BUFFER_SIZE)
+		{
+		newcap*=2;
+		}
+	if (newcap>SHARD_BUFFER_SIZE)
+		{
+		newcap=SHARD_BUFFER_SIZE;
+		}
+	if (newcap==sf->cap)
+		{
+		return;
+		}
+
+	while (shardbufferbytes+newcap-sf->cap>SHARD_MEMORY_LIMIT)
+		{
+		shard_reclaim(sf);
+		}
+
+	newbuf=realloc(sf->buf,newcap);
+	if (newbuf==NULL)
+		{
+		printf("Error: out of memory for shard buffers\n");
+		exit(6);
+		}
+	shardbufferbytes+=newcap-sf->cap;
+	sf->buf=newbuf;
+	sf->cap=newcap;
+}
+
+
+void shard_reclaim(struct shardfile *exclude)
+{
+// write out and free the fullest buffer, so the next write is as large as possible
+	struct shardfile *sf;
+	struct shardfile *fullest;
+	unsigned int n;
+
+	fullest=NULL;
+	for (n=0;n<shardcount*2;n++)
+		{
+		sf=(n&1) ? &shards[n/2].csv : &shards[n/2].xml;
+		if (sf!=exclude && sf->cap && (fullest==NULL || sf->len>fullest->len))
+			{
+			fullest=sf;
+			}
+		}
+	if (fullest==NULL)
+		{
+		printf("Error: SHARD_MEMORY_LIMIT is smaller than SHARD_BUFFER_SIZE\n");
+		exit(6);
+		}
+
+	shard_flush(fullest);
+	free(fullest->buf);
+	shardbufferbytes-=fullest->cap;
+	fullest->buf=NULL;
+	fullest->cap=0;
+}
+
+
+void shard_flush(struct shardfile *sf)
+{
+	if (sf->len)
+		{
+		shard_write(sf,sf->buf,sf->len);
+		sf->len=0;
+		}
+}
+
+
+void shard_write(struct shardfile *sf, unsigned char *data, size_t len)
+{
+	FILE *fp;
+
+	fp=shard_open(sf);
+	if (fp==NULL || fwrite(data,len,1,fp)!=1)
+		{
+		errorcount++;
+		printf("Error %lu: failed to write %lu bytes to shard %lu%s\n",errorcount,(unsigned long)len,sf->artist_id,sf->ext);
+#if WRITE_DEBUG_FILE
+		fprintf(debugfile,"Error %lu: failed to write %lu bytes to shard %lu%s\n",errorcount,(unsigned long)len,sf->artist_id,sf->ext);
+#endif
+		return;
+		}
+	shardwrites++;
+	shardbyteswritten+=len;
+}
+
+
+FILE *shard_open(struct shardfile *sf)
+{
+// returns the open file for sf, opening it (and closing the least recently used
+// shard file if the cache is full) when needed.  Keeps the cache in LRU order.
+	char filename[1000];
+	struct shardfile *victim;
+
+	if (sf->fp!=NULL)
+		{
+		if (sf!=shardlru_head)
+			{
+			// unlink, then fall through to put it at the head
+			sf->lru_prev->lru_next=sf->lru_next;
+			if (sf->lru_next!=NULL)
+				sf->lru_next->lru_prev=sf->lru_prev;
+			else
+				shardlru_tail=sf->lru_prev;
+			sf->lru_prev=NULL;
+			sf->lru_next=shardlru_head;
+			shardlru_head->lru_prev=sf;
+			shardlru_head=sf;
+			}
+		return sf->fp;
+		}
+
+	if (shardopencount>=shard_max_open)
+		{
+		victim=shardlru_tail;
+		shardlru_tail=victim->lru_prev;
+		if (shardlru_tail!=NULL)
+			shardlru_tail->lru_next=NULL;
+		else
+			shardlru_head=NULL;
+		fclose(victim->fp);
+		victim->fp=NULL;
+		victim->lru_prev=NULL;
+		shardopencount--;
+		shardevictions++;
+		}
+
+	sprintf(filename,"%s/%lu%s",sharddirname,sf->artist_id,sf->ext);
+	sf->fp=fopen(filename,sf->created ? "ab" : "wb");
+	if (sf->fp==NULL)
+		{
+		return NULL;
+		}
+	setvbuf(sf->fp,NULL,_IONBF,0);  // already buffered in sf->buf
+	sf->created=1;
+	shardopens++;
+	shardopencount++;
+
+	sf->lru_prev=NULL;
+	sf->lru_next=shardlru_head;
+	if (shardlru_head!=NULL)
+		shardlru_head->lru_prev=sf;
+	else
+		shardlru_tail=sf;
+	shardlru_head=sf;
+
+	return sf->fp;
+}
+
+
+void shard_closeall(void)
+{
+	unsigned int n;
+	unsigned int written;
+
+	written=0;
+	for (n=0;n<shardcount;n++)
+		{
+		shard_flush(&shards[n].xml);
+		shard_flush(&shards[n].csv);
+		if (shards[n].xml.created)
+			{
+			written++;
+			}
+		}
+	while (shardlru_head!=NULL)
+		{
+		fclose(shardlru_head->fp);
+		shardlru_head->fp=NULL;
+		shardlru_head=shardlru_head->lru_next;
+		}
+	shardlru_tail=NULL;
+	shardopencount=0;
+
+	for (n=0;n<shardcount;n++)
+		{
+		free(shards[n].xml.buf);
+		free(shards[n].csv.buf);
+		}
+	free(shards);
+	free(shardhash);
+	shards=NULL;
+	shardhash=NULL;
+
+	printf("Shards: %u of %u artists written, %lu writes, %llu bytes, %lu opens, %lu evictions\n",written,shardcount,shardwrites,shardbyteswritten,shardopens,shardevictions);
+	fprintf(outfile,"Shards: %u of %u artists written, %lu writes, %llu bytes, %lu opens, %lu evictions\n",written,shardcount,shardwrites,shardbyteswritten,shardopens,shardevictions);
+	shardcount=0;
+}
+
+
+/*--- sorted csv output --------------------------------------
+csv lines are collected in sortarena with their (master_id, release_id) keys.
+When sort_memory is used up they are sorted, and written to a run file next to
+csvfile.  At the end the runs are merged SORT_MAX_MERGE at a time into csvfile,
+dropping lines whose keys equal the line before.  If everything fit in memory,
+no run file is written at all.
+
+Run file records are: master_id, release_id (unsigned long long), line length
+(unsigned int), then the csv line.
+------------------------------------------------------------*/
+
+void sort_add_row(void)
+{
+// keep csvrow for sorting, keyed on fields
+	size_t newcap;
+
+	if (sortentrycount && sortarenalen+csvrowlen+(sortentrycount+1)*sizeof(struct sortentry)>sort_memory)
+		{
+		sort_write_run();
+		}
+
+	if (sortarenalen+csvrowlen>sortarenacap)
+		{
+		newcap=sortarenacap ? sortarenacap*2 : 1048576;
+		while (newcap<sortarenalen+csvrowlen)
+			{
+			newcap*=2;
+			}
+		sortarena=realloc(sortarena,newcap);
+		if (sortarena==NULL)
+			{
+			printf("Error: out of memory for --sort\n");
+			exit(6);
+			}
+		sortarenacap=newcap;
+		}
+	if (sortentrycount==sortentrycap)
+		{
+		sortentrycap=sortentrycap ? sortentrycap*2 : 16384;
+		sortentries=realloc(sortentries,sortentrycap*sizeof(struct sortentry));
+		if (sortentries==NULL)
+			{
+			printf("Error: out of memory for --sort\n");
+			exit(6);
+			}
+		}
+
+	sortentries[sortentrycount].master_id=fields.master_id;
+	sortentries[sortentrycount].release_id=rel_id;
+	sortentries[sortentrycount].offset=sortarenalen;
+	sortentries[sortentrycount].len=csvrowlen;
+	sortentrycount++;
+	memcpy(sortarena+sortarenalen,csvrow,csvrowlen);
+	sortarenalen+=csvrowlen;
+	sortrowsin++;
+}
+
+
+int sort_compare(const void *a, const void *b)
+{
+	const struct sortentry *x=a;
+	const struct sortentry *y=b;
+
+	if (x->master_id!=y->master_id)
+		return x->master_id<y->master_id ? -1 : 1;
+	if (x->release_id!=y->release_id)
+		return x->release_id<y->release_id ? -1 : 1;
+	return 0;
+}
+
+
+int sort_compare_runs(struct sortrun *a, struct sortrun *b)
+{
+	if (a->master_id!=b->master_id)
+		return a->master_id<b->master_id ? -1 : 1;
+	if (a->release_id!=b->release_id)
+		return a->release_id<b->release_id ? -1 : 1;
+	return 0;
+}
+
+
+void sort_write_run(void)
+{
+// sort what is in memory and write it to the next run file (or to csvfile, if
+// nothing has gone to disk and this is the end)
+	char runname[1000];
+	FILE *runfile;
+	size_t n;
+	struct sortentry *e;
+
+	qsort(sortentries,sortentrycount,sizeof(struct sortentry),sort_compare);
+
+	sprintf(runname,"%s%s%u",csvfilename,SORT_RUN_EXT,sortnextrun);
+	runfile=fopen(runname,"wb");
+	if (runfile==NULL)
+		{
+		printf("Error: can't create sort run file %s\n",runname);
+		exit(7);
+		}
+	setvbuf(runfile,NULL,_IOFBF,SORT_IO_BUFFER);
+
+	for (n=0;n<sortentrycount;n++)
+		{
+		e=&sortentries[n];
+		if (n && !sort_compare(e,e-1))
+			{
+			sortduplicates++;
+			continue;
+			}
+		fwrite(&e->master_id,sizeof(e->master_id),1,runfile);
+		fwrite(&e->release_id,sizeof(e->release_id),1,runfile);
+		fwrite(&e->len,sizeof(e->len),1,runfile);
+		fwrite(sortarena+e->offset,e->len,1,runfile);
+		}
+	if (fclose(runfile))
+		{
+		printf("Error: failed writing sort run file %s\n",runname);
+		exit(7);
+		}
+
+	sortruns=realloc(sortruns,(sortruncount+1)*sizeof(unsigned int));
+	sortruns[sortruncount++]=sortnextrun++;
+	sortrunswritten++;
+	sortentrycount=0;
+	sortarenalen=0;
+}
+
+
+int sort_read_record(struct sortrun *run)
+{
+// next record of a run file into run, returns 0 at the end of the run
+	if (fread(&run->master_id,sizeof(run->master_id),1,run->fp)!=1
+	 || fread(&run->release_id,sizeof(run->release_id),1,run->fp)!=1
+	 || fread(&run->len,sizeof(run->len),1,run->fp)!=1)
+		{
+		return 0;
+		}
+	if (run->len>run->rowcap)
+		{
+		run->rowcap=run->len;
+		run->row=realloc(run->row,run->rowcap);
+		if (run->row==NULL)
+			{
+			printf("Error: out of memory for --sort\n");
+			exit(6);
+			}
+		}
+	return fread(run->row,run->len,1,run->fp)==1 || run->len==0;
+}
+
+
+void sort_merge(unsigned int *runs, unsigned int count, FILE *out, int final)
+{
+// k-way merge of run files into out, with a heap of the runs ordered by their
+// current record.  final writes just the csv lines, otherwise run records.
+// The run files are deleted.
+	struct sortrun *run;
+	unsigned int *heap;
+	unsigned int heapcount;
+	unsigned int n,parent,child,top;
+	char runname[1000];
+	unsigned long long lastmaster,lastrelease;
+	int havelast;
+
+	run=calloc(count,sizeof(struct sortrun));
+	heap=malloc(count*sizeof(unsigned int));
+	if (run==NULL || heap==NULL)
+		{
+		printf("Error: out of memory for --sort\n");
+		exit(6);
+		}
+
+	heapcount=0;
+	for (n=0;n<count;n++)
+		{
+		sprintf(runname,"%s%s%u",csvfilename,SORT_RUN_EXT,runs[n]);
+		run[n].fp=fopen(runname,"rb");
+		if (run[n].fp==NULL)
+			{
+			printf("Error: can't reopen sort run file %s\n",runname);
+			exit(7);
+			}
+		setvbuf(run[n].fp,NULL,_IOFBF,SORT_IO_BUFFER);
+		if (!sort_read_record(&run[n]))
+			{
+			continue;
+			}
+		// sift up
+		child=heapcount++;
+		while (child)
+			{
+			parent=(child-1)/2;
+			if (sort_compare_runs(&run[n],&run[heap[parent]])>=0)
+				break;
+			heap[child]=heap[parent];
+			child=parent;
+			}
+		heap[child]=n;
+		}
+
+	havelast=0;
+	lastmaster=0;
+	lastrelease=0;
+	while (heapcount)
+		{
+		top=heap[0];
+		if (havelast && run[top].master_id==lastmaster && run[top].release_id==lastrelease)
+			{
+			sortduplicates++;
+			}
+		else
+			{
+			if (!final)
+				{
+				fwrite(&run[top].master_id,sizeof(run[top].master_id),1,out);
+				fwrite(&run[top].release_id,sizeof(run[top].release_id),1,out);
+				fwrite(&run[top].len,sizeof(run[top].len),1,out);
+				}
+			else
+				{
+				sortrowsout++;
+				}
+			fwrite(run[top].row,run[top].len,1,out);
+			lastmaster=run[top].master_id;
+			lastrelease=run[top].release_id;
+			havelast=1;
+			}
+
+		if (!sort_read_record(&run[top]))
+			{
+			top=heap[--heapcount];  // run finished, last heap entry sifts down from the top
+			}
+		// sift down
+		parent=0;
+		while ((child=parent*2+1)<heapcount)
+			{
+			if (child+1<heapcount && sort_compare_runs(&run[heap[child+1]],&run[heap[child]])<0)
+				child++;
+			if (sort_compare_runs(&run[heap[child]],&run[top])>=0)
+				break;
+			heap[parent]=heap[child];
+			parent=child;
+			}
+		if (heapcount)
+			heap[parent]=top;
+		}
+
+	for (n=0;n<count;n++)
+		{
+		fclose(run[n].fp);
+		free(run[n].row);
+		sprintf(runname,"%s%s%u",csvfilename,SORT_RUN_EXT,runs[n]);
+		remove(runname);
+		}
+	free(run);
+	free(heap);
+}
+
+
+void sort_finish(void)
+{
+// write the sorted csv lines to csvfile
+	size_t n;
+	struct sortentry *e;
+	char runname[1000];
+	FILE *runfile;
+
+	if (sortruncount==0)
+		{
+		// all in memory
+		qsort(sortentries,sortentrycount,sizeof(struct sortentry),sort_compare);
+		for (n=0;n<sortentrycount;n++)
+			{
+			e=&sortentries[n];
+			if (n && !sort_compare(e,e-1))
+				{
+				sortduplicates++;
+				continue;
+				}
+			fwrite(sortarena+e->offset,e->len,1,csvfile);
+			sortrowsout++;
+			}
+		}
+	else
+		{
+		if (sortentrycount)
+			{
+			sort_write_run();
+			}
+		free(sortarena);
+		free(sortentries);
+		sortarena=NULL;
+		sortentries=NULL;
+		sortarenacap=0;
+		sortentrycap=0;
+
+		// merge passes until the rest can be merged in one go
+		while (sortruncount>SORT_MAX_MERGE)
+			{
+			sprintf(runname,"%s%s%u",csvfilename,SORT_RUN_EXT,sortnextrun);
+			runfile=fopen(runname,"wb");
+			if (runfile==NULL)
+				{
+				printf("Error: can't create sort run file %s\n",runname);
+				exit(7);
+				}
+			setvbuf(runfile,NULL,_IOFBF,SORT_IO_BUFFER);
+			sort_merge(sortruns,SORT_MAX_MERGE,runfile,0);
+			fclose(runfile);
+			memmove(sortruns,sortruns+SORT_MAX_MERGE,(sortruncount-SORT_MAX_MERGE)*sizeof(unsigned int));
+			sortruncount-=SORT_MAX_MERGE;
+			sortruns[sortruncount++]=sortnextrun++;
+			}
+		sort_merge(sortruns,sortruncount,csvfile,1);
+		sortruncount=0;
+		}
+
+	free(sortarena);
+	free(sortentries);
+	free(sortruns);
+	sortarena=NULL;
+	sortentries=NULL;
+	sortruns=NULL;
+	sortentrycount=0;
+	sortarenalen=0;
+
+	printf("Sort: %lu csv lines in, %lu out, %lu duplicates dropped, %lu runs\n",sortrowsin,sortrowsout,sortduplicates,sortrunswritten);
+	fprintf(outfile,"Sort: %lu csv lines in, %lu out, %lu duplicates dropped, %lu runs\n",sortrowsin,sortrowsout,sortduplicates,sortrunswritten);
+}
+
+
+/*--- aggregation --------------------------------------------
+Each matched release adds 1 to the group named by its values of the
+--aggregate fields, in an open addressed hash table of the group keys.
+A field with several values in one release (label, catno, description) adds
+the release to one group per distinct value, so with two such fields it's one
+per combination.  Missing values group as "".
+------------------------------------------------------------*/
+
+int aggregate_parse_fields(char *list)
+{
+// comma separated field names into aggregatefields[], returns 0 if one is unknown
+	char *p;
+	char *comma;
+	size_t len;
+	int f;
+
+	aggregatefieldcount=0;
+	for (p=list;*p;p=comma+1)
+		{
+		comma=strchr(p,',');
+		if (comma==NULL)
+			{
+			comma=p+strlen(p);  // last one
+			}
+		len=comma-p;
+		for (f=0;aggregate_field_names[f]!=NULL;f++)
+			{
+			if (len==strlen(aggregate_field_names[f]) && !strncmp(p,aggregate_field_names[f],len))
+				{
+				break;
+				}
+			}
+		if (aggregate_field_names[f]==NULL || aggregatefieldcount==AGGREGATE_MAX_FIELDS)
+			{
+			printf("Error: can't aggregate by \"%.*s\" (up to %u of the listed fields)\n",(int)len,p,AGGREGATE_MAX_FIELDS);
+			return 0;
+			}
+		aggregatefields[aggregatefieldcount++]=f;
+		if (*comma=='\0')
+			{
+			break;
+			}
+		}
+	return aggregatefieldcount;
+}
+
+
+unsigned int aggregate_value_count(int field)
+{
+// how many values the current release has for field
+	switch (field)
+		{
+		case AGG_LABEL:
+		case AGG_CATNO:
+			return catno_count ? catno_count : 1;
+		case AGG_DESCRIPTION:
+			return format_desc_count ? format_desc_count : 1;
+		default:
+			return 1;
+		}
+}
+
+
+unsigned char *aggregate_value(int field, unsigned int index, size_t *len)
+{
+// value number index of field in the current release
+	unsigned char *value;
+
+	value=(unsigned char *)"";
+	*len=0;
+	switch (field)
+		{
+		case AGG_COUNTRY:
+			value=fields.country.ptr;
+			*len=fields.country.len;
+			break;
+		case AGG_YEAR:
+			value=fields.released.ptr;
+			*len=fields.released.len<AGGREGATE_YEAR_LEN ? fields.released.len : AGGREGATE_YEAR_LEN;
+			break;
+		case AGG_RELEASED:
+			value=fields.released.ptr;
+			*len=fields.released.len;
+			break;
+		case AGG_FORMAT:
+			value=format_name;
+			*len=strlen((char *)format_name);
+			break;
+		case AGG_LABEL:
+			if (index<catno_count)
+				{
+				value=labelname[index];
+				*len=strlen((char *)labelname[index]);
+				}
+			break;
+		case AGG_CATNO:
+			if (index<catno_count)
+				{
+				value=catno[index];
+				*len=strlen((char *)catno[index]);
+				}
+			break;
+		case AGG_DESCRIPTION:
+			if (index<format_desc_count)
+				{
+				value=description[index];
+				*len=strlen((char *)description[index]);
+				}
+			break;
+		case AGG_DATA_QUALITY:
+			value=fields.data_quality.ptr;
+			*len=fields.data_quality.len;
+			break;
+		}
+	if (value==NULL)
+		{
+		value=(unsigned char *)"";
+		*len=0;
+		}
+	return value;
+}
+
+
+int aggregate_repeated_value(int field, unsigned int index)
+{
+// 1 if value number index of field is the same as an earlier one, so a
+// release with two 12" formats is only counted once for 12"
+	unsigned char *value;
+	unsigned char *earlier;
+	size_t len,earlierlen;
+	unsigned int n;
+
+	value=aggregate_value(field,index,&len);
+	for (n=0;n<index;n++)
+		{
+		earlier=aggregate_value(field,n,&earlierlen);
+		if (len==earlierlen && !memcmp(value,earlier,len))
+			{
+			return 1;
+			}
+		}
+	return 0;
+}
+
+
+void aggregate_release(void)
+{
+// count the current release (fields from process_xml()) in every group it belongs to
+	unsigned int index[AGGREGATE_MAX_FIELDS];
+	unsigned char key[AGGREGATE_MAX_KEY];
+	unsigned int keylen;
+	unsigned char *value;
+	size_t len;
+	unsigned int f;
+	int repeated;
+
+	aggregatereleases++;
+	memset(index,0,sizeof(index));
+	for (;;)
+		{
+		keylen=0;
+		repeated=0;
+		for (f=0;f<aggregatefieldcount;f++)
+			{
+			repeated|=aggregate_repeated_value(aggregatefields[f],index[f]);
+			value=aggregate_value(aggregatefields[f],index[f],&len);
+			// truncated to leave a byte for the tab after it
+			if (keylen>=AGGREGATE_MAX_KEY-1)
+				len=0;
+			else if (len>AGGREGATE_MAX_KEY-keylen-1)
+				len=AGGREGATE_MAX_KEY-keylen-1;
+			memcpy(key+keylen,value,len);
+			keylen+=len;
+			if (f!=aggregatefieldcount-1 && keylen<AGGREGATE_MAX_KEY)
+				{
+				key[keylen++]='\t';
+				}
+			}
+		if (!repeated)
+			{
+			aggregate_add(key,keylen);
+			}
+
+		// next combination of multi-valued fields, last field fastest
+		for (f=aggregatefieldcount;f>0;f--)
+			{
+			if (++index[f-1]<aggregate_value_count(aggregatefields[f-1]))
+				{
+				break;
+				}
+			index[f-1]=0;
+			}
+		if (f==0)
+			{
+			break;
+			}
+		}
+}
+
+
+void aggregate_add(unsigned char *key, unsigned int keylen)
+{
+	unsigned int hash,slot,n;
+	struct aggregate_entry *e;
+
+	// FNV-1a
+	hash=2166136261u;
+	for (n=0;n<keylen;n++)
+		{
+		hash=(hash^key[n])*16777619u;
+		}
+
+	if ((aggregatecount+1)*2>aggregatetablesize)
+		{
+		aggregate_grow();
+		}
+
+	slot=hash&(aggregatetablesize-1);
+	for (;;)
+		{
+		e=&aggregatetable[slot];
+		if (e->key==NULL)
+			{
+			e->key=malloc(keylen ? keylen : 1);
+			if (e->key==NULL)
+				{
+				printf("Error: out of memory for --aggregate\n");
+				exit(6);
+				}
+			memcpy(e->key,key,keylen);
+			e->keylen=keylen;
+			e->hash=hash;
+			e->count=1;
+			aggregatecount++;
+			return;
+			}
+		if (e->hash==hash && e->keylen==keylen && !memcmp(e->key,key,keylen))
+			{
+			e->count++;
+			return;
+			}
+		slot=(slot+1)&(aggregatetablesize-1);
+		}
+}
+
+
+void aggregate_grow(void)
+{
+// double the hash table (starting at 1024 slots) and rehash
+	struct aggregate_entry *old;
+	unsigned int oldsize,n,slot;
+
+	old=aggregatetable;
+	oldsize=aggregatetablesize;
+	aggregatetablesize=oldsize ? oldsize*2 : 1024;
+	aggregatetable=calloc(aggregatetablesize,sizeof(struct aggregate_entry));
+	if (aggregatetable==NULL)
+		{
+		printf("Error: out of memory for --aggregate\n");
+		exit(6);
+		}
+	for (n=0;n<oldsize;n++)
+		{
+		if (old[n].key==NULL)
+			{
+			continue;
+			}
+		slot=old[n].hash&(aggregatetablesize-1);
+		while (aggregatetable[slot].key!=NULL)
+			{
+			slot=(slot+1)&(aggregatetablesize-1);
+			}
+		aggregatetable[slot]=old[n];
+		}
+	free(old);
+}
+
+
+int aggregate_compare(const void *a, const void *b)
+{
+// largest count first, then by key
+	const struct aggregate_entry *x=a;
+	const struct aggregate_entry *y=b;
+	int c;
+
+	if (x->count!=y->count)
+		return x->count>y->count ? -1 : 1;
+	c=memcmp(x->key,y->key,x->keylen<y->keylen ? x->keylen : y->keylen);
+	if (c)
+		return c;
+	return x->keylen<y->keylen ? -1 : x->keylen>y->keylen;
+}
+
+
+void aggregate_write_key(FILE *fp, struct aggregate_entry *e)
+{
+// "value"	"value"... as csv fields
+	unsigned int n;
+
+	fputc('"',fp);
+	for (n=0;n<e->keylen;n++)
+		{
+		if (e->key[n]=='\t')
+			fprintf(fp,"\"%s\"",SEPARATOR);
+		else
+			fputc(e->key[n],fp);
+		}
+	fputc('"',fp);
+}
+
+
+void aggregate_finish(void)
+{
+// write the table to csvfile, largest group first, and show the top of it
+	unsigned int n,f;
+	struct aggregate_entry *e;
+	double scale=0.0;
+
+	// pack the used slots to the front and sort them
+	for (n=0,f=0;n<aggregatetablesize;n++)
+		{
+		if (aggregatetable[n].key!=NULL)
+			{
+			aggregatetable[f++]=aggregatetable[n];
+			}
+		}
+	qsort(aggregatetable,aggregatecount,sizeof(struct aggregate_entry),aggregate_compare);
+
+	for (f=0;f<aggregatefieldcount;f++)
+		{
+		fprintf(csvfile,"\"%s\"%s",aggregate_field_names[aggregatefields[f]],SEPARATOR);
+		}
+	if (sample_mode)
+		{
+		// the sampled counts, and scaled up to the estimated matches
+		scale=aggregatereleases ? samplematched/aggregatereleases : 0.0;
+		fprintf(csvfile,"\"releases\"%s\"estimated\"\n",SEPARATOR);
+		}
+	else
+		fprintf(csvfile,"\"releases\"\n");
+	printf("\n%u groups of %lu releases by %s:\n",aggregatecount,aggregatereleases,aggregatefieldlist);
+	for (n=0;n<aggregatecount;n++)
+		{
+		e=&aggregatetable[n];
+		aggregate_write_key(csvfile,e);
+		if (sample_mode)
+			fprintf(csvfile,"%s\"%lu\"%s\"%.0f\"\n",SEPARATOR,e->count,SEPARATOR,e->count*scale);
+		else
+			fprintf(csvfile,"%s\"%lu\"\n",SEPARATOR,e->count);
+		if (n<AGGREGATE_PRINT_ROWS)
+			{
+			aggregate_write_key(stdout,e);
+			if (sample_mode)
+				printf("%s%lu%s~%.0f\n",SEPARATOR,e->count,SEPARATOR,e->count*scale);
+			else
+				printf("%s%lu\n",SEPARATOR,e->count);
+			}
+		free(e->key);
+		}
+	if (aggregatecount>AGGREGATE_PRINT_ROWS)
+		{
+		printf("... %u more in %s\n",aggregatecount-AGGREGATE_PRINT_ROWS,csvfilename);
+		}
+	fprintf(outfile,"Aggregated %lu releases into %u groups by %s\n",aggregatereleases,aggregatecount,aggregatefieldlist);
+
+	free(aggregatetable);
+	aggregatetable=NULL;
+	aggregatetablesize=0;
+	aggregatecount=0;
+}
+
+
+/*--- merge of byte range outputs ----------------------------
+The outputs of --start-offset/--end-offset runs look just like whole-file
+outputs.  The first part's headers are kept, every part's releases are copied
+in order, and the close files summaries of the parts are replaced by one with
+the counts added up.  Parts are copied in BLOCKSIZE pieces, never parsed.
+
+The csv part is copied through its column names line, whatever the columns
+(--columns, --schema), as long as every part has the same ones, or from the
+top with --json, which has no header.  Parts made with --sort or --aggregate
+are refused: their csv lines would need merging or adding up, not copying.
+Every part is checked before anything is written, and outputs left half
+done by a part that fails later are removed.
+------------------------------------------------------------*/
+
+void merge_outputs(int argc, char *argv[])
+{
+// argv: outfile csvfile, then xml, csv (and debug) file of each part
+	FILE *in;
+	unsigned int perpart,parts,part;
+	long long bodypos,footerpos;
+	unsigned long processed,matched,errors;
+	unsigned long dprocessed,dmatched,derrors;
+	char **name;
+	char columns[1000];
+	char partcolumns[1000];
+
+	perpart=WRITE_DEBUG_FILE ? 3 : 2;
+	if (argc<3+(int)perpart || (argc-3)%perpart)
+		{
+		syntax();
+		}
+	parts=(argc-3)/perpart;
+
+	for (part=0;part<parts;part++)
+		{
+		name=&argv[3+part*perpart];
+		if (!merge_check_part(name,part==0 ? columns : partcolumns))
+			{
+			errorcode=8;
+			return;
+			}
+		if (part>0 && strcmp(columns,partcolumns))
+			{
+			printf("Error: %s doesn't have the same columns as %s\n",name[1],argv[4]);
+			errorcode=8;
+			return;
+			}
+		}
+
+	strcpy((char *)outfilename,argv[1]);
+	strcpy((char *)csvfilename,argv[2]);
+	strcpy((char *)debugfilename,debugfileoption!=NULL ? debugfileoption : DEBUGFILENAME);
+	outfile=fopen((char *)outfilename,"wb");
+	csvfile=fopen((char *)csvfilename,"wb");
+	if (outfile==NULL || csvfile==NULL)
+		{
+		printf("outfile or csvfile failed!\n");
+		merge_abandon();
+		errorcode=2;
+		return;
+		}
+#if WRITE_DEBUG_FILE
+	debugfile=fopen((char *)debugfilename,"wb");
+	if (debugfile==NULL)
+		{
+		printf("debugfile failed!\n");
+		merge_abandon();
+		errorcode=4;
+		return;
+		}
+#endif
+
+	for (part=0;part<parts;part++)
+		{
+		name=&argv[3+part*perpart];
+		printf("Merging part %u: %s %s%s%s\n",part+1,name[0],name[1],perpart==3 ? " " : "",perpart==3 ? name[2] : "");
+
+		// xml: header (first part only), releases, summary
+		in=fopen(name[0],"rb");
+		if (in==NULL || !merge_copy_header(in,part==0 ? outfile : NULL,"Searching input file",1)
+		 || (bodypos=ftell64(in))<0 || !merge_find_footer(in,&footerpos,&processed,&matched,&errors))
+			{
+			printf("Error: %s is not an xml outfile of a byte range run\n",name[0]);
+			if (in!=NULL)
+				fclose(in);
+			merge_abandon();
+			errorcode=8;
+			return;
+			}
+		merge_copy_range(in,outfile,bodypos,footerpos);
+		fclose(in);
+		releasecount+=processed;
+		foundcount+=matched;
+		errorcount+=errors;
+
+		// csv: header (first part only) through the column names, then the
+		// lines.  JSON Lines has no header.
+		in=fopen(name[1],"rb");
+		if (in==NULL || (columns[0]!='\0' && !merge_copy_header(in,part==0 ? csvfile : NULL,columns,0))
+		 || (bodypos=ftell64(in))<0)
+			{
+			printf("Error: %s is not a csvfile of a byte range run\n",name[1]);
+			if (in!=NULL)
+				fclose(in);
+			merge_abandon();
+			errorcode=8;
+			return;
+			}
+		fseek64(in,0,SEEK_END);
+		merge_copy_range(in,csvfile,bodypos,ftell64(in));
+		fclose(in);
+
+#if WRITE_DEBUG_FILE
+		in=fopen(name[2],"rb");
+		if (in==NULL || !merge_copy_header(in,part==0 ? debugfile : NULL,"Debug output of found releases and errors:",1)
+		 || (bodypos=ftell64(in))<0 || !merge_find_footer(in,&footerpos,&dprocessed,&dmatched,&derrors))
+			{
+			printf("Error: %s is not a debug file of a byte range run\n",name[2]);
+			if (in!=NULL)
+				fclose(in);
+			merge_abandon();
+			errorcode=8;
+			return;
+			}
+		merge_copy_range(in,debugfile,bodypos,footerpos);
+		fclose(in);
+#endif
+		}
+
+	printf("Saved %lu releases containing searchstring among %lu total releases.\n",foundcount,releasecount);
+	printf("close files.  processed %lu releases, matched %lu releases\n",	releasecount,foundcount);
+	fprintf(outfile,"\n\nclose files.  processed %lu releases, matched %lu releases\n",	releasecount,foundcount);
+	fprintf(outfile,"%lu errors.\n",errorcount);
+	fclose(outfile);
+	fclose(csvfile);
+#if WRITE_DEBUG_FILE
+	fprintf(debugfile,"\n\nclose files.  processed %lu releases, matched %lu releases\n",	releasecount,foundcount);
+	fprintf(debugfile,"%lu errors.\n",errorcount);
+	fclose(debugfile);
+#endif
+}
+
+
+int merge_check_part(char **name, char *columns)
+{
+// 1 if the part's xml and csv can be merged by copying, with its csv column
+// names line in columns ("" for JSON Lines).  Says why not if they can't.
+	FILE *in;
+	char line[1000];
+	unsigned int n;
+	int aggregated,json;
+	long long footerpos;
+	unsigned long processed,matched,errors;
+
+	// xml: --aggregate says so in the header, --sort just before the summary
+	in=fopen(name[0],"rb");
+	if (in==NULL)
+		{
+		printf("Error: can't open %s\n",name[0]);
+		return 0;
+		}
+	aggregated=0;
+	for (n=0;n<MERGE_MAX_HEADER_LINES && fgets(line,sizeof(line),in)!=NULL;n++)
+		{
+		if (!strncmp(line,MERGE_AGGREGATE_LINE,strlen(MERGE_AGGREGATE_LINE)))
+			{
+			aggregated=1;
+			}
+		}
+	if (!merge_find_footer(in,&footerpos,&processed,&matched,&errors))
+		{
+		printf("Error: %s is not an xml outfile of a byte range run\n",name[0]);
+		fclose(in);
+		return 0;
+		}
+	fclose(in);
+	if (aggregated)
+		{
+		printf("Error: %s is from an --aggregate run, its table can't be merged\n",name[0]);
+		return 0;
+		}
+	if (strstr((char *)tempbuffer,MERGE_SORT_LINE)!=NULL)
+		{
+		printf("Error: %s is from a --sort run, its sorted lines can't be merged\n",name[0]);
+		return 0;
+		}
+
+	// csv: the column names are the first line starting with a quote
+	in=fopen(name[1],"rb");
+	if (in==NULL)
+		{
+		printf("Error: can't open %s\n",name[1]);
+		return 0;
+		}
+	columns[0]='\0';
+	json=0;
+	for (n=0;n<MERGE_MAX_HEADER_LINES && fgets(line,sizeof(line),in)!=NULL;n++)
+		{
+		if (line[0]=='{' && n==0)
+			{
+			json=1;
+			break;
+			}
+		if (line[0]=='"')
+			{
+			strcpy(columns,line);
+			break;
+			}
+		}
+	fclose(in);
+	if (columns[0]=='\0' && !json)
+		{
+		printf("Error: %s is not a csvfile of a byte range run\n",name[1]);
+		return 0;
+		}
+	return 1;
+}
+
+
+void merge_abandon(void)
+{
+// close and remove the outputs of a merge that failed part way
+	if (outfile!=NULL)
+		{
+		fclose(outfile);
+		outfile=NULL;
+		remove((char *)outfilename);
+		}
+	if (csvfile!=NULL)
+		{
+		fclose(csvfile);
+		csvfile=NULL;
+		remove((char *)csvfilename);
+		}
+#if WRITE_DEBUG_FILE
+	if (debugfile!=NULL)
+		{
+		fclose(debugfile);
+		debugfile=NULL;
+		remove((char *)debugfilename);
+		}
+#endif
+}
+
+
+int merge_copy_header(FILE *in, FILE *out, const char *lastline, int extralines)
+{
+// copy (or just skip, if out is NULL) the lines of in up to the one starting
+// with lastline, and extralines more.  0 if lastline isn't near the top.
+	char line[1000];
+	unsigned int n;
+
+	for (n=0;n<MERGE_MAX_HEADER_LINES;n++)
+		{
+		if (fgets(line,sizeof(line),in)==NULL)
+			{
+			return 0;
+			}
+		if (out!=NULL)
+			{
+			fputs(line,out);
+			}
+		if (!strncmp(line,lastline,strlen(lastline)))
+			{
+			break;
+			}
+		}
+	if (n==MERGE_MAX_HEADER_LINES)
+		{
+		return 0;
+		}
+	while (extralines--)
+		{
+		if (fgets(line,sizeof(line),in)==NULL)
+			{
+			return 0;
+			}
+		if (out!=NULL)
+			{
+			fputs(line,out);
+			}
+		}
+	return 1;
+}
+
+
+int merge_find_footer(FILE *in, long long *footerpos, unsigned long *processed, unsigned long *matched, unsigned long *errors)
+{
+// find the last close files summary in the tail of in, and read its counts
+	long long size,tailpos;
+	size_t taillen;
+	unsigned char *p;
+	unsigned char *last;
+
+	fseek64(in,0,SEEK_END);
+	size=ftell64(in);
+	tailpos=size>MERGE_TAIL ? size-MERGE_TAIL : 0;
+	fseek64(in,tailpos,SEEK_SET);
+	taillen=fread(tempbuffer,1,(size_t)(size-tailpos),in);
+	tempbuffer[taillen]='\0';
+
+	last=NULL;
+	p=tempbuffer;
+	while ((p=memmem(p,tempbuffer+taillen-p,(unsigned char *)CLOSE_FILES_LINE,strlen(CLOSE_FILES_LINE)))!=NULL)
+		{
+		last=p++;
+		}
+	if (last==NULL
+	 || sscanf((char *)last+2,"close files.  processed %lu releases, matched %lu releases\n%lu errors.",processed,matched,errors)!=3)
+		{
+		return 0;
+		}
+	*footerpos=tailpos+(last-tempbuffer);
+	return 1;
+}
+
+
+void merge_copy_range(FILE *in, FILE *out, long long from, long long to)
+{
+	size_t len;
+
+	fseek64(in,from,SEEK_SET);
+	while (from<to)
+		{
+		len=(size_t)(to-from>BLOCKSIZE ? BLOCKSIZE : to-from);
+		len=fread(tempbuffer,1,len,in);
+		if (len==0)
+			{
+			break;
+			}
+		if (fwrite(tempbuffer,len,1,out)!=1)
+			{
+			errorcount++;
+			printf("Error %lu: failed to write merged output\n",errorcount);
+			break;
+			}
+		from+=len;
+		}
+}
+
+
+/*--- live metrics -------------------------------------------
+--metrics-file is rewritten every metrics_interval seconds during the scan.
+The clock is only looked at every METRICS_CHECK_RELEASES releases.  The file
+is written to name.tmp and renamed over name, so a reader never sees half of
+it.  A stalled run shows up as discogs_scan_last_update_timestamp_seconds
+no longer moving.
+------------------------------------------------------------*/
+
+void metrics_start(void)
+{
+	long long here;
+	long long filesize;
+
+	here=ftell64(infile);
+	fseek64(infile,0,SEEK_END);
+	filesize=ftell64(infile);
+	fseek64(infile,here,SEEK_SET);
+
+	if (end_offset && (long long)end_offset<filesize)
+		{
+		filesize=end_offset;
+		}
+	scantotalbytes=filesize-(long long)start_offset;
+	if (scantotalbytes<0)
+		{
+		scantotalbytes=0;
+		}
+
+	scanposition=start_offset;
+	metricsstarttime=time(NULL);
+	metricslasttime=metricsstarttime;
+	metricslastreleases=0;
+	metricslastposition=scanposition;
+	metricsreleaserate=0;
+	metricsbyterate=0;
+	metrics_write(0);
+}
+
+
+void metrics_check(unsigned long releaseid)
+{
+// called during the scan, writes the metrics if metrics_interval is up
+	time_t now;
+
+	now=time(NULL);
+	if (now-metricslasttime<(time_t)metrics_interval)
+		{
+		return;
+		}
+
+	// rates over the last interval, so a slowdown shows straight away
+	metricsreleaserate=(double)(releasecount-metricslastreleases)/(double)(now-metricslasttime);
+	metricsbyterate=(double)(scanposition-metricslastposition)/(double)(now-metricslasttime);
+	metricslasttime=now;
+	metricslastreleases=releasecount;
+	metricslastposition=scanposition;
+	current_release_id=releaseid;
+
+	metrics_write(0);
+}
+
+
+void metrics_write(int final)
+{
+	char tmpname[1000];
+	FILE *fp;
+	long long done_bytes;
+	double eta;
+	time_t now;
+
+	now=time(NULL);
+	done_bytes=scanposition-(long long)start_offset;
+	if (final)
+		{
+		eta=0;
+		}
+	else if (metricsbyterate>0)
+		{
+		eta=(double)(scantotalbytes-done_bytes)/metricsbyterate;
+		}
+	else
+		{
+		eta=-1;  // not known yet
+		}
+
+	sprintf(tmpname,"%s%s",metricsfilename,METRICS_TMP_EXT);
+	fp=fopen(tmpname,"wb");
+	if (fp==NULL)
+		{
+		printf("Error: can't write metrics file %s\n",tmpname);
+		return;
+		}
+
+	fprintf(fp,"# HELP discogs_scan_bytes_processed Bytes of infile scanned so far.\n");
+	fprintf(fp,"# TYPE discogs_scan_bytes_processed gauge\n");
+	fprintf(fp,"discogs_scan_bytes_processed %lld\n",done_bytes);
+	fprintf(fp,"# HELP discogs_scan_bytes_total Bytes of infile to scan.\n");
+	fprintf(fp,"# TYPE discogs_scan_bytes_total gauge\n");
+	fprintf(fp,"discogs_scan_bytes_total %lld\n",scantotalbytes);
+	fprintf(fp,"# HELP discogs_scan_releases_total Releases scanned.\n");
+	fprintf(fp,"# TYPE discogs_scan_releases_total counter\n");
+	fprintf(fp,"discogs_scan_releases_total %lu\n",releasecount);
+	fprintf(fp,"# HELP discogs_scan_matches_total Releases matched.\n");
+	fprintf(fp,"# TYPE discogs_scan_matches_total counter\n");
+	fprintf(fp,"discogs_scan_matches_total %lu\n",foundcount);
+	fprintf(fp,"# HELP discogs_scan_errors_total Write and other errors.\n");
+	fprintf(fp,"# TYPE discogs_scan_errors_total counter\n");
+	fprintf(fp,"discogs_scan_errors_total %lu\n",errorcount);
+	fprintf(fp,"# HELP discogs_scan_releases_per_second Releases scanned per second over the last interval.\n");
+	fprintf(fp,"# TYPE discogs_scan_releases_per_second gauge\n");
+	fprintf(fp,"discogs_scan_releases_per_second %.1f\n",metricsreleaserate);
+	fprintf(fp,"# HELP discogs_scan_bytes_per_second Bytes scanned per second over the last interval.\n");
+	fprintf(fp,"# TYPE discogs_scan_bytes_per_second gauge\n");
+	fprintf(fp,"discogs_scan_bytes_per_second %.0f\n",metricsbyterate);
+	fprintf(fp,"# HELP discogs_scan_current_release_id Id of the release being scanned.\n");
+	fprintf(fp,"# TYPE discogs_scan_current_release_id gauge\n");
+	fprintf(fp,"discogs_scan_current_release_id %lu\n",current_release_id);
+	fprintf(fp,"# HELP discogs_scan_buffer_refills_total Blocks read into inputbuffer.\n");
+	fprintf(fp,"# TYPE discogs_scan_buffer_refills_total counter\n");
+	fprintf(fp,"discogs_scan_buffer_refills_total %lu\n",readblockcount);
+	fprintf(fp,"# HELP discogs_scan_seek_backs_total Seeks back to re-read a release or start tag split by a block end.\n");
+	fprintf(fp,"# TYPE discogs_scan_seek_backs_total counter\n");
+	fprintf(fp,"discogs_scan_seek_backs_total %lu\n",seekbackcount);
+	fprintf(fp,"# HELP discogs_scan_eta_seconds Estimated seconds to the end of the scan, -1 if not known yet.\n");
+	fprintf(fp,"# TYPE discogs_scan_eta_seconds gauge\n");
+	fprintf(fp,"discogs_scan_eta_seconds %.0f\n",eta);
+	fprintf(fp,"# HELP discogs_scan_elapsed_seconds Seconds since the scan started.\n");
+	fprintf(fp,"# TYPE discogs_scan_elapsed_seconds gauge\n");
+	fprintf(fp,"discogs_scan_elapsed_seconds %lld\n",(long long)(now-metricsstarttime));
+	fprintf(fp,"# HELP discogs_scan_last_update_timestamp_seconds When this file was written.\n");
+	fprintf(fp,"# TYPE discogs_scan_last_update_timestamp_seconds gauge\n");
+	fprintf(fp,"discogs_scan_last_update_timestamp_seconds %lld\n",(long long)now);
+	fprintf(fp,"# HELP discogs_scan_done 1 once the scan has finished.\n");
+	fprintf(fp,"# TYPE discogs_scan_done gauge\n");
+	fprintf(fp,"discogs_scan_done %d\n",final);
+	if (fclose(fp))
+		{
+		printf("Error: can't write metrics file %s\n",tmpname);
+		return;
+		}
+
+#ifdef _WIN32
+	remove(metricsfilename);  // rename won't replace on windows
+#endif
+	if (rename(tmpname,metricsfilename))
+		{
+		printf("Error: can't rename %s to %s\n",tmpname,metricsfilename);
+		}
+}
+
+
+/*--- streaming parser ---------------------------------------
+--stream reads infile front to back once, with no seeking back, through a
+resumable XML tokenizer (xmlstream_feed()).  The tokenizer keeps its state
+between calls, so a block can end anywhere, even in the middle of a tag or an
+attribute value.  It calls the SAX style callbacks in struct xmlstream for each
+start tag, attribute, piece of text and end tag.
+
+The stream_ callbacks pick the fields out as they go by, into fixed size
+buffers, and match the release on the <artist><id> text of SEARCH_STRING.
+At </release> a matched release is written like in the default search.  If it
+started before the current block, its xml is copied from infile by file offset
+through a second file handle, so a release of any size is handled in the same
+memory.  Entities are left as they are, as process_xml() does.
+------------------------------------------------------------*/
+
+void xmlstream_init(struct xmlstream *xs, long long offset)
+{
+	memset(xs,0,sizeof(*xs));
+	xs->state=XS_TEXT;
+	xs->offset=offset;
+}
+
+
+int xmlstream_lookup(unsigned char *name)
+{
+// element id of name, ELEM_OTHER if it's not one that the callbacks use
+	int n;
+
+	for (n=1;stream_element_names[n]!=NULL;n++)
+		{
+		if (!strcmp((char *)name,stream_element_names[n]))
+			{
+			return n;
+			}
+		}
+	return ELEM_OTHER;
+}
+
+
+int xmlstream_parent(struct xmlstream *xs, unsigned int up)
+{
+// element id up levels above the current element (0 is the current element)
+	if (up>=xs->depth || xs->depth-up>STREAM_MAX_DEPTH)
+		{
+		return ELEM_OTHER;
+		}
+	return xs->stack[xs->depth-1-up];
+}
+
+
+void xmlstream_open_tag(struct xmlstream *xs)
+{
+	xs->name[xs->namelen]='\0';
+	xs->elem=xmlstream_lookup(xs->name);
+	if (xs->depth<STREAM_MAX_DEPTH)
+		{
+		xs->stack[xs->depth]=xs->elem;
+		}
+	xs->depth++;
+	if (xs->start_element!=NULL)
+		{
+		xs->start_element(xs);
+		}
+}
+
+
+void xmlstream_close_tag(struct xmlstream *xs)
+{
+	if (xs->depth==0)
+		{
+		return;  // stray end tag
+		}
+	xs->elem=xmlstream_parent(xs,0);
+	if (xs->end_element!=NULL)
+		{
+		xs->end_element(xs);
+		}
+	xs->depth--;
+	xs->emptytag=0;
+}
+
+
+size_t xmlstream_feed(struct xmlstream *xs, unsigned char *data, size_t len)
+{
+// feed the next len bytes of the document.  Returns the number of bytes used,
+// which is less than len only if a callback set xs->stop.
+	unsigned char *p,*q,*end;
+	unsigned char c;
+	size_t n;
+
+	p=data;
+	end=data+len;
+	while (p<end && !xs->stop)
+		{
+		switch (xs->state)
+			{
+			case XS_TEXT:
+				q=memchr(p,'<',end-p);
+				if (q==NULL)
+					{
+					q=end;
+					}
+				if (q>p && xs->text!=NULL)
+					{
+					xs->text(xs,p,q-p);
+					}
+				if (q<end)
+					{
+					xs->tagoffset=xs->offset+(q-data);
+					xs->state=XS_TAG;
+					q++;
+					}
+				p=q;
+				break;
+
+			case XS_TAG:
+				c=*p++;
+				xs->namelen=0;
+				xs->emptytag=0;
+				if (c=='/')
+					{
+					xs->state=XS_END_NAME;
+					}
+				else if (c=='!')
+					{
+					xs->state=XS_BANG;
+					}
+				else if (c=='?')
+					{
+					xs->terminator="?>";
+					xs->matched=0;
+					xs->state=XS_SPECIAL;
+					}
+				else
+					{
+					xs->name[xs->namelen++]=c;
+					xs->state=XS_NAME;
+					}
+				break;
+
+			case XS_NAME:
+				c=*p++;
+				if (c=='>' || c=='/' || c==' ' || c=='\t' || c=='\r' || c=='\n')
+					{
+					xmlstream_open_tag(xs);
+					if (c=='>')
+						{
+						xs->endoffset=xs->offset+(p-data);
+						xs->state=XS_TEXT;
+						}
+					else if (c=='/')
+						xs->state=XS_EMPTY;
+					else
+						xs->state=XS_ATTRS;
+					}
+				else if (xs->namelen<STREAM_NAME_MAX-1)
+					{
+					xs->name[xs->namelen++]=c;
+					}
+				break;
+
+			case XS_ATTRS:
+				c=*p++;
+				if (c=='>')
+					{
+					xs->endoffset=xs->offset+(p-data);
+					xs->state=XS_TEXT;
+					}
+				else if (c=='/')
+					{
+					xs->state=XS_EMPTY;
+					}
+				else if (c!=' ' && c!='\t' && c!='\r' && c!='\n')
+					{
+					xs->attrname[0]=c;
+					xs->attrnamelen=1;
+					xs->state=XS_ATTR_NAME;
+					}
+				break;
+
+			case XS_ATTR_NAME:
+				c=*p++;
+				if (c=='=')
+					{
+					xs->state=XS_ATTR_QUOTE;
+					}
+				else if (c==' ' || c=='\t' || c=='\r' || c=='\n')
+					{
+					xs->state=XS_ATTR_EQ;
+					}
+				else if (xs->attrnamelen<STREAM_NAME_MAX-1)
+					{
+					xs->attrname[xs->attrnamelen++]=c;
+					}
+				break;
+
+			case XS_ATTR_EQ:
+			case XS_ATTR_QUOTE:
+				c=*p;
+				if (c==' ' || c=='\t' || c=='\r' || c=='\n')
+					{
+					p++;
+					}
+				else if (c=='=' && xs->state==XS_ATTR_EQ)
+					{
+					p++;
+					xs->state=XS_ATTR_QUOTE;
+					}
+				else if ((c=='"' || c=='\'') && xs->state==XS_ATTR_QUOTE)
+					{
+					p++;
+					xs->quote=c;
+					xs->attrvaluelen=0;
+					xs->state=XS_ATTR_VALUE;
+					}
+				else
+					{
+					xs->state=XS_ATTRS;  // attribute without a value, take c as the next one
+					}
+				break;
+
+			case XS_ATTR_VALUE:
+				q=memchr(p,xs->quote,end-p);
+				if (q==NULL)
+					{
+					q=end;
+					}
+				n=q-p;
+				if (n>STREAM_ATTR_MAX-1-xs->attrvaluelen)
+					{
+					n=STREAM_ATTR_MAX-1-xs->attrvaluelen;
+					}
+				memcpy(xs->attrvalue+xs->attrvaluelen,p,n);
+				xs->attrvaluelen+=n;
+				p=q;
+				if (q<end)
+					{
+					p++;
+					xs->attrname[xs->attrnamelen]='\0';
+					xs->attrvalue[xs->attrvaluelen]='\0';
+					if (xs->attribute!=NULL)
+						{
+						xs->attribute(xs);
+						}
+					xs->state=XS_ATTRS;
+					}
+				break;
+
+			case XS_EMPTY:
+				c=*p++;
+				if (c=='>')
+					{
+					xs->endoffset=xs->offset+(p-data);
+					xs->emptytag=1;
+					xmlstream_close_tag(xs);
+					xs->state=XS_TEXT;
+					}
+				else
+					{
+					xs->state=XS_ATTRS;
+					p--;
+					}
+				break;
+
+			case XS_END_NAME:
+			case XS_END_WAIT:
+				c=*p++;
+				if (c=='>')
+					{
+					xs->endoffset=xs->offset+(p-data);
+					xmlstream_close_tag(xs);
+					xs->state=XS_TEXT;
+					}
+				else if (c==' ' || c=='\t' || c=='\r' || c=='\n')
+					{
+					xs->state=XS_END_WAIT;
+					}
+				break;
+
+			case XS_BANG:
+				// <!-- comment -->, <![CDATA[ text ]]> or <!DOCTYPE ...>
+				c=*p++;
+				xs->matched=0;
+				if (c=='-')
+					{
+					xs->terminator="-->";
+					xs->state=XS_SPECIAL;
+					}
+				else if (c=='[')
+					{
+					xs->state=XS_CDATA_OPEN;
+					}
+				else
+					{
+					xs->terminator=">";
+					xs->state=XS_SPECIAL;
+					}
+				break;
+
+			case XS_CDATA_OPEN:
+				// skip "CDATA["
+				if (*p++=='[')
+					{
+					xs->state=XS_CDATA;
+					}
+				break;
+
+			case XS_SPECIAL:
+				c=*p++;
+				if (c==(unsigned char)xs->terminator[xs->matched])
+					{
+					xs->matched++;
+					if (xs->terminator[xs->matched]=='\0')
+						{
+						xs->state=XS_TEXT;
+						}
+					}
+				else if (c==(unsigned char)xs->terminator[0])
+					{
+					if (xs->matched<2 || xs->terminator[1]!=c)
+						{
+						xs->matched=1;  // "--->" is still the end of a comment
+						}
+					}
+				else
+					{
+					xs->matched=0;
+					}
+				break;
+
+			case XS_CDATA:
+				// the text up to "]]>"
+				c=*p++;
+				if (c==']' && xs->matched<2)
+					{
+					xs->matched++;
+					}
+				else if (c=='>' && xs->matched==2)
+					{
+					xs->state=XS_TEXT;
+					}
+				else if (c==']')
+					{
+					if (xs->text!=NULL)
+						{
+						xs->text(xs,(unsigned char *)"]",1);  // "]]]" keeps the last two
+						}
+					}
+				else
+					{
+					if (xs->text!=NULL)
+						{
+						if (xs->matched)
+							{
+							xs->text(xs,(unsigned char *)"]]",xs->matched);
+							}
+						xs->text(xs,p-1,1);
+						}
+					xs->matched=0;
+					}
+				break;
+			}
+		}
+	n=p-data;
+	xs->offset+=n;
+	return n;
+}
+
+
+void stream_input_file(void)
+{
+// --stream: the search of process_input_file() done by the streaming parser
+	unsigned char *tagptr;
+	unsigned char *p;
+	long long resyncpos;
+	size_t used;
+
+	printf("Searching input file	%s: \n",infilename);
+	fprintf(outfile,"Searching input file	%s: \n\n",infilename);
+
+	begin_time=clock();
+	if (metricsfilename!=NULL)
+		{
+		metrics_start();
+		}
+	if (perf_option)
+		{
+		perf_start();
+		}
+	readblockcount=1;
+
+	// the artist id text to match, from SEARCH_STRING
+	tagptr=(unsigned char *)SEARCH_STRING;
+	if (strncmp((char *)tagptr,SHARD_ARTIST_TAG,shardartisttaglen))
+		{
+		printf("Error: --stream needs SEARCH_STRING to be %s...</id>\n",SHARD_ARTIST_TAG);
+		errorcount++;
+		return;
+		}
+	tagptr+=shardartisttaglen;
+	p=(unsigned char *)strchr((char *)tagptr,'<');
+	streamartistidlen=p!=NULL ? (size_t)(p-tagptr) : strlen((char *)tagptr);
+	if (streamartistidlen>=sizeof(streamartistid))
+		{
+		streamartistidlen=sizeof(streamartistid)-1;
+		}
+	memcpy(streamartistid,tagptr,streamartistidlen);
+
+	xmlstream_init(&stream,0);
+	if (start_offset || end_offset)
+		{
+		printf("Searching releases starting from byte %llu to ",start_offset);
+		if (end_offset)
+			printf("%llu\n",end_offset);
+		else
+			printf("the end\n");
+		}
+	if (start_offset)
+		{
+		// start at the first release at or after start_offset, as if inside <releases>
+		resyncpos=stream_resync((long long)start_offset);
+		if (resyncpos<0 || fseek64(infile,resyncpos,SEEK_SET))
+			{
+			printf("No release starts after --start-offset %llu\n",start_offset);
+			resyncpos=-1;
+			}
+		xmlstream_init(&stream,resyncpos);
+		stream.stack[0]=ELEM_RELEASES;
+		stream.depth=1;
+		if (resyncpos<0)
+			{
+			stream.stop=1;
+			}
+		}
+	stream.start_element=stream_start_element;
+	stream.attribute=stream_attribute;
+	stream.text=stream_text;
+	stream.end_element=stream_end_element;
+	streamrelease=0;
+
+	while (!stream.stop)
+		{
+		blockfileposition=stream.offset;
+		perfstage(PERF_READ);
+		tracebegin(TRACE_READ);
+		readresult=fread(inputbuffer,1,BLOCKSIZE,infile);
+		traceend(TRACE_READ,blockfileposition);
+		perfstage(PERF_SEARCH);
+		if (readresult==0)
+			{
+			break;
+			}
+		readblockcount++;
+		used=xmlstream_feed(&stream,inputbuffer,readresult);
+		scanposition=blockfileposition+used;
+		}
+
+	if (streamrelease && !stream.stop)
+		{
+		errorcount++;
+		printf("Error %lu: input ends inside release %lu\n",errorcount,rel_id);
+#if WRITE_DEBUG_FILE
+		fprintf(debugfile,"Error %lu: input ends inside release %lu\n",errorcount,rel_id);
+#endif
+		}
+	if (stream.stop && end_offset)
+		{
+		printf("End offset %llu reached\n",end_offset);
+		}
+	if (streamcopyfile!=NULL)
+		{
+		fclose(streamcopyfile);
+		streamcopyfile=NULL;
+		}
+
+	if (metricsfilename!=NULL)
+		{
+		scanposition=(long long)start_offset+scantotalbytes;  // all of it
+		metrics_write(1);
+		}
+
+	end_time=clock();
+	printf("End of file encountered at readblockcount %lu\n",readblockcount);
+	execution_time=end_time-begin_time;
+	printf("Execution time: %ld\n",execution_time);
+	printf("%lu releases copied back from infile\n",streamcopies);
+	printf("Saved %lu releases containing searchstring among %lu total releases.\n",foundcount,releasecount);
+	printf("Press Enter to continue\n");
+	ch=getchar();
+}
+
+
+long long stream_resync(long long offset)
+{
+// file offset of the first SEARCH_START at or after offset, -1 if none
+	unsigned char *p;
+	size_t len;
+
+	while (!fseek64(infile,offset,SEEK_SET))
+		{
+		len=fread(inputbuffer,1,BLOCKSIZE,infile);
+		if (len<(size_t)startstringlen)
+			{
+			break;
+			}
+		p=memmem(inputbuffer,len,startsearchbuffer,startstringlen);
+		if (p!=NULL)
+			{
+			return offset+(p-inputbuffer);
+			}
+		if (len<BLOCKSIZE)
+			{
+			break;
+			}
+		offset+=len-(startstringlen-1);  // in case it's split by the block end
+		}
+	return -1;
+}
+
+
+void stream_start_element(struct xmlstream *xs)
+{
+	int parent;
+
+	parent=xmlstream_parent(xs,1);
+	if (xs->elem==ELEM_RELEASE && xs->depth==2)
+		{
+		if (end_offset && xs->tagoffset>=(long long)end_offset)
+			{
+			xs->stop=1;  // the rest belongs to the next byte range
+			return;
+			}
+		streamrelease=1;
+		streamreleasestart=xs->tagoffset;
+		streammatched=0;
+		streamcapture=NULL;
+		streamformatcount=0;
+		rel_id=0;
+		process_xml_reset();
+		streamtitle.len=streamreleased.len=streamcountry.len=streamnotes.len=0;
+		streamdataquality.len=streammasterid.len=0;
+		streamartisthit=0;
+		return;
+		}
+	if (!streamrelease)
+		{
+		return;
+		}
+
+	switch (xs->elem)
+		{
+		case ELEM_TITLE:
+			if (parent==ELEM_RELEASE && !fields.title.found)
+				stream_capture(xs,&streamtitle);
+			break;
+		case ELEM_RELEASED:
+			if (parent==ELEM_RELEASE && !fields.released.found)
+				stream_capture(xs,&streamreleased);
+			break;
+		case ELEM_COUNTRY:
+			if (parent==ELEM_RELEASE && !fields.country.found)
+				stream_capture(xs,&streamcountry);
+			break;
+		case ELEM_NOTES:
+			if (parent==ELEM_RELEASE && !fields.notes.found)
+				stream_capture(xs,&streamnotes);
+			break;
+		case ELEM_DATA_QUALITY:
+			if (parent==ELEM_RELEASE && !fields.data_quality.found)
+				stream_capture(xs,&streamdataquality);
+			break;
+		case ELEM_MASTER_ID:
+			if (parent==ELEM_RELEASE && !streammasterid.len)
+				stream_capture(xs,&streammasterid);
+			break;
+		case ELEM_LABEL:
+			if (parent==ELEM_LABELS && catno_count<MAX_CATNO_COUNT)
+				{
+				catno[catno_count][0]='\0';
+				labelname[catno_count][0]='\0';
+				}
+			break;
+		case ELEM_FORMAT:
+			if (parent==ELEM_FORMATS)
+				streamformatcount++;
+			break;
+		case ELEM_DESCRIPTION:
+			if (parent==ELEM_DESCRIPTIONS && format_desc_count<MAX_DESCRIPTION_COUNT)
+				stream_capture(xs,&streamtext);
+			break;
+		case ELEM_ID:
+			if (parent==ELEM_ARTIST && !streammatched)
+				stream_capture(xs,&streamtext);
+			break;
+		case ELEM_ARTIST:
+			streamartisthit=0;
+			streamrole.len=0;
+			if (xmlstream_parent(xs,2)!=ELEM_RELEASE)
+				streamartistwhere=ROLE_TRACK;
+			else if (parent==ELEM_EXTRAARTISTS)
+				streamartistwhere=ROLE_EXTRA;
+			else
+				streamartistwhere=ROLE_MAIN;
+			break;
+		case ELEM_ROLE:
+			if (parent==ELEM_ARTIST && streamartisthit)
+				stream_capture(xs,&streamrole);
+			break;
+		}
+}
+
+
+void stream_capture(struct xmlstream *xs, struct streamfield *sf)
+{
+// collect the text of the current element into sf
+	sf->len=0;
+	streamcapture=sf;
+	streamcapturedepth=xs->depth;
+}
+
+
+void stream_attribute(struct xmlstream *xs)
+{
+	unsigned char *dest;
+	size_t cap;
+	unsigned char *xptr;
+
+	if (xs->elem==ELEM_RELEASE && xs->depth==2)
+		{
+		if (!strcmp((char *)xs->attrname,"id"))
+			{
+			rel_id=strtoul((char *)xs->attrvalue,NULL,10);
+			}
+		return;
+		}
+	if (!streamrelease)
+		{
+		return;
+		}
+
+	dest=NULL;
+	cap=0;
+	if (xs->elem==ELEM_LABEL && xmlstream_parent(xs,1)==ELEM_LABELS && catno_count<MAX_CATNO_COUNT)
+		{
+		if (!strcmp((char *)xs->attrname,"catno"))
+			{
+			dest=catno[catno_count];
+			cap=MAX_CATNO_LEN;
+			}
+		else if (!strcmp((char *)xs->attrname,"name"))
+			{
+			dest=labelname[catno_count];
+			cap=MAX_LABELNAME_LEN;
+			}
+		}
+	else if (xs->elem==ELEM_FORMAT && streamformatcount==1 && xmlstream_parent(xs,1)==ELEM_FORMATS)
+		{
+		if (!strcmp((char *)xs->attrname,"name"))
+			{
+			dest=format_name;
+			cap=sizeof(format_name);
+			}
+		else if (!strcmp((char *)xs->attrname,"qty"))
+			{
+			dest=format_qty;
+			cap=sizeof(format_qty);
+			}
+		else if (!strcmp((char *)xs->attrname,"text"))
+			{
+			dest=format_text;
+			cap=sizeof(format_text);
+			}
+		}
+	if (dest==NULL)
+		{
+		return;
+		}
+	sprintf((char *)dest,"%.*s",(int)(xs->attrvaluelen<cap ? xs->attrvaluelen : cap-1),xs->attrvalue);
+	if (dest==labelname[catno_count])
+		{
+		//strip " (3)" from labelname if present
+		xptr=(unsigned char *)strstr((char *)dest," (");
+		if (xptr!=NULL)
+			{
+			*xptr='\0';
+			}
+		}
+}
+
+
+void stream_text(struct xmlstream *xs, unsigned char *data, size_t len)
+{
+	if (streamcapture==NULL || xs->depth!=streamcapturedepth)
+		{
+		return;
+		}
+	if (len>STREAM_FIELD_MAX-streamcapture->len)
+		{
+		len=STREAM_FIELD_MAX-streamcapture->len;  // the rest is dropped
+		}
+	memcpy(streamcapture->buf+streamcapture->len,data,len);
+	streamcapture->len+=len;
+}
+
+
+void stream_end_element(struct xmlstream *xs)
+{
+	int parent;
+	struct streamfield *sf;
+
+	if (!streamrelease)
+		{
+		return;
+		}
+	parent=xmlstream_parent(xs,1);
+	sf=NULL;
+	if (streamcapture!=NULL && xs->depth==streamcapturedepth)
+		{
+		sf=streamcapture;
+		streamcapture=NULL;
+		}
+
+	switch (xs->elem)
+		{
+		case ELEM_RELEASE:
+			if (xs->depth==2)
+				{
+				stream_end_release(xs);
+				}
+			break;
+		case ELEM_TITLE:
+			stream_set_field(xs,sf,&streamtitle,&fields.title);
+			break;
+		case ELEM_RELEASED:
+			stream_set_field(xs,sf,&streamreleased,&fields.released);
+			break;
+		case ELEM_COUNTRY:
+			stream_set_field(xs,sf,&streamcountry,&fields.country);
+			break;
+		case ELEM_NOTES:
+			stream_set_field(xs,sf,&streamnotes,&fields.notes);
+			break;
+		case ELEM_DATA_QUALITY:
+			stream_set_field(xs,sf,&streamdataquality,&fields.data_quality);
+			break;
+		case ELEM_LABEL:
+			if (parent==ELEM_LABELS && catno_count<MAX_CATNO_COUNT)
+				catno_count++;
+			break;
+		case ELEM_LABELS:
+			if (parent==ELEM_RELEASE && !xs->emptytag)
+				labels_found=1;
+			break;
+		case ELEM_FORMATS:
+			if (parent==ELEM_RELEASE && !xs->emptytag && streamformatcount)
+				formats_found=1;
+			break;
+		case ELEM_DESCRIPTION:
+			if (sf==&streamtext)
+				{
+				sprintf((char *)description[format_desc_count],"%.*s",(int)(sf->len<MAX_DESCRIPTION_LEN ? sf->len : MAX_DESCRIPTION_LEN-1),sf->buf);
+				format_desc_count++;
+				}
+			break;
+		case ELEM_ID:
+			if (sf==&streamtext && sf->len==streamartistidlen && !memcmp(sf->buf,streamartistid,sf->len))
+				{
+				if (role_mode)
+					streamartisthit=1;  // the role comes later in the <artist>
+				else
+					streammatched=1;
+				}
+			break;
+		case ELEM_ARTIST:
+			if (streamartisthit && !streammatched && role_accept(streamartistwhere,streamrole.buf,streamrole.len))
+				streammatched=1;
+			streamartisthit=0;
+			break;
+		}
+}
+
+
+void stream_set_field(struct xmlstream *xs, struct streamfield *sf, struct streamfield *want, struct xmlspan *span)
+{
+// sf was collected, if it is the one for span, point span at it
+	if (sf!=want || xs->emptytag)
+		{
+		return;  // <notes/> counts as missing, like in process_xml()
+		}
+	span->ptr=sf->buf;
+	span->len=sf->len;
+	span->found=1;
+}
+
+
+void stream_end_release(struct xmlstream *xs)
+{
+// at </release>: count it, and write it out if it matched
+	size_t len;
+
+	streamrelease=0;
+	releasecount++;
+	scanposition=xs->endoffset;
+	if (metricsfilename!=NULL && 0==releasecount%METRICS_CHECK_RELEASES)
+		{
+		metrics_check(rel_id);
+		}
+#if DEBUG_PROGRESS
+	if (0==releasecount%100)
+		{
+		printf(" r%lu ",releasecount);
+		}
+#endif
+	if (index_build_mode)
+		{
+		index_add_release(xs);
+		return;
+		}
+	if (text_mode)
+		{
+		streammatched=text_match_fields();
+		}
+	if (!streammatched)
+		{
+		return;
+		}
+
+	foundcount++;
+	release_id=rel_id;
+#if DEBUG_FINDS
+	printf("Foundcount: %lu   Releasecount: %lu\n",foundcount,releasecount);
+	printf("S Found release id %lu at file offset %lld\n",release_id,streamreleasestart);
+#endif
+#if WRITE_DEBUG_FILE
+	fprintf(debugfile,"<release id=\"%lu\"\n",release_id);
+#endif
+#if DEBUG_PROGRESS
+	if (0==foundcount%10)
+		{
+		printf("\nf%lu ",foundcount);
+		}
+#endif
+
+	perfstage(PERF_EXTRACT);
+	fields.release_id=rel_id;
+	streammasterid.buf[streammasterid.len<STREAM_FIELD_MAX ? streammasterid.len : STREAM_FIELD_MAX-1]='\0';
+	fields.master_id=strtoull((char *)streammasterid.buf,NULL,10);
+	csvrowlen=0;
+	if (csvrow_enabled)
+		{
+		write_csv_row();
+		}
+
+	perfstage(PERF_OUTPUT);
+	len=(size_t)(xs->endoffset-streamreleasestart);
+	if (streamreleasestart>=blockfileposition)
+		write_release(inputbuffer+(streamreleasestart-blockfileposition),streamreleasestart,len);
+	else
+		write_release(NULL,streamreleasestart,len);
+	perfstage(PERF_SEARCH);
+}
+
+
+size_t stream_copy_release(long long startoffset, size_t len)
+{
+// copy len bytes of infile at startoffset to outfile.  Returns 1 if it worked,
+// like fwrite() of one item.
+	size_t n;
+
+	if (streamcopyfile==NULL)
+		{
+		streamcopyfile=fopen((char *)infilename,"rb");
+		if (streamcopyfile==NULL)
+			{
+			printf("Error: can't reopen %s to copy a release\n",infilename);
+			return 0;
+			}
+		}
+	if (fseek64(streamcopyfile,startoffset,SEEK_SET))
+		{
+		return 0;
+		}
+	streamcopies++;
+	while (len)
+		{
+		n=len<BLOCKSIZE ? len : BLOCKSIZE;
+		if (fread(tempbuffer,1,n,streamcopyfile)!=n || fwrite(tempbuffer,1,n,outfile)!=n)
+			{
+			return 0;
+			}
+		len-=n;
+		}
+	return 1;
+}
+
+
+/*--- artist roles -------------------------------------------
+--role only takes a release if SEARCH_STRING's artist is credited in it in one
+of the listed ways:
+	main    in the release's <artists>
+	extra   in the release's <extraartists>
+	track   in the <artists> or <extraartists> of a <track>
+	other   a value of the artist's <role>, such as Remix or Producer.  A
+	        <role> can hold several, "Producer, Mixed By [Additional]", and
+	        each is compared without case and without its [...] part.
+The csv line gets a matched_role column with the first credit that passed,
+as main, extra:<role> or track:<role>.
+
+The block search works out where a reference sits from the tags before it
+in the release; --stream has the element stack.
+------------------------------------------------------------*/
+
+int role_parse_filter(char *list)
+{
+// the comma separated --role list into rolefilter[], 0 if it is empty or too long
+	char *p;
+	size_t n;
+
+	rolefiltercount=0;
+	p=list;
+	while (*p)
+		{
+		n=strcspn(p,",");
+		if (n>0)
+			{
+			if (rolefiltercount==ROLE_MAX_FILTERS || n>=ROLE_TEXT_MAX)
+				{
+				printf("Error: --role takes up to %u values of up to %u characters\n",ROLE_MAX_FILTERS,ROLE_TEXT_MAX-1);
+				return 0;
+				}
+			memcpy(rolefilter[rolefiltercount],p,n);
+			rolefilter[rolefiltercount][n]='\0';
+			rolefiltercount++;
+			}
+		p+=n;
+		if (*p==',')
+			{
+			p++;
+			}
+		}
+	return rolefiltercount;
+}
+
+
+int role_accept(int where, unsigned char *role, size_t rolelen)
+{
+// does a credit in where (ROLE_) with <role> text role pass --role?
+// fills matchedrole if so.
+	unsigned int f;
+	unsigned char *p,*end;
+	size_t n;
+
+	for (f=0;f<rolefiltercount;f++)
+		{
+		if (!strcmp(rolefilter[f],role_names[where]))
+			{
+			break;
+			}
+		// each role in the <role> list, less its [qualifier]
+		p=role;
+		end=role+rolelen;
+		while (p<end)
+			{
+			while (p<end && (*p==' ' || *p==','))
+				{
+				p++;
+				}
+			n=0;
+			while (p+n<end && p[n]!=',' && p[n]!='[')
+				{
+				n++;
+				}
+			while (n>0 && p[n-1]==' ')
+				{
+				n--;
+				}
+			if (n>0 && n==strlen(rolefilter[f]) && role_compare(p,(unsigned char *)rolefilter[f],n))
+				{
+				break;
+				}
+			while (p<end && *p!=',')
+				{
+				p++;
+				}
+			}
+		if (p<end)
+			{
+			break;
+			}
+		}
+	if (f==rolefiltercount)
+		{
+		return 0;
+		}
+
+	if (rolelen>ROLE_TEXT_MAX-16)
+		{
+		rolelen=ROLE_TEXT_MAX-16;
+		}
+	if (rolelen)
+		sprintf(matchedrole,"%s:%.*s",role_names[where],(int)rolelen,role);
+	else
+		strcpy(matchedrole,role_names[where]);
+	return 1;
+}
+
+
+int role_compare(unsigned char *a, unsigned char *b, size_t n)
+{
+// 1 if the n bytes match, ignoring ascii case
+	while (n--)
+		{
+		if (tolower(*a)!=tolower(*b))
+			{
+			return 0;
+			}
+		a++;
+		b++;
+		}
+	return 1;
+}
+
+
+unsigned char *role_last(unsigned char *startptr, unsigned char *endptr, char *tag)
+{
+// last tag between startptr and endptr, NULL if there isn't one
+	unsigned char *p,*last;
+	size_t taglen;
+
+	taglen=strlen(tag);
+	last=NULL;
+	p=startptr;
+	while ((p=memmem(p,endptr-p,(unsigned char *)tag,taglen))!=NULL)
+		{
+		last=p;
+		p+=taglen;
+		}
+	return last;
+}
+
+
+unsigned char *role_match_release(unsigned char *startptr, size_t len)
+{
+// the block search's match for --role: the first SEARCH_STRING in the release
+// whose credit passes, NULL if none do.
+	unsigned char *p,*endptr,*artistend,*rolestart,*roleend;
+	unsigned char *opentag,*closetag,*artists,*extraartists;
+	int where;
+
+	endptr=startptr+len;
+	p=startptr;
+	while ((p=memmem(p,endptr-p,searchbuffer,searchstringlen))!=NULL)
+		{
+		// in a track if the last <tracklist> before it is still open
+		opentag=role_last(startptr,p,ROLE_TRACKLIST_START);
+		closetag=role_last(startptr,p,ROLE_TRACKLIST_END);
+		if (opentag!=NULL && (closetag==NULL || closetag<opentag))
+			{
+			where=ROLE_TRACK;
+			}
+		else
+			{
+			artists=role_last(startptr,p,ROLE_ARTISTS_START);
+			extraartists=role_last(startptr,p,ROLE_EXTRAARTISTS_START);
+			where=(extraartists!=NULL && (artists==NULL || extraartists>artists)) ? ROLE_EXTRA : ROLE_MAIN;
+			}
+
+		// <role> of this <artist>
+		rolestart=NULL;
+		roleend=NULL;
+		artistend=memmem(p,endptr-p,(unsigned char *)ROLE_ARTIST_END,strlen(ROLE_ARTIST_END));
+		if (artistend!=NULL)
+			{
+			rolestart=memmem(p,artistend-p,(unsigned char *)ROLE_START,strlen(ROLE_START));
+			}
+		if (rolestart!=NULL)
+			{
+			rolestart+=strlen(ROLE_START);
+			roleend=memmem(rolestart,artistend-rolestart,(unsigned char *)ROLE_END,strlen(ROLE_END));
+			}
+		if (roleend==NULL)
+			{
+			rolestart=roleend=p;
+			}
+		if (role_accept(where,rolestart,roleend-rolestart))
+			{
+			return p;
+			}
+		p+=searchstringlen;
+		}
+	return NULL;
+}
+
+
+/*--- performance counters -----------------------------------
+--perf-counters counts cycles, instructions, branch misses and last level
+cache misses with perf_event_open(), and adds them up by the stage of the
+search the program is in: reading blocks, finding release boundaries (or
+tokenizing, with --stream), matching the artist, extracting the fields, and
+writing the output.  perfstage(s) at each change of stage reads the counter
+group once and charges the counts since the last read to the stage being
+left.  The report at the end gives them per MB scanned and per release.
+With --stream the artist match happens inside the tokenizer, so it is
+counted under boundaries.
+
+The counters are opened for the search thread only (pid 0, no inherit), so
+the extraction --threads hands to the pool workers wouldn't be counted and
+the two are refused together.  The compressing and decompressing threads
+of --compress and --frames aren't counted either.
+
+Counters that can't be opened (no PMU in a virtual machine, or
+perf_event_paranoid too high) are left out; if none open the run carries on
+without them.  Kernel time (the reads) is only counted if allowed.
+------------------------------------------------------------*/
+
+#ifdef __linux__
+long perf_open(int counter, int groupfd, int kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr,0,sizeof(attr));
+	attr.size=sizeof(attr);
+	attr.type=perf_counter_types[counter];
+	attr.config=perf_counter_configs[counter];
+	attr.read_format=PERF_FORMAT_GROUP|PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled=(groupfd==-1);
+	attr.exclude_kernel=!kernel;
+	attr.exclude_hv=1;
+	return syscall(__NR_perf_event_open,&attr,0,-1,groupfd,0);
+}
+#endif
+
+
+void perf_start(void)
+{
+#ifdef __linux__
+	int counter;
+	int kernel;
+	long fd;
+
+	perfcount=0;
+	for (kernel=1;kernel>=0 && perfcount==0;kernel--)
+		{
+		perfleader=-1;
+		for (counter=0;counter<PERF_COUNTERS;counter++)
+			{
+			fd=perf_open(counter,perfleader,kernel);
+			perfslot[counter]=-1;
+			if (fd<0)
+				{
+				perferrno[counter]=errno;
+				continue;
+				}
+			if (perfleader==-1)
+				{
+				perfleader=(int)fd;
+				}
+			perfslot[counter]=perfcount++;
+			}
+		perfkernel=kernel;
+		}
+	if (perfcount==0)
+		{
+		printf("Note: no performance counters available (%s), carrying on without them\n",strerror(perferrno[0]));
+		return;
+		}
+	for (counter=0;counter<PERF_COUNTERS;counter++)
+		{
+		if (perfslot[counter]<0)
+			{
+			printf("Note: %s counter not available (%s)\n",perf_counter_names[counter],strerror(perferrno[counter]));
+			}
+		}
+	ioctl(perfleader,PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+	ioctl(perfleader,PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+	perfcurrent=PERF_SEARCH;
+	perf_read(perflast);
+	perf_mode=1;
+#else
+	printf("Note: --perf-counters needs Linux perf_event_open(), carrying on without them\n");
+#endif
+}
+
+
+int perf_read(unsigned long long *values)
+{
+// the counter group into values[slot], 0 if the read failed
+#ifdef __linux__
+	unsigned long long buf[3+PERF_COUNTERS];  // nr, time enabled, time running, values
+	unsigned int n;
+
+	if (read(perfleader,buf,sizeof(buf))<(ssize_t)((3+perfcount)*sizeof(unsigned long long)))
+		{
+		return 0;
+		}
+	perfenabled=buf[1];
+	perfrunning=buf[2];
+	for (n=0;n<perfcount;n++)
+		{
+		values[n]=buf[3+n];
+		}
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+void perf_stage(int stage)
+{
+// charge the counts since the last call to the current stage, and switch to stage
+	unsigned long long now[PERF_COUNTERS];
+	unsigned int n;
+
+	if (stage==perfcurrent || !perf_read(now))
+		{
+		return;
+		}
+	for (n=0;n<perfcount;n++)
+		{
+		perftotals[perfcurrent][n]+=now[n]-perflast[n];
+		perflast[n]=now[n];
+		}
+	perfcurrent=stage;
+}
+
+
+void perf_report(void)
+{
+	double mb;
+	double releases;
+	double value;
+	unsigned long long cycles,instructions;
+	int stage,counter;
+
+	perf_stage(PERF_STAGES);  // charge the last stretch, to no stage
+#ifdef __linux__
+	ioctl(perfleader,PERF_EVENT_IOC_DISABLE,PERF_IOC_FLAG_GROUP);
+	close(perfleader);
+#endif
+
+	mb=(double)(scanposition-(long long)start_offset)/1048576.0;
+	if (mb<=0)
+		{
+		mb=1;
+		}
+	releases=releasecount ? (double)releasecount : 1;
+
+	printf("\nPerformance counters (%s), %.1f MB, %lu releases",perfkernel ? "user and kernel" : "user only",mb,releasecount);
+	if (perfrunning<perfenabled)
+		{
+		printf(", scaled down: counted %.0f%% of the time",100.0*perfrunning/perfenabled);
+		}
+	printf("\n%-10s %-12s","stage","");
+	for (counter=0;counter<PERF_COUNTERS;counter++)
+		{
+		printf(" %14s",perf_counter_names[counter]);
+		}
+	printf(" %6s\n","IPC");
+
+	for (stage=0;stage<PERF_STAGES;stage++)
+		{
+		printf("%-10s %-12s",perf_stage_names[stage],"per MB");
+		for (counter=0;counter<PERF_COUNTERS;counter++)
+			{
+			if (perfslot[counter]<0)
+				{
+				printf(" %14s","n/a");
+				continue;
+				}
+			value=(double)perftotals[stage][perfslot[counter]];
+			printf(" %14.0f",value/mb);
+			}
+		cycles=perfslot[PERF_CYCLES]<0 ? 0 : perftotals[stage][perfslot[PERF_CYCLES]];
+		instructions=perfslot[PERF_INSTRUCTIONS]<0 ? 0 : perftotals[stage][perfslot[PERF_INSTRUCTIONS]];
+		if (cycles && instructions)
+			printf(" %6.2f\n",(double)instructions/(double)cycles);
+		else
+			printf(" %6s\n","n/a");
+
+		printf("%-10s %-12s","","per release");
+		for (counter=0;counter<PERF_COUNTERS;counter++)
+			{
+			if (perfslot[counter]<0)
+				{
+				printf(" %14s","n/a");
+				continue;
+				}
+			value=(double)perftotals[stage][perfslot[counter]];
+			printf(" %14.1f",value/releases);
+			}
+		printf("\n");
+		}
+}
+
+
+/*--- validation ---------------------------------------------
+--validate infile reads the whole dump once and checks it before an
+extraction is started on it:
+	tags nest, and every end tag closes the element that is open
+	every <release has an id, and is closed by </release> before the next
+	no NUL bytes (what a broken download is usually padded with)
+	the file doesn't end inside a tag or an element
+It reports release id gaps and ids out of order, the largest release (and
+how many are too large for the block search), and the byte offset of each
+piece of damage found.
+
+Text is skipped with validate_scan(), 16 bytes at a time with SSE2 where the
+compiler has it, looking for the next < (or NUL), and tags are skipped the
+same way to their > (stepping over "quoted" attribute values).  A tag split
+by the block end is moved to the front of inputbuffer and the next block
+read in after it, so nothing is read twice and there is no seeking.
+------------------------------------------------------------*/
+
+unsigned char *validate_scan(unsigned char *p, unsigned char *end, unsigned char c1, unsigned char c2)
+{
+// the first c1 or c2 at or after p, end if there isn't one
+#if VALIDATE_SSE2
+	__m128i v1,v2,x;
+	unsigned int mask;
+#ifdef _MSC_VER
+	unsigned long bit;
+#endif
+
+	v1=_mm_set1_epi8((char)c1);
+	v2=_mm_set1_epi8((char)c2);
+	while (end-p>=16)
+		{
+		x=_mm_loadu_si128((__m128i *)p);
+		mask=(unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x,v1),_mm_cmpeq_epi8(x,v2)));
+		if (mask)
+			{
+#ifdef _MSC_VER
+			_BitScanForward(&bit,mask);
+			return p+bit;
+#else
+			return p+__builtin_ctz(mask);
+#endif
+			}
+		p+=16;
+		}
+#endif
+	while (p<end && *p!=c1 && *p!=c2)
+		{
+		p++;
+		}
+	return p;
+}
+
+
+void validate_damage(long long offset, const char *format, ...)
+{
+	va_list args;
+
+	validatedamage++;
+	if (validatedamage>VALIDATE_MAX_DAMAGE)
+		{
+		return;
+		}
+	printf("damage at byte %lld: ",offset);
+	va_start(args,format);
+	vprintf(format,args);
+	va_end(args);
+	printf("\n");
+	if (validatedamage==VALIDATE_MAX_DAMAGE)
+		{
+		printf("(no more damage is listed, only counted)\n");
+		}
+}
+
+
+void validate_pop(unsigned int depth)
+{
+// close elements down to depth, checking for a release left open
+	while (validatedepth>depth)
+		{
+		validatedepth--;
+		if (validatedepth==validatereleasedepth && validaterelease)
+			{
+			validate_damage(validatereleasestart,"release %lu has no </release>",validatereleaseid);
+			validaterelease=0;
+			}
+		}
+}
+
+
+void validate_start_tag(unsigned char *name, size_t namelen, unsigned char *tag, size_t taglen, long long offset, int empty)
+{
+	unsigned char *p;
+	unsigned long id;
+
+	if (namelen==7 && !memcmp(name,"release",7))
+		{
+		if (validaterelease)
+			{
+			// the last release never closed, carry on from this one
+			validate_pop(validatereleasedepth);
+			}
+		p=memmem(tag,taglen,(unsigned char *)" id=\"",5);
+		if (p==NULL)
+			{
+			validate_damage(offset,"<release> without an id");
+			id=0;
+			}
+		else
+			{
+			id=strtoul((char *)p+5,NULL,10);
+			if (validatereleases && id<=validatelastid)
+				{
+				validateoutoforder++;
+				validate_damage(offset,"release id %lu after %lu",id,validatelastid);
+				}
+			else if (validatereleases && id>validatelastid+1)
+				{
+				validategaps++;
+				validatemissing+=id-validatelastid-1;
+				if (id-validatelastid-1>validatelargestgap)
+					{
+					validatelargestgap=id-validatelastid-1;
+					validategapafter=validatelastid;
+					}
+				}
+			if (!validatereleases)
+				{
+				validatefirstid=id;
+				}
+			validatelastid=id;
+			}
+		validatereleases++;
+		if (!empty)
+			{
+			validaterelease=1;
+			validatereleaseid=id;
+			validatereleasestart=offset;
+			validatereleasedepth=validatedepth;
+			}
+		}
+	if (empty)
+		{
+		return;
+		}
+	if (validatedepth<STREAM_MAX_DEPTH)
+		{
+		if (namelen>=STREAM_NAME_MAX)
+			{
+			namelen=STREAM_NAME_MAX-1;
+			}
+		memcpy(validatestack[validatedepth],name,namelen);
+		validatestacklen[validatedepth]=namelen;
+		}
+	else if (validatedepth==STREAM_MAX_DEPTH)
+		{
+		validate_damage(offset,"elements nested more than %u deep",STREAM_MAX_DEPTH);
+		}
+	validatedepth++;
+}
+
+
+void validate_end_tag(unsigned char *name, size_t namelen, long long offset, long long endoffset)
+{
+	unsigned int depth;
+
+	if (namelen>=STREAM_NAME_MAX)
+		{
+		namelen=STREAM_NAME_MAX-1;
+		}
+	if (validatedepth==0)
+		{
+		validate_damage(offset,"</%.*s> after the end of the document",(int)namelen,name);
+		return;
+		}
+	if (validatedepth>STREAM_MAX_DEPTH)
+		{
+		validatedepth--;  // too deep to have been kept
+		return;
+		}
+	// find what it closes, normally the top of the stack
+	for (depth=validatedepth;depth>0;depth--)
+		{
+		if (validatestacklen[depth-1]==namelen && !memcmp(validatestack[depth-1],name,namelen))
+			{
+			break;
+			}
+		}
+	if (depth==0)
+		{
+		validate_damage(offset,"</%.*s> with no <%.*s> open",(int)namelen,name,(int)namelen,name);
+		return;
+		}
+	depth--;
+	if (depth+1<validatedepth)
+		{
+		validate_damage(offset,"</%.*s> closes <%.*s>",(int)namelen,name,
+			(int)validatestacklen[validatedepth-1],validatestack[validatedepth-1]);
+		}
+
+	if (validaterelease && depth==validatereleasedepth)
+		{
+		// </release>
+		validaterelease=0;
+		if (endoffset-validatereleasestart>validatelargest)
+			{
+			validatelargest=endoffset-validatereleasestart;
+			validatelargestid=validatereleaseid;
+			validatelargestoffset=validatereleasestart;
+			}
+		if (endoffset-validatereleasestart>BLOCKSIZE)
+			{
+			validatetoolarge++;
+			}
+		}
+	validate_pop(depth);
+}
+
+
+size_t validate_buffer(unsigned char *buf, size_t len, long long bufoffset, int eof)
+{
+// check the complete tags in buf.  Returns how much was used; the rest is an
+// unfinished tag, to be done again with more data after it.
+	unsigned char *p,*end,*q,*name,*nameend;
+
+	p=buf;
+	end=buf+len;
+	while (p<end)
+		{
+		// text, to the next tag
+		p=validate_scan(p,end,'<','\0');
+		if (p==end)
+			{
+			break;
+			}
+		if (*p=='\0')
+			{
+			q=p;
+			while (q<end && *q=='\0')
+				{
+				q++;
+				}
+			validate_damage(bufoffset+(p-buf),"%lu NUL bytes",(unsigned long)(q-p));
+			p=q;
+			continue;
+			}
+
+		// a tag
+		if (end-p<VALIDATE_TAG_LOOKAHEAD && !eof)
+			{
+			break;  // maybe a split <!-- or <![CDATA[
+			}
+		validatetags++;
+		if (p+1<end && p[1]=='/')
+			{
+			q=memchr(p,'>',end-p);
+			if (q==NULL)
+				{
+				break;
+				}
+			name=p+2;
+			nameend=name;
+			while (nameend<q && *nameend!=' ' && *nameend!='\t' && *nameend!='\r' && *nameend!='\n')
+				{
+				nameend++;
+				}
+			validate_end_tag(name,nameend-name,bufoffset+(p-buf),bufoffset+(q+1-buf));
+			p=q+1;
+			}
+		else if (end-p>=4 && !memcmp(p,"<!--",4))
+			{
+			q=memmem(p+4,end-p-4,(unsigned char *)"-->",3);
+			if (q==NULL)
+				{
+				break;
+				}
+			p=q+3;
+			}
+		else if (end-p>=9 && !memcmp(p,"<![CDATA[",9))
+			{
+			q=memmem(p+9,end-p-9,(unsigned char *)"]]>",3);
+			if (q==NULL)
+				{
+				break;
+				}
+			p=q+3;
+			}
+		else if (p+1<end && (p[1]=='?' || p[1]=='!'))
+			{
+			q=memchr(p,'>',end-p);
+			if (q==NULL)
+				{
+				break;
+				}
+			p=q+1;
+			}
+		else
+			{
+			// start tag, to its > outside of any attribute value
+			name=p+1;
+			nameend=name;
+			while (nameend<end && *nameend!=' ' && *nameend!='\t' && *nameend!='\r' && *nameend!='\n'
+				&& *nameend!='>' && *nameend!='/')
+				{
+				nameend++;
+				}
+			q=nameend;
+			for (;;)
+				{
+				q=validate_scan(q,end,'>','"');
+				if (q==end || *q=='>')
+					{
+					break;
+					}
+				q=memchr(q+1,'"',end-q-1);
+				if (q==NULL)
+					{
+					q=end;
+					break;
+					}
+				q++;
+				}
+			if (q==end)
+				{
+				break;
+				}
+			if (nameend==name)
+				{
+				validate_damage(bufoffset+(p-buf),"< with no element name");
+				}
+			else
+				{
+				validate_start_tag(name,nameend-name,p,q+1-p,bufoffset+(p-buf),q[-1]=='/');
+				}
+			p=q+1;
+			}
+		}
+	return p-buf;
+}
+
+
+void validate_file(int argc, char *argv[])
+{
+	long long bufoffset;
+	size_t have,used,n;
+	int eof;
+	double seconds;
+
+	if (argc!=2)
+		{
+		syntax();
+		}
+	strcpy((char *)infilename,argv[1]);
+	infile=fopen((char *)infilename,"rb");
+	if (infile==NULL)
+		{
+		printf("Error: input file %s not found.\n",infilename);
+		errorcode=1;
+		return;
+		}
+	printf("Validating %s\n",infilename);
+#if VALIDATE_SSE2
+	printf("(SSE2 tag scanner)\n");
+#endif
+	begin_time=clock();
+
+	bufoffset=0;
+	have=0;
+	eof=0;
+	while (!eof)
+		{
+		n=fread(inputbuffer+have,1,BLOCKSIZE-have,infile);
+		eof=(n<BLOCKSIZE-have);
+		have+=n;
+		used=validate_buffer(inputbuffer,have,bufoffset,eof);
+		if (used==0 && have==BLOCKSIZE)
+			{
+			validate_damage(bufoffset,"tag longer than %u bytes, skipped",BLOCKSIZE);
+			used=1;  // step over its <
+			}
+		if (eof && used<have)
+			{
+			validate_damage(bufoffset+used,"file ends inside a tag");
+			}
+		// keep an unfinished tag for the next block
+		memmove(inputbuffer,inputbuffer+used,have-used);
+		bufoffset+=used;
+		have-=used;
+		}
+	if (ferror(infile))
+		{
+		validate_damage(bufoffset+have,"read error");
+		}
+	if (validaterelease)
+		{
+		validate_damage(validatereleasestart,"file ends inside release %lu (truncated?)",validatereleaseid);
+		}
+	if (validatedepth>0)
+		{
+		validate_damage(bufoffset+have,"file ends with %u elements still open, <%.*s> first",validatedepth,
+			(int)validatestacklen[0],validatestack[0]);
+		}
+	fclose(infile);
+
+	end_time=clock();
+	seconds=(double)(end_time-begin_time)/CLOCKS_PER_SEC;
+	printf("\n%lld bytes, %lu tags, %lu releases in %.1f s",bufoffset+have,validatetags,validatereleases,seconds);
+	if (seconds>0)
+		{
+		printf(" (%.0f MB/s)",(double)(bufoffset+have)/1048576.0/seconds);
+		}
+	printf("\n");
+	if (validatereleases)
+		{
+		printf("release ids %lu to %lu: %lu gaps, %lu ids missing, %lu out of order\n",
+			validatefirstid,validatelastid,validategaps,validatemissing,validateoutoforder);
+		if (validategaps)
+			{
+			printf("largest gap: %lu ids after release %lu\n",validatelargestgap,validategapafter);
+			}
+		printf("largest release: %lu, %lld bytes at byte %lld\n",validatelargestid,validatelargest,validatelargestoffset);
+		if (validatetoolarge)
+			{
+			printf("%lu releases are larger than BLOCKSIZE (%u), use --stream for them\n",validatetoolarge,BLOCKSIZE);
+			}
+		}
+	if (validatedamage)
+		{
+		printf("%lu pieces of damage found\n",validatedamage);
+		errorcode=9;
+		}
+	else
+		{
+		printf("no damage found\n");
+		}
+}
+
+
+/*--- text search --------------------------------------------
+--text phrase matches releases by words in their fields instead of by
+SEARCH_STRING's artist.  A release matches if any --text phrase is in any
+of the --text-fields (title and notes unless told otherwise), without
+regard to ascii case.  Matches go out through the normal outfile and csvfile
+writing.
+
+text_find() is the search kernel.  With SSE2 it folds 16 bytes of the
+field to lower case at a time, at two places the phrase's length-1 apart,
+and compares them with its first and last characters; only where both
+match are the characters between compared.  The phrases are folded once, by
+text_add_phrase().  Letters outside ascii aren't folded.
+------------------------------------------------------------*/
+
+int text_add_phrase(char *phrase)
+{
+	size_t n;
+
+	n=strlen(phrase);
+	if (textphrasecount==TEXT_MAX_PHRASES || n==0 || n>=TEXT_PHRASE_MAX)
+		{
+		printf("Error: up to %u --text phrases of 1 to %u characters\n",TEXT_MAX_PHRASES,TEXT_PHRASE_MAX-1);
+		return 0;
+		}
+	for (textphraselen[textphrasecount]=0;textphraselen[textphrasecount]<n;textphraselen[textphrasecount]++)
+		{
+		textphrase[textphrasecount][textphraselen[textphrasecount]]=(unsigned char)tolower((unsigned char)phrase[textphraselen[textphrasecount]]);
+		}
+	textphrase[textphrasecount][n]='\0';
+	textphrasecount++;
+	return 1;
+}
+
+
+int text_parse_fields(char *list)
+{
+// --text-fields list into textfields, a bit per field
+	char *p;
+	size_t n;
+	int f;
+
+	textfields=0;
+	p=list;
+	while (*p)
+		{
+		n=strcspn(p,",");
+		for (f=0;text_field_names[f]!=NULL;f++)
+			{
+			if (strlen(text_field_names[f])==n && !strncmp(p,text_field_names[f],n))
+				{
+				break;
+				}
+			}
+		if (text_field_names[f]==NULL)
+			{
+			printf("Error: unknown --text-fields field %.*s\n",(int)n,p);
+			return 0;
+			}
+		textfields|=1<<f;
+		p+=n;
+		if (*p==',')
+			{
+			p++;
+			}
+		}
+	return textfields!=0;
+}
+
+
+#if VALIDATE_SSE2
+__m128i text_fold16(__m128i x)
+{
+// ascii A-Z to a-z in 16 bytes
+	__m128i t;
+
+	t=_mm_sub_epi8(x,_mm_set1_epi8('A'));
+	t=_mm_cmpeq_epi8(_mm_min_epu8(t,_mm_set1_epi8(25)),t);  // 0xff where x was A-Z
+	return _mm_add_epi8(x,_mm_and_si128(t,_mm_set1_epi8(0x20)));
+}
+#endif
+
+
+int text_equal(unsigned char *p, unsigned char *lowered, size_t n)
+{
+// p matches the already lowered n bytes, folding p's case
+	while (n--)
+		{
+		if (tolower(*p)!=*lowered)
+			{
+			return 0;
+			}
+		p++;
+		lowered++;
+		}
+	return 1;
+}
+
+
+unsigned char *text_find(unsigned char *hay, size_t haylen, unsigned char *phrase, size_t n)
+{
+// first place phrase (lowered) is in hay, ignoring case, NULL if not
+	unsigned char *p,*end;
+#if VALIDATE_SSE2
+	__m128i first,last,a,b;
+	unsigned int mask;
+	unsigned int bit;
+#endif
+
+	if (n==0 || haylen<n)
+		{
+		return NULL;
+		}
+	p=hay;
+	end=hay+haylen-n+1;  // last place it can start, plus one
+#if VALIDATE_SSE2
+	first=_mm_set1_epi8((char)phrase[0]);
+	last=_mm_set1_epi8((char)phrase[n-1]);
+	while (end-p>=16)
+		{
+		a=text_fold16(_mm_loadu_si128((__m128i *)p));
+		b=text_fold16(_mm_loadu_si128((__m128i *)(p+n-1)));
+		mask=(unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a,first),_mm_cmpeq_epi8(b,last)));
+		while (mask)
+			{
+#ifdef _MSC_VER
+			{
+			unsigned long index;
+
+			_BitScanForward(&index,mask);
+			bit=(unsigned int)index;
+			}
+#else
+			bit=(unsigned int)__builtin_ctz(mask);
+#endif
+			if (n<=2 || text_equal(p+bit+1,phrase+1,n-2))
+				{
+				return p+bit;
+				}
+			mask&=mask-1;
+			}
+		p+=16;
+		}
+#endif
+	for (;p<end;p++)
+		{
+		if (text_equal(p,phrase,n))
+			{
+			return p;
+			}
+		}
+	return NULL;
+}
+
+
+int text_match_span(unsigned char *ptr, size_t len)
+{
+	unsigned int n;
+
+	for (n=0;n<textphrasecount;n++)
+		{
+		if (text_find(ptr,len,textphrase[n],textphraselen[n])!=NULL)
+			{
+			return 1;
+			}
+		}
+	return 0;
+}
+
+
+unsigned char *text_match_release(unsigned char *startptr, size_t len)
+{
+// the block search's match for --text: the first chosen field of the
+// release that has a phrase in it, NULL if none
+	unsigned char *p,*q,*endptr;
+	int f;
+
+	endptr=startptr+len;
+	for (f=0;text_field_names[f]!=NULL;f++)
+		{
+		if (!(textfields&(1<<f)))
+			{
+			continue;
+			}
+		p=memmem(startptr,len,(unsigned char *)text_field_starts[f],strlen(text_field_starts[f]));
+		if (p==NULL)
+			{
+			continue;
+			}
+		p+=strlen(text_field_starts[f]);
+		q=memmem(p,endptr-p,(unsigned char *)text_field_ends[f],strlen(text_field_ends[f]));
+		if (q!=NULL && text_match_span(p,q-p))
+			{
+			return p;
+			}
+		}
+	return NULL;
+}
+
+
+int text_match_fields(void)
+{
+// the --stream match for --text, on the fields it collected
+	if ((textfields&(1<<TEXT_TITLE)) && fields.title.found>0 && text_match_span(fields.title.ptr,fields.title.len))
+		{
+		return 1;
+		}
+	if ((textfields&(1<<TEXT_NOTES)) && fields.notes.found>0 && text_match_span(fields.notes.ptr,fields.notes.len))
+		{
+		return 1;
+		}
+	return 0;
+}
+
+
+/*--- trigram index ------------------------------------------
+--build-index indexfile infile reads infile once with the streaming parser
+and writes indexfile: for every three byte sequence (trigram, ascii case
+folded) in any release's title or notes, the releases that have it.  Then
+--index indexfile with --text looks up the trigrams of each phrase,
+intersects their release lists, and only reads those releases from infile
+(with a positioned read each), instead of all of it.  The candidates are
+checked by text_match_release() like any release in a --text search, as a
+trigram list can't tell where the trigrams were, or in which field, and go
+through process_xml() and write_release() the same as well.  A phrase
+shorter than a trigram matches every release, so it makes them all
+candidates.
+
+Releases are numbered in file order, and each trigram's list is those
+numbers as differences from the one before (the first from 0), as varints
+(7 bits a byte, high bit set on all but the last).  While building, the
+lists are kept in a hash table on the trigram and grow a byte at a time;
+when they reach --index-memory, they are written sorted by trigram to a
+segment file (indexfile.seg0, .seg1...) and the table starts over.  At the
+end the segments are merged trigram by trigram, the list of each segment
+after the first having its first number made relative to the last one of
+the segment before it.
+
+indexfile holds, in order:
+	struct indexheader
+	struct indexrecord per release: its offset and length in infile
+	the posting lists
+	struct indexentry per trigram, sorted by trigram, where its list is
+The header has infile's size and a hash of its start, and --index won't
+use an index made from another file.  Titles and notes are indexed up to
+STREAM_FIELD_MAX bytes, like the --stream csv fields.
+------------------------------------------------------------*/
+
+int index_read_at(FILE *fp, void *buf, size_t len, long long offset)
+{
+// len bytes at offset of fp, without using its stdio position.  1 if all read.
+#ifdef _WIN32
+	if (fseek64(fp,offset,SEEK_SET))
+		{
+		return 0;
+		}
+	return fread(buf,1,len,fp)==len;
+#else
+	ssize_t n;
+	size_t got;
+
+	for (got=0;got<len;got+=(size_t)n)
+		{
+		n=pread(fileno(fp),(unsigned char *)buf+got,len-got,(off_t)(offset+(long long)got));
+		if (n<=0)
+			{
+			return 0;
+			}
+		}
+	return 1;
+#endif
+}
+
+
+int index_fingerprint(FILE *fp, long long *size, unsigned long long *hash)
+{
+// size of fp and an FNV-1a hash of its first INDEX_FINGERPRINT_BYTES
+	size_t n,i;
+
+	if (fseek64(fp,0,SEEK_END))
+		{
+		return 0;
+		}
+	*size=ftell64(fp);
+	n=*size<INDEX_FINGERPRINT_BYTES ? (size_t)*size : INDEX_FINGERPRINT_BYTES;
+	if (!index_read_at(fp,tempbuffer,n,0))
+		{
+		return 0;
+		}
+	*hash=14695981039346656037ULL;
+	for (i=0;i<n;i++)
+		{
+		*hash=(*hash^tempbuffer[i])*1099511628211ULL;
+		}
+	return fseek64(fp,0,SEEK_SET)==0;
+}
+
+
+unsigned int index_put_varint(unsigned char *p, unsigned int v)
+{
+// v as a varint at p, returns its length (up to 5)
+	unsigned int n;
+
+	for (n=0;v>=0x80;n++)
+		{
+		p[n]=(unsigned char)(v|0x80);
+		v>>=7;
+		}
+	p[n++]=(unsigned char)v;
+	return n;
+}
+
+
+unsigned int index_get_varint(unsigned char **p, unsigned char *end)
+{
+// the varint at *p, which is moved past it
+	unsigned int v;
+	unsigned int shift;
+
+	v=0;
+	for (shift=0;*p<end && shift<32;shift+=7)
+		{
+		v|=(unsigned int)(**p&0x7f)<<shift;
+		if (!(*(*p)++&0x80))
+			{
+			break;
+			}
+		}
+	return v;
+}
+
+
+void index_grow(void)
+{
+// double the trigram hash table
+	struct indexposting *old;
+	unsigned int oldsize,n,h;
+
+	old=indextable;
+	oldsize=indextablesize;
+	indextablesize=oldsize ? oldsize*2 : INDEX_TABLE_START;
+	indextable=calloc(indextablesize,sizeof(struct indexposting));
+	if (indextable==NULL)
+		{
+		printf("Error: out of memory for the trigram table\n");
+		exit(6);
+		}
+	for (n=0;n<oldsize;n++)
+		{
+		if (old[n].count)
+			{
+			h=(old[n].trigram*2654435761U)&(indextablesize-1);
+			while (indextable[h].count)
+				{
+				h=(h+1)&(indextablesize-1);
+				}
+			indextable[h]=old[n];
+			}
+		}
+	free(old);
+}
+
+
+void index_add_posting(unsigned int trigram, unsigned int ordinal)
+{
+// release ordinal has trigram, once per release
+	struct indexposting *ip;
+	unsigned int h;
+	unsigned char *p;
+
+	h=(trigram*2654435761U)&(indextablesize-1);
+	while (indextable[h].count && indextable[h].trigram!=trigram)
+		{
+		h=(h+1)&(indextablesize-1);
+		}
+	ip=&indextable[h];
+	if (ip->count)
+		{
+		if (ip->last==ordinal)
+			{
+			return;  // already in this release
+			}
+		}
+	else
+		{
+		ip->trigram=trigram;
+		ip->last=0;  // the first number is from 0
+		indextrigrams++;
+		}
+	if (ip->len+5>ip->cap)
+		{
+		indexbytes-=ip->cap;
+		ip->cap=ip->cap ? ip->cap*2 : 16;
+		p=realloc(ip->buf,ip->cap);
+		if (p==NULL)
+			{
+			printf("Error: out of memory for posting lists\n");
+			exit(6);
+			}
+		ip->buf=p;
+		indexbytes+=ip->cap;
+		}
+	ip->len+=index_put_varint(ip->buf+ip->len,ordinal-ip->last);
+	ip->last=ordinal;
+	ip->count++;
+	indexpostings++;
+	if (indextrigrams*2>indextablesize)
+		{
+		index_grow();
+		}
+}
+
+
+void index_add_text(unsigned char *p, size_t len, unsigned int ordinal)
+{
+	unsigned int trigram;
+	size_t i;
+
+	if (len<3)
+		{
+		return;
+		}
+	trigram=(tolower(p[0])<<8)|tolower(p[1]);
+	for (i=2;i<len;i++)
+		{
+		trigram=((trigram<<8)|tolower(p[i]))&0xffffff;
+		index_add_posting(trigram,ordinal);
+		}
+}
+
+
+void index_add_release(struct xmlstream *xs)
+{
+// --build-index, at </release>: its record, and its title and notes trigrams
+	struct indexrecord rec;
+
+	rec.offset=streamreleasestart;
+	rec.len=(unsigned int)(xs->endoffset-streamreleasestart);
+	rec.release_id=(unsigned int)rel_id;
+	if (fwrite(&rec,sizeof(rec),1,indexfile)!=1)
+		{
+		printf("Error: can't write to %s\n",indexfilename);
+		exit(10);
+		}
+	if (fields.title.found>0)
+		{
+		index_add_text(fields.title.ptr,fields.title.len,indexreleases);
+		}
+	if (fields.notes.found>0)
+		{
+		index_add_text(fields.notes.ptr,fields.notes.len,indexreleases);
+		}
+	indexreleases++;
+	if (indexbytes+(size_t)indextablesize*sizeof(struct indexposting)>=index_memory)
+		{
+		index_write_segment();
+		}
+}
+
+
+int index_compare_postings(const void *a, const void *b)
+{
+	const struct indexposting *x=*(const struct indexposting **)a;
+	const struct indexposting *y=*(const struct indexposting **)b;
+
+	return x->trigram<y->trigram ? -1 : x->trigram>y->trigram;
+}
+
+
+void index_write_segment(void)
+{
+// the posting lists in the table to indexfile.seg<n>, sorted by trigram, and empty the table
+	struct indexposting **sorted;
+	unsigned int n,m;
+	unsigned int head[4];
+	char name[300];
+	FILE *fp;
+
+	if (indextrigrams==0)
+		{
+		return;
+		}
+	sorted=malloc(indextrigrams*sizeof(struct indexposting *));
+	if (sorted==NULL)
+		{
+		printf("Error: out of memory for a segment\n");
+		exit(6);
+		}
+	for (n=m=0;n<indextablesize;n++)
+		{
+		if (indextable[n].count)
+			{
+			sorted[m++]=&indextable[n];
+			}
+		}
+	qsort(sorted,m,sizeof(struct indexposting *),index_compare_postings);
+
+	sprintf(name,"%s%s%u",indexfilename,INDEX_SEGMENT_EXT,indexsegments);
+	fp=fopen(name,"wb");
+	if (fp==NULL)
+		{
+		printf("Error: can't create segment %s\n",name);
+		exit(10);
+		}
+	setvbuf(fp,NULL,_IOFBF,SORT_IO_BUFFER);
+	for (n=0;n<m;n++)
+		{
+		head[0]=sorted[n]->trigram;
+		head[1]=sorted[n]->count;
+		head[2]=sorted[n]->last;
+		head[3]=(unsigned int)sorted[n]->len;
+		if (fwrite(head,sizeof(head),1,fp)!=1 || fwrite(sorted[n]->buf,sorted[n]->len,1,fp)!=1)
+			{
+			printf("Error: can't write segment %s\n",name);
+			exit(10);
+			}
+		free(sorted[n]->buf);
+		}
+	if (fclose(fp))
+		{
+		printf("Error: can't write segment %s\n",name);
+		exit(10);
+		}
+	printf("\nsegment %u: %u trigrams, %llu postings\n",indexsegments,m,indexpostings);
+	free(sorted);
+	indexsegments++;
+	memset(indextable,0,indextablesize*sizeof(struct indexposting));
+	indextrigrams=0;
+	indexbytes=0;
+	indexpostings=0;
+}
+
+
+int index_read_segment(struct indexsegment *seg)
+{
+// the next list head of seg, 0 at its end
+	unsigned int head[4];
+
+	if (fread(head,sizeof(head),1,seg->fp)!=1)
+		{
+		seg->done=1;
+		return 0;
+		}
+	seg->trigram=head[0];
+	seg->count=head[1];
+	seg->last=head[2];
+	seg->bytes=head[3];
+	return 1;
+}
+
+
+void index_merge_segments(long long offset)
+{
+// join the segments' lists into indexfile at offset, then its directory
+	struct indexsegment *segs;
+	struct indexentry *entries;
+	unsigned int entrycount,entrycap;
+	unsigned int n,trigram,last,first;
+	int any;
+	unsigned char *buf,*p;
+	size_t bufcap;
+	unsigned char varint[5];
+	unsigned int vlen;
+	char name[300];
+
+	segs=calloc(indexsegments ? indexsegments : 1,sizeof(struct indexsegment));
+	entrycap=65536;
+	entries=malloc(entrycap*sizeof(struct indexentry));
+	bufcap=65536;
+	buf=malloc(bufcap);
+	if (segs==NULL || entries==NULL || buf==NULL)
+		{
+		printf("Error: out of memory to merge segments\n");
+		exit(6);
+		}
+	for (n=0;n<indexsegments;n++)
+		{
+		sprintf(name,"%s%s%u",indexfilename,INDEX_SEGMENT_EXT,n);
+		segs[n].fp=fopen(name,"rb");
+		if (segs[n].fp==NULL)
+			{
+			printf("Error: can't open segment %s\n",name);
+			exit(10);
+			}
+		setvbuf(segs[n].fp,NULL,_IOFBF,SORT_IO_BUFFER);
+		index_read_segment(&segs[n]);
+		}
+
+	indexheader.postingsoffset=offset;
+	entrycount=0;
+	for (;;)
+		{
+		// smallest trigram at the head of any segment
+		any=0;
+		trigram=0;
+		for (n=0;n<indexsegments;n++)
+			{
+			if (!segs[n].done && (!any || segs[n].trigram<trigram))
+				{
+				trigram=segs[n].trigram;
+				any=1;
+				}
+			}
+		if (!any)
+			{
+			break;
+			}
+		if (entrycount==entrycap)
+			{
+			entrycap*=2;
+			entries=realloc(entries,entrycap*sizeof(struct indexentry));
+			if (entries==NULL)
+				{
+				printf("Error: out of memory for the index directory\n");
+				exit(6);
+				}
+			}
+		entries[entrycount].trigram=trigram;
+		entries[entrycount].count=0;
+		entries[entrycount].offset=offset;
+		entries[entrycount].bytes=0;
+		entries[entrycount].pad=0;
+
+		// segments are in release order, so their lists are appended in turn
+		last=0;
+		for (n=0;n<indexsegments;n++)
+			{
+			if (segs[n].done || segs[n].trigram!=trigram)
+				{
+				continue;
+				}
+			if (segs[n].bytes>bufcap)
+				{
+				bufcap=segs[n].bytes;
+				free(buf);
+				buf=malloc(bufcap);
+				if (buf==NULL)
+					{
+					printf("Error: out of memory to merge segments\n");
+					exit(6);
+					}
+				}
+			if (fread(buf,1,segs[n].bytes,segs[n].fp)!=segs[n].bytes)
+				{
+				printf("Error: segment %u is short\n",n);
+				exit(10);
+				}
+			p=buf;
+			first=index_get_varint(&p,buf+segs[n].bytes);
+			vlen=index_put_varint(varint,first-last);
+			if (fwrite(varint,1,vlen,indexfile)!=vlen
+				|| fwrite(p,1,segs[n].bytes-(p-buf),indexfile)!=segs[n].bytes-(size_t)(p-buf))
+				{
+				printf("Error: can't write to %s\n",indexfilename);
+				exit(10);
+				}
+			entries[entrycount].bytes+=vlen+(unsigned int)(segs[n].bytes-(p-buf));
+			entries[entrycount].count+=segs[n].count;
+			last=segs[n].last;
+			index_read_segment(&segs[n]);
+			}
+		offset+=entries[entrycount].bytes;
+		entrycount++;
+		}
+
+	indexheader.directoryoffset=offset;
+	indexheader.trigrams=entrycount;
+	if (entrycount && fwrite(entries,sizeof(struct indexentry),entrycount,indexfile)!=entrycount)
+		{
+		printf("Error: can't write to %s\n",indexfilename);
+		exit(10);
+		}
+	for (n=0;n<indexsegments;n++)
+		{
+		fclose(segs[n].fp);
+		sprintf(name,"%s%s%u",indexfilename,INDEX_SEGMENT_EXT,n);
+		remove(name);
+		}
+	free(segs);
+	free(entries);
+	free(buf);
+}
+
+
+void index_build(int argc, char *argv[])
+{
+// --build-index indexfile infile
+	double seconds;
+
+	if (argc!=2)
+		{
+		syntax();
+		}
+	strcpy((char *)infilename,argv[1]);
+	infile=fopen((char *)infilename,"rb");
+	if (infile==NULL)
+		{
+		printf("Error: input file %s not found.\n",infilename);
+		errorcode=1;
+		return;
+		}
+	memset(&indexheader,0,sizeof(indexheader));
+	memcpy(indexheader.magic,INDEX_MAGIC,sizeof(indexheader.magic));
+	indexheader.version=INDEX_VERSION;
+	if (!index_fingerprint(infile,&indexheader.dumpsize,&indexheader.dumphash))
+		{
+		printf("Error: can't read %s\n",infilename);
+		errorcode=1;
+		return;
+		}
+	indexfile=fopen(indexfilename,"wb");
+	if (indexfile==NULL)
+		{
+		printf("Error: can't create index file %s\n",indexfilename);
+		errorcode=10;
+		return;
+		}
+	setvbuf(indexfile,NULL,_IOFBF,SORT_IO_BUFFER);
+	fwrite(&indexheader,sizeof(indexheader),1,indexfile);  // filled in at the end
+	indexheader.recordsoffset=sizeof(indexheader);
+	printf("Indexing titles and notes of %s into %s\n",infilename,indexfilename);
+	begin_time=clock();
+	index_grow();
+
+	xmlstream_init(&stream,0);
+	stream.start_element=stream_start_element;
+	stream.attribute=stream_attribute;
+	stream.text=stream_text;
+	stream.end_element=stream_end_element;
+	streamrelease=0;
+	while (!stream.stop)
+		{
+		blockfileposition=stream.offset;
+		readresult=fread(inputbuffer,1,BLOCKSIZE,infile);
+		if (readresult==0)
+			{
+			break;
+			}
+		xmlstream_feed(&stream,inputbuffer,readresult);
+		}
+	if (streamrelease)
+		{
+		printf("\nError: input ends inside release %lu, which isn't indexed\n",rel_id);
+		errorcode=10;
+		}
+	fclose(infile);
+
+	index_write_segment();
+	indexheader.releases=indexreleases;
+	index_merge_segments(indexheader.recordsoffset+(long long)indexreleases*sizeof(struct indexrecord));
+	if (fseek64(indexfile,0,SEEK_SET) || fwrite(&indexheader,sizeof(indexheader),1,indexfile)!=1 || fclose(indexfile))
+		{
+		printf("Error: can't write to %s\n",indexfilename);
+		errorcode=10;
+		return;
+		}
+
+	end_time=clock();
+	seconds=(double)(end_time-begin_time)/CLOCKS_PER_SEC;
+	printf("\n%u releases, %u trigrams, %lld bytes of index in %.1f s\n",indexreleases,indexheader.trigrams,
+		indexheader.directoryoffset+(long long)indexheader.trigrams*sizeof(struct indexentry),seconds);
+}
+
+
+int index_open(void)
+{
+// open indexfilename for a query of infile, and load its directory
+	long long size;
+	unsigned long long hash;
+
+	indexfile=fopen(indexfilename,"rb");
+	if (indexfile==NULL)
+		{
+		printf("Error: can't open index file %s\n",indexfilename);
+		return 0;
+		}
+	if (!index_read_at(indexfile,&indexheader,sizeof(indexheader),0)
+		|| memcmp(indexheader.magic,INDEX_MAGIC,sizeof(indexheader.magic)) || indexheader.version!=INDEX_VERSION)
+		{
+		printf("Error: %s is not a trigram index\n",indexfilename);
+		return 0;
+		}
+	if (!index_fingerprint(infile,&size,&hash) || size!=indexheader.dumpsize || hash!=indexheader.dumphash)
+		{
+		printf("Error: index %s was built from another file than %s\n",indexfilename,infilename);
+		return 0;
+		}
+	indexdirectory=malloc(indexheader.trigrams ? indexheader.trigrams*sizeof(struct indexentry) : 1);
+	if (indexdirectory==NULL
+		|| !index_read_at(indexfile,indexdirectory,indexheader.trigrams*sizeof(struct indexentry),indexheader.directoryoffset))
+		{
+		printf("Error: can't read the directory of %s\n",indexfilename);
+		return 0;
+		}
+	return 1;
+}
+
+
+struct indexentry *index_lookup(unsigned int trigram)
+{
+// bsearch of the directory, NULL if no release has trigram
+	unsigned int lo,hi,mid;
+
+	lo=0;
+	hi=indexheader.trigrams;
+	while (lo<hi)
+		{
+		mid=lo+(hi-lo)/2;
+		if (indexdirectory[mid].trigram<trigram)
+			lo=mid+1;
+		else
+			hi=mid;
+		}
+	if (lo<indexheader.trigrams && indexdirectory[lo].trigram==trigram)
+		{
+		return &indexdirectory[lo];
+		}
+	return NULL;
+}
+
+
+unsigned int *index_postings(struct indexentry *e)
+{
+// the release ordinals of e, decoded into a new array of e->count
+	unsigned int *list;
+	unsigned char *buf,*p;
+	unsigned int n,ordinal;
+
+	list=malloc((e->count ? e->count : 1)*sizeof(unsigned int));
+	buf=malloc(e->bytes ? e->bytes : 1);
+	if (list==NULL || buf==NULL)
+		{
+		printf("Error: out of memory for posting lists\n");
+		exit(6);
+		}
+	if (!index_read_at(indexfile,buf,e->bytes,e->offset))
+		{
+		printf("Error: can't read %s\n",indexfilename);
+		exit(10);
+		}
+	p=buf;
+	ordinal=0;
+	for (n=0;n<e->count;n++)
+		{
+		ordinal+=index_get_varint(&p,buf+e->bytes);
+		list[n]=ordinal;
+		}
+	free(buf);
+	return list;
+}
+
+
+int index_compare_entries(const void *a, const void *b)
+{
+	const struct indexentry *x=*(const struct indexentry **)a;
+	const struct indexentry *y=*(const struct indexentry **)b;
+
+	return x->count<y->count ? -1 : x->count>y->count;
+}
+
+
+unsigned int index_phrase(unsigned int phrase, unsigned int **result)
+{
+// releases that have every trigram of the phrase, into *result (NULL if
+// none), returns how many.  -1 (all of them) for a phrase too short to have one.
+	struct indexentry *e[TEXT_PHRASE_MAX];
+	unsigned int n,t,trigram,count,i,j,k,other;
+	unsigned int *list,*more;
+
+	*result=NULL;
+	if (textphraselen[phrase]<3)
+		{
+		return (unsigned int)-1;
+		}
+	// the phrase is already lower case, like the index
+	trigram=(textphrase[phrase][0]<<8)|textphrase[phrase][1];
+	for (n=2,t=0;n<textphraselen[phrase];n++)
+		{
+		trigram=((trigram<<8)|textphrase[phrase][n])&0xffffff;
+		e[t]=index_lookup(trigram);
+		if (e[t]==NULL)
+			{
+			return 0;
+			}
+		t++;
+		}
+	// from the rarest trigram, so the list shrinks as fast as it can
+	qsort(e,t,sizeof(struct indexentry *),index_compare_entries);
+	list=index_postings(e[0]);
+	count=e[0]->count;
+	for (n=1;n<t && count;n++)
+		{
+		more=index_postings(e[n]);
+		other=e[n]->count;
+		for (i=j=k=0;i<count && j<other;)
+			{
+			if (list[i]<more[j])
+				i++;
+			else if (list[i]>more[j])
+				j++;
+			else
+				{
+				list[k++]=list[i++];
+				j++;
+				}
+			}
+		count=k;
+		free(more);
+		}
+	*result=list;
+	return count;
+}
+
+
+int index_compare_ordinals(const void *a, const void *b)
+{
+	unsigned int x=*(const unsigned int *)a;
+	unsigned int y=*(const unsigned int *)b;
+
+	return x<y ? -1 : x>y;
+}
+
+
+void index_query_file(void)
+{
+// --index with --text: read and check only the releases the index gives
+	unsigned int *candidates,*list;
+	unsigned int count,n,c,p;
+	int all;
+	struct indexrecord rec;
+	long long recoffset;
+
+	printf("Searching input file	%s: \n",infilename);
+	fprintf(outfile,"Searching input file	%s: \n\n",infilename);
+	begin_time=clock();
+	if (!index_open())
+		{
+		errorcount++;
+		return;
+		}
+	printf("Using index %s of %u releases\n",indexfilename,indexheader.releases);
+
+	// union of the phrases' candidates
+	candidates=NULL;
+	count=0;
+	all=0;
+	for (p=0;p<textphrasecount;p++)
+		{
+		n=index_phrase(p,&list);
+		if (n==(unsigned int)-1)
+			{
+			all=1;
+			break;
+			}
+		if (n==0)
+			{
+			free(list);
+			continue;
+			}
+		candidates=realloc(candidates,(count+n)*sizeof(unsigned int));
+		if (candidates==NULL)
+			{
+			printf("Error: out of memory for candidates\n");
+			exit(6);
+			}
+		memcpy(candidates+count,list,n*sizeof(unsigned int));
+		count+=n;
+		free(list);
+		}
+	if (all)
+		{
+		printf("A phrase is shorter than 3 characters, every release is a candidate\n");
+		count=indexheader.releases;
+		}
+	else if (textphrasecount>1)
+		{
+		qsort(candidates,count,sizeof(unsigned int),index_compare_ordinals);
+		for (n=c=0;n<count;n++)
+			{
+			if (c==0 || candidates[n]!=candidates[c-1])
+				{
+				candidates[c++]=candidates[n];
+				}
+			}
+		count=c;
+		}
+	printf("%u candidate releases\n",count);
+
+	for (n=0;n<count;n++)
+		{
+		recoffset=indexheader.recordsoffset+(long long)(all ? n : candidates[n])*sizeof(struct indexrecord);
+		if (!index_read_at(indexfile,&rec,sizeof(rec),recoffset))
+			{
+			printf("Error: can't read %s\n",indexfilename);
+			errorcount++;
+			break;
+			}
+		if (rec.offset<(long long)start_offset || (end_offset && rec.offset>=(long long)end_offset))
+			{
+			continue;
+			}
+		releasecount++;
+		release_id=rec.release_id;
+		if (rec.len>BLOCKSIZE || !index_read_at(infile,inputbuffer,rec.len,rec.offset)
+			|| memcmp(inputbuffer,startsearchbuffer,startstringlen))
+			{
+			errorcount++;
+			printf("Error %lu: can't read release %lu at byte %lld (%u bytes)\n",errorcount,release_id,rec.offset,rec.len);
+#if WRITE_DEBUG_FILE
+			fprintf(debugfile,"Error %lu: can't read release %lu at byte %lld (%u bytes)\n",errorcount,release_id,rec.offset,rec.len);
+#endif
+			continue;
+			}
+		inputbuffer[rec.len]='\0';  // process_xml() looks for some tags with strstr()
+		if (text_match_release(inputbuffer,rec.len)==NULL)
+			{
+			continue;  // the trigrams were there, but not the phrase
+			}
+		foundcount++;
+#if DEBUG_FINDS
+		printf("Foundcount: %lu   Releasecount: %lu\n",foundcount,releasecount);
+		printf("S Found release id %lu at file offset %lld\n",release_id,rec.offset);
+#endif
+#if WRITE_DEBUG_FILE
+		fprintf(debugfile,"<release id=\"%lu\"\n",release_id);
+#endif
+		csvrowlen=0;
+		process_xml(inputbuffer,rec.len);
+		write_release(inputbuffer,rec.offset,rec.len);
+		}
+	free(candidates);
+	free(indexdirectory);
+	fclose(indexfile);
+
+	end_time=clock();
+	execution_time=end_time-begin_time;
+	printf("Execution time: %ld\n",execution_time);
+	printf("Saved %lu releases containing searchstring among %lu candidate releases.\n",foundcount,releasecount);
+}
+
+
+/*--- binary release store -----------------------------------
+--build-store storefile infile copies every release of infile into
+storefile as a record that says where its fields are, so later runs with
+--store (storefile given as infile) go straight to them, with no looking
+for release boundaries or tags.  A record is
+	struct storerecord   release id, master_id, where the release was
+	                     in infile, and for title, released, country,
+	                     notes, data_quality, labels, formats and artists
+	                     the offset and length of the text in the xml
+	                     (found as process_xml() would find it)
+	artistcount ids      every <artist><id> in the release, as numbers
+	the release xml
+padded to STORE_ALIGN bytes.  The file starts with a struct storeheader.
+
+--store maps the whole file into memory and steps from record to record.
+The artist match is a look through the ids for SEARCH_STRING's, --text
+looks at only the title and notes spans, and --role and --shard-dir are
+given the xml.  A matched release gets fields filled in from its record,
+with the labels and formats parsed by process_xml()'s own code, and is
+written by write_release() from the mapped xml, so the output is the same
+as from infile.  The byte range options are on the releases' offsets in
+infile.
+
+A release longer than BLOCKSIZE is left out of the store, with an error.
+------------------------------------------------------------*/
+
+void store_span(unsigned char *xml, size_t len, const char *start, const char *end, struct storefield *sf)
+{
+// the text between the first start and first end tags, like process_xml()
+	unsigned char *p,*q;
+
+	memset(sf,0,sizeof(*sf));
+	p=memmem(xml,len,(unsigned char *)start,strlen(start));
+	if (p==NULL)
+		{
+		return;
+		}
+	q=memmem(xml,len,(unsigned char *)end,strlen(end));
+	p+=strlen(start);
+	if (q==NULL || q<p)
+		{
+		sf->found=-1;
+		return;
+		}
+	sf->offset=(unsigned int)(p-xml);
+	sf->len=(unsigned int)(q-p);
+	sf->found=1;
+}
+
+
+void store_add_release(unsigned char *xml, size_t len, long long offset)
+{
+// --build-store: one release's record to storefile
+	struct storerecord rec;
+	unsigned char *p,*q;
+	static unsigned char pad[STORE_ALIGN];
+
+	memset(&rec,0,sizeof(rec));
+	rec.release_id=(unsigned int)strtoul((char *)xml+startstringlen+1,NULL,10);
+	rec.offset=offset;
+	rec.xmllen=(unsigned int)len;
+	store_span(xml,len,TITLE_START,TITLE_END,&rec.field[STORE_TITLE]);
+	store_span(xml,len,RELEASED_START,RELEASED_END,&rec.field[STORE_RELEASED]);
+	store_span(xml,len,COUNTRY_START,COUNTRY_END,&rec.field[STORE_COUNTRY]);
+	store_span(xml,len,NOTES_START,NOTES_END,&rec.field[STORE_NOTES]);
+	store_span(xml,len,DATA_QUALITY_START,DATA_QUALITY_END,&rec.field[STORE_DATA_QUALITY]);
+	store_span(xml,len,LABELS_START,LABELS_END,&rec.field[STORE_LABELS]);
+	store_span(xml,len,FORMAT_NAME_START,FORMATS_END,&rec.field[STORE_FORMATS]);
+	store_span(xml,len,ROLE_ARTISTS_START,STORE_ARTISTS_END,&rec.field[STORE_ARTISTS]);
+
+	p=memmem(xml,len,(unsigned char *)MASTER_ID_START,strlen(MASTER_ID_START));
+	if (p!=NULL)
+		{
+		q=memchr(p,'>',xml+len-p);
+		if (q!=NULL)
+			{
+			rec.master_id=strtoull((char *)q+1,NULL,10);
+			}
+		}
+
+	// every artist id, wherever it is credited
+	p=xml;
+	while ((p=memmem(p,xml+len-p,shardartisttag,shardartisttaglen))!=NULL)
+		{
+		p+=shardartisttaglen;
+		if (rec.artistcount==storeidcap)
+			{
+			storeidcap=storeidcap ? storeidcap*2 : 256;
+			storeids=realloc(storeids,storeidcap*sizeof(unsigned int));
+			if (storeids==NULL)
+				{
+				printf("Error: out of memory for artist ids\n");
+				exit(6);
+				}
+			}
+		storeids[rec.artistcount++]=(unsigned int)strtoul((char *)p,NULL,10);
+		}
+
+	rec.size=(unsigned int)(sizeof(rec)+rec.artistcount*sizeof(unsigned int)+len);
+	rec.size=(rec.size+STORE_ALIGN-1)&~(STORE_ALIGN-1);
+	if (fwrite(&rec,sizeof(rec),1,storefile)!=1
+		|| (rec.artistcount && fwrite(storeids,sizeof(unsigned int),rec.artistcount,storefile)!=rec.artistcount)
+		|| fwrite(xml,1,len,storefile)!=len
+		|| fwrite(pad,1,rec.size-sizeof(rec)-rec.artistcount*sizeof(unsigned int)-len,storefile)
+			!=rec.size-sizeof(rec)-rec.artistcount*sizeof(unsigned int)-len)
+		{
+		printf("Error: can't write to %s\n",storefilename);
+		exit(10);
+		}
+	storeheader.releases++;
+	storeheader.bytes+=rec.size;
+}
+
+
+void store_build(int argc, char *argv[])
+{
+// --build-store storefile infile
+	unsigned char *p,*s,*e,*end;
+	long long bufoffset;
+	size_t have,n,used;
+	int eof;
+	double seconds;
+
+	if (argc!=2)
+		{
+		syntax();
+		}
+	strcpy((char *)infilename,argv[1]);
+	infile=fopen((char *)infilename,"rb");
+	if (infile==NULL)
+		{
+		printf("Error: input file %s not found.\n",infilename);
+		errorcode=1;
+		return;
+		}
+	memset(&storeheader,0,sizeof(storeheader));
+	memcpy(storeheader.magic,STORE_MAGIC,sizeof(storeheader.magic));
+	storeheader.version=STORE_VERSION;
+	if (!index_fingerprint(infile,&storeheader.dumpsize,&storeheader.dumphash))
+		{
+		printf("Error: can't read %s\n",infilename);
+		errorcode=1;
+		return;
+		}
+	storeheader.recordsoffset=sizeof(storeheader);
+	storefile=fopen(storefilename,"wb");
+	if (storefile==NULL)
+		{
+		printf("Error: can't create store file %s\n",storefilename);
+		errorcode=10;
+		return;
+		}
+	setvbuf(storefile,NULL,_IOFBF,SORT_IO_BUFFER);
+	fwrite(&storeheader,sizeof(storeheader),1,storefile);  // filled in at the end
+	printf("Storing the releases of %s in %s\n",infilename,storefilename);
+	begin_time=clock();
+
+	bufoffset=0;
+	have=0;
+	eof=0;
+	while (!eof)
+		{
+		n=fread(inputbuffer+have,1,BLOCKSIZE-have,infile);
+		eof=(n<BLOCKSIZE-have);
+		have+=n;
+		p=inputbuffer;
+		end=inputbuffer+have;
+		for (;;)
+			{
+			s=memmem(p,end-p,startsearchbuffer,startstringlen);
+			if (s==NULL)
+				{
+				// keep what could be the start of a split SEARCH_START
+				p=end-p>startstringlen ? end-(startstringlen-1) : p;
+				break;
+				}
+			e=memmem(s+startstringlen,end-s-startstringlen,endsearchbuffer,endstringlen);
+			if (e==NULL)
+				{
+				if (s==inputbuffer && have==BLOCKSIZE)
+					{
+					errorcount++;
+					printf("Error %lu: release %lu at byte %lld is longer than BLOCKSIZE, not stored\n",errorcount,
+						strtoul((char *)s+startstringlen+1,NULL,10),bufoffset);
+					p=s+startstringlen;  // on to the next release
+					continue;
+					}
+				p=s;  // read the rest of it
+				break;
+				}
+			e+=endstringlen;
+			store_add_release(s,e-s,bufoffset+(s-inputbuffer));
+#if DEBUG_PROGRESS
+			if (0==storeheader.releases%100000)
+				{
+				printf(" r%u ",storeheader.releases);
+				}
+#endif
+			p=e;
+			}
+		used=p-inputbuffer;
+		memmove(inputbuffer,p,have-used);
+		bufoffset+=used;
+		have-=used;
+		}
+	if (memmem(inputbuffer,have,startsearchbuffer,startstringlen)!=NULL)
+		{
+		errorcount++;
+		printf("\nError %lu: input ends inside a release at byte %lld, not stored\n",errorcount,bufoffset);
+		}
+	fclose(infile);
+
+	if (fseek64(storefile,0,SEEK_SET) || fwrite(&storeheader,sizeof(storeheader),1,storefile)!=1 || fclose(storefile))
+		{
+		printf("Error: can't write to %s\n",storefilename);
+		errorcode=10;
+		return;
+		}
+	if (errorcount)
+		{
+		errorcode=10;
+		}
+	end_time=clock();
+	seconds=(double)(end_time-begin_time)/CLOCKS_PER_SEC;
+	printf("\n%u releases, %lld bytes of store in %.1f s, %lu errors\n",storeheader.releases,
+		storeheader.recordsoffset+storeheader.bytes,seconds,errorcount);
+}
+
+
+unsigned char *store_map(FILE *fp, long long *size)
+{
+// all of fp mapped read only, NULL if it can't be
+	unsigned char *base;
+#ifdef _WIN32
+	HANDLE mapping;
+	LARGE_INTEGER li;
+
+	if (!GetFileSizeEx((HANDLE)_get_osfhandle(_fileno(fp)),&li))
+		{
+		return NULL;
+		}
+	*size=li.QuadPart;
+	mapping=CreateFileMapping((HANDLE)_get_osfhandle(_fileno(fp)),NULL,PAGE_READONLY,0,0,NULL);
+	if (mapping==NULL)
+		{
+		return NULL;
+		}
+	base=MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+	CloseHandle(mapping);  // the view keeps it
+	return base;
+#else
+	if (fseek64(fp,0,SEEK_END))
+		{
+		return NULL;
+		}
+	*size=ftell64(fp);
+	if (*size<=0)
+		{
+		return NULL;
+		}
+	base=mmap(NULL,(size_t)*size,PROT_READ,MAP_SHARED,fileno(fp),0);
+	if (base==MAP_FAILED)
+		{
+		return NULL;
+		}
+#ifdef MADV_SEQUENTIAL
+	madvise(base,(size_t)*size,MADV_SEQUENTIAL);
+#endif
+	return base;
+#endif
+}
+
+
+void store_unmap(unsigned char *base, long long size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+#else
+	munmap(base,(size_t)size);
+#endif
+}
+
+
+void store_set_field(struct xmlspan *span, unsigned char *xml, struct storefield *sf)
+{
+	span->ptr=xml+sf->offset;
+	span->len=sf->len;
+	span->found=sf->found;
+}
+
+
+void store_extract(struct storerecord *rec, unsigned char *xml)
+{
+// fields, the label and format arrays and csvrow for a record, as process_xml() would
+	tracebegin(TRACE_EXTRACT);
+	process_xml_reset();
+	rel_id=rec->release_id;
+	fields.release_id=rec->release_id;
+	fields.master_id=rec->master_id;
+	store_set_field(&fields.title,xml,&rec->field[STORE_TITLE]);
+	store_set_field(&fields.released,xml,&rec->field[STORE_RELEASED]);
+	store_set_field(&fields.country,xml,&rec->field[STORE_COUNTRY]);
+	store_set_field(&fields.notes,xml,&rec->field[STORE_NOTES]);
+	store_set_field(&fields.data_quality,xml,&rec->field[STORE_DATA_QUALITY]);
+	if (schemaneeds&SCHEMA_LABELS)
+		{
+		labels_found=rec->field[STORE_LABELS].found;
+		if (labels_found>0)
+			{
+			process_xml_labels(xml+rec->field[STORE_LABELS].offset,rec->field[STORE_LABELS].len);
+			}
+		}
+	if (schemaneeds&SCHEMA_FORMATS)
+		{
+		formats_found=rec->field[STORE_FORMATS].found;
+		if (formats_found>0)
+			{
+			process_xml_formats(xml+rec->field[STORE_FORMATS].offset,rec->field[STORE_FORMATS].len);
+			}
+		}
+	process_xml_lists(xml,rec->xmllen);
+	if (csvrow_enabled)
+		{
+		write_csv_row();
+		}
+	traceend(TRACE_EXTRACT,rec->xmllen);
+}
+
+
+int store_match(struct storerecord *rec, unsigned char *xml)
+{
+// the match of process_input_file() for a record
+	unsigned int *ids;
+	unsigned int n;
+
+	if (shard_mode)
+		{
+		return shard_match_release(xml,rec->xmllen)!=NULL;
+		}
+	if (role_mode)
+		{
+		return role_match_release(xml,rec->xmllen)!=NULL;
+		}
+	if (text_mode)
+		{
+		if ((textfields&(1<<TEXT_TITLE)) && rec->field[STORE_TITLE].found>0
+			&& text_match_span(xml+rec->field[STORE_TITLE].offset,rec->field[STORE_TITLE].len))
+			{
+			return 1;
+			}
+		return (textfields&(1<<TEXT_NOTES)) && rec->field[STORE_NOTES].found>0
+			&& text_match_span(xml+rec->field[STORE_NOTES].offset,rec->field[STORE_NOTES].len);
+		}
+	ids=(unsigned int *)(rec+1);
+	for (n=0;n<rec->artistcount;n++)
+		{
+		if (ids[n]==storeartistid)
+			{
+			return 1;
+			}
+		}
+	return 0;
+}
+
+
+void store_input_file(void)
+{
+// --store: the search of process_input_file() over the records of a store
+	unsigned char *base,*p,*end,*xml;
+	struct storerecord *rec;
+	long long size;
+	unsigned int n;
+
+	printf("Searching input file	%s: \n",infilename);
+	fprintf(outfile,"Searching input file	%s: \n\n",infilename);
+
+	begin_time=clock();
+	if (strncmp(SEARCH_STRING,SHARD_ARTIST_TAG,shardartisttaglen))
+		{
+		printf("Error: --store needs SEARCH_STRING to be %s...</id>\n",SHARD_ARTIST_TAG);
+		errorcount++;
+		return;
+		}
+	storeartistid=(unsigned int)strtoul(SEARCH_STRING+shardartisttaglen,NULL,10);
+
+	base=store_map(infile,&size);
+	if (base==NULL || size<(long long)sizeof(struct storeheader))
+		{
+		printf("Error: can't map %s into memory\n",infilename);
+		errorcount++;
+		return;
+		}
+	memcpy(&storeheader,base,sizeof(storeheader));
+	if (memcmp(storeheader.magic,STORE_MAGIC,sizeof(storeheader.magic)) || storeheader.version!=STORE_VERSION
+		|| storeheader.recordsoffset+storeheader.bytes>size)
+		{
+		printf("Error: %s is not a release store, or is cut short\n",infilename);
+		errorcount++;
+		store_unmap(base,size);
+		return;
+		}
+	printf("Store of %u releases\n",storeheader.releases);
+	if (metricsfilename!=NULL)
+		{
+		metrics_start();
+		// in infile's bytes, which the record offsets are
+		scantotalbytes=(end_offset && (long long)end_offset<storeheader.dumpsize ? (long long)end_offset : storeheader.dumpsize)
+			-(long long)start_offset;
+		if (scantotalbytes<0)
+			{
+			scantotalbytes=0;
+			}
+		}
+	if (start_offset || end_offset)
+		{
+		printf("Searching releases starting from byte %llu to ",start_offset);
+		if (end_offset)
+			printf("%llu\n",end_offset);
+		else
+			printf("the end\n");
+		}
+
+	p=base+storeheader.recordsoffset;
+	end=p+storeheader.bytes;
+	for (n=0;n<storeheader.releases && p<end;n++,p+=rec->size)
+		{
+		rec=(struct storerecord *)p;
+		xml=p+sizeof(struct storerecord)+rec->artistcount*sizeof(unsigned int);
+		if (rec->offset<(long long)start_offset)
+			{
+			continue;
+			}
+		if (end_offset && rec->offset>=(long long)end_offset)
+			{
+			printf("End offset %llu reached\n",end_offset);
+			break;
+			}
+		releasecount++;
+		scanposition=rec->offset+rec->xmllen;
+		if (metricsfilename!=NULL && 0==releasecount%METRICS_CHECK_RELEASES)
+			{
+			metrics_check(rec->release_id);
+			}
+#if DEBUG_PROGRESS
+		if (0==releasecount%100)
+			{
+			printf(" r%lu ",releasecount);
+			}
+#endif
+		if (!store_match(rec,xml))
+			{
+			continue;
+			}
+
+		foundcount++;
+		release_id=rec->release_id;
+#if DEBUG_FINDS
+		printf("Foundcount: %lu   Releasecount: %lu\n",foundcount,releasecount);
+		printf("S Found release id %lu at file offset %lld\n",release_id,rec->offset);
+#endif
+#if WRITE_DEBUG_FILE
+		fprintf(debugfile,"<release id=\"%lu\"\n",release_id);
+#endif
+#if DEBUG_PROGRESS
+		if (0==foundcount%10)
+			{
+			printf("\nf%lu ",foundcount);
+			}
+#endif
+		csvrowlen=0;
+		store_extract(rec,xml);
+		write_release(xml,xml-base,rec->xmllen);
+		}
+	store_unmap(base,size);
+
+	if (metricsfilename!=NULL)
+		{
+		scanposition=(long long)start_offset+scantotalbytes;  // all of it
+		metrics_write(1);
+		}
+
+	end_time=clock();
+	execution_time=end_time-begin_time;
+	printf("Execution time: %ld\n",execution_time);
+	printf("Saved %lu releases containing searchstring among %lu total releases.\n",foundcount,releasecount);
+}
+
+
+/*--- extraction threads -------------------------------------
+With --threads n the block search only finds and matches releases; the
+field extraction and csv formatting of process_xml() for each match is done
+by n worker threads.  The extraction state (fields, the label and format
+arrays, csvrow, tempbuffer...) is THREADLOCAL, so each worker has its own.
+
+A match is copied into the next job of a ring of n*POOL_JOBS_PER_THREAD,
+numbered in the order found.  Workers take queued jobs in that order and
+mark them done.  The search thread writes done jobs from the oldest one on
+(copying the job's csv line back into its own csvrow for write_release()),
+so outfile and csvfile are in dump order whatever order the workers finish
+in.  The search thread only waits when the ring is full of jobs that are
+not yet written, and for the last ones at the end.
+
+--aggregate needs no ordering: workers add their release to the table
+under a lock, since the table is written out sorted.
+------------------------------------------------------------*/
+
+#ifdef _WIN32
+DWORD WINAPI pool_worker(LPVOID arg)
+#else
+void *pool_worker(void *arg)
+#endif
+{
+// take jobs in order, extract them and mark them done
+	struct pooljob *job;
+
+	(void)arg;
+	mutex_lock(poolmutex);
+	for (;;)
+		{
+		while (pooltaken==poolqueued && !poolstop)
+			{
+			cond_wait(poolwork,poolmutex);
+			}
+		if (pooltaken==poolqueued)
+			{
+			break;
+			}
+		job=&pooljobs[pooltaken%poolslots];
+		pooltaken++;
+		mutex_unlock(poolmutex);
+
+		strcpy(matchedrole,job->role);
+		csvrowlen=0;
+		process_xml(job->xml,job->xmllen);
+		if (aggregate_mode)
+			{
+			mutex_lock(poolaggregatemutex);
+			aggregate_release();
+			mutex_unlock(poolaggregatemutex);
+			}
+		else
+			{
+			if (!pool_reserve(&job->csv,&job->csvcap,csvrowlen))
+				{
+				csvrowlen=0;
+				}
+			memcpy(job->csv,csvrow,csvrowlen);
+			job->csvlen=csvrowlen;
+			job->master_id=fields.master_id;
+			job->rel_id=rel_id;
+			}
+
+		mutex_lock(poolmutex);
+		job->state=POOL_DONE;
+		cond_broadcast(pooldone);
+		}
+	mutex_unlock(poolmutex);
+	return 0;
+}
+
+
+int pool_reserve(unsigned char **buf, size_t *cap, size_t len)
+{
+// grow a job buffer to hold len bytes
+	unsigned char *p;
+
+	if (len<=*cap)
+		{
+		return 1;
+		}
+	p=realloc(*buf,len);
+	if (p==NULL)
+		{
+		printf("Error: out of memory for an extraction job of %lu bytes\n",(unsigned long)len);
+		return 0;
+		}
+	*buf=p;
+	*cap=len;
+	return 1;
+}
+
+
+void pool_start(void)
+{
+// the job ring and poolthreads workers
+	unsigned int n;
+
+	poolslots=poolthreads*POOL_JOBS_PER_THREAD;
+	pooljobs=calloc(poolslots,sizeof(struct pooljob));
+	poolthreadids=calloc(poolthreads,sizeof(poolthread_t));
+	if (pooljobs==NULL || poolthreadids==NULL)
+		{
+		printf("Error: out of memory for %u extraction threads\n",poolthreads);
+		exit(6);
+		}
+	mutex_init(poolmutex);
+	mutex_init(poolaggregatemutex);
+	cond_init(poolwork);
+	cond_init(pooldone);
+	for (n=0;n<poolthreads;n++)
+		{
+#ifdef _WIN32
+		poolthreadids[n]=CreateThread(NULL,0,pool_worker,NULL,0,NULL);
+		if (poolthreadids[n]==NULL)
+#else
+		if (pthread_create(&poolthreadids[n],NULL,pool_worker,NULL))
+#endif
+			{
+			printf("Error: could not start extraction thread %u\n",n+1);
+			exit(6);
+			}
+		}
+}
+
+
+int pool_write_next(int wait)
+{
+// write the oldest job if it is done (or once it is, if wait).  0 if there was none to write.
+	struct pooljob *job;
+
+	if (poolwritten==poolqueued)
+		{
+		return 0;
+		}
+	job=&pooljobs[poolwritten%poolslots];
+	mutex_lock(poolmutex);
+	if (wait && job->state!=POOL_DONE)
+		{
+		tracebegin(TRACE_POOL_WAIT);
+		}
+	while (job->state!=POOL_DONE)
+		{
+		if (!wait)
+			{
+			mutex_unlock(poolmutex);
+			return 0;
+			}
+		cond_wait(pooldone,poolmutex);
+		}
+	mutex_unlock(poolmutex);
+	traceend(TRACE_POOL_WAIT,poolwritten);
+
+	if (!aggregate_mode)
+		{
+		release_id=job->release_id;
+		rel_id=job->rel_id;
+		fields.master_id=job->master_id;
+		memcpy(csvrow,job->csv,job->csvlen);
+		csvrowlen=job->csvlen;
+		write_release(job->xml,job->offset,job->xmllen);
+		}
+	job->state=POOL_FREE;
+	poolwritten++;
+	return 1;
+}
+
+
+void pool_submit(unsigned char *startptr, size_t len)
+{
+// hand a matched release (and its matchedrole) to the workers
+	struct pooljob *job;
+
+	while (poolqueued-poolwritten==poolslots)
+		{
+		pool_write_next(1);
+		}
+	// only this thread fills a free job, so no lock until it is queued
+	job=&pooljobs[poolqueued%poolslots];
+	if (!pool_reserve(&job->xml,&job->xmlcap,len))
+		{
+		exit(6);
+		}
+	memcpy(job->xml,startptr,len);
+	job->xmllen=len;
+	job->offset=blockfileposition+(startptr-inputbuffer);
+	job->release_id=strtoul((char *)startptr+startstringlen+1,NULL,10);
+	strcpy(job->role,role_mode?matchedrole:"");
+
+	mutex_lock(poolmutex);
+	job->state=POOL_QUEUED;
+	poolqueued++;
+	cond_signal(poolwork);
+	mutex_unlock(poolmutex);
+
+	while (pool_write_next(0))
+		{
+		}
+}
+
+
+void pool_finish(void)
+{
+// write the rest, in order, and stop the workers
+	unsigned int n;
+
+	while (pool_write_next(1))
+		{
+		}
+	mutex_lock(poolmutex);
+	poolstop=1;
+	cond_broadcast(poolwork);
+	mutex_unlock(poolmutex);
+	for (n=0;n<poolthreads;n++)
+		{
+#ifdef _WIN32
+		WaitForSingleObject(poolthreadids[n],INFINITE);
+		CloseHandle(poolthreadids[n]);
+#else
+		pthread_join(poolthreadids[n],NULL);
+#endif
+		}
+	for (n=0;n<poolslots;n++)
+		{
+		free(pooljobs[n].xml);
+		free(pooljobs[n].csv);
+		}
+	free(pooljobs);
+	free(poolthreadids);
+}
+
+
+/*--- following a growing dump -------------------------------
+--follow lets the block search start on a dump that is still being
+downloaded or decompressed into infile.  Where a read comes up short of a
+whole block, follow_read() waits for infile to grow (inotify on Linux,
+otherwise a look every FOLLOW_POLL_MS) and reads on, instead of taking it
+as the end of the file.  The dump is finished when its last bytes are the
+closing FOLLOW_END_TAG, or when the --follow-marker file exists (checked
+before each read, so all that was written before the marker is read).
+Then the short block is given to the search as its last pass, as at EOF.
+------------------------------------------------------------*/
+
+void follow_start(void)
+{
+// watch infile for writes
+#ifdef __linux__
+	followfd=inotify_init1(IN_NONBLOCK);
+	if (followfd>=0 && inotify_add_watch(followfd,(char *)infilename,IN_MODIFY|IN_CLOSE_WRITE)<0)
+		{
+		close(followfd);
+		followfd=-1;
+		}
+	if (followfd<0)
+		{
+		printf("Note: no inotify for --follow, looking every %u ms\n",FOLLOW_POLL_MS);
+		}
+#endif
+	printf("Following %s until it ends with %s",infilename,FOLLOW_END_TAG);
+	if (followmarkername!=NULL)
+		{
+		printf(" or %s exists",followmarkername);
+		}
+	printf("\n");
+}
+
+
+void follow_stop(void)
+{
+#ifdef __linux__
+	if (followfd>=0)
+		{
+		close(followfd);
+		followfd=-1;
+		}
+#endif
+	if (followwaits)
+		{
+		printf("Waited %lu times for %s to grow\n",followwaits,infilename);
+		}
+}
+
+
+int follow_finished(void)
+{
+// is the marker there, or does infile (up to where it has been read) end with FOLLOW_END_TAG
+	FILE *fp;
+	unsigned char tail[FOLLOW_TAIL];
+	long long end;
+	size_t n;
+	int finished;
+
+	if (followmarkername!=NULL)
+		{
+		fp=fopen(followmarkername,"rb");
+		if (fp!=NULL)
+			{
+			fclose(fp);
+			return 1;
+			}
+		}
+	end=ftell64(infile);
+	n=end<FOLLOW_TAIL ? (size_t)end : FOLLOW_TAIL;
+	finished=0;
+	if (n>=strlen(FOLLOW_END_TAG) && index_read_at(infile,tail,n,end-(long long)n))
+		{
+		finished=memmem(tail,n,(unsigned char *)FOLLOW_END_TAG,strlen(FOLLOW_END_TAG))!=NULL;
+		}
+	fseek64(infile,end,SEEK_SET);
+	return finished;
+}
+
+
+void follow_wait(void)
+{
+// until infile is written to, or FOLLOW_POLL_MS
+#ifdef __linux__
+	struct pollfd pfd;
+	unsigned char events[4096];
+
+	if (followfd>=0)
+		{
+		pfd.fd=followfd;
+		pfd.events=POLLIN;
+		pfd.revents=0;
+		if (poll(&pfd,1,FOLLOW_POLL_MS)>0)
+			{
+			while (read(followfd,events,sizeof(events))>0)
+				{
+				}
+			}
+		return;
+		}
+#endif
+#ifdef _WIN32
+	Sleep(FOLLOW_POLL_MS);
+#else
+	usleep(FOLLOW_POLL_MS*1000);
+#endif
+}
+
+
+size_t follow_read(unsigned char *buffer)
+{
+// fread() of one BLOCKSIZE block for --follow.  1 with a whole block, 0 with
+// the last of the dump (zero padded), once it is finished.
+	size_t got;
+	int finished;
+
+	got=0;
+	finished=0;
+	for (;;)
+		{
+		got+=fread(buffer+got,1,BLOCKSIZE-got,infile);
+		if (got==BLOCKSIZE)
+			{
+			return 1;
+			}
+		if (ferror(infile))
+			{
+			printf("Error: reading %s while following it\n",infilename);
+			errorcount++;
+			return 0;
+			}
+		clearerr(infile);
+		if (finished)
+			{
+			return 0;
+			}
+		// once finished, one more read for what was written before the marker
+		finished=follow_finished();
+		if (!finished)
+			{
+			followwaits++;
+			tracebegin(TRACE_FOLLOW_WAIT);
+			follow_wait();
+			traceend(TRACE_FOLLOW_WAIT,ftell64(infile));
+			}
+		}
+}
+
+
+/*--- microbenchmarks ----------------------------------------
+--bench times the search and extraction kernels on their own, on
+synthetic releases made by bench_release() in the dump's layout, so a
+change to memmem() or process_xml() can be measured without a dump or
+disk reads in the way:
+	search      memmem() through BENCH_RELEASES releases for SEARCH_START,
+	            SEARCH_END and SEARCH_STRING, the last with the artist in
+	            0, 1, 10 and 100% of the releases
+	resync      from BENCH_RESYNCS places inside releases to the next
+	            whole release, as after a seek back or a --start-offset
+	extract     process_xml() without the csv line, for releases with 1,
+	            3 and 20 labels and formats
+	csv         write_csv_row() alone, for the same three releases
+Each is run --bench-repeats times (default BENCH_REPEATS).  The median run
+is given in ns per byte (of xml searched or extracted, of csv written) and
+per record, with the fastest run and the spread (standard deviation over
+the mean) to tell noise from a change.
+------------------------------------------------------------*/
+
+double bench_now(void)
+{
+// ns, from a monotonic clock
+#ifdef _WIN32
+	LARGE_INTEGER count,frequency;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart*1e9/(double)frequency.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (double)ts.tv_sec*1e9+(double)ts.tv_nsec;
+#endif
+}
+
+
+size_t bench_release(unsigned char *out, unsigned long id, unsigned int labels, unsigned int formats, int match)
+{
+// a release like those of the dump, with the artist of SEARCH_STRING if match
+	char *p;
+	unsigned int n;
+
+	p=(char *)out;
+	p+=sprintf(p,"%s\"%lu\" status=\"Accepted\"><images><image height=\"600\" type=\"primary\" uri=\"\" uri150=\"\" width=\"600\"/></images>",SEARCH_START,id);
+	p+=sprintf(p,"<artists><artist><id>%lu</id><name>Artist %lu</name><anv></anv><join></join><role></role><tracks></tracks></artist></artists>",match ? benchartistid : benchartistid+1+id%5000,id);
+	p+=sprintf(p,"<title>Title of release %lu</title><labels>",id);
+	for (n=0;n<labels;n++)
+		{
+		p+=sprintf(p,"<label catno=\"CAT-%lu-%u\" id=\"%u\" name=\"Label %u (%u)\"/>",id,n,n,n,n);
+		}
+	p+=sprintf(p,"</labels><extraartists><artist><id>%lu</id><name>E</name><anv></anv><join></join><role>Remix</role><tracks></tracks></artist></extraartists><formats>",benchartistid+7+id%5000);
+	for (n=0;n<formats;n++)
+		{
+		p+=sprintf(p,"<format name=\"%s\" qty=\"%u\" text=\"\"><descriptions><description>LP</description><description>Album</description></descriptions></format>",n&1 ? "Vinyl" : "CD",n+1);
+		}
+	p+=sprintf(p,"</formats><genres><genre>Electronic</genre></genres><styles><style>Techno</style></styles><country>UK</country><released>%lu</released>",1960+id%60);
+	p+=sprintf(p,"<notes>Notes of release %lu &amp; more</notes><master_id is_main_release=\"true\">%lu</master_id><data_quality>Correct</data_quality>",id,id/3);
+	p+=sprintf(p,"<tracklist><track><position>A1</position><title>Track</title><duration>5:57</duration></track></tracklist>%s\n",SEARCH_END);
+	return (unsigned char *)p-out;
+}
+
+
+size_t bench_releases(unsigned char *out, unsigned int percent)
+{
+// BENCH_RELEASES releases, percent of them with the artist
+	size_t len;
+	unsigned long id;
+
+	len=0;
+	for (id=1;id<=BENCH_RELEASES;id++)
+		{
+		len+=bench_release(out+len,id,2,1,id%100<percent);
+		}
+	return len;
+}
+
+
+unsigned long long bench_kernel(int kernel, unsigned char *buf, size_t len, const char *needle, unsigned int count)
+{
+// one run of a kernel.  Returns something of the work done, for bench_sink.
+	unsigned char *p,*end;
+	unsigned long long total;
+	unsigned int seed,n;
+
+	total=0;
+	switch (kernel)
+		{
+		case BENCH_SEARCH:
+			for (p=buf;(p=memmem(p,buf+len-p,(unsigned char *)needle,strlen(needle)))!=NULL;p++)
+				{
+				total++;
+				}
+			break;
+		case BENCH_RESYNC:
+			seed=12345;
+			for (n=0;n<count;n++)
+				{
+				seed=seed*1103515245+12345;
+				p=buf+(seed>>8)%(len-BENCH_RELEASE_MAX);
+				p=memmem(p,buf+len-p,startsearchbuffer,startstringlen);
+				if (p!=NULL)
+					{
+					end=memmem(p+startstringlen,buf+len-p-startstringlen,endsearchbuffer,endstringlen);
+					total+=end!=NULL ? (unsigned long long)(end-p) : 0;
+					}
+				}
+			break;
+		case BENCH_EXTRACT:
+			for (n=0;n<count;n++)
+				{
+				process_xml(buf,len);
+				total+=catno_count+format_desc_count;
+				}
+			break;
+		case BENCH_CSV:
+			for (n=0;n<count;n++)
+				{
+				csvrowlen=0;
+				write_csv_row();
+				total+=csvrowlen;
+				}
+			break;
+		}
+	return total;
+}
+
+
+int bench_compare(const void *a, const void *b)
+{
+	double x=*(const double *)a;
+	double y=*(const double *)b;
+
+	return x<y ? -1 : x>y;
+}
+
+
+void bench_measure(const char *name, int kernel, unsigned char *buf, size_t len, const char *needle, unsigned int count, double bytes, double records)
+{
+// bench_repeats runs of a kernel, after one to warm the caches, and a line of results
+	double *times;
+	double mean,var,median;
+	unsigned int r;
+
+	times=malloc(bench_repeats*sizeof(double));
+	if (times==NULL)
+		{
+		printf("Error: out of memory for --bench\n");
+		exit(6);
+		}
+	bench_sink+=bench_kernel(kernel,buf,len,needle,count);
+	for (r=0;r<bench_repeats;r++)
+		{
+		times[r]=bench_now();
+		bench_sink+=bench_kernel(kernel,buf,len,needle,count);
+		times[r]=bench_now()-times[r];
+		}
+	qsort(times,bench_repeats,sizeof(double),bench_compare);
+	median=times[bench_repeats/2];
+	mean=0;
+	for (r=0;r<bench_repeats;r++)
+		{
+		mean+=times[r];
+		}
+	mean/=bench_repeats;
+	var=0;
+	for (r=0;r<bench_repeats;r++)
+		{
+		var+=(times[r]-mean)*(times[r]-mean);
+		}
+	var/=bench_repeats;
+
+	printf("%-32s %10.3f %12.1f %10.3f %10.3f %7.1f%%\n",name,bytes>0 ? median/bytes : 0,records>0 ? median/records : 0,median/1e6,times[0]/1e6,mean>0 ? 100*sqrt(var)/mean : 0);
+	free(times);
+}
+
+
+void bench_run(void)
+{
+// --bench
+	static const unsigned int percents[]={0,1,10,100};
+	static const unsigned int sizes[]={1,3,20};
+	unsigned char *buf;
+	unsigned char release[BENCH_RELEASE_MAX];
+	size_t len,rlen;
+	unsigned long long scanned;
+	unsigned int n;
+	char name[100];
+
+	printf("%s\n",VERSION);
+	printf("Microbenchmarks, median of %u runs\n\n",bench_repeats);
+	printf("%-32s %10s %12s %10s %10s %8s\n","kernel","ns/byte","ns/record","median ms","min ms","spread");
+
+	buf=malloc((size_t)BENCH_RELEASES*BENCH_RELEASE_MAX);
+	if (buf==NULL)
+		{
+		printf("Error: out of memory for --bench\n");
+		exit(6);
+		}
+	benchartistid=strtoul(SEARCH_STRING+strlen(SHARD_ARTIST_TAG),NULL,10);
+
+	// needle searches
+	len=bench_releases(buf,10);
+	bench_measure("search " SEARCH_START,BENCH_SEARCH,buf,len,SEARCH_START,0,len,BENCH_RELEASES);
+	bench_measure("search " SEARCH_END,BENCH_SEARCH,buf,len,SEARCH_END,0,len,BENCH_RELEASES);
+	bench_measure("search " SHARD_ARTIST_TAG,BENCH_SEARCH,buf,len,SHARD_ARTIST_TAG,0,len,BENCH_RELEASES);
+	for (n=0;n<sizeof(percents)/sizeof(percents[0]);n++)
+		{
+		len=bench_releases(buf,percents[n]);
+		sprintf(name,"search artist, %u%% match",percents[n]);
+		bench_measure(name,BENCH_SEARCH,buf,len,SEARCH_STRING,0,len,BENCH_RELEASES);
+		}
+
+	// boundary resync
+	scanned=bench_kernel(BENCH_RESYNC,buf,len,NULL,BENCH_RESYNCS);
+	bench_measure("resync to next release",BENCH_RESYNC,buf,len,NULL,BENCH_RESYNCS,(double)scanned,BENCH_RESYNCS);
+
+	// extraction and csv of single releases
+	for (n=0;n<sizeof(sizes)/sizeof(sizes[0]);n++)
+		{
+		rlen=bench_release(release,1000+n,sizes[n],sizes[n],1);
+		csvrow_enabled=0;
+		sprintf(name,"extract, %u labels/formats",sizes[n]);
+		bench_measure(name,BENCH_EXTRACT,release,rlen,NULL,BENCH_EXTRACTS,(double)rlen*BENCH_EXTRACTS,BENCH_EXTRACTS);
+
+		process_xml(release,rlen);
+		csvrow_enabled=1;
+		csvrowlen=0;
+		write_csv_row();
+		sprintf(name,"csv, %u labels/formats",sizes[n]);
+		bench_measure(name,BENCH_CSV,release,rlen,NULL,BENCH_EXTRACTS,(double)csvrowlen*BENCH_EXTRACTS,BENCH_EXTRACTS);
+		}
+
+	free(buf);
+	if (!bench_sink)
+		{
+		printf("(nothing found)\n");
+		}
+}
+
+
+/*--- csv columns --------------------------------------------
+--columns (or --schema, a file of the same names one per line) picks the
+columns of csvfile, in order, from schema_column_names: the HEADER_LINE
+ones and master_id, genres, styles and identifiers.  schema_compile() turns
+the list into schemaneeds, the fields process_xml() (and store_extract())
+have to look for, so a run that only wants release_id and country doesn't
+search for the title, labels or formats at all.  --sort adds master_id to
+the plan, and without --columns --aggregate gets only the fields it groups
+by.
+
+With --columns every column is written, EMPTY_FIELD if the release doesn't
+have it, so the rows always line up with the header.  genres, styles and
+identifiers are only taken apart when written: the values joined with
+SCHEMA_LIST_SEPARATOR, identifiers as type: value.  Without --columns the
+plan is the whole HEADER_LINE and write_csv_row() is as before.
+------------------------------------------------------------*/
+
+int schema_parse_columns(char *list)
+{
+// comma or line separated column names into schemacolumns[], returns 0 if one is unknown
+	char *p;
+	char *end;
+	size_t len;
+	int c;
+
+	schemacount=0;
+	for (p=list;*p;p=end)
+		{
+		end=p+strcspn(p,",\r\n");
+		len=end-p;
+		if (*end)
+			{
+			end++;
+			}
+		while (len && (*p==' ' || *p=='\t'))
+			{
+			p++;
+			len--;
+			}
+		while (len && (p[len-1]==' ' || p[len-1]=='\t'))
+			{
+			len--;
+			}
+		if (len==0 || *p=='#')
+			{
+			continue;  // blank line or comment in a --schema file
+			}
+		for (c=0;schema_column_names[c]!=NULL;c++)
+			{
+			if (len==strlen(schema_column_names[c]) && !strncmp(p,schema_column_names[c],len))
+				{
+				break;
+				}
+			}
+		if (schema_column_names[c]==NULL || schemacount==SCHEMA_MAX_COLUMNS)
+			{
+			printf("Error: no csv column \"%.*s\" (up to %u of those listed by --help)\n",(int)len,p,SCHEMA_MAX_COLUMNS);
+			return 0;
+			}
+		schemacolumns[schemacount++]=c;
+		}
+	if (schemacount==0)
+		{
+		printf("Error: no csv columns given\n");
+		}
+	return schemacount;
+}
+
+
+char *schema_read_file(char *filename)
+{
+// a --schema file, as one string
+	FILE *fp;
+	char *text;
+	long size;
+
+	fp=fopen(filename,"rb");
+	if (fp==NULL)
+		{
+		printf("Error: can't open --schema file %s\n",filename);
+		return NULL;
+		}
+	fseek(fp,0,SEEK_END);
+	size=ftell(fp);
+	fseek(fp,0,SEEK_SET);
+	text=malloc(size+1);
+	if (text==NULL || fread(text,1,size,fp)!=(size_t)size)
+		{
+		printf("Error: can't read --schema file %s\n",filename);
+		free(text);
+		fclose(fp);
+		return NULL;
+		}
+	text[size]='\0';
+	fclose(fp);
+	return text;
+}
+
+
+int schema_compile(void)
+{
+// the extraction plan and csv header for the run.  0 if the columns are no good.
+	unsigned int c,f;
+	size_t len;
+
+	if (schemafilename!=NULL)
+		{
+		schemacolumnlist=schema_read_file(schemafilename);
+		if (schemacolumnlist==NULL)
+			{
+			return 0;
+			}
+		}
+	if (schemacolumnlist==NULL)
+		{
+		schemaneeds=SCHEMA_ALL_HEADER;
+		if (json_mode)
+			{
+			json_init();
+			schemaneeds|=SCHEMA_LABEL_LIST|SCHEMA_FORMAT_LIST|SCHEMA_GENRES|SCHEMA_STYLES;
+			}
+		if (aggregate_mode)
+			{
+			// only what is grouped by
+			schemaneeds=0;
+			for (f=0;f<aggregatefieldcount;f++)
+				{
+				schemaneeds|=schema_aggregate_needs[aggregatefields[f]];
+				}
+			}
+		return 1;
+		}
+
+	if (!schema_parse_columns(schemacolumnlist))
+		{
+		return 0;
+		}
+	schema_mode=1;
+	schemaneeds=0;
+	len=2;
+	for (c=0;c<schemacount;c++)
+		{
+		schemaneeds|=schema_column_needs[schemacolumns[c]];
+		len+=strlen(schema_column_names[schemacolumns[c]])+3;
+		}
+	if (sort_mode)
+		{
+		schemaneeds|=SCHEMA_MASTER_ID;
+		}
+
+	csvheader=malloc(len);
+	if (csvheader==NULL)
+		{
+		printf("Error: out of memory for the csv header\n");
+		exit(6);
+		}
+	len=0;
+	for (c=0;c<schemacount;c++)
+		{
+		len+=sprintf(csvheader+len,"%s\"%s\"",c ? SEPARATOR : "",schema_column_names[schemacolumns[c]]);
+		}
+	strcpy(csvheader+len,"\n");
+	return 1;
+}
+
+
+void process_xml_lists(unsigned char *xml, size_t len)
+{
+// the spans of the genres, styles and identifiers wanted by --columns
+	if (schemaneeds&SCHEMA_GENRES)
+		{
+		schema_find_span(xml,len,GENRES_START,GENRES_END,&fields.genres);
+		}
+	if (schemaneeds&SCHEMA_STYLES)
+		{
+		schema_find_span(xml,len,STYLES_START,STYLES_END,&fields.styles);
+		}
+	if (schemaneeds&SCHEMA_IDENTIFIERS)
+		{
+		schema_find_span(xml,len,IDENTIFIERS_START,IDENTIFIERS_END,&fields.identifiers);
+		}
+	if (schemaneeds&SCHEMA_LABEL_LIST)
+		{
+		schema_find_span(xml,len,LABELS_START,LABELS_END,&fields.labels);
+		}
+	if (schemaneeds&SCHEMA_FORMAT_LIST)
+		{
+		schema_find_span(xml,len,FORMATS_START,FORMATS_END,&fields.formats);
+		}
+}
+
+
+void schema_find_span(unsigned char *xml, size_t len, const char *start, const char *end, struct xmlspan *span)
+{
+// the text between the first start and first end tags
+	unsigned char *p,*q;
+
+	span->found=0;
+	p=memmem(xml,len,(unsigned char *)start,strlen(start));
+	if (p==NULL)
+		{
+		return;
+		}
+	p+=strlen(start);
+	q=memmem(p,xml+len-p,(unsigned char *)end,strlen(end));
+	if (q==NULL)
+		{
+		span->found=-1;
+		return;
+		}
+	span->ptr=p;
+	span->len=q-p;
+	span->found=1;
+}
+
+
+void schema_write_span(struct xmlspan *span)
+{
+	if (span->found>0)
+		{
+		rowprintf("\"%.*s\"",(int)span->len,span->ptr);
+		}
+	else
+		{
+		rowprintf("%s",EMPTY_FIELD);
+		}
+}
+
+
+void schema_write_list(struct xmlspan *span, const char *start, const char *end)
+{
+// the text of each start...end element in span, joined
+	unsigned char *p,*q,*stop;
+	int count;
+
+	count=0;
+	if (span->found>0)
+		{
+		stop=span->ptr+span->len;
+		for (p=span->ptr;(p=memmem(p,stop-p,(unsigned char *)start,strlen(start)))!=NULL;p=q+strlen(end))
+			{
+			p+=strlen(start);
+			q=memmem(p,stop-p,(unsigned char *)end,strlen(end));
+			if (q==NULL)
+				{
+				break;
+				}
+			rowprintf("%s%.*s",count++ ? SCHEMA_LIST_SEPARATOR : "\"",(int)(q-p),p);
+			}
+		}
+	if (count)
+		{
+		rowprintf("\"");
+		}
+	else
+		{
+		rowprintf("%s",EMPTY_FIELD);
+		}
+}
+
+
+unsigned char *schema_attribute(unsigned char *p, unsigned char *stop, const char *name, size_t *len)
+{
+// the value of attribute name="..." in the tag at p
+	unsigned char *q,*tagend;
+
+	tagend=memchr(p,'>',stop-p);
+	if (tagend==NULL)
+		{
+		tagend=stop;
+		}
+	q=memmem(p,tagend-p,(unsigned char *)name,strlen(name));
+	if (q==NULL)
+		{
+		*len=0;
+		return p;
+		}
+	q+=strlen(name);
+	p=memchr(q,'"',tagend-q);
+	*len=p!=NULL ? (size_t)(p-q) : 0;
+	return q;
+}
+
+
+void schema_write_identifiers(struct xmlspan *span)
+{
+// each <identifier> as type: value, joined
+	unsigned char *p,*stop,*type,*value;
+	size_t typelen,valuelen;
+	int count;
+
+	count=0;
+	if (span->found>0)
+		{
+		stop=span->ptr+span->len;
+		for (p=span->ptr;(p=memmem(p,stop-p,(unsigned char *)IDENTIFIER_START,strlen(IDENTIFIER_START)))!=NULL;p++)
+			{
+			type=schema_attribute(p,stop," type=\"",&typelen);
+			value=schema_attribute(p,stop," value=\"",&valuelen);
+			rowprintf("%s%.*s: %.*s",count++ ? SCHEMA_LIST_SEPARATOR : "\"",(int)typelen,type,(int)valuelen,value);
+			}
+		}
+	if (count)
+		{
+		rowprintf("\"");
+		}
+	else
+		{
+		rowprintf("%s",EMPTY_FIELD);
+		}
+}
+
+
+void schema_write_row(void)
+{
+// csvrow in the --columns columns
+	unsigned int c,n;
+
+	csvrowlen=0;
+	for (c=0;c<schemacount;c++)
+		{
+		if (c)
+			{
+			rowprintf(SEPARATOR);
+			}
+		switch (schemacolumns[c])
+			{
+			case SCHEMA_COL_RELEASE_ID:
+				rowprintf("\"%lu\"",fields.release_id);
+				break;
+			case SCHEMA_COL_TITLE:
+				schema_write_span(&fields.title);
+				break;
+			case SCHEMA_COL_RELEASED:
+				schema_write_span(&fields.released);
+				break;
+			case SCHEMA_COL_COUNTRY:
+				schema_write_span(&fields.country);
+				break;
+			case SCHEMA_COL_NOTES:
+				schema_write_span(&fields.notes);
+				break;
+			case SCHEMA_COL_DATA_QUALITY:
+				schema_write_span(&fields.data_quality);
+				break;
+			case SCHEMA_COL_FIRST_LABEL_CATNO:
+			case SCHEMA_COL_FIRST_LABEL:
+			case SCHEMA_COL_FIRST_CATNO:
+			case SCHEMA_COL_ALL_LABEL_CATNO:
+				if (labels_found<=0 || catno_count==0)
+					{
+					rowprintf("%s",EMPTY_FIELD);
+					}
+				else if (schemacolumns[c]==SCHEMA_COL_FIRST_LABEL_CATNO)
+					{
+					rowprintf("\"%s%s%s\"",labelname[0],LABEL_CATNO_SEPARATOR,catno[0]);
+					}
+				else if (schemacolumns[c]==SCHEMA_COL_FIRST_LABEL)
+					{
+					rowprintf("\"%s\"",labelname[0]);
+					}
+				else if (schemacolumns[c]==SCHEMA_COL_FIRST_CATNO)
+					{
+					rowprintf("\"%s\"",catno[0]);
+					}
+				else
+					{
+					for (n=0;n<catno_count;n++)
+						{
+						rowprintf("%s%s%s%s",n ? ", " : "\"",labelname[n],LABEL_CATNO_SEPARATOR,catno[n]);
+						}
+					rowprintf("\"");
+					}
+				break;
+			case SCHEMA_COL_FORMAT_NAME:
+			case SCHEMA_COL_FORMAT_QTY:
+			case SCHEMA_COL_FORMAT_TEXT:
+			case SCHEMA_COL_DESCRIPTION:
+			case SCHEMA_COL_COMBINED_DESCRIPTION:
+				if (formats_found<=0)
+					{
+					rowprintf("%s",EMPTY_FIELD);
+					}
+				else if (schemacolumns[c]==SCHEMA_COL_FORMAT_NAME)
+					{
+					rowprintf("\"%s\"",format_name);
+					}
+				else if (schemacolumns[c]==SCHEMA_COL_FORMAT_QTY)
+					{
+					rowprintf("\"%s\"",format_qty);
+					}
+				else if (schemacolumns[c]==SCHEMA_COL_FORMAT_TEXT)
+					{
+					rowprintf("\"%s\"",format_text);
+					}
+				else
+					{
+					// as write_csv_row() does them
+					if (schemacolumns[c]==SCHEMA_COL_DESCRIPTION)
+						{
+						rowprintf("\"");
+						}
+					else if (!strcmp((char *)format_qty,"1"))
+						{
+						rowprintf("\"%s%s",format_name,FORMAT_DESCRIPTION_SEPARATOR);
+						}
+					else
+						{
+						rowprintf("\"%sx%s%s",format_qty,format_name,FORMAT_DESCRIPTION_SEPARATOR);
+						}
+					for (n=0;n<format_desc_count;n++)
+						{
+						rowprintf("%s%s",n ? FORMAT_DESCRIPTION_SEPARATOR : "",description[n]);
+						}
+					rowprintf("\"");
+					}
+				break;
+			case SCHEMA_COL_MASTER_ID:
+				if (fields.master_id)
+					{
+					rowprintf("\"%llu\"",fields.master_id);
+					}
+				else
+					{
+					rowprintf("%s",EMPTY_FIELD);
+					}
+				break;
+			case SCHEMA_COL_GENRES:
+				schema_write_list(&fields.genres,GENRE_START,GENRE_END);
+				break;
+			case SCHEMA_COL_STYLES:
+				schema_write_list(&fields.styles,STYLE_START,STYLE_END);
+				break;
+			case SCHEMA_COL_IDENTIFIERS:
+				schema_write_identifiers(&fields.identifiers);
+				break;
+			}
+		}
+
+	if (role_mode)
+		{
+		rowprintf(SEPARATOR);
+		rowprintf("\"%s\"",matchedrole);
+		}
+	rowprintf("\n");
+}
+
+
+/*--- result cache -------------------------------------------
+With --cache-dir dir, the finished outfile and csvfile of a run are kept
+in dir, so the same search of the same dump asked for again is a copy of
+two files instead of a scan.  An entry is found by the hash of its key:
+	the dump's fingerprint  size, modification time and a hash of
+	                        CACHE_SAMPLES pieces spread over it (cheap
+	                        even for the whole dump)
+	the query               VERSION, BLOCKSIZE, the compiled search
+	                        strings, and every option that changes the
+	                        output (--role, --text, --index and the
+	                        fingerprint of its file, --sort, --aggregate,
+	                        --columns, the byte range), normalised
+The entry is dir/<hash>.xml, .csv and .key; the .key file holds the key
+text, checked on a hit in case two keys hash the same.  dir/cache.idx
+lists the entries with their size and when they were last used, and once
+the entries add up to more than --cache-size MB the least recently used
+are deleted.
+
+The outputs are as the first run wrote them (its input file name and
+times included).  A run with errors isn't kept.  Entries are written as
+.tmp files and renamed, so a run that stops halfway leaves no entry.
+------------------------------------------------------------*/
+
+int cache_fingerprint(char *filename, FILE *fp, unsigned long long *size, unsigned long long *mtime, unsigned int *hash)
+{
+// size, modification time and sampled content hash of the dump.  0 if it can't be had.
+#ifdef _WIN32
+	struct _stati64 st;
+#else
+	struct stat st;
+#endif
+	unsigned char sample[CACHE_SAMPLE_BYTES];
+	unsigned long long offset;
+	size_t len,n;
+	unsigned int s;
+
+#ifdef _WIN32
+	if (_stati64(filename,&st))
+#else
+	if (stat(filename,&st))
+#endif
+		{
+		return 0;
+		}
+	*size=(unsigned long long)st.st_size;
+	*mtime=(unsigned long long)st.st_mtime;
+
+	// FNV-1a over the samples, the first at the start and the last at the end
+	*hash=2166136261u;
+	for (s=0;s<CACHE_SAMPLES;s++)
+		{
+		len=*size<CACHE_SAMPLE_BYTES ? (size_t)*size : CACHE_SAMPLE_BYTES;
+		offset=(*size-len)/(CACHE_SAMPLES-1)*s;
+		if (!index_read_at(fp,sample,len,(long long)offset))
+			{
+			return 0;
+			}
+		for (n=0;n<len;n++)
+			{
+			*hash^=sample[n];
+			*hash*=16777619u;
+			}
+		}
+	fseek64(fp,0,SEEK_SET);
+	return 1;
+}
+
+
+int cache_make_key(void)
+{
+// cachekey and cachename for this run.  0 if infile can't be fingerprinted.
+	unsigned long long size,mtime,hash;
+	unsigned int samplehash;
+	unsigned int n;
+	size_t len;
+	FILE *fp;
+
+	if (!cache_fingerprint((char *)infilename,infile,&size,&mtime,&samplehash))
+		{
+		printf("Note: can't fingerprint %s, not using the cache\n",infilename);
+		return 0;
+		}
+	len=sprintf(cachekey,"%s\nblocksize %lu\ndump %llu %llu %08x\nsearch %s %s %s\n",
+		VERSION,(unsigned long)BLOCKSIZE,size,mtime,samplehash,SEARCH_START,SEARCH_END,SEARCH_STRING);
+	len+=sprintf(cachekey+len,"range %llu %llu\nsort %d\n",start_offset,end_offset,sort_mode);
+	if (role_mode)
+		{
+		len+=sprintf(cachekey+len,"role");
+		for (n=0;n<rolefiltercount;n++)
+			{
+			len+=sprintf(cachekey+len," %s",rolefilter[n]);
+			}
+		len+=sprintf(cachekey+len,"\n");
+		}
+	if (text_mode)
+		{
+		len+=sprintf(cachekey+len,"text %x",textfields);
+		for (n=0;n<textphrasecount;n++)
+			{
+			len+=sprintf(cachekey+len," \"%s\"",(char *)textphrase[n]);
+			}
+		len+=sprintf(cachekey+len,"\n");
+		}
+	if (index_mode)
+		{
+		// only the releases the index lists are processed, so it counts as
+		// much as the dump
+		fp=fopen(indexfilename,"rb");
+		if (fp==NULL || !cache_fingerprint(indexfilename,fp,&size,&mtime,&samplehash))
+			{
+			printf("Note: can't fingerprint %s, not using the cache\n",indexfilename);
+			if (fp!=NULL)
+				fclose(fp);
+			return 0;
+			}
+		fclose(fp);
+		len+=sprintf(cachekey+len,"index %llu %llu %08x\n",size,mtime,samplehash);
+		}
+	if (aggregate_mode)
+		{
+		len+=sprintf(cachekey+len,"aggregate");
+		for (n=0;n<aggregatefieldcount;n++)
+			{
+			len+=sprintf(cachekey+len," %s",aggregate_field_names[aggregatefields[n]]);
+			}
+		len+=sprintf(cachekey+len,"\n");
+		}
+	if (compress_mode)
+		{
+		len+=sprintf(cachekey+len,"compress %s %d\n",compress_names[compress_mode],compress_level);
+		}
+	len+=sprintf(cachekey+len,"json %d\ncolumns %s",json_mode,csvheader);
+
+	// FNV-1a 64 of the key names the entry
+	hash=14695981039346656037ull;
+	for (n=0;n<len;n++)
+		{
+		hash^=(unsigned char)cachekey[n];
+		hash*=1099511628211ull;
+		}
+	sprintf(cachename,"%016llx",hash);
+	return 1;
+}
+
+
+int cache_copy(char *from, char *to)
+{
+// copy a file, through tempbuffer.  1 if it all went.
+	FILE *in,*out;
+	size_t n;
+	int ok;
+
+	in=fopen(from,"rb");
+	if (in==NULL)
+		{
+		return 0;
+		}
+	out=fopen(to,"wb");
+	if (out==NULL)
+		{
+		fclose(in);
+		return 0;
+		}
+	ok=1;
+	while ((n=fread(tempbuffer,1,BLOCKSIZE,in))>0)
+		{
+		if (fwrite(tempbuffer,1,n,out)!=n)
+			{
+			ok=0;
+			break;
+			}
+		}
+	if (ferror(in))
+		{
+		ok=0;
+		}
+	fclose(in);
+	if (fclose(out))
+		{
+		ok=0;
+		}
+	return ok;
+}
+
+
+void cache_path(char *path, const char *name, const char *ext)
+{
+	sprintf(path,"%s/%s%s",cachedirname,name,ext);
+}
+
+
+unsigned int cache_read_index(void)
+{
+// dir/cache.idx into cacheentries[], as many as fit
+	FILE *fp;
+	char path[CACHE_PATH_MAX];
+	unsigned int count;
+
+	count=0;
+	cache_path(path,CACHE_INDEX_NAME,"");
+	fp=fopen(path,"rb");
+	if (fp==NULL)
+		{
+		return 0;
+		}
+	while (count<CACHE_MAX_ENTRIES && fscanf(fp,"%16s %llu %llu",cacheentries[count].name,&cacheentries[count].bytes,&cacheentries[count].used)==3)
+		{
+		count++;
+		}
+	fclose(fp);
+	return count;
+}
+
+
+void cache_write_index(unsigned int count)
+{
+// cacheentries[] to dir/cache.idx, via a .tmp file
+	FILE *fp;
+	char path[CACHE_PATH_MAX];
+	char tmppath[CACHE_PATH_MAX];
+	unsigned int n;
+
+	cache_path(path,CACHE_INDEX_NAME,"");
+	cache_path(tmppath,CACHE_INDEX_NAME,CACHE_TMP_EXT);
+	fp=fopen(tmppath,"wb");
+	if (fp==NULL)
+		{
+		printf("Note: can't write the cache index %s\n",tmppath);
+		return;
+		}
+	for (n=0;n<count;n++)
+		{
+		fprintf(fp,"%s %llu %llu\n",cacheentries[n].name,cacheentries[n].bytes,cacheentries[n].used);
+		}
+	fclose(fp);
+	remove(path);  // rename won't replace on windows
+	rename(tmppath,path);
+}
+
+
+void cache_touch(unsigned long long bytes)
+{
+// cachename was used now: into the index, with the least recently used
+// entries deleted while the cache is over cache_size
+	unsigned int count,n,oldest;
+	unsigned long long total;
+	char path[CACHE_PATH_MAX];
+	const char *exts[]={".xml",".csv",".key"};
+	unsigned int e;
+
+	count=cache_read_index();
+	for (n=0;n<count;n++)
+		{
+		if (!strcmp(cacheentries[n].name,cachename))
+			{
+			break;
+			}
+		}
+	if (n==count)
+		{
+		if (count==CACHE_MAX_ENTRIES)
+			{
+			n=0;  // no room, it replaces the oldest below
+			}
+		else
+			{
+			count++;
+			}
+		strcpy(cacheentries[n].name,cachename);
+		}
+	cacheentries[n].bytes=bytes;
+	cacheentries[n].used=(unsigned long long)time(NULL);
+
+	for (;;)
+		{
+		total=0;
+		oldest=count;
+		for (n=0;n<count;n++)
+			{
+			total+=cacheentries[n].bytes;
+			if (strcmp(cacheentries[n].name,cachename) && (oldest==count || cacheentries[n].used<cacheentries[oldest].used))
+				{
+				oldest=n;
+				}
+			}
+		if (total<=cache_size || oldest==count)
+			{
+			break;
+			}
+		printf("Cache: evicting %s (%llu bytes)\n",cacheentries[oldest].name,cacheentries[oldest].bytes);
+		for (e=0;e<3;e++)
+			{
+			cache_path(path,cacheentries[oldest].name,exts[e]);
+			remove(path);
+			}
+		cacheentries[oldest]=cacheentries[--count];
+		}
+	cache_write_index(count);
+}
+
+
+int cache_lookup(void)
+{
+// for an entry of this run: copy it to outfile and csvfile.  1 on a hit.
+	FILE *fp;
+	char path[CACHE_PATH_MAX];
+	char xmlpath[CACHE_PATH_MAX];
+	char csvpath[CACHE_PATH_MAX];
+	size_t len;
+	unsigned long long bytes;
+
+	cachekeyvalid=cache_make_key();
+	if (!cachekeyvalid)
+		{
+		return 0;
+		}
+	cache_path(path,cachename,".key");
+	fp=fopen(path,"rb");
+	if (fp==NULL)
+		{
+		printf("Cache: no entry %s, searching\n",cachename);
+		return 0;
+		}
+	len=fread(tempbuffer,1,CACHE_KEY_MAX,fp);
+	fclose(fp);
+	if (len!=strlen(cachekey) || memcmp(tempbuffer,cachekey,len))
+		{
+		printf("Cache: entry %s is of another search, searching\n",cachename);
+		return 0;
+		}
+
+	cache_path(xmlpath,cachename,".xml");
+	cache_path(csvpath,cachename,".csv");
+	if (!cache_copy(xmlpath,(char *)outfilename) || !cache_copy(csvpath,(char *)csvfilename))
+		{
+		printf("Cache: entry %s couldn't be copied, searching\n",cachename);
+		return 0;
+		}
+	fp=fopen((char *)outfilename,"rb");
+	fseek64(fp,0,SEEK_END);
+	bytes=(unsigned long long)ftell64(fp);
+	fclose(fp);
+	fp=fopen((char *)csvfilename,"rb");
+	fseek64(fp,0,SEEK_END);
+	bytes+=(unsigned long long)ftell64(fp);
+	fclose(fp);
+	cache_touch(bytes);
+	printf("Cache: hit %s, outputs copied from %s\n",cachename,cachedirname);
+	return 1;
+}
+
+
+void cache_store(void)
+{
+// keep the closed outputs of this run as its entry
+	FILE *fp;
+	char path[CACHE_PATH_MAX];
+	char tmppath[CACHE_PATH_MAX];
+	const char *exts[]={".xml",".csv"};
+	char *from[2];
+	unsigned long long bytes;
+	unsigned int e;
+
+	if (errorcount)
+		{
+		printf("Cache: not keeping a run with errors\n");
+		return;
+		}
+	from[0]=(char *)outfilename;
+	from[1]=(char *)csvfilename;
+	bytes=0;
+	for (e=0;e<2;e++)
+		{
+		cache_path(path,cachename,exts[e]);
+		cache_path(tmppath,cachename,CACHE_TMP_EXT);
+		if (!cache_copy(from[e],tmppath))
+			{
+			printf("Note: can't write cache entry %s\n",tmppath);
+			remove(tmppath);
+			return;
+			}
+		remove(path);
+		rename(tmppath,path);
+		fp=fopen(path,"rb");
+		if (fp!=NULL)
+			{
+			fseek64(fp,0,SEEK_END);
+			bytes+=(unsigned long long)ftell64(fp);
+			fclose(fp);
+			}
+		}
+	// the key last, as it makes the entry visible
+	cache_path(path,cachename,".key");
+	cache_path(tmppath,cachename,CACHE_TMP_EXT);
+	fp=fopen(tmppath,"wb");
+	if (fp==NULL || fwrite(cachekey,strlen(cachekey),1,fp)!=1)
+		{
+		printf("Note: can't write cache entry %s\n",tmppath);
+		if (fp!=NULL)
+			{
+			fclose(fp);
+			}
+		return;
+		}
+	fclose(fp);
+	remove(path);
+	rename(tmppath,path);
+	cache_touch(bytes);
+	printf("Cache: kept as %s\n",cachename);
+}
+
+
+/*--- zero-copy output ---------------------------------------
+With --zero-copy, write_release() doesn't fwrite() a matched release to
+outfile but notes where it is in infile, and zerocopy_flush() has the
+kernel copy the byte ranges from infile's file to outfile's with
+copy_file_range() (or sendfile() where that isn't there, and pread() and
+write() where neither is), so the xml doesn't pass through our memory
+again.  Releases next to each other in infile with the newline between them
+(checked in inputbuffer) become one range.  Ranges are kept until
+ZEROCOPY_RANGES are waiting or outfile is closed, and outfile is flushed
+before each batch so the ranges land after what stdio has written.
+
+Only on Linux; elsewhere --zero-copy notes that and output is as normal.
+------------------------------------------------------------*/
+
+int zerocopy_add(long long offset, size_t len, int newlinenext)
+{
+// a release of len bytes at offset of infile goes to outfile, then a newline,
+// which is the next byte of infile if newlinenext is set
+	struct zerocopyrange *r;
+
+	if (offset<0)
+		{
+		return 0;
+		}
+	if (newlinenext)
+		{
+		len++;
+		}
+	zerocopyreleases++;
+	if (zerocopycount)
+		{
+		r=&zerocopyranges[zerocopycount-1];
+		if (!r->addnewline && r->offset+(long long)r->len==offset)
+			{
+			r->len+=len;
+			r->addnewline=!newlinenext;
+			return 1;
+			}
+		}
+	if (zerocopycount==ZEROCOPY_RANGES)
+		{
+		zerocopy_flush();
+		}
+	r=&zerocopyranges[zerocopycount++];
+	r->offset=offset;
+	r->len=len;
+	r->addnewline=!newlinenext;
+	return 1;
+}
+
+
+int zerocopy_range(int infd, int outfd, long long offset, size_t len)
+{
+// len bytes of infd at offset onto the end of outfd.  1 if all of it went.
+#ifdef __linux__
+	long n;
+	long long inoffset;       // loff_t
+	off_t sendoffset;
+
+	while (len)
+		{
+		n=-1;
+#ifdef __NR_copy_file_range
+		if (zerocopy_method==ZEROCOPY_COPY_FILE_RANGE)
+			{
+			inoffset=offset;
+			n=syscall(__NR_copy_file_range,infd,&inoffset,outfd,NULL,len,0);
+			if (n<0 && (errno==ENOSYS || errno==EXDEV || errno==EINVAL || errno==EOPNOTSUPP))
+				{
+				zerocopy_method=ZEROCOPY_SENDFILE;
+				continue;
+				}
+			}
+		else
+#endif
+		if (zerocopy_method!=ZEROCOPY_READ_WRITE)
+			{
+			sendoffset=offset;
+			n=sendfile(outfd,infd,&sendoffset,len);
+			if (n<0 && (errno==ENOSYS || errno==EINVAL))
+				{
+				zerocopy_method=ZEROCOPY_READ_WRITE;
+				continue;
+				}
+			}
+		else
+			{
+			n=len<BLOCKSIZE ? len : BLOCKSIZE;
+			n=pread(infd,tempbuffer,n,offset);
+			if (n>0 && write(outfd,tempbuffer,n)!=n)
+				{
+				n=-1;
+				}
+			}
+		if (n<=0)
+			{
+			return 0;
+			}
+		zerocopysyscalls++;
+		offset+=n;
+		len-=n;
+		}
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+void zerocopy_flush(void)
+{
+// the waiting ranges to outfile
+	unsigned int n;
+	int infd,outfd;
+
+	if (zerocopycount==0)
+		{
+		return;
+		}
+	tracebegin(TRACE_FLUSH);
+	fflush(outfile);
+	infd=fileno(infile);
+	outfd=fileno(outfile);
+	for (n=0;n<zerocopycount;n++)
+		{
+		if (!zerocopy_range(infd,outfd,zerocopyranges[n].offset,zerocopyranges[n].len)
+		 || (zerocopyranges[n].addnewline && write(outfd,newline,1)!=1))
+			{
+			errorcount++;
+			printf("Error %lu: failed to copy %lu bytes at %lld of infile to outfile\n",errorcount,(unsigned long)zerocopyranges[n].len,zerocopyranges[n].offset);
+#if WRITE_DEBUG_FILE
+			fprintf(debugfile,"Error %lu: failed to copy %lu bytes at %lld of infile to outfile\n",errorcount,(unsigned long)zerocopyranges[n].len,zerocopyranges[n].offset);
+#endif
+			}
+		zerocopybytes+=zerocopyranges[n].len;
+		}
+	zerocopyflushes+=zerocopycount;
+	zerocopycount=0;
+	traceend(TRACE_FLUSH,zerocopybytes);
+}
+
+
+void zerocopy_finish(void)
+{
+// before outfile gets the run summary
+	zerocopy_flush();
+	printf("Zero-copy: %lu releases, %llu bytes in %lu ranges, %lu calls to %s\n",zerocopyreleases,zerocopybytes,zerocopyflushes,zerocopysyscalls,zerocopy_method_names[zerocopy_method]);
+}
+
+
+/*--- timeline trace -----------------------------------------
+--trace file records when each stage of the search ran and for how long,
+so a run can be looked at in a trace viewer (chrome://tracing, Perfetto)
+for the stalls that the totals of --perf-counters or the metrics don't
+show: a slow re-read after a seek back, a run of huge releases, the output
+stopping for a flush, the search waiting on the extraction threads.
+
+tracebegin(e) notes the time an event starts and traceend(e,arg) adds it,
+with its length and one number (trace_arg_names[e]), to the calling
+thread's ring.  Like perfstage() they cost a test of trace_mode without
+--trace.  Each thread has its own ring of trace_events (a power of 2), made
+the first time it begins an event, so adding one needs no lock; a full
+ring overwrites its oldest events.  The rings are written out once the
+threads are done, at the end of closefiles(), as "X" (complete) events of
+the Chrome trace event format, with ts and dur in microseconds.
+------------------------------------------------------------*/
+
+void trace_start(void)
+{
+// open the trace file, and the search thread's ring
+	unsigned int events;
+
+	tracefile=fopen(tracefilename,"w");
+	if (tracefile==NULL)
+		{
+		errorcount++;
+		printf("Error %lu: can't write trace file %s, carrying on without it\n",errorcount,tracefilename);
+		return;
+		}
+	for (events=1024;events<trace_events && events<0x10000000;events<<=1)
+		{
+		}
+	trace_events=events;
+	mutex_init(tracemutex);
+	tracebase=bench_now();
+	trace_mode=1;
+	trace_thread();
+}
+
+
+void trace_thread(void)
+{
+// a ring for the calling thread, the first one is the search thread's
+	struct tracering *ring;
+
+	traceregistered=1;
+	mutex_lock(tracemutex);
+	ring=NULL;
+	if (tracethreads<TRACE_THREADS)
+		{
+		ring=calloc(1,sizeof(struct tracering));
+		if (ring!=NULL)
+			{
+			ring->events=malloc(trace_events*sizeof(struct traceevent));
+			if (ring->events==NULL)
+				{
+				free(ring);
+				ring=NULL;
+				}
+			}
+		if (ring==NULL)
+			{
+			printf("Note: no memory for the trace events of thread %u, left out\n",tracethreads);
+			}
+		else
+			{
+			ring->tid=tracethreads;
+			tracerings[tracethreads++]=ring;
+			}
+		}
+	mutex_unlock(tracemutex);
+	tracering=ring;
+}
+
+
+void trace_begin(int type)
+{
+	if (!traceregistered)
+		{
+		trace_thread();
+		}
+	if (tracering!=NULL)
+		{
+		tracering->open[type]=bench_now()-tracebase;
+		}
+}
+
+
+void trace_end(int type, long long arg)
+{
+// add the event begun by trace_begin(type), if it was
+	struct traceevent *e;
+
+	if (tracering==NULL || tracering->open[type]==0)
+		{
+		return;
+		}
+	e=&tracering->events[tracering->count&(trace_events-1)];
+	tracering->count++;
+	e->start=tracering->open[type];
+	e->len=bench_now()-tracebase-e->start;
+	e->arg=arg;
+	e->type=type;
+	tracering->open[type]=0;
+}
+
+
+void trace_finish(void)
+{
+// write the rings out as Chrome trace event JSON
+	unsigned int t;
+	unsigned long long n,first,events,overwritten;
+	struct tracering *ring;
+	struct traceevent *e;
+
+	trace_mode=0;
+	events=0;
+	overwritten=0;
+	fprintf(tracefile,"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(tracefile,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"discogs\"}}");
+	for (t=0;t<tracethreads;t++)
+		{
+		ring=tracerings[t];
+		if (t==0)
+			fprintf(tracefile,",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"search\"}}");
+		else
+			fprintf(tracefile,",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"extraction %u\"}}",t,t);
+		first=0;
+		if (ring->count>trace_events)
+			{
+			first=ring->count-trace_events;
+			overwritten+=first;
+			}
+		for (n=first;n<ring->count;n++)
+			{
+			e=&ring->events[n&(trace_events-1)];
+			fprintf(tracefile,",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"%s\":%lld}}",
+				trace_names[e->type],trace_categories[e->type],e->start/1000.0,e->len/1000.0,ring->tid,trace_arg_names[e->type],e->arg);
+			}
+		events+=ring->count-first;
+		free(ring->events);
+		free(ring);
+		}
+	fprintf(tracefile,"\n]}\n");
+	if (fclose(tracefile))
+		{
+		errorcount++;
+		printf("Error %lu: failed to write trace file %s\n",errorcount,tracefilename);
+		return;
+		}
+	printf("Trace: %llu events of %u threads in %s",events,tracethreads,tracefilename);
+	if (overwritten)
+		{
+		printf(" (%llu older ones overwritten, --trace-events %u)",overwritten,trace_events);
+		}
+	printf("\n");
+}
+
+
+/*--- compressed output --------------------------------------
+With --compress, outfile, csvfile and the debug file are each replaced by
+the write end of a pipe (compress_open()), so everything the search and the
+summaries fprintf() or fwrite() to them is compressed without any change
+to how they are written.  A reader thread per file takes what comes out of
+its pipe into frames of COMPRESS_FRAME_BYTES and queues them, and
+compressthreads workers shared by the files compress each frame on its own
+(a gzip member, or a zstd frame; either format allows several in a row).
+The reader writes the compressed frames to the real file in the order they
+were queued, and flushes it, so a partial file can always be decompressed
+up to its last whole frame.  A frame is cut early when no more output has
+come for COMPRESS_FLUSH_SECONDS (Linux only; elsewhere the read waits).
+
+The search only waits when a pipe is full, which is when the reader has
+compressthreads+2 frames not yet written; until then it only waits on
+write()s to the pipe.  compress_finish(), after the pipes are closed,
+waits for the readers to write their last frames, and stops the workers.
+------------------------------------------------------------*/
+
+FILE *compress_open(FILE *fp, const char *name)
+{
+// a pipe to write into instead of fp, whose reader compresses into fp
+	struct compressstream *cs;
+	FILE *writer;
+	int fds[2];
+	unsigned int n;
+
+	if (compressthreadids==NULL)
+		{
+		compress_start();
+		}
+	cs=&compressstreams[compressstreamcount++];
+	cs->name=name;
+	cs->file=fp;
+	cs->frames=calloc(compressthreads+2,sizeof(struct compressframe));
+	if (cs->frames==NULL)
+		{
+		printf("Error: out of memory for compressing %s\n",name);
+		exit(6);
+		}
+	for (n=0;n<compressthreads+2;n++)
+		{
+		cs->frames[n].cs=cs;
+		cs->frames[n].in=malloc(COMPRESS_FRAME_BYTES);
+		if (cs->frames[n].in==NULL)
+			{
+			printf("Error: out of memory for compressing %s\n",name);
+			exit(6);
+			}
+		}
+#ifdef _WIN32
+	if (_pipe(fds,COMPRESS_PIPE_BYTES,_O_BINARY) || (writer=_fdopen(fds[1],"wb"))==NULL)
+#else
+	if (pipe(fds) || (writer=fdopen(fds[1],"wb"))==NULL)
+#endif
+		{
+		printf("Error: can't make a pipe for compressing %s\n",name);
+		exit(2);
+		}
+	setvbuf(writer,NULL,_IOFBF,COMPRESS_PIPE_BYTES);
+	cs->readfd=fds[0];
+#ifdef _WIN32
+	cs->thread=CreateThread(NULL,0,compress_reader,cs,0,NULL);
+	if (cs->thread==NULL)
+#else
+	if (pthread_create(&cs->thread,NULL,compress_reader,cs))
+#endif
+		{
+		printf("Error: could not start the thread compressing %s\n",name);
+		exit(6);
+		}
+	printf("%s compressed with %s\n",name,compress_names[compress_mode]);
+	return writer;
+}
+
+
+void compress_start(void)
+{
+// the workers, for all the files
+	unsigned int n;
+
+	compressthreadids=calloc(compressthreads,sizeof(poolthread_t));
+	if (compressthreadids==NULL)
+		{
+		printf("Error: out of memory for %u compression threads\n",compressthreads);
+		exit(6);
+		}
+	mutex_init(compressmutex);
+	cond_init(compresswork);
+	cond_init(compressdone);
+	for (n=0;n<compressthreads;n++)
+		{
+#ifdef _WIN32
+		compressthreadids[n]=CreateThread(NULL,0,compress_worker,NULL,0,NULL);
+		if (compressthreadids[n]==NULL)
+#else
+		if (pthread_create(&compressthreadids[n],NULL,compress_worker,NULL))
+#endif
+			{
+			printf("Error: could not start compression thread %u\n",n+1);
+			exit(6);
+			}
+		}
+}
+
+
+#ifdef _WIN32
+DWORD WINAPI compress_worker(LPVOID arg)
+#else
+void *compress_worker(void *arg)
+#endif
+{
+// take queued frames in order, compress them and mark them done
+	struct compressframe *frame;
+
+	(void)arg;
+	mutex_lock(compressmutex);
+	for (;;)
+		{
+		while (compresstaken==compressqueued && !compressstop)
+			{
+			cond_wait(compresswork,compressmutex);
+			}
+		if (compresstaken==compressqueued)
+			{
+			break;
+			}
+		frame=compressqueue[compresstaken%COMPRESS_QUEUE];
+		compresstaken++;
+		mutex_unlock(compressmutex);
+
+		compress_frame(frame);
+
+		mutex_lock(compressmutex);
+		frame->state=POOL_DONE;
+		cond_broadcast(compressdone);
+		}
+	mutex_unlock(compressmutex);
+#if HAVE_ZLIB
+	if (compresszsready)
+		{
+		deflateEnd(&compresszs);
+		}
+#endif
+#if HAVE_ZSTD
+	ZSTD_freeCCtx(compresscctx);
+#endif
+	return 0;
+}
+
+
+void compress_frame(struct compressframe *frame)
+{
+// frame->in to frame->out, as a whole gzip member or zstd frame.  outlen 0 if it failed.
+#if HAVE_ZLIB || HAVE_ZSTD
+	size_t bound;
+#endif
+
+	frame->outlen=0;
+#if HAVE_ZLIB
+	if (compress_mode==COMPRESS_GZIP)
+		{
+		// windowBits 15+16 for a gzip header and trailer
+		if (!compresszsready)
+			{
+			if (deflateInit2(&compresszs,compress_level<0 ? Z_DEFAULT_COMPRESSION : compress_level,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK)
+				{
+				return;
+				}
+			compresszsready=1;
+			}
+		else
+			{
+			deflateReset(&compresszs);
+			}
+		bound=deflateBound(&compresszs,(uLong)frame->inlen);
+		if (!pool_reserve(&frame->out,&frame->outcap,bound))
+			{
+			return;
+			}
+		compresszs.next_in=frame->in;
+		compresszs.avail_in=(uInt)frame->inlen;
+		compresszs.next_out=frame->out;
+		compresszs.avail_out=(uInt)frame->outcap;
+		if (deflate(&compresszs,Z_FINISH)==Z_STREAM_END)
+			{
+			frame->outlen=frame->outcap-compresszs.avail_out;
+			}
+		}
+#endif
+#if HAVE_ZSTD
+	if (compress_mode==COMPRESS_ZSTD)
+		{
+		if (compresscctx==NULL && (compresscctx=ZSTD_createCCtx())==NULL)
+			{
+			return;
+			}
+		bound=ZSTD_compressBound(frame->inlen);
+		if (!pool_reserve(&frame->out,&frame->outcap,bound))
+			{
+			return;
+			}
+		bound=ZSTD_compressCCtx(compresscctx,frame->out,frame->outcap,frame->in,frame->inlen,compress_level<0 ? 3 : compress_level);
+		if (!ZSTD_isError(bound))
+			{
+			frame->outlen=bound;
+			}
+		}
+#endif
+}
+
+
+int compress_wait_input(int fd)
+{
+// 0 if nothing more comes out of the pipe for COMPRESS_FLUSH_SECONDS
+#ifdef __linux__
+	struct pollfd pfd;
+
+	pfd.fd=fd;
+	pfd.events=POLLIN;
+	pfd.revents=0;
+	return poll(&pfd,1,COMPRESS_FLUSH_SECONDS*1000)!=0;
+#else
+	return 1;
+#endif
+}
+
+
+#ifdef _WIN32
+DWORD WINAPI compress_reader(LPVOID arg)
+#else
+void *compress_reader(void *arg)
+#endif
+{
+// cut a file's pipe into frames, queue them, and write them compressed in order
+	struct compressstream *cs;
+	struct compressframe *frame;
+	time_t started;
+	long n;
+	int eof;
+
+	cs=arg;
+	eof=0;
+	while (!eof)
+		{
+		frame=&cs->frames[cs->filled%(compressthreads+2)];
+		while (frame->state!=POOL_FREE)
+			{
+			compress_write_next(cs,1);
+			}
+		frame->inlen=0;
+		started=time(NULL);
+		while (frame->inlen<COMPRESS_FRAME_BYTES)
+			{
+			if (frame->inlen && !compress_wait_input(cs->readfd))
+				{
+				break;
+				}
+#ifdef _WIN32
+			n=_read(cs->readfd,frame->in+frame->inlen,(unsigned int)(COMPRESS_FRAME_BYTES-frame->inlen));
+#else
+			n=(long)read(cs->readfd,frame->in+frame->inlen,COMPRESS_FRAME_BYTES-frame->inlen);
+#endif
+			if (n<=0)
+				{
+				eof=1;
+				break;
+				}
+			frame->inlen+=n;
+			while (compress_write_next(cs,0))
+				{
+				}
+			if (time(NULL)-started>=COMPRESS_FLUSH_SECONDS)
+				{
+				break;
+				}
+			}
+		if (frame->inlen)
+			{
+			mutex_lock(compressmutex);
+			frame->state=POOL_QUEUED;
+			compressqueue[compressqueued%COMPRESS_QUEUE]=frame;
+			compressqueued++;
+			cs->filled++;
+			cond_signal(compresswork);
+			mutex_unlock(compressmutex);
+			}
+		}
+	while (compress_write_next(cs,1))
+		{
+		}
+#ifdef _WIN32
+	_close(cs->readfd);
+#else
+	close(cs->readfd);
+#endif
+	return 0;
+}
+
+
+int compress_write_next(struct compressstream *cs, int wait)
+{
+// write the oldest frame of cs if it is compressed (or once it is, if wait).  0 if there was none.
+	struct compressframe *frame;
+
+	if (cs->written==cs->filled)
+		{
+		return 0;
+		}
+	frame=&cs->frames[cs->written%(compressthreads+2)];
+	mutex_lock(compressmutex);
+	while (frame->state!=POOL_DONE)
+		{
+		if (!wait)
+			{
+			mutex_unlock(compressmutex);
+			return 0;
+			}
+		cond_wait(compressdone,compressmutex);
+		}
+	mutex_unlock(compressmutex);
+
+	if (frame->outlen==0 || fwrite(frame->out,frame->outlen,1,cs->file)!=1 || fflush(cs->file))
+		{
+		compressfailed=1;
+		}
+	cs->inbytes+=frame->inlen;
+	cs->outbytes+=frame->outlen;
+	frame->state=POOL_FREE;
+	cs->written++;
+	return 1;
+}
+
+
+void compress_finish(void)
+{
+// after outfile and the debug file are closed: close csvfile, and wait for the last frames
+	struct compressstream *cs;
+	unsigned int n;
+
+	if (csvfile!=NULL)
+		{
+		fclose(csvfile);
+		csvfile=NULL;
+		}
+	for (n=0;n<compressstreamcount;n++)
+		{
+		cs=&compressstreams[n];
+#ifdef _WIN32
+		WaitForSingleObject(cs->thread,INFINITE);
+		CloseHandle(cs->thread);
+#else
+		pthread_join(cs->thread,NULL);
+#endif
+		if (fclose(cs->file))
+			{
+			compressfailed=1;
+			}
+		}
+	mutex_lock(compressmutex);
+	compressstop=1;
+	cond_broadcast(compresswork);
+	mutex_unlock(compressmutex);
+	for (n=0;n<compressthreads;n++)
+		{
+#ifdef _WIN32
+		WaitForSingleObject(compressthreadids[n],INFINITE);
+		CloseHandle(compressthreadids[n]);
+#else
+		pthread_join(compressthreadids[n],NULL);
+#endif
+		}
+	for (n=0;n<compressstreamcount;n++)
+		{
+		cs=&compressstreams[n];
+		printf("Compressed %s: %llu to %llu bytes (%.1f%%) in %llu frames\n",cs->name,cs->inbytes,cs->outbytes,
+			cs->inbytes ? 100.0*cs->outbytes/cs->inbytes : 0.0,cs->written);
+		}
+	if (compressfailed)
+		{
+		errorcount++;
+		printf("Error %lu: failed to compress or write the %s output\n",errorcount,compress_names[compress_mode]);
+		}
+}
+
+
+/*--- JSON Lines output --------------------------------------
+With --json, write_csv_row() hands over to json_write_row(), which puts one
+JSON object for the release into csvrow, so it goes out wherever a csv line
+would (through --sort, --threads, --store...).  Nothing is allocated: each
+value is copied from its span of the release xml straight into csvrow,
+with the XML entities (&amp; and so on, and &#...;) turned back into
+characters.  json_string() copies
+runs of ordinary bytes with memcpy(), looking each byte up in jsonspecial[]
+for the few that need escaping (", \ and control characters) or are the &
+of an entity.  Bytes over 127 are the dump's UTF-8 and are copied as they
+are.
+
+labels and formats are all of the release's, from the spans process_xml_lists()
+finds for them, each format with its own descriptions.  A release whose
+object doesn't fit in csvrow is written as {"release_id":n,"truncated":true}
+so every line of the file is still an object.
+------------------------------------------------------------*/
+
+#define json_literal(s) json_put(s,sizeof(s)-1)
+
+void json_init(void)
+{
+	unsigned int c;
+
+	for (c=0;c<0x20;c++)
+		{
+		jsonspecial[c]=1;
+		}
+	jsonspecial['"']=1;
+	jsonspecial['\\']=1;
+	jsonspecial['&']=1;
+}
+
+
+void json_put(const char *p, size_t n)
+{
+// append n bytes to csvrow, as they are
+	if (csvrowlen+n>=CSVROW_SIZE)
+		{
+		jsonoverflow=1;
+		return;
+		}
+	memcpy(csvrow+csvrowlen,p,n);
+	csvrowlen+=n;
+}
+
+
+void json_char(unsigned int c)
+{
+// one byte, escaped if it has to be
+	char buf[8];
+
+	switch (c)
+		{
+		case '"':  json_literal("\\\""); break;
+		case '\\': json_literal("\\\\"); break;
+		case '\n': json_literal("\\n"); break;
+		case '\r': json_literal("\\r"); break;
+		case '\t': json_literal("\\t"); break;
+		case '\b': json_literal("\\b"); break;
+		case '\f': json_literal("\\f"); break;
+		default:
+			if (c<0x20)
+				{
+				sprintf(buf,"\\u%04x",c);
+				json_put(buf,6);
+				}
+			else
+				{
+				buf[0]=(char)c;
+				json_put(buf,1);
+				}
+		}
+}
+
+
+void json_codepoint(unsigned long cp)
+{
+// a character from an entity, in UTF-8
+	unsigned char buf[4];
+
+	if (cp<0x80)
+		json_char((unsigned int)cp);
+	else
+		json_put((char *)buf,json_utf8(cp,buf));
+}
+
+
+size_t json_utf8(unsigned long cp, unsigned char *buf)
+{
+// cp in UTF-8 at buf, and its length
+	if (cp<0x80)
+		{
+		buf[0]=(unsigned char)cp;
+		return 1;
+		}
+	if (cp<0x800)
+		{
+		buf[0]=(unsigned char)(0xc0|cp>>6);
+		buf[1]=(unsigned char)(0x80|(cp&0x3f));
+		return 2;
+		}
+	if (cp<0x10000)
+		{
+		buf[0]=(unsigned char)(0xe0|cp>>12);
+		buf[1]=(unsigned char)(0x80|((cp>>6)&0x3f));
+		buf[2]=(unsigned char)(0x80|(cp&0x3f));
+		return 3;
+		}
+	buf[0]=(unsigned char)(0xf0|cp>>18);
+	buf[1]=(unsigned char)(0x80|((cp>>12)&0x3f));
+	buf[2]=(unsigned char)(0x80|((cp>>6)&0x3f));
+	buf[3]=(unsigned char)(0x80|(cp&0x3f));
+	return 4;
+}
+
+
+size_t json_entity(unsigned char *p, unsigned char *stop, unsigned long *cp)
+{
+// the length of the entity at p (at its &) and its character, 0 if it isn't one
+	static const char *names[]={"&amp;","&lt;","&gt;","&quot;","&apos;"};
+	static const char chars[]={'&','<','>','"','\''};
+	unsigned char *q;
+	unsigned int n;
+	size_t len;
+
+	if (p+1<stop && p[1]=='#')
+		{
+		q=p+2;
+		*cp=0;
+		if (q<stop && (*q=='x' || *q=='X'))
+			{
+			for (q++;q<stop && isxdigit(*q) && *cp<=0x10ffff;q++)
+				{
+				*cp=*cp*16+(isdigit(*q) ? *q-'0' : (*q|0x20)-'a'+10);
+				}
+			}
+		else
+			{
+			for (;q<stop && isdigit(*q) && *cp<=0x10ffff;q++)
+				{
+				*cp=*cp*10+(*q-'0');
+				}
+			}
+		if (q<stop && *q==';' && q>p+2 && *cp>0 && *cp<=0x10ffff && (*cp<0xd800 || *cp>0xdfff))
+			{
+			return q+1-p;
+			}
+		return 0;
+		}
+	for (n=0;n<sizeof(chars);n++)
+		{
+		len=strlen(names[n]);
+		if ((size_t)(stop-p)>=len && !memcmp(p,names[n],len))
+			{
+			*cp=(unsigned char)chars[n];
+			return len;
+			}
+		}
+	return 0;
+}
+
+
+void json_string(unsigned char *p, size_t n)
+{
+// n bytes of xml text as a JSON string
+	unsigned char *run,*stop;
+	unsigned long cp;
+	size_t len;
+
+	stop=p+n;
+	json_literal("\"");
+	while (p<stop)
+		{
+		for (run=p;run<stop && !jsonspecial[*run];run++)
+			{
+			}
+		if (run>p)
+			{
+			json_put((char *)p,run-p);
+			p=run;
+			}
+		if (p==stop)
+			{
+			break;
+			}
+		if (*p=='&' && (len=json_entity(p,stop,&cp))>0)
+			{
+			json_codepoint(cp);
+			p+=len;
+			}
+		else
+			{
+			json_char(*p++);
+			}
+		}
+	json_literal("\"");
+}
+
+
+void json_number(unsigned long long v)
+{
+	char buf[24],*p;
+
+	p=buf+sizeof(buf);
+	do
+		{
+		*--p=(char)('0'+v%10);
+		v/=10;
+		}
+	while (v);
+	json_put(p,buf+sizeof(buf)-p);
+}
+
+
+void json_span(const char *key, struct xmlspan *span)
+{
+// ,"key":value, null if the release doesn't have it
+	json_put(key,strlen(key));
+	if (span->found>0)
+		json_string(span->ptr,span->len);
+	else
+		json_literal("null");
+}
+
+
+void json_list(const char *key, struct xmlspan *span, const char *start, const char *end)
+{
+// the text of each start...end element in span, as an array
+	unsigned char *p,*q,*stop;
+	int count;
+
+	json_put(key,strlen(key));
+	json_literal("[");
+	count=0;
+	if (span->found>0)
+		{
+		stop=span->ptr+span->len;
+		for (p=span->ptr;(p=memmem(p,stop-p,(unsigned char *)start,strlen(start)))!=NULL;p=q+strlen(end))
+			{
+			p+=strlen(start);
+			q=memmem(p,stop-p,(unsigned char *)end,strlen(end));
+			if (q==NULL)
+				{
+				break;
+				}
+			if (count++)
+				{
+				json_literal(",");
+				}
+			json_string(p,q-p);
+			}
+		}
+	json_literal("]");
+}
+
+
+void json_attribute(const char *key, unsigned char *p, unsigned char *stop, const char *name, int number)
+{
+// "key":value of attribute name of the tag at p, a number if number, null if it has none
+	unsigned char *value;
+	size_t len;
+
+	json_put(key,strlen(key));
+	value=schema_attribute(p,stop,name,&len);
+	if (value==p)
+		json_literal("null");
+	else if (number)
+		json_number(strtoull((char *)value,NULL,10));
+	else
+		json_string(value,len);
+}
+
+
+void json_labels(void)
+{
+// ,"labels":[{"name":...,"catno":...,"id":...},...]
+	unsigned char *p,*stop;
+	int count;
+
+	json_literal(",\"labels\":[");
+	count=0;
+	if (fields.labels.found>0)
+		{
+		stop=fields.labels.ptr+fields.labels.len;
+		for (p=fields.labels.ptr;(p=memmem(p,stop-p,(unsigned char *)LABEL_START,strlen(LABEL_START)))!=NULL;p++)
+			{
+			if (count++)
+				{
+				json_literal(",");
+				}
+			json_literal("{");
+			json_attribute("\"name\":",p,stop," name=\"",0);
+			json_attribute(",\"catno\":",p,stop," catno=\"",0);
+			json_attribute(",\"id\":",p,stop," id=\"",1);
+			json_literal("}");
+			}
+		}
+	json_literal("]");
+}
+
+
+void json_formats(void)
+{
+// ,"formats":[{"name":...,"qty":...,"text":...,"descriptions":[...]},...]
+	struct xmlspan descriptions;
+	unsigned char *p,*q,*stop;
+	int count;
+
+	json_literal(",\"formats\":[");
+	count=0;
+	if (fields.formats.found>0)
+		{
+		stop=fields.formats.ptr+fields.formats.len;
+		for (p=fields.formats.ptr;(p=memmem(p,stop-p,(unsigned char *)FORMAT_START,strlen(FORMAT_START)))!=NULL;p=q)
+			{
+			// to its </format>, or the end of the tag if it is <format .../>
+			q=memchr(p,'>',stop-p);
+			if (q==NULL)
+				{
+				break;
+				}
+			descriptions.ptr=q;
+			if (q[-1]=='/')
+				q++;
+			else if ((q=memmem(q,stop-q,(unsigned char *)FORMAT_END,strlen(FORMAT_END)))==NULL)
+				q=stop;
+			if (count++)
+				{
+				json_literal(",");
+				}
+			json_literal("{");
+			json_attribute("\"name\":",p,stop," name=\"",0);
+			json_attribute(",\"qty\":",p,stop," qty=\"",1);
+			json_attribute(",\"text\":",p,stop," text=\"",0);
+			descriptions.len=q-descriptions.ptr;
+			descriptions.found=1;
+			json_list(",\"descriptions\":",&descriptions,DESCRIPTION_START,DESCRIPTION_END);
+			json_literal("}");
+			}
+		}
+	json_literal("]");
+}
+
+
+void json_write_row(void)
+{
+// csvrow as one JSON object and a newline
+	csvrowlen=0;
+	jsonoverflow=0;
+	json_literal("{\"release_id\":");
+	json_number(fields.release_id);
+	json_span(",\"title\":",&fields.title);
+	json_span(",\"released\":",&fields.released);
+	json_span(",\"country\":",&fields.country);
+	json_span(",\"notes\":",&fields.notes);
+	json_span(",\"data_quality\":",&fields.data_quality);
+	json_literal(",\"master_id\":");
+	if (fields.master_id)
+		json_number(fields.master_id);
+	else
+		json_literal("null");
+	json_labels();
+	json_formats();
+	if (schemaneeds&SCHEMA_GENRES)
+		{
+		json_list(",\"genres\":",&fields.genres,GENRE_START,GENRE_END);
+		json_list(",\"styles\":",&fields.styles,STYLE_START,STYLE_END);
+		}
+	if (role_mode)
+		{
+		json_literal(",\"matched_role\":");
+		json_string((unsigned char *)matchedrole,strlen(matchedrole));
+		}
+	json_literal("}\n");
+	if (jsonoverflow)
+		{
+		csvrowlen=0;
+		jsonoverflow=0;
+		json_literal("{\"release_id\":");
+		json_number(fields.release_id);
+		json_literal(",\"truncated\":true}\n");
+		}
+}
+
+
+/*--- SQLite output ------------------------------------------
+With --sqlite, write_release() also hands each matched release to
+db_add_release(), which puts a row in releases, one in labels for each of
+its labels and one in formats for each format, from the same spans --json
+writes (so process_xml_lists() finds the labels and formats spans for it,
+which --stream doesn't).  The database is made for loading, not for safety
+while it loads: no rollback journal, no syncing, an exclusive lock, 64KB
+pages and a big page cache, and it is all one transaction for db_batch
+releases at a time.  The three INSERTs are prepared once and only rebound
+per row.
+Text is bound straight from the release xml (SQLITE_STATIC, it is still
+in memory until the row is stepped), unless it has an entity, when it is
+copied into dbtext without them first.  The indexes are made by
+db_finish() once everything is in, which is quicker than keeping them up
+to date row by row.
+
+It all runs on the search thread, so --threads is out, and a failed
+insert stops the loading (the error is counted) but not the search.
+------------------------------------------------------------*/
+
+#if HAVE_SQLITE
+
+void db_start(void)
+{
+	char sql[64];
+
+	remove(dbfilename);
+	if (sqlite3_open(dbfilename,&db)!=SQLITE_OK)
+		{
+		printf("Error: can't make the SQLite database %s: %s\n",dbfilename,sqlite3_errmsg(db));
+		exit(2);
+		}
+	sprintf(sql,"PRAGMA page_size=%u",DB_PAGE_SIZE);
+	if (!db_exec(sql))
+		{
+		exit(2);
+		}
+	sprintf(sql,"PRAGMA cache_size=-%u",DB_CACHE_KB);
+	if (!db_exec(sql)
+	 || !db_exec("PRAGMA journal_mode=OFF")
+	 || !db_exec("PRAGMA synchronous=OFF")
+	 || !db_exec("PRAGMA locking_mode=EXCLUSIVE")
+	 || !db_exec("PRAGMA temp_store=MEMORY")
+	 || !db_exec("CREATE TABLE releases(release_id INTEGER PRIMARY KEY,title TEXT,released TEXT,country TEXT,"
+		"notes TEXT,data_quality TEXT,master_id INTEGER,matched_role TEXT)")
+	 || !db_exec("CREATE TABLE labels(release_id INTEGER,position INTEGER,name TEXT,catno TEXT,label_id INTEGER)")
+	 || !db_exec("CREATE TABLE formats(release_id INTEGER,position INTEGER,name TEXT,qty INTEGER,text TEXT,descriptions TEXT)"))
+		{
+		exit(2);
+		}
+	if (sqlite3_prepare_v2(db,"INSERT OR IGNORE INTO releases VALUES(?,?,?,?,?,?,?,?)",-1,&dbrelease,NULL)!=SQLITE_OK
+	 || sqlite3_prepare_v2(db,"INSERT INTO labels VALUES(?,?,?,?,?)",-1,&dblabel,NULL)!=SQLITE_OK
+	 || sqlite3_prepare_v2(db,"INSERT INTO formats VALUES(?,?,?,?,?,?)",-1,&dbformat,NULL)!=SQLITE_OK)
+		{
+		db_fail("prepare");
+		exit(2);
+		}
+	if (!db_exec("BEGIN"))
+		{
+		exit(2);
+		}
+	db_mode=1;
+	dbstarttime=bench_now();
+}
+
+
+int db_exec(const char *sql)
+{
+// 1 if sql ran
+	if (sqlite3_exec(db,sql,NULL,NULL,NULL)!=SQLITE_OK)
+		{
+		db_fail(sql);
+		return 0;
+		}
+	return 1;
+}
+
+
+void db_fail(const char *what)
+{
+// an SQLite error stops the loading
+	errorcount++;
+	printf("Error %lu: SQLite %s in %s: %s\n",errorcount,what,dbfilename,sqlite3_errmsg(db));
+	db_mode=0;
+}
+
+
+size_t db_unescape(unsigned char *out, unsigned char *p, size_t n)
+{
+// n bytes of xml text at out without their entities, and the length.  out has
+// room for n bytes, as an entity is never shorter than its character.
+	unsigned char *stop,*q,*o;
+	unsigned long cp;
+	size_t len;
+
+	stop=p+n;
+	o=out;
+	while (p<stop)
+		{
+		q=memchr(p,'&',stop-p);
+		if (q==NULL)
+			{
+			q=stop;
+			}
+		memcpy(o,p,q-p);
+		o+=q-p;
+		p=q;
+		if (p==stop)
+			{
+			break;
+			}
+		if ((len=json_entity(p,stop,&cp))>0)
+			{
+			o+=json_utf8(cp,o);
+			p+=len;
+			}
+		else
+			{
+			*o++=*p++;
+			}
+		}
+	return o-out;
+}
+
+
+void db_text(sqlite3_stmt *stmt, int col, unsigned char *p, size_t n)
+{
+// bind n bytes of xml text to column col, without the entities if it has any
+	if (memchr(p,'&',n)!=NULL && dbtextlen+n<=sizeof(dbtext))
+		{
+		n=db_unescape(dbtext+dbtextlen,p,n);
+		p=dbtext+dbtextlen;
+		dbtextlen+=n;
+		}
+	sqlite3_bind_text(stmt,col,(char *)p,(int)n,SQLITE_STATIC);
+}
+
+
+void db_span(sqlite3_stmt *stmt, int col, struct xmlspan *span)
+{
+// NULL if the release doesn't have it
+	if (span->found>0)
+		db_text(stmt,col,span->ptr,span->len);
+	else
+		sqlite3_bind_null(stmt,col);
+}
+
+
+void db_attribute(sqlite3_stmt *stmt, int col, unsigned char *p, unsigned char *stop, const char *name, int number)
+{
+// attribute name of the tag at p, a number if number, NULL if it has none
+	unsigned char *value;
+	size_t len;
+
+	value=schema_attribute(p,stop,name,&len);
+	if (value==p)
+		sqlite3_bind_null(stmt,col);
+	else if (number)
+		sqlite3_bind_int64(stmt,col,(sqlite3_int64)strtoull((char *)value,NULL,10));
+	else
+		db_text(stmt,col,value,len);
+}
+
+
+int db_step(sqlite3_stmt *stmt)
+{
+// run a bound INSERT and free its text.  1 if it went in.
+	int rc;
+
+	rc=sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	dbtextlen=0;
+	if (rc!=SQLITE_DONE)
+		{
+		db_fail("insert");
+		return 0;
+		}
+	return 1;
+}
+
+
+void db_labels(void)
+{
+	unsigned char *p,*stop;
+	unsigned int n;
+
+	sqlite3_bind_int64(dblabel,1,(sqlite3_int64)fields.release_id);
+	n=0;
+	if (fields.labels.found>0)
+		{
+		stop=fields.labels.ptr+fields.labels.len;
+		for (p=fields.labels.ptr;db_mode && (p=memmem(p,stop-p,(unsigned char *)LABEL_START,strlen(LABEL_START)))!=NULL;p++)
+			{
+			sqlite3_bind_int(dblabel,2,n++);
+			db_attribute(dblabel,3,p,stop," name=\"",0);
+			db_attribute(dblabel,4,p,stop," catno=\"",0);
+			db_attribute(dblabel,5,p,stop," id=\"",1);
+			dblabels+=db_step(dblabel);
+			}
+		}
+}
+
+
+void db_formats(void)
+{
+	unsigned char *p,*q,*d,*e,*stop;
+	unsigned char *list;
+	size_t len;
+	unsigned int n;
+
+	sqlite3_bind_int64(dbformat,1,(sqlite3_int64)fields.release_id);
+	n=0;
+	if (fields.formats.found>0)
+		{
+		stop=fields.formats.ptr+fields.formats.len;
+		for (p=fields.formats.ptr;db_mode && (p=memmem(p,stop-p,(unsigned char *)FORMAT_START,strlen(FORMAT_START)))!=NULL;p=q)
+			{
+			// to its </format>, or the end of the tag if it is <format .../>
+			q=memchr(p,'>',stop-p);
+			if (q==NULL)
+				{
+				break;
+				}
+			d=q;
+			if (q[-1]=='/')
+				q++;
+			else if ((q=memmem(q,stop-q,(unsigned char *)FORMAT_END,strlen(FORMAT_END)))==NULL)
+				q=stop;
+			sqlite3_bind_int(dbformat,2,n++);
+			db_attribute(dbformat,3,p,stop," name=\"",0);
+			db_attribute(dbformat,4,p,stop," qty=\"",1);
+			db_attribute(dbformat,5,p,stop," text=\"",0);
+			// the descriptions, joined into dbtext after what the attributes put there
+			list=dbtext+dbtextlen;
+			len=0;
+			for (;(d=memmem(d,q-d,(unsigned char *)DESCRIPTION_START,strlen(DESCRIPTION_START)))!=NULL;d=e+strlen(DESCRIPTION_END))
+				{
+				d+=strlen(DESCRIPTION_START);
+				e=memmem(d,q-d,(unsigned char *)DESCRIPTION_END,strlen(DESCRIPTION_END));
+				if (e==NULL || dbtextlen+len+strlen(DB_LIST_SEPARATOR)+(e-d)>sizeof(dbtext))
+					{
+					break;
+					}
+				if (len)
+					{
+					memcpy(list+len,DB_LIST_SEPARATOR,strlen(DB_LIST_SEPARATOR));
+					len+=strlen(DB_LIST_SEPARATOR);
+					}
+				len+=db_unescape(list+len,d,e-d);
+				}
+			sqlite3_bind_text(dbformat,6,(char *)list,(int)len,SQLITE_STATIC);
+			dbformats+=db_step(dbformat);
+			}
+		}
+}
+
+
+void db_add_release(void)
+{
+// the release's rows, and a new transaction every db_batch releases
+	sqlite3_bind_int64(dbrelease,1,(sqlite3_int64)fields.release_id);
+	db_span(dbrelease,2,&fields.title);
+	db_span(dbrelease,3,&fields.released);
+	db_span(dbrelease,4,&fields.country);
+	db_span(dbrelease,5,&fields.notes);
+	db_span(dbrelease,6,&fields.data_quality);
+	if (fields.master_id)
+		sqlite3_bind_int64(dbrelease,7,(sqlite3_int64)fields.master_id);
+	else
+		sqlite3_bind_null(dbrelease,7);
+	if (role_mode)
+		sqlite3_bind_text(dbrelease,8,matchedrole,-1,SQLITE_STATIC);
+	else
+		sqlite3_bind_null(dbrelease,8);
+	if (!db_step(dbrelease))
+		{
+		return;
+		}
+	if (!sqlite3_changes(db))
+		{
+		// already in, from a release repeated in the dump
+		return;
+		}
+	dbreleases++;
+	db_labels();
+	db_formats();
+	if (db_mode && ++dbinbatch>=db_batch)
+		{
+		dbinbatch=0;
+		if (db_exec("COMMIT"))
+			{
+			db_exec("BEGIN");
+			}
+		}
+}
+
+
+void db_finish(void)
+{
+// the last transaction, then the indexes
+	double seconds;
+
+	if (db_mode)
+		{
+		if (db_exec("COMMIT")
+		 && db_exec("CREATE INDEX labels_release_id ON labels(release_id)")
+		 && db_exec("CREATE INDEX formats_release_id ON formats(release_id)"))
+			{
+			db_exec("CREATE INDEX releases_master_id ON releases(master_id)");
+			}
+		}
+	sqlite3_finalize(dbrelease);
+	sqlite3_finalize(dblabel);
+	sqlite3_finalize(dbformat);
+	if (sqlite3_close(db)!=SQLITE_OK)
+		{
+		db_fail("close");
+		}
+	seconds=(bench_now()-dbstarttime)/1e9;
+	printf("SQLite: %lu releases, %lu labels, %lu formats in %s (%.0f rows/s)\n",dbreleases,dblabels,dbformats,dbfilename,
+		seconds>0 ? (dbreleases+dblabels+dbformats)/seconds : 0.0);
+	db_mode=0;
+}
+
+#else
+
+void db_start(void)
+{
+}
+
+
+void db_add_release(void)
+{
+}
+
+
+void db_finish(void)
+{
+}
+
+#endif
+
+
+/*--- statistical sampling -----------------------------------
+--sample k reads only a little of infile: it is cut into k equal parts, and
+in each, from a random byte, the next sample_releases releases are read
+(whole releases that start in the part, found as the block search finds
+them) and matched, extracted and written like any other.  A point's sample
+runs from the start of its first release to the start of the release after
+its last, so it holds exactly the releases it counts.  The one the random
+byte falls in is skipped, as it is more likely to be a long one.
+
+For point i with r releases, m of them matched, in b bytes, the estimates
+over the S bytes searched are ratio estimates,
+	releases  S * sum(r)/sum(b)
+	matched   S * sum(m)/sum(b)
+with the usual variance of a ratio over k clusters,
+	(1-f)/(k(k-1) bbar^2) * sum((r - R b)^2)
+(f the fraction of S read), and a normal 95% interval of SAMPLE_Z standard
+errors.  Treating the parts as one random sample of clusters overstates
+the variance a little, as they are spread evenly over the file.  Neither
+the interval nor the estimate means much with only a few points, or when
+the matches are so rare that few points have any.
+------------------------------------------------------------*/
+
+void sample_input_file(void)
+{
+// sample_releases releases at a random offset in each of sample_points parts of infile
+	struct samplepoint *points,*sp;
+	long long size,lo,hi,part,from,to,pos,offset;
+	unsigned long long seed;
+	unsigned char *start,*end,*stop;
+	size_t len,want;
+	unsigned int k;
+
+	printf("Sampling input file	%s: \n",infilename);
+	fprintf(outfile,"Sampling input file	%s: \n\n",infilename);
+	begin_time=clock();
+	if (fseek64(infile,0,SEEK_END) || (size=ftell64(infile))<0)
+		{
+		errorcount++;
+		printf("Error %lu: can't find the size of %s\n",errorcount,infilename);
+		return;
+		}
+	lo=(long long)start_offset;
+	hi=end_offset && (long long)end_offset<size ? (long long)end_offset : size;
+	if (hi<=lo)
+		{
+		errorcount++;
+		printf("Error %lu: nothing to sample from byte %lld to %lld\n",errorcount,lo,hi);
+		return;
+		}
+	if ((long long)sample_points>hi-lo)
+		{
+		sample_points=(unsigned int)(hi-lo);
+		}
+	points=calloc(sample_points,sizeof(struct samplepoint));
+	if (points==NULL)
+		{
+		printf("Error: out of memory for %u sample points\n",sample_points);
+		exit(6);
+		}
+	printf("%u sample points of %lu releases, seed %llu\n",sample_points,sample_releases,sample_seed);
+	part=(hi-lo)/sample_points;
+	seed=sample_seed;
+	for (k=0;k<sample_points;k++)
+		{
+		sp=&points[k];
+		sp->first=-1;
+		from=lo+(long long)k*part;
+		to=k==sample_points-1 ? hi : from+part;
+		seed=seed*6364136223846793005ULL+1442695040888963407ULL;
+		pos=from+(long long)((seed>>11)%(unsigned long long)(to-from));
+		want=to-pos<SAMPLE_MIN_READ ? SAMPLE_MIN_READ : to-pos<SAMPLE_READ_BYTES ? (size_t)(to-pos) : SAMPLE_READ_BYTES;
+		for (;;)
+			{
+			len=(size_t)(size-pos<(long long)want ? size-pos : (long long)want);
+			perfstage(PERF_READ);
+			tracebegin(TRACE_READ);
+			if (!index_read_at(infile,inputbuffer,len,pos))
+				{
+				errorcount++;
+				printf("Error %lu: can't read %s at byte %lld\n",errorcount,infilename,pos);
+				break;
+				}
+			traceend(TRACE_READ,pos);
+			perfstage(PERF_SEARCH);
+			samplebytes+=len;
+			stop=inputbuffer+len;
+			offset=pos;
+			tracebegin(TRACE_BOUNDARY);
+			for (start=inputbuffer;(start=memmem(start,stop-start,startsearchbuffer,startstringlen))!=NULL;start=end)
+				{
+				offset=pos+(start-inputbuffer);
+				if (sp->releases>=sample_releases || offset>=to)
+					{
+					break;
+					}
+				end=memmem(start+startstringlen,stop-start-startstringlen,endsearchbuffer,endstringlen);
+				if (end==NULL)
+					{
+					break;
+					}
+				end+=endstringlen;
+				sample_release(sp,start,offset,end-start);
+				}
+			traceend(TRACE_BOUNDARY,len);
+			if (start!=NULL && (sp->releases>=sample_releases || offset>=to))
+				{
+				sp->next=offset;
+				break;
+				}
+			if (pos+(long long)len>=size)
+				{
+				// the end of infile ends the sample
+				sp->next=sp->last;
+				break;
+				}
+			if (start==NULL)
+				{
+				// keep what could be the start of a split start tag
+				pos+=len-(startstringlen-1);
+				}
+			else if (start>inputbuffer)
+				pos=offset;  // read again from the release that didn't fit
+			else if (want<BLOCKSIZE)
+				want=want*2<BLOCKSIZE ? want*2 : BLOCKSIZE;
+			else
+				{
+				errorcount++;
+				printf("Error %lu: release at byte %lld is longer than BLOCKSIZE, not sampled\n",errorcount,offset);
+				pos=offset+startstringlen;
+				want=SAMPLE_READ_BYTES;
+				}
+			}
+		}
+	sample_report(points,(double)(hi-lo));
+	free(points);
+
+	end_time=clock();
+	execution_time=end_time-begin_time;
+	printf("Execution time: %ld\n",execution_time);
+	printf("Saved %lu releases containing searchstring among %lu sampled releases.\n",foundcount,releasecount);
+}
+
+
+void sample_release(struct samplepoint *sp, unsigned char *start, long long offset, size_t len)
+{
+// count, match and write one release of a sample point
+	unsigned char *found;
+	unsigned char saved;
+
+	if (sp->first<0)
+		{
+		sp->first=offset;
+		}
+	sp->last=offset+(long long)len;
+	sp->releases++;
+	releasecount++;
+	perfstage(PERF_MATCH);
+	if (role_mode)
+		found=role_match_release(start,len);
+	else if (text_mode)
+		found=text_match_release(start,len);
+	else
+		found=memmem(start,len,searchbuffer,searchstringlen);
+	perfstage(PERF_SEARCH);
+	if (found==NULL)
+		{
+		return;
+		}
+	sp->matched++;
+	foundcount++;
+	perfstage(PERF_EXTRACT);
+	saved=start[len];
+	start[len]='\0';  // process_xml() looks for some tags with strstr()
+	csvrowlen=0;
+	process_xml(start,len);
+	start[len]=saved;
+	perfstage(PERF_OUTPUT);
+	write_release(start,offset,len);
+	perfstage(PERF_SEARCH);
+}
+
+
+void sample_report(struct samplepoint *points, double span)
+{
+// the estimates for the span bytes searched, and their intervals
+	double r,m,b,sr,sm,sb,R,Q,P,vr,vm,vp,f,k;
+	unsigned int n;
+	FILE *fp;
+	int pass;
+
+	sr=sm=sb=0;
+	for (n=0;n<sample_points;n++)
+		{
+		sr+=points[n].releases;
+		sm+=points[n].matched;
+		sb+=points[n].releases ? (double)(points[n].next-points[n].first) : 0.0;
+		}
+	k=sample_points;
+	R=sb>0 ? sr/sb : 0.0;   // releases a byte
+	Q=sb>0 ? sm/sb : 0.0;   // matches a byte
+	P=sr>0 ? sm/sr : 0.0;   // matches a release
+	vr=vm=vp=0;
+	for (n=0;n<sample_points;n++)
+		{
+		r=points[n].releases;
+		m=points[n].matched;
+		b=points[n].releases ? (double)(points[n].next-points[n].first) : 0.0;
+		vr+=(r-R*b)*(r-R*b);
+		vm+=(m-Q*b)*(m-Q*b);
+		vp+=(m-P*r)*(m-P*r);
+		}
+	f=span>0 && sb<span ? sb/span : 1.0;
+	if (k>1 && sb>0)
+		{
+		vr*=(1-f)/(k*(k-1)*(sb/k)*(sb/k));
+		vm*=(1-f)/(k*(k-1)*(sb/k)*(sb/k));
+		vp*=(1-f)/(k*(k-1)*(sr/k)*(sr/k));
+		}
+	else
+		vr=vm=vp=0;
+	samplematched=span*Q;
+
+	for (pass=0;pass<2;pass++)
+		{
+		fp=pass ? outfile : stdout;
+		fprintf(fp,"Sampled %lu releases at %u points, %.1f MB of %.1f MB read (%.3f%%)\n",releasecount,sample_points,
+			samplebytes/1048576.0,span/1048576.0,span>0 ? 100.0*samplebytes/span : 0.0);
+		if (k>1)
+			{
+			fprintf(fp,"Estimated releases: %.0f +- %.0f (95%%)\n",span*R,SAMPLE_Z*span*sqrt(vr));
+			fprintf(fp,"Estimated matched:  %.0f +- %.0f (95%%), %.4f%% +- %.4f%% of releases\n",samplematched,SAMPLE_Z*span*sqrt(vm),
+				100*P,100*SAMPLE_Z*sqrt(vp));
+			}
+		else
+			{
+			fprintf(fp,"Estimated releases: %.0f (no interval from one point)\n",span*R);
+			fprintf(fp,"Estimated matched:  %.0f, %.4f%% of releases\n",samplematched,100*P);
+			}
+		}
+}
 
 
+/*--- other dumps and the I/O scheduler ----------------------
+Discogs publishes masters, artists and labels dumps beside the releases
+one, all of them a list of records between a start and an end tag, which
+recordtypes[] gives for each (releases' are SEARCH_START and SEARCH_END).
+Each --dump is scanned by dump_scan() on a thread of its own while the
+search goes through infile: it reads DUMP_READ_BYTES at a time after
+whatever record was cut off by the read before, finds the records by
+their tags, and writes the ones with its text to its outfile.  A labels
+dump nests <label> in <sublabels>, so its records are ended by
+"</label>" and the newline after it, as each record is a line.  An
+artists record is only matched on the <id> right after its <artist>, as
+a group's record has its members' ids further in.  Nothing else is done
+with the other types' records: no csvfile, no --columns.
+
+The reads of the search (its BLOCKSIZE freads) and of the scans all ask
+the scheduler first.  iosched_begin() lets io_readers of them read at
+once, and of those waiting the next turn goes to the one that has read
+the fewest bytes so far, so the disks go through the files in big
+sequential reads, fairly, rather than the threads fighting over them
+seek by seek.  The scanning of one read overlaps the reading of the
+next, by another thread, so the run is about as long as reading all the
+files, or the biggest one when it is the scanning that is slow.
+------------------------------------------------------------*/
+
+void dump_start(void)
+{
+// open the --dump files and start their threads
+	struct dumpscan *ds;
+	unsigned long artist_id;
+	unsigned int n;
+
+	mutex_init(iomutex);
+	cond_init(ioturn);
+	iostreams[IOSCHED_SEARCH].name=(char *)infilename;
+	iostreamcount=1;
+	artist_id=strtoul(SEARCH_STRING+strlen(SHARD_ARTIST_TAG),NULL,10);
+	for (n=0;n<dumpcount;n++)
+		{
+		ds=&dumps[n];
+		if (ds->text==NULL)
+			{
+			ds->text=malloc(strlen(ds->type->match)+24);
+			if (ds->text==NULL)
+				{
+				printf("Error: out of memory for --dump %s\n",ds->infilename);
+				exit(6);
+				}
+			sprintf(ds->text,ds->type->match,artist_id);
+			ds->anchored=ds->type->anchored;
+			}
+		ds->in=fopen(ds->infilename,"rb");
+		if (ds->in==NULL)
+			{
+			printf("Error: can't open --dump %s\n",ds->infilename);
+			exit(1);
+			}
+		ds->out=fopen(ds->outfilename,"wb");
+		if (ds->out==NULL)
+			{
+			printf("Error: can't open --dump outfile %s\n",ds->outfilename);
+			exit(2);
+			}
+		fprintf(ds->out,"\n%s\n%s dump %s, records with \"%s\"\n\n",VERSION,ds->type->name,ds->infilename,ds->text);
+		ds->stream=iostreamcount;
+		iostreams[iostreamcount++].name=ds->infilename;
+		printf("Scanning %s dump %s for \"%s\" into %s\n",ds->type->name,ds->infilename,ds->text,ds->outfilename);
+		}
+	for (n=0;n<dumpcount;n++)
+		{
+		ds=&dumps[n];
+#ifdef _WIN32
+		ds->thread=CreateThread(NULL,0,dump_scan,ds,0,NULL);
+		if (ds->thread==NULL)
+#else
+		if (pthread_create(&ds->thread,NULL,dump_scan,ds))
+#endif
+			{
+			printf("Error: could not start the thread scanning %s\n",ds->infilename);
+			exit(6);
 			}
 		}
+}
 
 
+#ifdef _WIN32
+DWORD WINAPI dump_scan(LPVOID arg)
+#else
+void *dump_scan(void *arg)
+#endif
+{
+// read a dump through the scheduler and write its matched records
+	struct dumpscan *ds;
+	unsigned char *p,*start,*end,*stop;
+	size_t have,got,startlen,endlen,textlen;
+	int eof;
+
+	ds=arg;
+	startlen=strlen(ds->type->start);
+	endlen=strlen(ds->type->end);
+	textlen=strlen(ds->text);
+	have=0;
+	eof=0;
+	while (!eof)
+		{
+		if (!pool_reserve(&ds->buf,&ds->cap,have+DUMP_READ_BYTES))
+			{
+			ds->failed=1;
+			break;
+			}
+		iosched_begin(ds->stream);
+		got=fread(ds->buf+have,1,DUMP_READ_BYTES,ds->in);
+		iosched_end(ds->stream,got);
+		eof=got<DUMP_READ_BYTES;
+		have+=got;
+		stop=ds->buf+have;
+		for (p=ds->buf;(start=memmem(p,stop-p,(unsigned char *)ds->type->start,startlen))!=NULL;p=end)
+			{
+			end=memmem(start+startlen,stop-start-startlen,(unsigned char *)ds->type->end,endlen);
+			if (end==NULL)
+				{
+				break;
+				}
+			end+=endlen;
+			ds->records++;
+			if (ds->anchored ? end-start>=(long)textlen && !memcmp(start,ds->text,textlen)
+			                 : memmem(start,end-start,(unsigned char *)ds->text,textlen)!=NULL)
+				{
+				ds->matched++;
+				if (fwrite(start,end-start,1,ds->out)!=1 || (end[-1]!='\n' && fputc('\n',ds->out)==EOF))
+					{
+					ds->failed=1;
+					}
+				}
+			}
+		// keep the record that was cut off, or what could be the start of a start tag
+		if (start==NULL)
+			{
+			start=stop-p>=(long)startlen ? stop-(startlen-1) : p;
+			}
+		have=stop-start;
+		memmove(ds->buf,start,have);
+		}
+	if (ferror(ds->in))
+		{
+		ds->failed=1;
+		}
+	return 0;
+}
 
 
-/*
-<master_id
-is_main_release="false">142262</master_id><tracklist><track><position>A1</position><title>Hot
-Shot '97 (Rollercoaster Club
-Mix)</title><duration>5:57</duration><extraartists><artist><id>16019</id><name>Rollercoaster</name><anv></anv><join></join><role>Remix</role><tracks></tracks></artist></extraartists></track><track><position>A2</position><title>Hot
-Shot '97 (Da Techno Bohemian Hot Vocal
-Mix)</title><duration>6:09</duration><extraartists><artist><id>20922</id><name>Da
-Techno
-Bohemian</name><anv></anv><join></join><role>Remix</role><tracks></tracks></artist></extraartists></track><track><position>B1</position><title>Hot
-Shot '97 (Da Techno Bohemian Dirty Dub
-Mix)</title><duration>5:25</duration><extraartists><artist><id>20922</id><name>Da
-Techno
-Bohemian</name><anv></anv><join></join><role>Remix</role><tracks></tracks></artist></extraartists></track><track><position>B2</position><title>Hotdisco</title><duration>4:11</duration></track></tracklist>
-*/
+void dump_finish(void)
+{
+// wait for the scans, and say what they and the scheduler did
+	struct dumpscan *ds;
+	struct iostream *io;
+	unsigned int n;
+	int pass;
+	FILE *fp;
+
+	for (n=0;n<dumpcount;n++)
+		{
+		ds=&dumps[n];
+#ifdef _WIN32
+		WaitForSingleObject(ds->thread,INFINITE);
+		CloseHandle(ds->thread);
+#else
+		pthread_join(ds->thread,NULL);
+#endif
+		fprintf(ds->out,"\n\n%lu %s records, %lu with \"%s\"\n",ds->records,ds->type->name,ds->matched,ds->text);
+		if (fclose(ds->out) || ds->failed)
+			{
+			errorcount++;
+			printf("Error %lu: failed to read %s or write %s\n",errorcount,ds->infilename,ds->outfilename);
+			}
+		fclose(ds->in);
+		free(ds->buf);
+		}
+	for (pass=0;pass<2;pass++)
+		{
+		fp=pass ? outfile : stdout;
+		for (n=0;n<dumpcount;n++)
+			{
+			ds=&dumps[n];
+			fprintf(fp,"%s: %lu %s records, %lu matched, written to %s\n",ds->infilename,ds->records,ds->type->name,ds->matched,ds->outfilename);
+			}
+		for (n=0;n<iostreamcount;n++)
+			{
+			io=&iostreams[n];
+			fprintf(fp,"I/O %s: %.1f MB in %lu reads, %.2f s waiting for a turn\n",io->name,io->served/1048576.0,io->reads,io->waited/1e9);
+			}
+		}
+}
+
+
+void iosched_begin(int stream)
+{
+// wait for a turn to read: a reader free, and no one waiting who has read less
+	struct iostream *io;
+	unsigned int n;
+	double started;
+
+	io=&iostreams[stream];
+	started=bench_now();
+	mutex_lock(iomutex);
+	io->waiting=1;
+	for (;;)
+		{
+		if (ioactive<io_readers)
+			{
+			for (n=0;n<iostreamcount;n++)
+				{
+				if (iostreams[n].waiting && (iostreams[n].served<io->served || (iostreams[n].served==io->served && (int)n<stream)))
+					{
+					break;
+					}
+				}
+			if (n==iostreamcount)
+				{
+				break;
+				}
+			}
+		cond_wait(ioturn,iomutex);
+		}
+	io->waiting=0;
+	ioactive++;
+	mutex_unlock(iomutex);
+	io->waited+=bench_now()-started;
+}
+
+
+void iosched_end(int stream, unsigned long long bytes)
+{
+	mutex_lock(iomutex);
+	ioactive--;
+	iostreams[stream].served+=bytes;
+	iostreams[stream].reads++;
+	cond_broadcast(ioturn);
+	mutex_unlock(iomutex);
+}
+
+
+/*--- seekable zstd frames -----------------------------------
+--build-frames framefile infile rewrites the dump as zstd frames that
+each start at a release and hold only whole releases, about frame_bytes
+of them (the first also has the file's opening tags, the last its
+closing ones).  The frames are ordinary zstd frames with their sizes in
+their headers, so zstd -d gives back the dump byte for byte.  After them
+is a skippable frame (which zstd -d passes over) holding a frameentry for
+each frame and a struct frametrailer, which ends the file, so a reader
+finds the index from the end:
+
+	frame 0 ... frame n-1
+	FRAME_SKIPPABLE_MAGIC, length, frameentry[n], frametrailer
+
+infile is read through zlib's gzread(), which takes a plain file as it
+is, so a .gz dump is recompressed without unpacking it first.
+
+--frames searches a framefile.  frames_open() reads the index and picks
+the frames (all of them, or with --release-ids those whose lowest to
+highest ids overlap the range).  The main thread reads each picked frame
+with one positioned read into a ring of frameslots jobs, framethreads
+workers decompress them, and the main thread searches them in order as
+they are done, each one a whole number of releases, so there is nothing
+to resync and no seek back.  The output is the same as searching the
+dump, in the same order.
+------------------------------------------------------------*/
+
+#if HAVE_ZSTD
+
+void frames_build(int argc, char *argv[])
+{
+// --build-frames framefile infile
+	struct frameentry *entries,entry;
+	struct frametrailer trailer;
+	unsigned char *buf,*out,*s,*e;
+	unsigned char header[8];
+	size_t have,cap,outcap,scan,n;
+	unsigned int count,entrycap,id;
+	long long written,dumpoffset;
+	ZSTD_CCtx *cctx;
+	void *in;
+	int eof;
+	double seconds;
+
+	if (argc!=2)
+		{
+		syntax();
+		}
+	strcpy((char *)infilename,argv[1]);
+#if HAVE_ZLIB
+	in=gzopen((char *)infilename,"rb");
+#else
+	in=fopen((char *)infilename,"rb");
+#endif
+	if (in==NULL)
+		{
+		printf("Error: input file %s not found.\n",infilename);
+		errorcode=1;
+		return;
+		}
+	outfile=fopen(framefilename,"wb");
+	if (outfile==NULL)
+		{
+		printf("Error: can't create frame file %s\n",framefilename);
+		errorcode=10;
+		return;
+		}
+	setvbuf(outfile,NULL,_IOFBF,SORT_IO_BUFFER);
+	cap=frame_bytes+2*BLOCKSIZE;
+	buf=malloc(cap);
+	cctx=ZSTD_createCCtx();
+	if (buf==NULL || cctx==NULL)
+		{
+		printf("Error: out of memory for %lu byte frames\n",(unsigned long)frame_bytes);
+		exit(6);
+		}
+	out=NULL;
+	outcap=0;
+	entries=NULL;
+	entrycap=count=0;
+	printf("Writing the releases of %s as zstd frames of %lu KB in %s\n",infilename,(unsigned long)(frame_bytes/1024),framefilename);
+	begin_time=clock();
+
+	// buf is always the frame being made, from its first byte
+	memset(&entry,0,sizeof(entry));
+	written=dumpoffset=0;
+	have=scan=0;
+	eof=0;
+	while (!eof || have)
+		{
+		if (!eof)
+			{
+			if (have+BLOCKSIZE>cap)
+				{
+				// a release longer than the room left
+				cap=have+2*BLOCKSIZE;
+				buf=realloc(buf,cap);
+				if (buf==NULL)
+					{
+					printf("Error: out of memory for a %lu byte frame\n",(unsigned long)cap);
+					exit(6);
+					}
+				}
+			n=frames_read(in,buf+have,BLOCKSIZE);
+			eof=n<BLOCKSIZE;
+			have+=n;
+			}
+		for (;;)
+			{
+			s=memmem(buf+scan,have-scan,startsearchbuffer,startstringlen);
+			if (s==NULL)
+				{
+				// keep what could be the start of a split SEARCH_START
+				if (have-scan>(size_t)startstringlen)
+					{
+					scan=have-(startstringlen-1);
+					}
+				break;
+				}
+			if (entry.releases && (size_t)(s-buf)>=frame_bytes)
+				{
+				// the frame ends where this release starts
+				n=s-buf;
+				entry.offset=written;
+				entry.dumpoffset=dumpoffset;
+				if (!frames_write(outfile,buf,n,&entry,cctx,&out,&outcap))
+					{
+					errorcode=10;
+					return;
+					}
+				if (count==entrycap)
+					{
+					entrycap=entrycap ? entrycap*2 : 1024;
+					entries=realloc(entries,entrycap*sizeof(struct frameentry));
+					if (entries==NULL)
+						{
+						printf("Error: out of memory for the frame index\n");
+						exit(6);
+						}
+					}
+				entries[count++]=entry;
+				written+=entry.size;
+				dumpoffset+=n;
+				memmove(buf,buf+n,have-n);
+				have-=n;
+				s-=n;
+				memset(&entry,0,sizeof(entry));
+				}
+			e=memmem(s+startstringlen,have-(s+startstringlen-buf),endsearchbuffer,endstringlen);
+			if (e==NULL)
+				{
+				scan=s-buf;  // read the rest of it
+				break;
+				}
+			id=(unsigned int)strtoul((char *)s+startstringlen+1,NULL,10);
+			if (!entry.releases || id<entry.firstid)
+				{
+				entry.firstid=id;
+				}
+			if (id>entry.lastid)
+				{
+				entry.lastid=id;
+				}
+			entry.releases++;
+			scan=e+endstringlen-buf;
+			}
+		if (eof)
+			{
+			// the last frame, to the end of the file
+			if (have)
+				{
+				entry.offset=written;
+				entry.dumpoffset=dumpoffset;
+				if (!frames_write(outfile,buf,have,&entry,cctx,&out,&outcap))
+					{
+					errorcode=10;
+					return;
+					}
+				if (count==entrycap)
+					{
+					entries=realloc(entries,(entrycap+1)*sizeof(struct frameentry));
+					if (entries==NULL)
+						{
+						printf("Error: out of memory for the frame index\n");
+						exit(6);
+						}
+					}
+				entries[count++]=entry;
+				written+=entry.size;
+				dumpoffset+=have;
+				}
+			have=0;
+			}
+		}
+#if HAVE_ZLIB
+	gzclose(in);
+#else
+	fclose(in);
+#endif
+
+	// the index, as a skippable frame
+	memset(&trailer,0,sizeof(trailer));
+	trailer.frames=count;
+	trailer.version=FRAME_INDEX_VERSION;
+	memcpy(trailer.magic,FRAME_INDEX_MAGIC,sizeof(trailer.magic));
+	n=count*sizeof(struct frameentry)+sizeof(trailer);
+	header[0]=(unsigned char)FRAME_SKIPPABLE_MAGIC;
+	header[1]=(unsigned char)(FRAME_SKIPPABLE_MAGIC>>8);
+	header[2]=(unsigned char)(FRAME_SKIPPABLE_MAGIC>>16);
+	header[3]=(unsigned char)(FRAME_SKIPPABLE_MAGIC>>24);
+	header[4]=(unsigned char)n;
+	header[5]=(unsigned char)(n>>8);
+	header[6]=(unsigned char)(n>>16);
+	header[7]=(unsigned char)(n>>24);
+	if (fwrite(header,sizeof(header),1,outfile)!=1 || (count && fwrite(entries,sizeof(struct frameentry),count,outfile)!=count)
+		|| fwrite(&trailer,sizeof(trailer),1,outfile)!=1 || fclose(outfile))
+		{
+		printf("Error: can't write to %s\n",framefilename);
+		errorcode=10;
+		return;
+		}
+	free(entries);
+	free(buf);
+	free(out);
+	ZSTD_freeCCtx(cctx);
+	end_time=clock();
+	seconds=(double)(end_time-begin_time)/CLOCKS_PER_SEC;
+	printf("%u frames, %lld bytes of dump in %lld bytes (%.1f%%) in %.1f s\n",count,dumpoffset,written,
+		dumpoffset ? 100.0*written/dumpoffset : 0.0,seconds);
+}
+
+
+size_t frames_read(void *in, unsigned char *buf, size_t len)
+{
+// up to len bytes of infile, gzip or not
+#if HAVE_ZLIB
+	int n;
+
+	n=gzread((gzFile)in,buf,(unsigned int)len);
+	return n<0 ? 0 : (size_t)n;
+#else
+	return fread(buf,1,len,(FILE *)in);
+#endif
+}
+
+
+int frames_write(FILE *fp, unsigned char *buf, size_t len, struct frameentry *entry, void *cctx, unsigned char **out, size_t *outcap)
+{
+// one frame of len bytes of the dump.  0 if it failed.
+	size_t bound;
+
+	bound=ZSTD_compressBound(len);
+	if (!pool_reserve(out,outcap,bound))
+		{
+		exit(6);
+		}
+	bound=ZSTD_compressCCtx((ZSTD_CCtx *)cctx,*out,*outcap,buf,len,compress_level<0 ? 3 : compress_level);
+	if (ZSTD_isError(bound))
+		{
+		printf("Error: zstd failed on a frame: %s\n",ZSTD_getErrorName(bound));
+		return 0;
+		}
+	if (fwrite(*out,bound,1,fp)!=1)
+		{
+		printf("Error: can't write to %s\n",framefilename);
+		return 0;
+		}
+	entry->size=(unsigned int)bound;
+	entry->dumpsize=(unsigned int)len;
+	return 1;
+}
+
+
+int frames_open(void)
+{
+// the frame index of infile, and the frames to search moved to the front of it.  0 if it has none.
+	struct frametrailer trailer;
+	long long size;
+	unsigned int n,k;
+
+	if (fseek64(infile,0,SEEK_END) || (size=ftell64(infile))<(long long)sizeof(trailer)
+		|| !index_read_at(infile,&trailer,sizeof(trailer),size-(long long)sizeof(trailer))
+		|| memcmp(trailer.magic,FRAME_INDEX_MAGIC,sizeof(trailer.magic)) || trailer.version!=FRAME_INDEX_VERSION
+		|| (long long)trailer.frames*(long long)sizeof(struct frameentry)>size-(long long)sizeof(trailer))
+		{
+		printf("Error: %s isn't a --build-frames file\n",infilename);
+		return 0;
+		}
+	framecount=trailer.frames;
+	frameentries=malloc((framecount ? framecount : 1)*sizeof(struct frameentry));
+	if (frameentries==NULL)
+		{
+		printf("Error: out of memory for the frame index\n");
+		exit(6);
+		}
+	if (framecount && !index_read_at(infile,frameentries,framecount*sizeof(struct frameentry),
+		size-(long long)sizeof(trailer)-(long long)framecount*(long long)sizeof(struct frameentry)))
+		{
+		printf("Error: can't read the frame index of %s\n",infilename);
+		return 0;
+		}
+	printf("Using frame index of %s: %u frames\n",infilename,framecount);
+	if (releaseidrange)
+		{
+		for (n=k=0;n<framecount;n++)
+			{
+			if (frameentries[n].lastid>=releaseidfirst && frameentries[n].firstid<=releaseidlast && frameentries[n].releases)
+				{
+				frameentries[k++]=frameentries[n];
+				}
+			}
+		printf("%u frames have releases %lu to %lu\n",k,releaseidfirst,releaseidlast);
+		framecount=k;
+		}
+	return 1;
+}
+
+
+void frames_input_file(void)
+{
+// read the frames in order, decompressed on framethreads threads, and search them
+	struct framejob *job;
+	unsigned long long next;
+	unsigned int n;
+
+	printf("Searching input file	%s: \n",infilename);
+	fprintf(outfile,"Searching input file	%s: \n\n",infilename);
+	begin_time=clock();
+	if (!frames_open())
+		{
+		errorcount++;
+		return;
+		}
+	frameslots=framethreads*2;
+	framejobs=calloc(frameslots,sizeof(struct framejob));
+	framethreadids=calloc(framethreads,sizeof(poolthread_t));
+	if (framejobs==NULL || framethreadids==NULL)
+		{
+		printf("Error: out of memory for %u decompression threads\n",framethreads);
+		exit(6);
+		}
+	mutex_init(framesmutex);
+	cond_init(frameswork);
+	cond_init(framesdone);
+	for (n=0;n<framethreads;n++)
+		{
+#ifdef _WIN32
+		framethreadids[n]=CreateThread(NULL,0,frames_worker,NULL,0,NULL);
+		if (framethreadids[n]==NULL)
+#else
+		if (pthread_create(&framethreadids[n],NULL,frames_worker,NULL))
+#endif
+			{
+			printf("Error: could not start decompression thread %u\n",n+1);
+			exit(6);
+			}
+		}
+
+	for (next=0;next<framecount;next++)
+		{
+		// keep the ring full, reading ahead of the search
+		while (framesqueued<framecount && framesqueued<next+frameslots)
+			{
+			job=&framejobs[framesqueued%frameslots];
+			job->entry=&frameentries[framesqueued];
+			job->failed=0;
+			perfstage(PERF_READ);
+			tracebegin(TRACE_READ);
+			if (!pool_reserve(&job->in,&job->incap,job->entry->size) || !pool_reserve(&job->out,&job->outcap,(size_t)job->entry->dumpsize+1))
+				{
+				exit(6);
+				}
+			if (!index_read_at(infile,job->in,job->entry->size,job->entry->offset))
+				{
+				job->failed=1;
+				}
+			traceend(TRACE_READ,job->entry->offset);
+			mutex_lock(framesmutex);
+			job->state=POOL_QUEUED;
+			framesqueued++;
+			cond_signal(frameswork);
+			mutex_unlock(framesmutex);
+			}
+		job=&framejobs[next%frameslots];
+		perfstage(PERF_SEARCH);
+		tracebegin(TRACE_POOL_WAIT);
+		mutex_lock(framesmutex);
+		while (job->state!=POOL_DONE)
+			{
+			cond_wait(framesdone,framesmutex);
+			}
+		mutex_unlock(framesmutex);
+		traceend(TRACE_POOL_WAIT,next);
+		if (job->failed)
+			{
+			errorcount++;
+			printf("Error %lu: can't read or decompress frame %llu at byte %lld of %s\n",errorcount,next,job->entry->offset,infilename);
+			}
+		else
+			frames_search(job);
+		mutex_lock(framesmutex);
+		job->state=POOL_FREE;
+		mutex_unlock(framesmutex);
+		}
+
+	mutex_lock(framesmutex);
+	framesstop=1;
+	cond_broadcast(frameswork);
+	mutex_unlock(framesmutex);
+	for (n=0;n<framethreads;n++)
+		{
+#ifdef _WIN32
+		WaitForSingleObject(framethreadids[n],INFINITE);
+		CloseHandle(framethreadids[n]);
+#else
+		pthread_join(framethreadids[n],NULL);
+#endif
+		}
+	for (n=0;n<frameslots;n++)
+		{
+		free(framejobs[n].in);
+		free(framejobs[n].out);
+		}
+	free(framejobs);
+	free(framethreadids);
+	free(frameentries);
+
+	end_time=clock();
+	execution_time=end_time-begin_time;
+	printf("Execution time: %ld\n",execution_time);
+	printf("Saved %lu releases containing searchstring among %lu total releases.\n",foundcount,releasecount);
+}
+
+
+#ifdef _WIN32
+DWORD WINAPI frames_worker(LPVOID arg)
+#else
+void *frames_worker(void *arg)
+#endif
+{
+// decompress queued frames, taking them in order
+	struct framejob *job;
+	size_t n;
+
+	(void)arg;
+	mutex_lock(framesmutex);
+	for (;;)
+		{
+		while (framestaken==framesqueued && !framesstop)
+			{
+			cond_wait(frameswork,framesmutex);
+			}
+		if (framestaken==framesqueued)
+			{
+			break;
+			}
+		job=&framejobs[framestaken%frameslots];
+		framestaken++;
+		mutex_unlock(framesmutex);
+		if (!job->failed)
+			{
+			n=ZSTD_decompress(job->out,job->outcap,job->in,job->entry->size);
+			job->failed=ZSTD_isError(n) || n!=job->entry->dumpsize;
+			}
+		mutex_lock(framesmutex);
+		job->state=POOL_DONE;
+		cond_broadcast(framesdone);
+		}
+	mutex_unlock(framesmutex);
+	return 0;
+}
+
 
+void frames_search(struct framejob *job)
+{
+// the releases of a decompressed frame, as the block search does them
+	unsigned char *p,*s,*e,*stop,*found;
+	unsigned char saved;
+	unsigned long id;
+	size_t len;
+
+	stop=job->out+job->entry->dumpsize;
+	for (p=job->out;(s=memmem(p,stop-p,startsearchbuffer,startstringlen))!=NULL;p=e)
+		{
+		e=memmem(s+startstringlen,stop-s-startstringlen,endsearchbuffer,endstringlen);
+		if (e==NULL)
+			{
+			break;  // the file ends inside a release
+			}
+		e+=endstringlen;
+		len=e-s;
+		if (releaseidrange)
+			{
+			id=strtoul((char *)s+startstringlen+1,NULL,10);
+			if (id<releaseidfirst || id>releaseidlast)
+				{
+				continue;
+				}
+			}
+		releasecount++;
+		perfstage(PERF_MATCH);
+		if (shard_mode)
+			found=shard_match_release(s,len);
+		else if (role_mode)
+			found=role_match_release(s,len);
+		else if (text_mode)
+			found=text_match_release(s,len);
+		else
+			found=memmem(s,len,searchbuffer,searchstringlen);
+		perfstage(PERF_SEARCH);
+		if (found==NULL)
+			{
+			continue;
+			}
+		foundcount++;
+		perfstage(PERF_EXTRACT);
+		saved=*e;
+		*e='\0';  // process_xml() looks for some tags with strstr()
+		csvrowlen=0;
+		process_xml(s,len);
+		*e=saved;
+		perfstage(PERF_OUTPUT);
+		write_release(s,job->entry->dumpoffset+(s-job->out),len);
+		perfstage(PERF_SEARCH);
+		}
+}
 
-		fprintf(csvfile,"\n");
+#else
 
+void frames_build(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
 }
 
 
+void frames_input_file(void)
+{
+}
+
+#endif